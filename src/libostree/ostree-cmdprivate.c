@@ -35,6 +35,31 @@ impl_ostree_generate_grub2_config (OstreeSysroot *sysroot, int bootversion, int
   return _ostree_bootloader_grub2_generate_config (sysroot, bootversion, target_fd, cancellable, error);
 }
 
+static gboolean
+impl_ostree_repo_verify_commit_cached (OstreeRepo *repo, const char *commit_checksum, GFile *keyringdir, GVariant **out_signatures, guint *out_n_valid, GCancellable *cancellable, GError **error)
+{
+  return _ostree_repo_verify_commit_cached (repo, commit_checksum, NULL, keyringdir, NULL,
+                                            out_signatures, out_n_valid, NULL,
+                                            cancellable, error);
+}
+
+static int
+impl_ostree_repo_dup_cache_dir_fd (OstreeRepo *repo)
+{
+  if (repo->cache_dir_fd == -1)
+    return -1;
+  return fcntl (repo->cache_dir_fd, F_DUPFD_CLOEXEC, 3);
+}
+
+/* Takes ownership of @fd, which may be -1 */
+static void
+impl_ostree_repo_replace_cache_dir_fd (OstreeRepo *repo, int fd)
+{
+  if (repo->cache_dir_fd != -1)
+    (void) close (repo->cache_dir_fd);
+  repo->cache_dir_fd = fd;
+}
+
 /**
  * ostree_cmdprivate: (skip)
  *
@@ -47,7 +72,11 @@ ostree_cmd__private__ (void)
   static OstreeCmdPrivateVTable table = {
     impl_ostree_generate_grub2_config,
     _ostree_repo_static_delta_dump,
-    _ostree_repo_static_delta_delete
+    _ostree_repo_static_delta_delete,
+    _ostree_repo_fsck_commits,
+    impl_ostree_repo_verify_commit_cached,
+    impl_ostree_repo_dup_cache_dir_fd,
+    impl_ostree_repo_replace_cache_dir_fd
   };
 
   return &table;
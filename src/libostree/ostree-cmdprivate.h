@@ -21,6 +21,7 @@
 #pragma once
 
 #include "ostree-types.h"
+#include "ostree-repo.h"
 
 G_BEGIN_DECLS
 
@@ -28,6 +29,10 @@ typedef struct {
   gboolean (* ostree_generate_grub2_config) (OstreeSysroot *sysroot, int bootversion, int target_fd, GCancellable *cancellable, GError **error);
   gboolean (* ostree_static_delta_dump) (OstreeRepo *repo, const char *delta_id, GCancellable *cancellable, GError **error);
   gboolean (* ostree_static_delta_delete) (OstreeRepo *repo, const char *delta_id, GCancellable *cancellable, GError **error);
+  gboolean (* ostree_repo_fsck_commits) (OstreeRepo *repo, const char * const *commits, OstreeRepoFsckFlags flags, guint64 max_age_secs, GPtrArray **out_corrupted, guint *out_n_verified, guint *out_n_skipped, GCancellable *cancellable, GError **error);
+  gboolean (* ostree_repo_verify_commit_cached) (OstreeRepo *repo, const char *commit_checksum, GFile *keyringdir, GVariant **out_signatures, guint *out_n_valid, GCancellable *cancellable, GError **error);
+  int (* ostree_repo_dup_cache_dir_fd) (OstreeRepo *repo);
+  void (* ostree_repo_replace_cache_dir_fd) (OstreeRepo *repo, int fd);
 } OstreeCmdPrivateVTable;
 
 /* Note this not really "public", we just export the symbol, but not the header */
@@ -315,6 +315,98 @@ session_thread_set_tls_database_cb (ThreadClosure *thread_closure,
     }
 }
 
+/* Streamed requests hand the response body to the caller, who may
+ * read it from any thread.  Wrap it so the bytes still count toward
+ * ostree_fetcher_bytes_transferred() as they arrive, and so
+ * @max_size is enforced like it is for downloads to a file.
+ */
+typedef struct {
+  GFilterInputStream parent_instance;
+
+  ThreadClosure *thread_closure;
+  char *uristr;
+  guint64 max_size;
+  guint64 current_size;
+} OstreeFetcherBodyStream;
+
+typedef GFilterInputStreamClass OstreeFetcherBodyStreamClass;
+
+static GType ostree_fetcher_body_stream_get_type (void);
+
+G_DEFINE_TYPE (OstreeFetcherBodyStream, ostree_fetcher_body_stream, G_TYPE_FILTER_INPUT_STREAM)
+
+static gssize
+ostree_fetcher_body_stream_read (GInputStream  *stream,
+                                 void          *buffer,
+                                 gsize          count,
+                                 GCancellable  *cancellable,
+                                 GError       **error)
+{
+  OstreeFetcherBodyStream *self = (OstreeFetcherBodyStream*) stream;
+  GInputStream *base = g_filter_input_stream_get_base_stream ((GFilterInputStream*) stream);
+  gssize n;
+
+  n = g_input_stream_read (base, buffer, count, cancellable, error);
+  if (n <= 0)
+    return n;
+
+  self->current_size += n;
+  if (self->max_size > 0 && self->current_size > self->max_size)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "URI %s exceeded maximum size of %" G_GUINT64_FORMAT " bytes",
+                   self->uristr, self->max_size);
+      return -1;
+    }
+
+  g_mutex_lock (&self->thread_closure->output_stream_set_lock);
+  self->thread_closure->total_downloaded += n;
+  g_mutex_unlock (&self->thread_closure->output_stream_set_lock);
+
+  return n;
+}
+
+static void
+ostree_fetcher_body_stream_finalize (GObject *object)
+{
+  OstreeFetcherBodyStream *self = (OstreeFetcherBodyStream*) object;
+
+  g_clear_pointer (&self->thread_closure, thread_closure_unref);
+  g_free (self->uristr);
+
+  G_OBJECT_CLASS (ostree_fetcher_body_stream_parent_class)->finalize (object);
+}
+
+static void
+ostree_fetcher_body_stream_class_init (OstreeFetcherBodyStreamClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GInputStreamClass *stream_class = G_INPUT_STREAM_CLASS (klass);
+
+  gobject_class->finalize = ostree_fetcher_body_stream_finalize;
+  stream_class->read_fn = ostree_fetcher_body_stream_read;
+}
+
+static void
+ostree_fetcher_body_stream_init (OstreeFetcherBodyStream *self)
+{
+}
+
+static GInputStream *
+ostree_fetcher_body_stream_new (OstreeFetcherPendingURI *pending)
+{
+  OstreeFetcherBodyStream *self;
+
+  self = g_object_new (ostree_fetcher_body_stream_get_type (),
+                       "base-stream", pending->request_body,
+                       NULL);
+  self->thread_closure = thread_closure_ref (pending->thread_closure);
+  self->uristr = soup_uri_to_string (pending->uri, FALSE);
+  self->max_size = pending->max_size;
+
+  return (GInputStream*) self;
+}
+
 static void
 on_request_sent (GObject        *object, GAsyncResult   *result, gpointer        user_data);
 
@@ -948,7 +1040,7 @@ on_request_sent (GObject        *object,
   else
     {
       g_task_return_pointer (task,
-                             g_object_ref (pending->request_body),
+                             ostree_fetcher_body_stream_new (pending),
                              (GDestroyNotify) g_object_unref);
     }
   
@@ -1026,7 +1118,7 @@ ostree_fetcher_request_uri_with_partial_finish (OstreeFetcher         *self,
   return g_task_propagate_pointer (G_TASK (result), error);
 }
 
-static void
+void
 ostree_fetcher_stream_uri_async (OstreeFetcher         *self,
                                  SoupURI               *uri,
                                  guint64                max_size,
@@ -1040,7 +1132,7 @@ ostree_fetcher_stream_uri_async (OstreeFetcher         *self,
                                        ostree_fetcher_stream_uri_async);
 }
 
-static GInputStream *
+GInputStream *
 ostree_fetcher_stream_uri_finish (OstreeFetcher         *self,
                                   GAsyncResult          *result,
                                   GError               **error)
@@ -1132,8 +1224,8 @@ ostree_fetcher_request_uri_to_membuf (OstreeFetcher  *fetcher,
   data.done = FALSE;
   data.error = error;
 
-  ostree_fetcher_stream_uri_async (fetcher, uri,
-                                   OSTREE_MAX_METADATA_SIZE,
+  /* No size limit; summaries in particular can be large */
+  ostree_fetcher_stream_uri_async (fetcher, uri, 0,
                                    OSTREE_FETCHER_DEFAULT_PRIORITY,
                                    cancellable,
                                    fetch_uri_sync_on_complete, &data);
@@ -28,6 +28,7 @@
 #include "otutil.h"
 
 #include <stdlib.h>
+#include <sys/stat.h>
 #include <glib/gstdio.h>
 
 typedef struct {
@@ -38,6 +39,23 @@ struct OstreeGpgVerifier {
   GObject parent;
 
   GList *keyrings;
+  OstreeGpgHomeCache *home_cache;
+};
+
+/* A GPG home directory containing the concatenation of a verifier's
+ * keyrings.  It's shared by every verification result created from it,
+ * and deleted once the last of them (and the cache) drops its ref, or
+ * at exit if the repo is never finalized.
+ */
+typedef struct {
+  volatile gint refcount;
+  char *path;
+  char *fingerprint;
+} OstreeGpgHome;
+
+struct OstreeGpgHomeCache {
+  GMutex lock;
+  GHashTable *homes; /* keyring paths -> OstreeGpgHome */
 };
 
 G_DEFINE_TYPE (OstreeGpgVerifier, _ostree_gpg_verifier, G_TYPE_OBJECT)
@@ -68,34 +86,171 @@ _ostree_gpg_verifier_init (OstreeGpgVerifier *self)
 {
 }
 
+/* Paths of every home still on disk, removed at exit */
+static GMutex live_homes_lock;
+static GHashTable *live_homes;
+
+static void
+remove_live_homes (void)
+{
+  GHashTableIter hashiter;
+  gpointer key, value;
+
+  g_mutex_lock (&live_homes_lock);
+  g_hash_table_iter_init (&hashiter, live_homes);
+  while (g_hash_table_iter_next (&hashiter, &key, &value))
+    (void) glnx_shutil_rm_rf_at (AT_FDCWD, key, NULL, NULL);
+  g_hash_table_remove_all (live_homes);
+  g_mutex_unlock (&live_homes_lock);
+}
+
+static OstreeGpgHome *
+gpg_home_new (char *path)
+{
+  OstreeGpgHome *home = g_new0 (OstreeGpgHome, 1);
+
+  home->refcount = 1;
+  home->path = path;
+
+  g_mutex_lock (&live_homes_lock);
+  if (live_homes == NULL)
+    {
+      live_homes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+      atexit (remove_live_homes);
+    }
+  g_hash_table_add (live_homes, g_strdup (path));
+  g_mutex_unlock (&live_homes_lock);
+
+  return home;
+}
+
+static OstreeGpgHome *
+gpg_home_ref (OstreeGpgHome *home)
+{
+  g_atomic_int_inc (&home->refcount);
+  return home;
+}
+
+static void
+gpg_home_unref (OstreeGpgHome *home)
+{
+  if (!g_atomic_int_dec_and_test (&home->refcount))
+    return;
+
+  g_mutex_lock (&live_homes_lock);
+  g_hash_table_remove (live_homes, home->path);
+  g_mutex_unlock (&live_homes_lock);
+
+  (void) glnx_shutil_rm_rf_at (AT_FDCWD, home->path, NULL, NULL);
+  g_free (home->path);
+  g_free (home->fingerprint);
+  g_free (home);
+}
+
+OstreeGpgHomeCache *
+_ostree_gpg_home_cache_new (void)
+{
+  OstreeGpgHomeCache *cache = g_new0 (OstreeGpgHomeCache, 1);
+
+  g_mutex_init (&cache->lock);
+  cache->homes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                        (GDestroyNotify) gpg_home_unref);
+  return cache;
+}
+
+void
+_ostree_gpg_home_cache_free (OstreeGpgHomeCache *cache)
+{
+  g_hash_table_destroy (cache->homes);
+  g_mutex_clear (&cache->lock);
+  g_free (cache);
+}
+
+void
+_ostree_gpg_verifier_set_home_cache (OstreeGpgVerifier  *self,
+                                     OstreeGpgHomeCache *cache)
+{
+  self->home_cache = cache;
+}
+
 static void
 verify_result_finalized_cb (gpointer data,
                             GObject *finalized_verify_result)
 {
-  g_autofree gchar *tmp_dir = data;  /* assume ownership */
-
   /* XXX OstreeGpgVerifyResult could do this cleanup in its own
    *     finalize() method, but I didn't want this keyring hack
    *     bleeding into multiple classes. */
 
-  (void) glnx_shutil_rm_rf_at (AT_FDCWD, tmp_dir, NULL, NULL);
+  gpg_home_unref (data);
 }
 
-OstreeGpgVerifyResult *
-_ostree_gpg_verifier_check_signature (OstreeGpgVerifier  *self,
-                                      GBytes             *signed_data,
-                                      GBytes             *signatures,
-                                      GCancellable       *cancellable,
-                                      GError            **error)
+/* Compute the cache key (the ordered list of keyring paths) and a
+ * fingerprint of their current contents.  Returns %FALSE if a keyring
+ * has no local path, in which case the home can't be cached.
+ */
+static gboolean
+keyrings_fingerprint (OstreeGpgVerifier  *self,
+                      char              **out_key,
+                      char              **out_fingerprint)
 {
-  gpgme_ctx_t gpg_ctx = NULL;
-  gpgme_error_t gpg_error = 0;
-  gpgme_data_t data_buffer = NULL;
-  gpgme_data_t signature_buffer = NULL;
+  g_autoptr(GString) key = g_string_new ("");
+  g_autoptr(GString) fingerprint = g_string_new ("");
+  GList *link;
+
+  for (link = self->keyrings; link != NULL; link = link->next)
+    {
+      const char *path = gs_file_get_path_cached (link->data);
+      struct stat stbuf;
+
+      if (path == NULL)
+        return FALSE;
+
+      g_string_append (key, path);
+      g_string_append_c (key, '\n');
+
+      if (stat (path, &stbuf) != 0)
+        g_string_append (fingerprint, "-;");
+      else
+        g_string_append_printf (fingerprint, "%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT
+                                ":%" G_GUINT64_FORMAT ":%" G_GINT64_FORMAT ".%ld;",
+                                (guint64) stbuf.st_dev, (guint64) stbuf.st_ino,
+                                (guint64) stbuf.st_size, (gint64) stbuf.st_mtim.tv_sec,
+                                (long) stbuf.st_mtim.tv_nsec);
+    }
+
+  *out_key = g_string_free (g_steal_pointer (&key), FALSE);
+  *out_fingerprint = g_string_free (g_steal_pointer (&fingerprint), FALSE);
+  return TRUE;
+}
+
+/* Returns a string identifying the current set and state of our
+ * keyrings, or %NULL if it can't be determined.
+ */
+char *
+_ostree_gpg_verifier_get_fingerprint (OstreeGpgVerifier *self)
+{
+  g_autofree char *key = NULL;
+  g_autofree char *fingerprint = NULL;
+
+  if (!keyrings_fingerprint (self, &key, &fingerprint))
+    return NULL;
+
+  return g_strconcat (key, fingerprint, NULL);
+}
+
+/* Create a new temporary home directory for @gpg_ctx containing all of
+ * our keyrings concatenated into one pubring.gpg.
+ */
+static gboolean
+build_keyring_home (OstreeGpgVerifier  *self,
+                    gpgme_ctx_t         gpg_ctx,
+                    char              **out_tmp_dir,
+                    GCancellable       *cancellable,
+                    GError            **error)
+{
+  gboolean ret = FALSE;
   g_autofree char *tmp_dir = NULL;
   g_autoptr(GOutputStream) target_stream = NULL;
-  OstreeGpgVerifyResult *result = NULL;
-  gboolean success = FALSE;
   GList *link;
 
   /* GPGME has no API for using multiple keyrings (aka, gpg --keyring),
@@ -103,15 +258,7 @@ _ostree_gpg_verifier_check_signature (OstreeGpgVerifier  *self,
    * temporary directory, then tell GPGME to use that directory as the
    * home directory. */
 
-  if (g_cancellable_set_error_if_cancelled (cancellable, error))
-    goto out;
-
-  result = g_initable_new (OSTREE_TYPE_GPG_VERIFY_RESULT,
-                           cancellable, error, NULL);
-  if (result == NULL)
-    goto out;
-
-  if (!ot_gpgme_ctx_tmp_home_dir (result->context, NULL,
+  if (!ot_gpgme_ctx_tmp_home_dir (gpg_ctx, NULL,
                                   &tmp_dir, &target_stream,
                                   cancellable, error))
     goto out;
@@ -148,6 +295,100 @@ _ostree_gpg_verifier_check_signature (OstreeGpgVerifier  *self,
   if (!g_output_stream_close (target_stream, cancellable, error))
     goto out;
 
+  ret = TRUE;
+  *out_tmp_dir = g_steal_pointer (&tmp_dir);
+ out:
+  if (tmp_dir != NULL)
+    (void) glnx_shutil_rm_rf_at (AT_FDCWD, tmp_dir, NULL, NULL);
+  return ret;
+}
+
+/* Point @gpg_ctx at a home directory holding our keyrings, reusing a
+ * cached one if none of the keyrings changed since it was built.
+ */
+static gboolean
+get_keyring_home (OstreeGpgVerifier  *self,
+                  gpgme_ctx_t         gpg_ctx,
+                  OstreeGpgHome     **out_home,
+                  GCancellable       *cancellable,
+                  GError            **error)
+{
+  gboolean ret = FALSE;
+  g_autofree char *key = NULL;
+  g_autofree char *fingerprint = NULL;
+  g_autofree char *tmp_dir = NULL;
+  OstreeGpgHome *home = NULL;
+  gboolean locked = FALSE;
+
+  if (self->home_cache != NULL &&
+      keyrings_fingerprint (self, &key, &fingerprint))
+    {
+      g_mutex_lock (&self->home_cache->lock);
+      locked = TRUE;
+
+      home = g_hash_table_lookup (self->home_cache->homes, key);
+      if (home != NULL && g_str_equal (home->fingerprint, fingerprint))
+        {
+          gpgme_error_t gpg_error;
+
+          gpg_error = gpgme_ctx_set_engine_info (gpg_ctx, GPGME_PROTOCOL_OpenPGP,
+                                                 NULL, home->path);
+          if (gpg_error != GPG_ERR_NO_ERROR)
+            {
+              ot_gpgme_error_to_gio_error (gpg_error, error);
+              goto out;
+            }
+
+          *out_home = gpg_home_ref (home);
+          ret = TRUE;
+          goto out;
+        }
+    }
+
+  if (!build_keyring_home (self, gpg_ctx, &tmp_dir, cancellable, error))
+    goto out;
+
+  home = gpg_home_new (g_steal_pointer (&tmp_dir));
+  home->fingerprint = g_steal_pointer (&fingerprint);
+
+  if (key != NULL)
+    g_hash_table_replace (self->home_cache->homes,
+                          g_steal_pointer (&key), gpg_home_ref (home));
+
+  *out_home = home;
+  ret = TRUE;
+ out:
+  if (locked)
+    g_mutex_unlock (&self->home_cache->lock);
+  return ret;
+}
+
+OstreeGpgVerifyResult *
+_ostree_gpg_verifier_check_signature (OstreeGpgVerifier  *self,
+                                      GBytes             *signed_data,
+                                      GBytes             *signatures,
+                                      GCancellable       *cancellable,
+                                      GError            **error)
+{
+  gpgme_ctx_t gpg_ctx = NULL;
+  gpgme_error_t gpg_error = 0;
+  gpgme_data_t data_buffer = NULL;
+  gpgme_data_t signature_buffer = NULL;
+  OstreeGpgHome *home = NULL;
+  OstreeGpgVerifyResult *result = NULL;
+  gboolean success = FALSE;
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    goto out;
+
+  result = g_initable_new (OSTREE_TYPE_GPG_VERIFY_RESULT,
+                           cancellable, error, NULL);
+  if (result == NULL)
+    goto out;
+
+  if (!get_keyring_home (self, result->context, &home, cancellable, error))
+    goto out;
+
   /* Both the signed data and signature GBytes instances will outlive the
    * gpgme_data_t structs, so we can safely reuse the GBytes memory buffer
    * directly and avoid a copy. */
@@ -200,22 +441,22 @@ out:
 
   if (success)
     {
-      /* Keep the temporary directory around for the life of the result
+      /* Keep the home directory around for the life of the result
        * object so its GPGME context remains valid.  It may yet have to
        * extract user details from signing keys and will need to access
        * the fabricated pubring.gpg keyring. */
       g_object_weak_ref (G_OBJECT (result),
                          verify_result_finalized_cb,
-                         g_strdup (tmp_dir));
+                         g_steal_pointer (&home));
     }
   else
     {
       /* Destroy the result object on error. */
       g_clear_object (&result);
 
-      /* Try to clean up the temporary directory. */
-      if (tmp_dir != NULL)
-        (void) glnx_shutil_rm_rf_at (AT_FDCWD, tmp_dir, NULL, NULL);
+      /* Drop our ref; this removes the directory unless it's cached. */
+      if (home != NULL)
+        gpg_home_unref (home);
     }
 
   g_prefix_error (error, "GPG: ");
@@ -34,6 +34,7 @@ G_BEGIN_DECLS
   (G_TYPE_CHECK_INSTANCE_TYPE ((obj), OSTREE_TYPE_GPG_VERIFIER))
 
 typedef struct OstreeGpgVerifier OstreeGpgVerifier;
+typedef struct OstreeGpgHomeCache OstreeGpgHomeCache;
 
 /* If this type becomes public in future, move this autoptr cleanup
  * definition to the ostree-autocleanups.h header file. Right now it
@@ -62,4 +63,13 @@ gboolean      _ostree_gpg_verifier_add_global_keyring_dir (OstreeGpgVerifier  *s
 void _ostree_gpg_verifier_add_keyring (OstreeGpgVerifier *self,
                                        GFile             *path);
 
+char *_ostree_gpg_verifier_get_fingerprint (OstreeGpgVerifier *self);
+
+OstreeGpgHomeCache *_ostree_gpg_home_cache_new (void);
+
+void _ostree_gpg_home_cache_free (OstreeGpgHomeCache *cache);
+
+void _ostree_gpg_verifier_set_home_cache (OstreeGpgVerifier  *self,
+                                          OstreeGpgHomeCache *cache);
+
 G_END_DECLS
@@ -0,0 +1,228 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2016 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "ostree-metadata-cache.h"
+
+/*
+ * A bounded, thread-safe LRU cache of parsed metadata objects.  Since
+ * objects are content-addressed, a cached variant never goes stale;
+ * the only reason to drop one is to bound memory usage (or because
+ * the object was deleted).  Entries are keyed by binary checksum and
+ * object type, and linked into a queue in order of use.
+ */
+
+typedef struct {
+  guchar csum[OSTREE_SHA256_DIGEST_LEN];
+  OstreeObjectType objtype;
+  GVariant *variant;
+  gsize size;
+  GList link;
+} CacheEntry;
+
+struct OstreeMetadataCache {
+  GMutex lock;
+  GHashTable *entries;  /* CacheEntry set */
+  GQueue lru;           /* Most recently used at the head */
+  gsize size;
+  gsize max_size;
+  guint64 hits;
+  guint64 misses;
+};
+
+static guint
+cache_entry_hash (gconstpointer v)
+{
+  const CacheEntry *entry = v;
+  guint h;
+
+  /* The checksum is already uniformly distributed */
+  memcpy (&h, entry->csum, sizeof (h));
+  return h ^ entry->objtype;
+}
+
+static gboolean
+cache_entry_equal (gconstpointer v1,
+                   gconstpointer v2)
+{
+  const CacheEntry *a = v1;
+  const CacheEntry *b = v2;
+
+  return a->objtype == b->objtype &&
+    memcmp (a->csum, b->csum, OSTREE_SHA256_DIGEST_LEN) == 0;
+}
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+  g_variant_unref (entry->variant);
+  g_free (entry);
+}
+
+OstreeMetadataCache *
+_ostree_metadata_cache_new (gsize max_size)
+{
+  OstreeMetadataCache *cache = g_new0 (OstreeMetadataCache, 1);
+
+  g_mutex_init (&cache->lock);
+  cache->entries = g_hash_table_new_full (cache_entry_hash, cache_entry_equal,
+                                          (GDestroyNotify) cache_entry_free, NULL);
+  g_queue_init (&cache->lru);
+  cache->max_size = max_size;
+
+  return cache;
+}
+
+void
+_ostree_metadata_cache_free (OstreeMetadataCache *cache)
+{
+  if (!cache)
+    return;
+
+  g_hash_table_destroy (cache->entries);
+  g_mutex_clear (&cache->lock);
+  g_free (cache);
+}
+
+static void
+init_key (CacheEntry        *key,
+          OstreeObjectType   objtype,
+          const char        *checksum)
+{
+  ostree_checksum_inplace_to_bytes (checksum, key->csum);
+  key->objtype = objtype;
+}
+
+/* Called with the lock held */
+static void
+remove_entry (OstreeMetadataCache *cache,
+              CacheEntry          *entry)
+{
+  g_queue_unlink (&cache->lru, &entry->link);
+  cache->size -= entry->size;
+  g_hash_table_remove (cache->entries, entry);
+}
+
+/*
+ * _ostree_metadata_cache_lookup:
+ *
+ * Returns: (transfer full): The cached object @checksum of type
+ * @objtype, or %NULL if it isn't cached
+ */
+GVariant *
+_ostree_metadata_cache_lookup (OstreeMetadataCache *cache,
+                               OstreeObjectType     objtype,
+                               const char          *checksum)
+{
+  CacheEntry key;
+  CacheEntry *entry;
+  GVariant *ret = NULL;
+
+  init_key (&key, objtype, checksum);
+
+  g_mutex_lock (&cache->lock);
+  entry = g_hash_table_lookup (cache->entries, &key);
+  if (entry)
+    {
+      cache->hits++;
+      g_queue_unlink (&cache->lru, &entry->link);
+      g_queue_push_head_link (&cache->lru, &entry->link);
+      ret = g_variant_ref (entry->variant);
+    }
+  else
+    cache->misses++;
+  g_mutex_unlock (&cache->lock);
+
+  return ret;
+}
+
+/*
+ * _ostree_metadata_cache_insert:
+ *
+ * Add @variant to the cache, evicting the least recently used objects
+ * as necessary.  Objects larger than a sixteenth of the cache aren't
+ * cached, so that a single huge dirtree doesn't flush everything else.
+ */
+void
+_ostree_metadata_cache_insert (OstreeMetadataCache *cache,
+                               OstreeObjectType     objtype,
+                               const char          *checksum,
+                               GVariant            *variant)
+{
+  CacheEntry *entry;
+  gsize size = g_variant_get_size (variant);
+
+  if (size > cache->max_size / 16)
+    return;
+
+  entry = g_new0 (CacheEntry, 1);
+  init_key (entry, objtype, checksum);
+  entry->variant = g_variant_ref (variant);
+  entry->size = size;
+  entry->link.data = entry;
+
+  g_mutex_lock (&cache->lock);
+  if (g_hash_table_contains (cache->entries, entry))
+    {
+      /* Lost a race with another thread loading the same object */
+      g_mutex_unlock (&cache->lock);
+      cache_entry_free (entry);
+      return;
+    }
+
+  while (cache->size + size > cache->max_size && cache->lru.tail)
+    remove_entry (cache, cache->lru.tail->data);
+
+  g_hash_table_add (cache->entries, entry);
+  g_queue_push_head_link (&cache->lru, &entry->link);
+  cache->size += size;
+  g_mutex_unlock (&cache->lock);
+}
+
+void
+_ostree_metadata_cache_remove (OstreeMetadataCache *cache,
+                               OstreeObjectType     objtype,
+                               const char          *checksum)
+{
+  CacheEntry key;
+  CacheEntry *entry;
+
+  init_key (&key, objtype, checksum);
+
+  g_mutex_lock (&cache->lock);
+  entry = g_hash_table_lookup (cache->entries, &key);
+  if (entry)
+    remove_entry (cache, entry);
+  g_mutex_unlock (&cache->lock);
+}
+
+void
+_ostree_metadata_cache_get_stats (OstreeMetadataCache *cache,
+                                  guint64             *out_hits,
+                                  guint64             *out_misses)
+{
+  g_mutex_lock (&cache->lock);
+  *out_hits = cache->hits;
+  *out_misses = cache->misses;
+  g_mutex_unlock (&cache->lock);
+}
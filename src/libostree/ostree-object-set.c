@@ -0,0 +1,239 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2016 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+#include "config.h"
+
+#include <string.h>
+
+#include "ostree-object-set.h"
+
+typedef struct {
+  guchar csum[OSTREE_SHA256_DIGEST_LEN];
+  guchar objtype; /* 0 for an empty slot */
+} ObjectSetEntry;
+
+struct OstreeObjectSet {
+  ObjectSetEntry *entries;
+  gsize n_slots; /* Always a power of two */
+  gsize n_entries;
+};
+
+#define OBJECT_SET_INITIAL_SLOTS 1024
+
+OstreeObjectSet *
+_ostree_object_set_new (void)
+{
+  OstreeObjectSet *set = g_new0 (OstreeObjectSet, 1);
+
+  set->n_slots = OBJECT_SET_INITIAL_SLOTS;
+  set->entries = g_new0 (ObjectSetEntry, set->n_slots);
+
+  return set;
+}
+
+void
+_ostree_object_set_free (OstreeObjectSet *set)
+{
+  if (!set)
+    return;
+
+  g_free (set->entries);
+  g_free (set);
+}
+
+gsize
+_ostree_object_set_size (OstreeObjectSet *set)
+{
+  return set->n_entries;
+}
+
+/* Returns the slot holding the object, or the empty slot where it
+ * would go.  There is always at least one empty slot.
+ */
+static ObjectSetEntry *
+object_set_find_slot (ObjectSetEntry   *entries,
+                      gsize             n_slots,
+                      const guchar     *csum,
+                      OstreeObjectType  objtype)
+{
+  gsize mask = n_slots - 1;
+  gsize idx;
+  guint64 h;
+
+  /* The checksum is already uniformly distributed */
+  memcpy (&h, csum, sizeof (h));
+  idx = (gsize) (h ^ objtype) & mask;
+
+  while (TRUE)
+    {
+      ObjectSetEntry *entry = &entries[idx];
+
+      if (entry->objtype == 0)
+        return entry;
+      if (entry->objtype == objtype &&
+          memcmp (entry->csum, csum, OSTREE_SHA256_DIGEST_LEN) == 0)
+        return entry;
+
+      idx = (idx + 1) & mask;
+    }
+}
+
+static void
+object_set_grow (OstreeObjectSet *set)
+{
+  gsize new_n_slots = set->n_slots * 2;
+  ObjectSetEntry *new_entries = g_new0 (ObjectSetEntry, new_n_slots);
+  gsize i;
+
+  for (i = 0; i < set->n_slots; i++)
+    {
+      ObjectSetEntry *entry = &set->entries[i];
+
+      if (entry->objtype == 0)
+        continue;
+
+      *object_set_find_slot (new_entries, new_n_slots, entry->csum, entry->objtype) = *entry;
+    }
+
+  g_free (set->entries);
+  set->entries = new_entries;
+  set->n_slots = new_n_slots;
+}
+
+/*
+ * _ostree_object_set_add:
+ *
+ * Returns: %TRUE if the object was newly added, %FALSE if it was
+ * already present
+ */
+gboolean
+_ostree_object_set_add (OstreeObjectSet   *set,
+                        const guchar      *csum,
+                        OstreeObjectType   objtype)
+{
+  ObjectSetEntry *entry;
+
+  g_return_val_if_fail (objtype > 0 && objtype <= OSTREE_OBJECT_TYPE_LAST, FALSE);
+
+  /* Keep the load factor below 3/4 so probe sequences stay short */
+  if ((set->n_entries + 1) * 4 > set->n_slots * 3)
+    object_set_grow (set);
+
+  entry = object_set_find_slot (set->entries, set->n_slots, csum, objtype);
+  if (entry->objtype != 0)
+    return FALSE;
+
+  memcpy (entry->csum, csum, OSTREE_SHA256_DIGEST_LEN);
+  entry->objtype = objtype;
+  set->n_entries++;
+
+  return TRUE;
+}
+
+gboolean
+_ostree_object_set_add_checksum (OstreeObjectSet   *set,
+                                 const char        *checksum,
+                                 OstreeObjectType   objtype)
+{
+  guchar csum[OSTREE_SHA256_DIGEST_LEN];
+
+  ostree_checksum_inplace_to_bytes (checksum, csum);
+  return _ostree_object_set_add (set, csum, objtype);
+}
+
+gboolean
+_ostree_object_set_contains (OstreeObjectSet   *set,
+                             const guchar      *csum,
+                             OstreeObjectType   objtype)
+{
+  return object_set_find_slot (set->entries, set->n_slots, csum, objtype)->objtype != 0;
+}
+
+gboolean
+_ostree_object_set_contains_checksum (OstreeObjectSet   *set,
+                                      const char        *checksum,
+                                      OstreeObjectType   objtype)
+{
+  guchar csum[OSTREE_SHA256_DIGEST_LEN];
+
+  ostree_checksum_inplace_to_bytes (checksum, csum);
+  return _ostree_object_set_contains (set, csum, objtype);
+}
+
+/*
+ * _ostree_object_set_add_names:
+ * @names: (element-type GVariant): Table keyed by ostree_object_name_serialize()
+ *
+ * Add every object named in @names to @set.
+ */
+void
+_ostree_object_set_add_names (OstreeObjectSet  *set,
+                              GHashTable       *names)
+{
+  GHashTableIter hashiter;
+  gpointer key, value;
+
+  g_hash_table_iter_init (&hashiter, names);
+  while (g_hash_table_iter_next (&hashiter, &key, &value))
+    {
+      const char *checksum;
+      OstreeObjectType objtype;
+
+      ostree_object_name_deserialize (key, &checksum, &objtype);
+      _ostree_object_set_add_checksum (set, checksum, objtype);
+    }
+}
+
+/*
+ * _ostree_object_set_iter_init:
+ *
+ * Iterate over @set in no particular order.  The set must not be
+ * modified during iteration.
+ */
+void
+_ostree_object_set_iter_init (OstreeObjectSetIter *iter,
+                              OstreeObjectSet     *set)
+{
+  iter->set = set;
+  iter->idx = 0;
+}
+
+gboolean
+_ostree_object_set_iter_next (OstreeObjectSetIter  *iter,
+                              const guchar        **out_csum,
+                              OstreeObjectType     *out_objtype)
+{
+  OstreeObjectSet *set = iter->set;
+
+  while (iter->idx < set->n_slots)
+    {
+      ObjectSetEntry *entry = &set->entries[iter->idx++];
+
+      if (entry->objtype == 0)
+        continue;
+
+      *out_csum = entry->csum;
+      *out_objtype = entry->objtype;
+      return TRUE;
+    }
+
+  return FALSE;
+}
@@ -0,0 +1,74 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2016 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+#pragma once
+
+#include "ostree-core.h"
+
+G_BEGIN_DECLS
+
+/* A set of object names, stored as binary checksums in a flat
+ * open-addressing table.  This uses well under half the memory of a
+ * GHashTable of serialized names, which matters when traversing
+ * repositories with millions of objects.  Not thread safe.
+ */
+typedef struct OstreeObjectSet OstreeObjectSet;
+
+typedef struct {
+  OstreeObjectSet *set;
+  gsize idx;
+} OstreeObjectSetIter;
+
+OstreeObjectSet *_ostree_object_set_new (void);
+
+void _ostree_object_set_free (OstreeObjectSet *set);
+
+gsize _ostree_object_set_size (OstreeObjectSet *set);
+
+gboolean _ostree_object_set_add (OstreeObjectSet   *set,
+                                 const guchar      *csum,
+                                 OstreeObjectType   objtype);
+
+gboolean _ostree_object_set_add_checksum (OstreeObjectSet   *set,
+                                          const char        *checksum,
+                                          OstreeObjectType   objtype);
+
+gboolean _ostree_object_set_contains (OstreeObjectSet   *set,
+                                      const guchar      *csum,
+                                      OstreeObjectType   objtype);
+
+gboolean _ostree_object_set_contains_checksum (OstreeObjectSet   *set,
+                                               const char        *checksum,
+                                               OstreeObjectType   objtype);
+
+void _ostree_object_set_add_names (OstreeObjectSet  *set,
+                                   GHashTable       *names);
+
+void _ostree_object_set_iter_init (OstreeObjectSetIter *iter,
+                                   OstreeObjectSet     *set);
+
+gboolean _ostree_object_set_iter_next (OstreeObjectSetIter  *iter,
+                                       const guchar        **out_csum,
+                                       OstreeObjectType     *out_objtype);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (OstreeObjectSet, _ostree_object_set_free)
+
+G_END_DECLS
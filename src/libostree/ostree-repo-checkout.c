@@ -25,6 +25,7 @@
 #include <glib-unix.h>
 #include <sys/xattr.h>
 #include <gio/gfiledescriptorbased.h>
+#include <gio/gunixinputstream.h>
 #include <gio/gunixoutputstream.h>
 #include "otutil.h"
 
@@ -34,6 +35,34 @@
 
 #define WHITEOUT_PREFIX ".wh."
 
+/* Protects OstreeRepoCheckoutOptions.devino_to_csum_cache during
+ * parallel checkouts */
+static GMutex devino_cache_lock;
+
+/* Record a lookup of @checksum in the uncompressed object cache, for
+ * the statistics and (if the cache size is bounded) for LRU eviction
+ * in ostree_repo_checkout_gc().
+ */
+static void
+uncompressed_cache_note_use (OstreeRepo  *self,
+                             const char  *checksum,
+                             gboolean     hit)
+{
+  g_mutex_lock (&self->cache_lock);
+  if (hit)
+    self->uncompressed_cache_hits++;
+  else
+    self->uncompressed_cache_misses++;
+  if (self->uncompressed_cache_max_size > 0)
+    {
+      if (self->uncompressed_cache_used == NULL)
+        self->uncompressed_cache_used = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                               g_free, NULL);
+      g_hash_table_add (self->uncompressed_cache_used, g_strdup (checksum));
+    }
+  g_mutex_unlock (&self->cache_lock);
+}
+
 static gboolean
 checkout_object_for_uncompressed_cache (OstreeRepo      *self,
                                         const char      *loose_path,
@@ -123,17 +152,31 @@ write_regular_file_content (OstreeRepo            *self,
 {
   gboolean ret = FALSE;
   const OstreeRepoCheckoutMode mode = options->mode;
+  gboolean did_clone = FALSE;
   int fd;
   int res;
 
-  if (g_output_stream_splice (output, input, 0,
-                              cancellable, error) < 0)
-    goto out;
+  fd = g_file_descriptor_based_get_fd ((GFileDescriptorBased*)output);
 
-  if (!g_output_stream_flush (output, cancellable, error))
-    goto out;
+  /* If the content is a plain file (bare repos, or the uncompressed
+   * cache), try to make a copy-on-write clone of it first.
+   */
+  if (G_IS_FILE_DESCRIPTOR_BASED (input))
+    {
+      if (!ot_clone_fd (g_file_descriptor_based_get_fd ((GFileDescriptorBased*)input),
+                        fd, &did_clone, error))
+        goto out;
+    }
 
-  fd = g_file_descriptor_based_get_fd ((GFileDescriptorBased*)output);
+  if (!did_clone)
+    {
+      if (g_output_stream_splice (output, input, 0,
+                                  cancellable, error) < 0)
+        goto out;
+
+      if (!g_output_stream_flush (output, cancellable, error))
+        goto out;
+    }
 
   if (mode != OSTREE_REPO_CHECKOUT_MODE_USER)
     {
@@ -384,10 +427,107 @@ checkout_file_hardlink (OstreeRepo                          *self,
   return ret;
 }
 
+/*
+ * Determine whether the content object @checksum is a symbolic link,
+ * without constructing a GFileInfo where the repository mode allows
+ * it.  For bare repositories the loose object itself tells us, for
+ * bare-user we consult the metadata xattr, and for archive-z2 a hit
+ * in the uncompressed cache implies a regular file, as symbolic links
+ * are never cached.  Otherwise (including objects only found in a
+ * parent repository), we fall back to loading the object, and return
+ * its info in @out_file_info so that the caller can reuse it.
+ */
+static gboolean
+query_content_is_symlink (OstreeRepo                *repo,
+                          OstreeRepoCheckoutOptions *options,
+                          const char                *checksum,
+                          gboolean                  *out_is_symlink,
+                          GFileInfo                **out_file_info,
+                          GCancellable              *cancellable,
+                          GError                   **error)
+{
+  char loose_path_buf[_OSTREE_LOOSE_PATH_MAX];
+  g_autoptr(GFileInfo) file_info = NULL;
+  struct stat stbuf;
+
+  _ostree_loose_path (loose_path_buf, checksum, OSTREE_OBJECT_TYPE_FILE, OSTREE_REPO_MODE_BARE);
+
+  if (repo->mode == OSTREE_REPO_MODE_BARE)
+    {
+      if (TEMP_FAILURE_RETRY (fstatat (repo->objects_dir_fd, loose_path_buf, &stbuf, AT_SYMLINK_NOFOLLOW)) == 0)
+        {
+          *out_is_symlink = S_ISLNK (stbuf.st_mode);
+          return TRUE;
+        }
+      else if (errno != ENOENT)
+        {
+          glnx_set_error_from_errno (error);
+          return FALSE;
+        }
+    }
+  else if (repo->mode == OSTREE_REPO_MODE_BARE_USER)
+    {
+      if (TEMP_FAILURE_RETRY (fstatat (repo->objects_dir_fd, loose_path_buf, &stbuf, AT_SYMLINK_NOFOLLOW)) == 0)
+        {
+          g_autoptr(GBytes) bytes = NULL;
+          g_autoptr(GVariant) metadata = NULL;
+          guint32 mode;
+
+          bytes = ot_lgetxattrat (repo->objects_dir_fd, loose_path_buf,
+                                  "user.ostreemeta", error);
+          if (bytes == NULL)
+            return FALSE;
+
+          metadata = g_variant_new_from_bytes (OSTREE_FILEMETA_GVARIANT_FORMAT,
+                                               bytes, FALSE);
+          g_variant_ref_sink (metadata);
+
+          /* PARSE OSTREE_FILEMETA_GVARIANT_FORMAT */
+          g_variant_get_child (metadata, 2, "u", &mode);
+          *out_is_symlink = S_ISLNK (GUINT32_FROM_BE (mode));
+          return TRUE;
+        }
+      else if (errno != ENOENT)
+        {
+          glnx_set_error_from_errno (error);
+          return FALSE;
+        }
+    }
+  else if (repo->mode == OSTREE_REPO_MODE_ARCHIVE_Z2
+           && options->mode == OSTREE_REPO_CHECKOUT_MODE_USER
+           && options->enable_uncompressed_cache
+           && repo->enable_uncompressed_cache)
+    {
+      if (TEMP_FAILURE_RETRY (fstatat (repo->uncompressed_objects_dir_fd, loose_path_buf, &stbuf, AT_SYMLINK_NOFOLLOW)) == 0)
+        {
+          *out_is_symlink = FALSE;
+          return TRUE;
+        }
+      else if (errno != ENOENT)
+        {
+          glnx_set_error_from_errno (error);
+          return FALSE;
+        }
+    }
+
+  if (!ostree_repo_load_file (repo, checksum, NULL, &file_info, NULL,
+                              cancellable, error))
+    return FALSE;
+
+  *out_is_symlink = g_file_info_get_file_type (file_info) == G_FILE_TYPE_SYMBOLIC_LINK;
+  *out_file_info = g_steal_pointer (&file_info);
+  return TRUE;
+}
+
+/*
+ * Check out the content object @checksum as @destination_name.
+ * @source_info may be %NULL, in which case it is only loaded if the
+ * object needs to be copied rather than hardlinked.
+ */
 static gboolean
 checkout_one_file_at (OstreeRepo                        *repo,
                       OstreeRepoCheckoutOptions         *options,
-                      GFile                             *source,
+                      const char                        *checksum,
                       GFileInfo                         *source_info,
                       int                                destination_dfd,
                       const char                        *destination_name,
@@ -395,18 +535,24 @@ checkout_one_file_at (OstreeRepo                        *repo,
                       GError                           **error)
 {
   gboolean ret = FALSE;
-  const char *checksum;
   gboolean is_symlink;
   gboolean can_cache;
   gboolean need_copy = TRUE;
   char loose_path_buf[_OSTREE_LOOSE_PATH_MAX];
+  g_autoptr(GFileInfo) loaded_info = NULL;
   g_autoptr(GInputStream) input = NULL;
   g_autoptr(GVariant) xattrs = NULL;
   gboolean is_whiteout;
 
-  is_symlink = g_file_info_get_file_type (source_info) == G_FILE_TYPE_SYMBOLIC_LINK;
-
-  checksum = ostree_repo_file_get_checksum ((OstreeRepoFile*)source);
+  if (source_info)
+    is_symlink = g_file_info_get_file_type (source_info) == G_FILE_TYPE_SYMBOLIC_LINK;
+  else
+    {
+      if (!query_content_is_symlink (repo, options, checksum, &is_symlink, &loaded_info,
+                                     cancellable, error))
+        goto out;
+      source_info = loaded_info;
+    }
 
   is_whiteout = !is_symlink && options->process_whiteouts &&
     g_str_has_prefix (destination_name, WHITEOUT_PREFIX);
@@ -432,7 +578,7 @@ checkout_one_file_at (OstreeRepo                        *repo,
 
       need_copy = FALSE;
     }
-  else if (!is_symlink)
+  else if (!is_symlink && !options->force_copy)
     {
       gboolean did_hardlink = FALSE;
       /* Try to do a hardlink first, if it's a regular file.  This also
@@ -481,10 +627,15 @@ checkout_one_file_at (OstreeRepo                        *repo,
                   key->dev = stbuf.st_dev;
                   key->ino = stbuf.st_ino;
                   memcpy (key->checksum, checksum, 65);
-                  
+
+                  g_mutex_lock (&devino_cache_lock);
                   g_hash_table_add ((GHashTable*)options->devino_to_csum_cache, key);
+                  g_mutex_unlock (&devino_cache_lock);
                 }
 
+              if (did_hardlink && is_archive_z2_with_cache)
+                uncompressed_cache_note_use (current_repo, checksum, TRUE);
+
               if (did_hardlink)
                 break;
             }
@@ -498,7 +649,9 @@ checkout_one_file_at (OstreeRepo                        *repo,
                && repo->enable_uncompressed_cache);
 
   /* Ok, if we're archive-z2 and we didn't find an object, uncompress
-   * it now, stick it in the cache, and then hardlink to that.
+   * it now, stick it in the cache, and then hardlink to that.  With
+   * force_copy, we instead use the cached object as the source for
+   * the copy below, which can then be a reflink.
    */
   if (can_cache
       && !is_whiteout
@@ -508,67 +661,120 @@ checkout_one_file_at (OstreeRepo                        *repo,
       && options->mode == OSTREE_REPO_CHECKOUT_MODE_USER)
     {
       gboolean did_hardlink;
-      
-      if (!ostree_repo_load_file (repo, checksum, &input, NULL, NULL,
-                                  cancellable, error))
-        goto out;
+      glnx_fd_close int cached_fd = -1;
 
       /* Overwrite any parent repo from earlier */
       _ostree_loose_path (loose_path_buf, checksum, OSTREE_OBJECT_TYPE_FILE, OSTREE_REPO_MODE_BARE);
 
-      if (!checkout_object_for_uncompressed_cache (repo, loose_path_buf,
-                                                   source_info, input,
-                                                   cancellable, error))
+      if (options->force_copy)
         {
-          g_prefix_error (error, "Unpacking loose object %s: ", checksum);
-          goto out;
+          if (!ot_openat_ignore_enoent (repo->uncompressed_objects_dir_fd, loose_path_buf,
+                                        &cached_fd, error))
+            goto out;
         }
-      
-      g_clear_object (&input);
 
-      /* Store the 2-byte objdir prefix (e.g. e3) in a set.  The basic
-       * idea here is that if we had to unpack an object, it's very
-       * likely we're replacing some other object, so we may need a GC.
-       *
-       * This model ensures that we do work roughly proportional to
-       * the size of the changes.  For example, we don't scan any
-       * directories if we didn't modify anything, meaning you can
-       * checkout the same tree multiple times very quickly.
-       *
-       * This is also scale independent; we don't hardcode e.g. looking
-       * at 1000 objects.
-       *
-       * The downside is that if we're unlucky, we may not free
-       * an object for quite some time.
-       */
-      g_mutex_lock (&repo->cache_lock);
-      {
-        gpointer key = GUINT_TO_POINTER ((g_ascii_xdigit_value (checksum[0]) << 4) + 
-                                         g_ascii_xdigit_value (checksum[1]));
-        if (repo->updated_uncompressed_dirs == NULL)
-          repo->updated_uncompressed_dirs = g_hash_table_new (NULL, NULL);
-        g_hash_table_insert (repo->updated_uncompressed_dirs, key, key);
-      }
-      g_mutex_unlock (&repo->cache_lock);
-
-      if (!checkout_file_hardlink (repo, options, loose_path_buf,
-                                   destination_dfd, destination_name,
-                                   FALSE, &did_hardlink,
-                                   cancellable, error))
-        {
-          g_prefix_error (error, "Using new cached uncompressed hardlink of %s to %s: ", checksum, destination_name);
-          goto out;
+      uncompressed_cache_note_use (repo, checksum, cached_fd != -1);
+
+      if (cached_fd == -1)
+        {
+          if (!ostree_repo_load_file (repo, checksum, &input,
+                                      source_info ? NULL : &loaded_info, NULL,
+                                      cancellable, error))
+            goto out;
+          if (!source_info)
+            source_info = loaded_info;
+
+          if (!checkout_object_for_uncompressed_cache (repo, loose_path_buf,
+                                                       source_info, input,
+                                                       cancellable, error))
+            {
+              g_prefix_error (error, "Unpacking loose object %s: ", checksum);
+              goto out;
+            }
+
+          g_clear_object (&input);
         }
 
-      need_copy = !did_hardlink;
+      if (options->force_copy)
+        {
+          /* A copy doesn't hold a link to the cached object, so it
+           * would be garbage collected straight away if we marked its
+           * directory below.
+           */
+          if (cached_fd == -1)
+            {
+              if (!gs_file_openat_noatime (repo->uncompressed_objects_dir_fd, loose_path_buf,
+                                           &cached_fd, cancellable, error))
+                goto out;
+            }
+
+          if (!source_info)
+            {
+              if (!ostree_repo_load_file (repo, checksum, NULL, &loaded_info, NULL,
+                                          cancellable, error))
+                goto out;
+              source_info = loaded_info;
+            }
+
+          input = g_unix_input_stream_new (glnx_steal_fd (&cached_fd), TRUE);
+        }
+      else
+        {
+          /* Store the 2-byte objdir prefix (e.g. e3) in a set.  The basic
+           * idea here is that if we had to unpack an object, it's very
+           * likely we're replacing some other object, so we may need a GC.
+           *
+           * This model ensures that we do work roughly proportional to
+           * the size of the changes.  For example, we don't scan any
+           * directories if we didn't modify anything, meaning you can
+           * checkout the same tree multiple times very quickly.
+           *
+           * This is also scale independent; we don't hardcode e.g. looking
+           * at 1000 objects.
+           *
+           * The downside is that if we're unlucky, we may not free
+           * an object for quite some time.
+           */
+          g_mutex_lock (&repo->cache_lock);
+          {
+            gpointer key = GUINT_TO_POINTER ((g_ascii_xdigit_value (checksum[0]) << 4) +
+                                             g_ascii_xdigit_value (checksum[1]));
+            if (repo->updated_uncompressed_dirs == NULL)
+              repo->updated_uncompressed_dirs = g_hash_table_new (NULL, NULL);
+            g_hash_table_insert (repo->updated_uncompressed_dirs, key, key);
+          }
+          g_mutex_unlock (&repo->cache_lock);
+
+          /* Allow ENOENT, in case a concurrent ostree_repo_checkout_gc()
+           * evicted the object again; we'll just copy it.
+           */
+          if (!checkout_file_hardlink (repo, options, loose_path_buf,
+                                       destination_dfd, destination_name,
+                                       TRUE, &did_hardlink,
+                                       cancellable, error))
+            {
+              g_prefix_error (error, "Using new cached uncompressed hardlink of %s to %s: ", checksum, destination_name);
+              goto out;
+            }
+
+          need_copy = !did_hardlink;
+        }
     }
 
-  /* Fall back to copy if we couldn't hardlink */
+  /* Fall back to copy if we couldn't hardlink; @input may already be
+   * the uncompressed cache object from above.
+   */
   if (need_copy)
     {
-      if (!ostree_repo_load_file (repo, checksum, &input, NULL, &xattrs,
-                                  cancellable, error))
-        goto out;
+      if (input == NULL)
+        {
+          if (!ostree_repo_load_file (repo, checksum, &input,
+                                      source_info ? NULL : &loaded_info, &xattrs,
+                                      cancellable, error))
+            goto out;
+          if (!source_info)
+            source_info = loaded_info;
+        }
 
       if (options->overwrite_mode == OSTREE_REPO_CHECKOUT_OVERWRITE_UNION_FILES)
         {
@@ -605,37 +811,26 @@ checkout_one_file_at (OstreeRepo                        *repo,
   return ret;
 }
 
-/*
- * checkout_tree_at:
- * @self: Repo
- * @mode: Options controlling all files
- * @overwrite_mode: Whether or not to overwrite files
- * @destination_parent_fd: Place tree here
- * @destination_name: Use this name for tree
- * @source: Source tree
- * @source_info: Source info
- * @cancellable: Cancellable
- * @error: Error
- *
- * Like ostree_repo_checkout_tree(), but check out @source into the
- * relative @destination_name, located by @destination_parent_fd.
+/* Create the directory @destination_name with mode 0700, and apply
+ * the xattrs from @dirmeta; the final mode and ownership are only set
+ * by checkout_dir_finish() once all of the children are in place.
  */
 static gboolean
-checkout_tree_at (OstreeRepo                        *self,
-                  OstreeRepoCheckoutOptions         *options,
-                  int                                destination_parent_fd,
-                  const char                        *destination_name,
-                  OstreeRepoFile                    *source,
-                  GFileInfo                         *source_info,
-                  GCancellable                      *cancellable,
-                  GError                           **error)
+checkout_dir_begin (OstreeRepo                        *self,
+                    OstreeRepoCheckoutOptions         *options,
+                    int                                destination_parent_fd,
+                    const char                        *destination_name,
+                    GVariant                          *dirmeta,
+                    gboolean                          *out_did_exist,
+                    int                               *out_dfd,
+                    GCancellable                      *cancellable,
+                    GError                           **error)
 {
   gboolean ret = FALSE;
   gboolean did_exist = FALSE;
-  int destination_dfd = -1;
+  glnx_fd_close int destination_dfd = -1;
   int res;
   g_autoptr(GVariant) xattrs = NULL;
-  g_autoptr(GFileEnumerator) dir_enum = NULL;
 
   /* Create initially with mode 0700, then chown/chmod only when we're
    * done.  This avoids anyone else being able to operate on partially
@@ -662,65 +857,41 @@ checkout_tree_at (OstreeRepo                        *self,
   /* Set the xattrs now, so any derived labeling works */
   if (!did_exist && options->mode != OSTREE_REPO_CHECKOUT_MODE_USER)
     {
-      if (!ostree_repo_file_get_xattrs (source, &xattrs, NULL, error))
-        goto out;
+      /* PARSE OSTREE_OBJECT_TYPE_DIR_META */
+      xattrs = g_variant_get_child_value (dirmeta, 3);
 
-      if (xattrs)
+      if (g_variant_n_children (xattrs) > 0)
         {
           if (!glnx_fd_set_all_xattrs (destination_dfd, xattrs, cancellable, error))
             goto out;
         }
     }
 
-  if (g_file_info_get_file_type (source_info) != G_FILE_TYPE_DIRECTORY)
-    {
-      ret = checkout_one_file_at (self, options,
-                                  (GFile *) source,
-                                  source_info,
-                                  destination_dfd,
-                                  g_file_info_get_name (source_info),
-                                  cancellable, error);
-      goto out;
-    }
-  dir_enum = g_file_enumerate_children ((GFile*)source,
-                                        OSTREE_GIO_FAST_QUERYINFO, 
-                                        G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                                        cancellable, 
-                                        error);
-  if (!dir_enum)
-    goto out;
-
-  while (TRUE)
-    {
-      GFileInfo *file_info;
-      GFile *src_child;
-      const char *name;
-
-      if (!gs_file_enumerator_iterate (dir_enum, &file_info, &src_child,
-                                       cancellable, error))
-        goto out;
-      if (file_info == NULL)
-        break;
+  ret = TRUE;
+  *out_did_exist = did_exist;
+  *out_dfd = glnx_steal_fd (&destination_dfd);
+ out:
+  return ret;
+}
 
-      name = g_file_info_get_name (file_info);
+static gboolean
+checkout_dir_finish (OstreeRepo                        *self,
+                     OstreeRepoCheckoutOptions         *options,
+                     int                                destination_dfd,
+                     GVariant                          *dirmeta,
+                     gboolean                           did_exist,
+                     GCancellable                      *cancellable,
+                     GError                           **error)
+{
+  int res;
+  guint32 uid, gid, mode;
 
-      if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_DIRECTORY)
-        {
-          if (!checkout_tree_at (self, options,
-                                 destination_dfd, name,
-                                 (OstreeRepoFile*)src_child, file_info,
-                                 cancellable, error))
-            goto out;
-        }
-      else
-        {
-          if (!checkout_one_file_at (self, options,
-                                     src_child, file_info,
-                                     destination_dfd, name,
-                                     cancellable, error))
-            goto out;
-        }
-    }
+  /* PARSE OSTREE_OBJECT_TYPE_DIR_META */
+  g_variant_get (dirmeta, "(uuu@a(ayay))",
+                 &uid, &gid, &mode, NULL);
+  uid = GUINT32_FROM_BE (uid);
+  gid = GUINT32_FROM_BE (gid);
+  mode = GUINT32_FROM_BE (mode);
 
   /* We do fchmod/fchown last so that no one else could access the
    * partially created directory and change content we're laying out.
@@ -728,27 +899,24 @@ checkout_tree_at (OstreeRepo                        *self,
   if (!did_exist)
     {
       do
-        res = fchmod (destination_dfd,
-                      g_file_info_get_attribute_uint32 (source_info, "unix::mode"));
+        res = fchmod (destination_dfd, mode);
       while (G_UNLIKELY (res == -1 && errno == EINTR));
       if (G_UNLIKELY (res == -1))
         {
           glnx_set_error_from_errno (error);
-          goto out;
+          return FALSE;
         }
     }
 
   if (!did_exist && options->mode != OSTREE_REPO_CHECKOUT_MODE_USER)
     {
       do
-        res = fchown (destination_dfd,
-                      g_file_info_get_attribute_uint32 (source_info, "unix::uid"),
-                      g_file_info_get_attribute_uint32 (source_info, "unix::gid"));
+        res = fchown (destination_dfd, uid, gid);
       while (G_UNLIKELY (res == -1 && errno == EINTR));
       if (G_UNLIKELY (res == -1))
         {
           glnx_set_error_from_errno (error);
-          goto out;
+          return FALSE;
         }
     }
 
@@ -764,7 +932,7 @@ checkout_tree_at (OstreeRepo                        *self,
       if (G_UNLIKELY (res == -1))
         {
           glnx_set_error_from_errno (error);
-          goto out;
+          return FALSE;
         }
     }
 
@@ -773,118 +941,1011 @@ checkout_tree_at (OstreeRepo                        *self,
       if (fsync (destination_dfd) == -1)
         {
           glnx_set_error_from_errno (error);
-          goto out;
+          return FALSE;
         }
     }
 
-  ret = TRUE;
- out:
-  if (destination_dfd != -1)
-    (void) close (destination_dfd);
-  return ret;
+  return TRUE;
 }
 
-/**
- * ostree_repo_checkout_tree:
+/*
+ * checkout_single_file_at:
  * @self: Repo
- * @mode: Options controlling all files
- * @overwrite_mode: Whether or not to overwrite files
- * @destination: Place tree here
- * @source: Source tree
+ * @options: Options controlling all files
+ * @destination_parent_fd: Place tree here
+ * @destination_name: Use this name for tree
+ * @source: Source file
  * @source_info: Source info
  * @cancellable: Cancellable
  * @error: Error
  *
- * Check out @source into @destination, which must live on the
- * physical filesystem.  @source may be any subdirectory of a given
- * commit.  The @mode and @overwrite_mode allow control over how the
- * files are checked out.
+ * Check out the non-directory @source into a new directory
+ * @destination_name, located by @destination_parent_fd.
  */
-gboolean
-ostree_repo_checkout_tree (OstreeRepo               *self,
-                           OstreeRepoCheckoutMode    mode,
-                           OstreeRepoCheckoutOverwriteMode    overwrite_mode,
-                           GFile                    *destination,
-                           OstreeRepoFile           *source,
-                           GFileInfo                *source_info,
-                           GCancellable             *cancellable,
-                           GError                  **error)
+static gboolean
+checkout_single_file_at (OstreeRepo                        *self,
+                         OstreeRepoCheckoutOptions         *options,
+                         int                                destination_parent_fd,
+                         const char                        *destination_name,
+                         OstreeRepoFile                    *source,
+                         GFileInfo                         *source_info,
+                         GCancellable                      *cancellable,
+                         GError                           **error)
 {
-  OstreeRepoCheckoutOptions options = { 0, };
+  gboolean ret = FALSE;
+  gboolean did_exist = FALSE;
+  glnx_fd_close int destination_dfd = -1;
+  g_autoptr(GVariant) xattrs = NULL;
+  g_autoptr(GVariant) dirmeta = NULL;
 
-  options.mode = mode;
-  options.overwrite_mode = overwrite_mode;
-  /* Backwards compatibility */
-  options.enable_uncompressed_cache = TRUE;
+  if (!ostree_repo_file_get_xattrs (source, &xattrs, cancellable, error))
+    goto out;
 
-  return checkout_tree_at (self, &options,
-                           AT_FDCWD, gs_file_get_path_cached (destination),
-                           source, source_info,
-                           cancellable, error);
+  dirmeta = ostree_create_directory_metadata (source_info, xattrs);
+
+  if (!checkout_dir_begin (self, options, destination_parent_fd, destination_name,
+                           dirmeta, &did_exist, &destination_dfd,
+                           cancellable, error))
+    goto out;
+
+  if (!checkout_one_file_at (self, options,
+                             ostree_repo_file_get_checksum (source),
+                             source_info,
+                             destination_dfd,
+                             g_file_info_get_name (source_info),
+                             cancellable, error))
+    goto out;
+
+  /* The dirmeta only carries the file's xattrs; its mode and owner
+   * describe the file, not a directory, so the directory stays as
+   * created.
+   */
+  ret = TRUE;
+ out:
+  return ret;
 }
 
-/**
- * ostree_repo_checkout_tree_at:
+/*
+ * checkout_tree_at:
  * @self: Repo
- * @options: (allow-none): Options
- * @destination_dfd: Directory FD for destination
- * @destination_path: Directory for destination
- * @commit: Checksum for commit
+ * @options: Options controlling all files
+ * @destination_parent_fd: Place tree here
+ * @destination_name: Use this name for tree
+ * @contents_checksum: Checksum of the source dirtree
+ * @metadata_checksum: Checksum of the source dirmeta
  * @cancellable: Cancellable
  * @error: Error
  *
- * Similar to ostree_repo_checkout_tree(), but uses directory-relative
- * paths for the destination, uses a new `OstreeRepoCheckoutOptions`,
- * and takes a commit checksum and optional subpath pair, rather than
- * requiring use of `GFile` APIs for the caller.
+ * Like ostree_repo_checkout_tree(), but check out the directory
+ * described by @contents_checksum and @metadata_checksum into the
+ * relative @destination_name, located by @destination_parent_fd.
  *
- * Note in addition that unlike ostree_repo_checkout_tree(), the
- * default is not to use the repository-internal uncompressed objects
- * cache.
+ * This works directly on the dirtree and dirmeta variants rather
+ * than going through #OstreeRepoFile, so that walking the tree does
+ * not allocate a #GFile and #GFileInfo for every entry.
  */
-gboolean
-ostree_repo_checkout_tree_at (OstreeRepo                         *self,
-                              OstreeRepoCheckoutOptions         *options,
-                              int                                destination_dfd,
-                              const char                        *destination_path,
-                              const char                        *commit,
-                              GCancellable                      *cancellable,
-                              GError                           **error)
+static gboolean
+checkout_tree_at (OstreeRepo                        *self,
+                  OstreeRepoCheckoutOptions         *options,
+                  int                                destination_parent_fd,
+                  const char                        *destination_name,
+                  const char                        *contents_checksum,
+                  const char                        *metadata_checksum,
+                  GCancellable                      *cancellable,
+                  GError                           **error)
 {
   gboolean ret = FALSE;
-  g_autoptr(GFile) commit_root = NULL;
-  g_autoptr(GFile) target_dir = NULL;
-  g_autoptr(GFileInfo) target_info = NULL;
-  OstreeRepoCheckoutOptions default_options = { 0, };
+  gboolean did_exist = FALSE;
+  glnx_fd_close int destination_dfd = -1;
+  g_autoptr(GVariant) dirtree = NULL;
+  g_autoptr(GVariant) dirmeta = NULL;
+  g_autoptr(GVariant) files_variant = NULL;
+  g_autoptr(GVariant) dirs_variant = NULL;
+  guint i, n;
+
+  if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_DIR_META, metadata_checksum,
+                                 &dirmeta, error))
+    goto out;
 
-  if (!options)
-    {
-      default_options.subpath = NULL;
-      options = &default_options;
-    }
+  if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_DIR_TREE, contents_checksum,
+                                 &dirtree, error))
+    goto out;
 
-  commit_root = (GFile*) _ostree_repo_file_new_for_commit (self, commit, error);
-  if (!commit_root)
+  if (!checkout_dir_begin (self, options, destination_parent_fd, destination_name,
+                           dirmeta, &did_exist, &destination_dfd,
+                           cancellable, error))
     goto out;
 
-  if (!ostree_repo_file_ensure_resolved ((OstreeRepoFile*)commit_root, error))
+  /* PARSE OSTREE_OBJECT_TYPE_DIR_TREE */
+  files_variant = g_variant_get_child_value (dirtree, 0);
+  n = g_variant_n_children (files_variant);
+  for (i = 0; i < n; i++)
+    {
+      const char *name;
+      g_autoptr(GVariant) csum_v = NULL;
+      char checksum[65];
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        goto out;
+
+      g_variant_get_child (files_variant, i, "(&s@ay)", &name, &csum_v);
+      if (!ot_util_filename_validate (name, error))
+        goto out;
+      ostree_checksum_inplace_from_bytes (ostree_checksum_bytes_peek (csum_v), checksum);
+
+      if (!checkout_one_file_at (self, options, checksum, NULL,
+                                 destination_dfd, name,
+                                 cancellable, error))
+        goto out;
+    }
+
+  dirs_variant = g_variant_get_child_value (dirtree, 1);
+  n = g_variant_n_children (dirs_variant);
+  for (i = 0; i < n; i++)
+    {
+      const char *name;
+      g_autoptr(GVariant) contents_csum_v = NULL;
+      g_autoptr(GVariant) metadata_csum_v = NULL;
+      char subdir_contents_checksum[65];
+      char subdir_metadata_checksum[65];
+
+      g_variant_get_child (dirs_variant, i, "(&s@ay@ay)",
+                           &name, &contents_csum_v, &metadata_csum_v);
+      if (!ot_util_filename_validate (name, error))
+        goto out;
+      ostree_checksum_inplace_from_bytes (ostree_checksum_bytes_peek (contents_csum_v),
+                                          subdir_contents_checksum);
+      ostree_checksum_inplace_from_bytes (ostree_checksum_bytes_peek (metadata_csum_v),
+                                          subdir_metadata_checksum);
+
+      if (!checkout_tree_at (self, options,
+                             destination_dfd, name,
+                             subdir_contents_checksum, subdir_metadata_checksum,
+                             cancellable, error))
+        goto out;
+    }
+
+  if (!checkout_dir_finish (self, options, destination_dfd, dirmeta, did_exist,
+                            cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/* Parallel checkout.  Each directory is a task on a GThreadPool; a
+ * task creates its directory, checks out the non-directory entries
+ * itself and queues a new task for each subdirectory.  A directory is
+ * finalized (mode, ownership, mtime, fsync) by whichever thread drops
+ * the last reference to it, which is only after all of its
+ * subdirectories have been finalized.  Directories are addressed by
+ * their path relative to the parent fd so that we only hold open
+ * descriptors for directories actively being worked on.
+ */
+typedef struct CheckoutDirTask CheckoutDirTask;
+
+typedef struct {
+  OstreeRepo *repo;
+  OstreeRepoCheckoutOptions *options;
+  int destination_parent_fd;
+  GCancellable *cancellable;
+  GThreadPool *pool;
+
+  GMutex lock;
+  GCond cond;
+  gboolean done;
+  GError *error;
+} ParallelCheckout;
+
+struct CheckoutDirTask {
+  ParallelCheckout *checkout;
+  CheckoutDirTask *parent;
+  char *path;
+  char contents_checksum[65];
+  char metadata_checksum[65];
+  GVariant *dirmeta;
+  gboolean did_exist;
+
+  /* One for the task itself, plus one per unfinished subdirectory */
+  volatile gint pending;
+};
+
+static CheckoutDirTask *
+checkout_dir_task_new (ParallelCheckout  *checkout,
+                       CheckoutDirTask   *parent,
+                       char              *path,
+                       const char        *contents_checksum,
+                       const char        *metadata_checksum)
+{
+  CheckoutDirTask *task = g_new0 (CheckoutDirTask, 1);
+
+  task->checkout = checkout;
+  task->parent = parent;
+  task->path = path;
+  memcpy (task->contents_checksum, contents_checksum, 65);
+  memcpy (task->metadata_checksum, metadata_checksum, 65);
+  task->pending = 1;
+  if (parent)
+    g_atomic_int_inc (&parent->pending);
+  return task;
+}
+
+static void
+checkout_dir_task_free (CheckoutDirTask *task)
+{
+  g_free (task->path);
+  if (task->dirmeta)
+    g_variant_unref (task->dirmeta);
+  g_free (task);
+}
+
+static gboolean
+parallel_checkout_failed (ParallelCheckout *checkout)
+{
+  gboolean failed;
+
+  g_mutex_lock (&checkout->lock);
+  failed = checkout->error != NULL;
+  g_mutex_unlock (&checkout->lock);
+
+  return failed || g_cancellable_is_cancelled (checkout->cancellable);
+}
+
+static void
+parallel_checkout_take_error (ParallelCheckout *checkout,
+                              GError           *error)
+{
+  g_mutex_lock (&checkout->lock);
+  if (checkout->error == NULL)
+    checkout->error = error;
+  else
+    g_error_free (error);
+  g_mutex_unlock (&checkout->lock);
+}
+
+static void
+checkout_dir_task_unref (CheckoutDirTask *task)
+{
+  while (task && g_atomic_int_dec_and_test (&task->pending))
+    {
+      ParallelCheckout *checkout = task->checkout;
+      CheckoutDirTask *parent = task->parent;
+
+      if (!parallel_checkout_failed (checkout))
+        {
+          glnx_fd_close int dfd = -1;
+          GError *local_error = NULL;
+
+          if (!glnx_opendirat (checkout->destination_parent_fd, task->path, TRUE,
+                               &dfd, &local_error) ||
+              !checkout_dir_finish (checkout->repo, checkout->options, dfd,
+                                    task->dirmeta, task->did_exist,
+                                    checkout->cancellable, &local_error))
+            parallel_checkout_take_error (checkout, local_error);
+        }
+
+      if (parent == NULL)
+        {
+          g_mutex_lock (&checkout->lock);
+          checkout->done = TRUE;
+          g_cond_signal (&checkout->cond);
+          g_mutex_unlock (&checkout->lock);
+        }
+
+      checkout_dir_task_free (task);
+      task = parent;
+    }
+}
+
+static gboolean
+checkout_dir_task_populate (CheckoutDirTask  *task,
+                            GError          **error)
+{
+  gboolean ret = FALSE;
+  ParallelCheckout *checkout = task->checkout;
+  glnx_fd_close int destination_dfd = -1;
+  g_autoptr(GVariant) dirtree = NULL;
+  g_autoptr(GVariant) files_variant = NULL;
+  g_autoptr(GVariant) dirs_variant = NULL;
+  guint i, n;
+
+  if (!ostree_repo_load_variant (checkout->repo, OSTREE_OBJECT_TYPE_DIR_META,
+                                 task->metadata_checksum, &task->dirmeta, error))
+    goto out;
+
+  if (!ostree_repo_load_variant (checkout->repo, OSTREE_OBJECT_TYPE_DIR_TREE,
+                                 task->contents_checksum, &dirtree, error))
+    goto out;
+
+  if (!checkout_dir_begin (checkout->repo, checkout->options,
+                           checkout->destination_parent_fd, task->path,
+                           task->dirmeta, &task->did_exist, &destination_dfd,
+                           checkout->cancellable, error))
     goto out;
 
-  if (options->subpath && strcmp (options->subpath, "/") != 0)
-    target_dir = g_file_get_child (commit_root, options->subpath);
+  /* Queue the subdirectories first, so other threads can get started
+   * on them while we check out our own files.
+   */
+
+  /* PARSE OSTREE_OBJECT_TYPE_DIR_TREE */
+  dirs_variant = g_variant_get_child_value (dirtree, 1);
+  n = g_variant_n_children (dirs_variant);
+  for (i = 0; i < n; i++)
+    {
+      const char *name;
+      g_autoptr(GVariant) contents_csum_v = NULL;
+      g_autoptr(GVariant) metadata_csum_v = NULL;
+      char subdir_contents_checksum[65];
+      char subdir_metadata_checksum[65];
+      CheckoutDirTask *child;
+
+      g_variant_get_child (dirs_variant, i, "(&s@ay@ay)",
+                           &name, &contents_csum_v, &metadata_csum_v);
+      if (!ot_util_filename_validate (name, error))
+        goto out;
+      ostree_checksum_inplace_from_bytes (ostree_checksum_bytes_peek (contents_csum_v),
+                                          subdir_contents_checksum);
+      ostree_checksum_inplace_from_bytes (ostree_checksum_bytes_peek (metadata_csum_v),
+                                          subdir_metadata_checksum);
+
+      child = checkout_dir_task_new (checkout, task,
+                                     g_build_filename (task->path, name, NULL),
+                                     subdir_contents_checksum,
+                                     subdir_metadata_checksum);
+      g_thread_pool_push (checkout->pool, child, NULL);
+    }
+
+  files_variant = g_variant_get_child_value (dirtree, 0);
+  n = g_variant_n_children (files_variant);
+  for (i = 0; i < n; i++)
+    {
+      const char *name;
+      g_autoptr(GVariant) csum_v = NULL;
+      char checksum[65];
+
+      if (parallel_checkout_failed (checkout))
+        break;
+
+      g_variant_get_child (files_variant, i, "(&s@ay)", &name, &csum_v);
+      if (!ot_util_filename_validate (name, error))
+        goto out;
+      ostree_checksum_inplace_from_bytes (ostree_checksum_bytes_peek (csum_v), checksum);
+
+      if (!checkout_one_file_at (checkout->repo, checkout->options,
+                                 checksum, NULL,
+                                 destination_dfd, name,
+                                 checkout->cancellable, error))
+        goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static void
+checkout_dir_task_run (gpointer data,
+                       gpointer user_data)
+{
+  CheckoutDirTask *task = data;
+  ParallelCheckout *checkout = user_data;
+  GError *local_error = NULL;
+
+  if (!parallel_checkout_failed (checkout) &&
+      !checkout_dir_task_populate (task, &local_error))
+    parallel_checkout_take_error (checkout, local_error);
+
+  checkout_dir_task_unref (task);
+}
+
+static gboolean
+checkout_tree_at_parallel (OstreeRepo                        *self,
+                           OstreeRepoCheckoutOptions         *options,
+                           int                                destination_parent_fd,
+                           const char                        *destination_name,
+                           const char                        *contents_checksum,
+                           const char                        *metadata_checksum,
+                           GCancellable                      *cancellable,
+                           GError                           **error)
+{
+  gboolean ret = FALSE;
+  ParallelCheckout checkout = { 0, };
+
+  checkout.repo = self;
+  checkout.options = options;
+  checkout.destination_parent_fd = destination_parent_fd;
+  checkout.cancellable = cancellable;
+  g_mutex_init (&checkout.lock);
+  g_cond_init (&checkout.cond);
+
+  checkout.pool = g_thread_pool_new (checkout_dir_task_run, &checkout,
+                                     options->parallelism, FALSE, error);
+  if (!checkout.pool)
+    goto out;
+
+  g_thread_pool_push (checkout.pool,
+                      checkout_dir_task_new (&checkout, NULL, g_strdup (destination_name),
+                                             contents_checksum, metadata_checksum),
+                      NULL);
+
+  g_mutex_lock (&checkout.lock);
+  while (!checkout.done)
+    g_cond_wait (&checkout.cond, &checkout.lock);
+  g_mutex_unlock (&checkout.lock);
+
+  /* All tasks have completed, but the threads may still be exiting */
+  g_thread_pool_free (checkout.pool, FALSE, TRUE);
+
+  if (checkout.error)
+    {
+      g_propagate_error (error, checkout.error);
+      goto out;
+    }
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  g_mutex_clear (&checkout.lock);
+  g_cond_clear (&checkout.cond);
+  return ret;
+}
+
+/*
+ * Check out @source, which may be a directory or a single file, using
+ * the parallel engine if requested by @options.
+ */
+static gboolean
+checkout_source_at (OstreeRepo                        *self,
+                    OstreeRepoCheckoutOptions         *options,
+                    int                                destination_parent_fd,
+                    const char                        *destination_name,
+                    OstreeRepoFile                    *source,
+                    GFileInfo                         *source_info,
+                    GCancellable                      *cancellable,
+                    GError                           **error)
+{
+  const char *contents_checksum;
+  const char *metadata_checksum;
+
+  if (g_file_info_get_file_type (source_info) != G_FILE_TYPE_DIRECTORY)
+    return checkout_single_file_at (self, options,
+                                    destination_parent_fd, destination_name,
+                                    source, source_info,
+                                    cancellable, error);
+
+  if (!ostree_repo_file_ensure_resolved (source, error))
+    return FALSE;
+
+  contents_checksum = ostree_repo_file_tree_get_contents_checksum (source);
+  metadata_checksum = ostree_repo_file_tree_get_metadata_checksum (source);
+
+  if (options->parallelism > 1)
+    return checkout_tree_at_parallel (self, options,
+                                      destination_parent_fd, destination_name,
+                                      contents_checksum, metadata_checksum,
+                                      cancellable, error);
+  else
+    return checkout_tree_at (self, options,
+                             destination_parent_fd, destination_name,
+                             contents_checksum, metadata_checksum,
+                             cancellable, error);
+}
+
+/**
+ * ostree_repo_checkout_tree:
+ * @self: Repo
+ * @mode: Options controlling all files
+ * @overwrite_mode: Whether or not to overwrite files
+ * @destination: Place tree here
+ * @source: Source tree
+ * @source_info: Source info
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Check out @source into @destination, which must live on the
+ * physical filesystem.  @source may be any subdirectory of a given
+ * commit.  The @mode and @overwrite_mode allow control over how the
+ * files are checked out.
+ */
+gboolean
+ostree_repo_checkout_tree (OstreeRepo               *self,
+                           OstreeRepoCheckoutMode    mode,
+                           OstreeRepoCheckoutOverwriteMode    overwrite_mode,
+                           GFile                    *destination,
+                           OstreeRepoFile           *source,
+                           GFileInfo                *source_info,
+                           GCancellable             *cancellable,
+                           GError                  **error)
+{
+  OstreeRepoCheckoutOptions options = { 0, };
+
+  options.mode = mode;
+  options.overwrite_mode = overwrite_mode;
+  /* Backwards compatibility */
+  options.enable_uncompressed_cache = TRUE;
+
+  return checkout_source_at (self, &options,
+                             AT_FDCWD, gs_file_get_path_cached (destination),
+                             source, source_info,
+                             cancellable, error);
+}
+
+/* Find the file or directory to check out for @commit and @subpath */
+static gboolean
+resolve_checkout_target (OstreeRepo     *self,
+                         const char     *commit,
+                         const char     *subpath,
+                         GFile         **out_target,
+                         GFileInfo     **out_target_info,
+                         GCancellable   *cancellable,
+                         GError        **error)
+{
+  g_autoptr(GFile) commit_root = NULL;
+  g_autoptr(GFile) target = NULL;
+  g_autoptr(GFileInfo) target_info = NULL;
+
+  commit_root = (GFile*) _ostree_repo_file_new_for_commit (self, commit, error);
+  if (!commit_root)
+    return FALSE;
+
+  if (!ostree_repo_file_ensure_resolved ((OstreeRepoFile*)commit_root, error))
+    return FALSE;
+
+  if (subpath && strcmp (subpath, "/") != 0)
+    target = g_file_get_child (commit_root, subpath);
   else
-    target_dir = g_object_ref (commit_root);
-  target_info = g_file_query_info (target_dir, OSTREE_GIO_FAST_QUERYINFO,
+    target = g_object_ref (commit_root);
+  target_info = g_file_query_info (target, OSTREE_GIO_FAST_QUERYINFO,
                                    G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
                                    cancellable, error);
   if (!target_info)
+    return FALSE;
+
+  *out_target = g_steal_pointer (&target);
+  *out_target_info = g_steal_pointer (&target_info);
+  return TRUE;
+}
+
+/**
+ * ostree_repo_checkout_tree_at:
+ * @self: Repo
+ * @options: (allow-none): Options
+ * @destination_dfd: Directory FD for destination
+ * @destination_path: Directory for destination
+ * @commit: Checksum for commit
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Similar to ostree_repo_checkout_tree(), but uses directory-relative
+ * paths for the destination, uses a new `OstreeRepoCheckoutOptions`,
+ * and takes a commit checksum and optional subpath pair, rather than
+ * requiring use of `GFile` APIs for the caller.
+ *
+ * Note in addition that unlike ostree_repo_checkout_tree(), the
+ * default is not to use the repository-internal uncompressed objects
+ * cache.
+ *
+ * If @options has a parallelism greater than one, subdirectories are
+ * checked out concurrently by that many threads.
+ */
+gboolean
+ostree_repo_checkout_tree_at (OstreeRepo                         *self,
+                              OstreeRepoCheckoutOptions         *options,
+                              int                                destination_dfd,
+                              const char                        *destination_path,
+                              const char                        *commit,
+                              GCancellable                      *cancellable,
+                              GError                           **error)
+{
+  gboolean ret = FALSE;
+  g_autoptr(GFile) target_dir = NULL;
+  g_autoptr(GFileInfo) target_info = NULL;
+  OstreeRepoCheckoutOptions default_options = { 0, };
+
+  if (!options)
+    {
+      default_options.subpath = NULL;
+      options = &default_options;
+    }
+
+  if (!resolve_checkout_target (self, commit, options->subpath,
+                                &target_dir, &target_info,
+                                cancellable, error))
     goto out;
 
-  if (!checkout_tree_at (self, options,
-                         destination_dfd,
-                         destination_path,
-                         (OstreeRepoFile*)target_dir, target_info,
-                         cancellable, error))
+  if (!checkout_source_at (self, options,
+                           destination_dfd, destination_path,
+                           (OstreeRepoFile*)target_dir, target_info,
+                           cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/* Map the name of each entry in @entries, the files or directories
+ * array of a dirtree, to its index plus one.  The names are borrowed
+ * from @entries.
+ */
+static GHashTable *
+dirtree_index_names (GVariant *entries)
+{
+  GHashTable *ret = g_hash_table_new (g_str_hash, g_str_equal);
+  guint i, n;
+
+  n = g_variant_n_children (entries);
+  for (i = 0; i < n; i++)
+    {
+      g_autoptr(GVariant) entry = g_variant_get_child_value (entries, i);
+      const char *name;
+
+      g_variant_get_child (entry, 0, "&s", &name);
+      g_hash_table_insert (ret, (char*)name, GUINT_TO_POINTER (i + 1));
+    }
+
+  return ret;
+}
+
+static const guchar *
+dirtree_peek_checksum (GVariant  *entries,
+                       guint      i,
+                       guint      child)
+{
+  g_autoptr(GVariant) entry = g_variant_get_child_value (entries, i);
+  g_autoptr(GVariant) csum_v = g_variant_get_child_value (entry, child);
+
+  /* Like the names, this points into the serialized dirtree */
+  return ostree_checksum_bytes_peek (csum_v);
+}
+
+/* Make @xattrs the complete set of extended attributes on @fd;
+ * glnx_fd_set_all_xattrs() only adds and overwrites, which would leave
+ * attributes the old dirmeta had and the new one dropped.
+ */
+static gboolean
+fd_replace_all_xattrs (int            fd,
+                       GVariant      *xattrs,
+                       GCancellable  *cancellable,
+                       GError       **error)
+{
+  g_autoptr(GVariant) old_xattrs = NULL;
+  g_autoptr(GHashTable) new_names = g_hash_table_new (g_str_hash, g_str_equal);
+  guint i, n;
+
+  if (!glnx_fd_get_all_xattrs (fd, &old_xattrs, cancellable, error))
+    return FALSE;
+
+  n = g_variant_n_children (xattrs);
+  for (i = 0; i < n; i++)
+    {
+      const char *name;
+
+      g_variant_get_child (xattrs, i, "(^&ay@ay)", &name, NULL);
+      g_hash_table_add (new_names, (char*)name);
+    }
+
+  n = g_variant_n_children (old_xattrs);
+  for (i = 0; i < n; i++)
+    {
+      const char *name;
+
+      g_variant_get_child (old_xattrs, i, "(^&ay@ay)", &name, NULL);
+      if (g_hash_table_contains (new_names, name))
+        continue;
+
+      if (fremovexattr (fd, name) < 0 && errno != ENODATA)
+        {
+          glnx_set_error_from_errno (error);
+          g_prefix_error (error, "Removing xattr %s: ", name);
+          return FALSE;
+        }
+    }
+
+  return glnx_fd_set_all_xattrs (fd, xattrs, cancellable, error);
+}
+
+/*
+ * checkout_tree_update_at:
+ *
+ * Update the existing checkout @destination_name of the directory
+ * @old_contents_checksum/@old_metadata_checksum to be a checkout of
+ * @new_contents_checksum/@new_metadata_checksum.  Subdirectories
+ * whose dirtree and dirmeta are unchanged are skipped entirely; only
+ * entries which differ are removed, replaced or added.
+ */
+static gboolean
+checkout_tree_update_at (OstreeRepo                        *self,
+                         OstreeRepoCheckoutOptions         *options,
+                         int                                destination_parent_fd,
+                         const char                        *destination_name,
+                         const char                        *old_contents_checksum,
+                         const char                        *old_metadata_checksum,
+                         const char                        *new_contents_checksum,
+                         const char                        *new_metadata_checksum,
+                         GCancellable                      *cancellable,
+                         GError                           **error)
+{
+  gboolean ret = FALSE;
+  glnx_fd_close int destination_dfd = -1;
+  g_autoptr(GVariant) old_dirtree = NULL;
+  g_autoptr(GVariant) new_dirtree = NULL;
+  g_autoptr(GVariant) new_dirmeta = NULL;
+  g_autoptr(GVariant) old_files = NULL;
+  g_autoptr(GVariant) old_dirs = NULL;
+  g_autoptr(GVariant) new_files = NULL;
+  g_autoptr(GVariant) new_dirs = NULL;
+  g_autoptr(GHashTable) old_file_names = NULL;
+  g_autoptr(GHashTable) old_dir_names = NULL;
+  g_autoptr(GHashTable) new_file_names = NULL;
+  g_autoptr(GHashTable) new_dir_names = NULL;
+  guint i, n;
+
+  if (strcmp (old_contents_checksum, new_contents_checksum) == 0 &&
+      strcmp (old_metadata_checksum, new_metadata_checksum) == 0)
+    {
+      ret = TRUE;
+      goto out;
+    }
+
+  if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_DIR_TREE, old_contents_checksum,
+                                 &old_dirtree, error))
+    goto out;
+  if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_DIR_TREE, new_contents_checksum,
+                                 &new_dirtree, error))
+    goto out;
+  if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_DIR_META, new_metadata_checksum,
+                                 &new_dirmeta, error))
+    goto out;
+
+  if (!glnx_opendirat (destination_parent_fd, destination_name, TRUE,
+                       &destination_dfd, error))
+    goto out;
+
+  /* PARSE OSTREE_OBJECT_TYPE_DIR_TREE */
+  old_files = g_variant_get_child_value (old_dirtree, 0);
+  old_dirs = g_variant_get_child_value (old_dirtree, 1);
+  new_files = g_variant_get_child_value (new_dirtree, 0);
+  new_dirs = g_variant_get_child_value (new_dirtree, 1);
+  old_file_names = dirtree_index_names (old_files);
+  old_dir_names = dirtree_index_names (old_dirs);
+  new_file_names = dirtree_index_names (new_files);
+  new_dir_names = dirtree_index_names (new_dirs);
+
+  /* Like checkout_dir_begin(), keep the directory private while we
+   * change it; checkout_dir_finish() sets the final mode.
+   */
+  if (TEMP_FAILURE_RETRY (fchmod (destination_dfd, 0700)) != 0)
+    {
+      glnx_set_error_from_errno (error);
+      goto out;
+    }
+
+  /* First remove everything which is gone or changed, so that e.g. a
+   * file replaced by a directory of the same name works.
+   */
+  n = g_variant_n_children (old_files);
+  for (i = 0; i < n; i++)
+    {
+      g_autoptr(GVariant) entry = g_variant_get_child_value (old_files, i);
+      const char *name;
+      guint new_i;
+
+      g_variant_get_child (entry, 0, "&s", &name);
+      new_i = GPOINTER_TO_UINT (g_hash_table_lookup (new_file_names, name));
+      if (new_i > 0 &&
+          memcmp (dirtree_peek_checksum (old_files, i, 1),
+                  dirtree_peek_checksum (new_files, new_i - 1, 1),
+                  OSTREE_SHA256_DIGEST_LEN) == 0)
+        continue;
+
+      if (!ot_util_filename_validate (name, error))
+        goto out;
+      if (unlinkat (destination_dfd, name, 0) != 0 && errno != ENOENT)
+        {
+          glnx_set_error_from_errno (error);
+          goto out;
+        }
+    }
+
+  n = g_variant_n_children (old_dirs);
+  for (i = 0; i < n; i++)
+    {
+      g_autoptr(GVariant) entry = g_variant_get_child_value (old_dirs, i);
+      const char *name;
+
+      g_variant_get_child (entry, 0, "&s", &name);
+      if (g_hash_table_contains (new_dir_names, name))
+        continue;
+
+      if (!ot_util_filename_validate (name, error))
+        goto out;
+      if (!glnx_shutil_rm_rf_at (destination_dfd, name, cancellable, error))
+        goto out;
+    }
+
+  /* Now add the new and changed files */
+  n = g_variant_n_children (new_files);
+  for (i = 0; i < n; i++)
+    {
+      const char *name;
+      g_autoptr(GVariant) csum_v = NULL;
+      char checksum[65];
+      guint old_i;
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        goto out;
+
+      g_variant_get_child (new_files, i, "(&s@ay)", &name, &csum_v);
+      old_i = GPOINTER_TO_UINT (g_hash_table_lookup (old_file_names, name));
+      if (old_i > 0 &&
+          memcmp (dirtree_peek_checksum (old_files, old_i - 1, 1),
+                  ostree_checksum_bytes_peek (csum_v),
+                  OSTREE_SHA256_DIGEST_LEN) == 0)
+        continue;
+
+      if (!ot_util_filename_validate (name, error))
+        goto out;
+      ostree_checksum_inplace_from_bytes (ostree_checksum_bytes_peek (csum_v), checksum);
+
+      if (!checkout_one_file_at (self, options, checksum, NULL,
+                                 destination_dfd, name,
+                                 cancellable, error))
+        goto out;
+    }
+
+  /* And recurse into directories, which are either updated or new */
+  n = g_variant_n_children (new_dirs);
+  for (i = 0; i < n; i++)
+    {
+      const char *name;
+      g_autoptr(GVariant) contents_csum_v = NULL;
+      g_autoptr(GVariant) metadata_csum_v = NULL;
+      char subdir_contents_checksum[65];
+      char subdir_metadata_checksum[65];
+      guint old_i;
+
+      g_variant_get_child (new_dirs, i, "(&s@ay@ay)",
+                           &name, &contents_csum_v, &metadata_csum_v);
+      if (!ot_util_filename_validate (name, error))
+        goto out;
+      ostree_checksum_inplace_from_bytes (ostree_checksum_bytes_peek (contents_csum_v),
+                                          subdir_contents_checksum);
+      ostree_checksum_inplace_from_bytes (ostree_checksum_bytes_peek (metadata_csum_v),
+                                          subdir_metadata_checksum);
+
+      old_i = GPOINTER_TO_UINT (g_hash_table_lookup (old_dir_names, name));
+      if (old_i > 0)
+        {
+          char old_subdir_contents_checksum[65];
+          char old_subdir_metadata_checksum[65];
+
+          ostree_checksum_inplace_from_bytes (dirtree_peek_checksum (old_dirs, old_i - 1, 1),
+                                              old_subdir_contents_checksum);
+          ostree_checksum_inplace_from_bytes (dirtree_peek_checksum (old_dirs, old_i - 1, 2),
+                                              old_subdir_metadata_checksum);
+
+          if (!checkout_tree_update_at (self, options, destination_dfd, name,
+                                        old_subdir_contents_checksum,
+                                        old_subdir_metadata_checksum,
+                                        subdir_contents_checksum,
+                                        subdir_metadata_checksum,
+                                        cancellable, error))
+            goto out;
+        }
+      else
+        {
+          if (!checkout_tree_at (self, options, destination_dfd, name,
+                                 subdir_contents_checksum, subdir_metadata_checksum,
+                                 cancellable, error))
+            goto out;
+        }
+    }
+
+  if (strcmp (old_metadata_checksum, new_metadata_checksum) != 0 &&
+      options->mode != OSTREE_REPO_CHECKOUT_MODE_USER)
+    {
+      g_autoptr(GVariant) xattrs = g_variant_get_child_value (new_dirmeta, 3);
+
+      if (!fd_replace_all_xattrs (destination_dfd, xattrs, cancellable, error))
+        goto out;
+    }
+
+  /* Reset mode, ownership and the mtime we just changed */
+  if (!checkout_dir_finish (self, options, destination_dfd, new_dirmeta, FALSE,
+                            cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/**
+ * ostree_repo_checkout_tree_update_at:
+ * @self: Repo
+ * @options: (allow-none): Options
+ * @destination_dfd: Directory FD for destination
+ * @destination_path: Directory for destination
+ * @from_commit: Checksum of the commit currently checked out at @destination_path
+ * @commit: Checksum for commit
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Update @destination_path, which must be an unmodified checkout of
+ * @from_commit made with the same @options, to be a checkout of
+ * @commit.  This is equivalent to deleting it and calling
+ * ostree_repo_checkout_tree_at(), but directories whose content is
+ * identical in both commits are skipped without being traversed, and
+ * only changed entries are removed, replaced or added.
+ *
+ * The update happens in place and is not atomic; if it fails,
+ * @destination_path should be deleted and checked out again.
+ */
+gboolean
+ostree_repo_checkout_tree_update_at (OstreeRepo                        *self,
+                                     OstreeRepoCheckoutOptions         *options,
+                                     int                                destination_dfd,
+                                     const char                        *destination_path,
+                                     const char                        *from_commit,
+                                     const char                        *commit,
+                                     GCancellable                      *cancellable,
+                                     GError                           **error)
+{
+  gboolean ret = FALSE;
+  g_autoptr(GFile) old_target = NULL;
+  g_autoptr(GFileInfo) old_target_info = NULL;
+  g_autoptr(GFile) new_target = NULL;
+  g_autoptr(GFileInfo) new_target_info = NULL;
+  OstreeRepoFile *old_dir;
+  OstreeRepoFile *new_dir;
+  OstreeRepoCheckoutOptions default_options = { 0, };
+
+  if (!options)
+    options = &default_options;
+
+  if (options->process_whiteouts)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                   "Whiteouts are not supported when updating a checkout");
+      goto out;
+    }
+
+  if (!resolve_checkout_target (self, from_commit, options->subpath,
+                                &old_target, &old_target_info,
+                                cancellable, error))
+    goto out;
+  if (!resolve_checkout_target (self, commit, options->subpath,
+                                &new_target, &new_target_info,
+                                cancellable, error))
+    goto out;
+
+  /* A single file can't be updated in place; just check it out again */
+  if (g_file_info_get_file_type (old_target_info) != G_FILE_TYPE_DIRECTORY ||
+      g_file_info_get_file_type (new_target_info) != G_FILE_TYPE_DIRECTORY)
+    {
+      if (!glnx_shutil_rm_rf_at (destination_dfd, destination_path, cancellable, error))
+        goto out;
+      if (!checkout_source_at (self, options,
+                               destination_dfd, destination_path,
+                               (OstreeRepoFile*)new_target, new_target_info,
+                               cancellable, error))
+        goto out;
+      ret = TRUE;
+      goto out;
+    }
+
+  old_dir = (OstreeRepoFile*)old_target;
+  new_dir = (OstreeRepoFile*)new_target;
+  if (!checkout_tree_update_at (self, options,
+                                destination_dfd, destination_path,
+                                ostree_repo_file_tree_get_contents_checksum (old_dir),
+                                ostree_repo_file_tree_get_metadata_checksum (old_dir),
+                                ostree_repo_file_tree_get_contents_checksum (new_dir),
+                                ostree_repo_file_tree_get_metadata_checksum (new_dir),
+                                cancellable, error))
     goto out;
 
   ret = TRUE;
@@ -928,6 +1989,342 @@ ostree_repo_devino_cache_new (void)
   return (OstreeRepoDevInoCache*) g_hash_table_new_full (devino_hash, devino_equal, g_free, NULL);
 }
 
+typedef struct {
+  char checksum[65];
+  guint64 size;
+  guint64 last_used;
+} UncompressedCacheEntry;
+
+/* Build an index for a cache which predates it (or whose index was
+ * lost); everything in it is considered least recently used.
+ */
+static gboolean
+uncompressed_cache_scan (OstreeRepo    *self,
+                         GHashTable    *entries,
+                         GCancellable  *cancellable,
+                         GError       **error)
+{
+  guint i;
+
+  for (i = 0; i < 256; i++)
+    {
+      char objdir_name[3];
+      g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+      glnx_fd_close int objdir_fd = -1;
+
+      g_snprintf (objdir_name, sizeof (objdir_name), "%02x", i);
+
+      if (!ot_openat_ignore_enoent (self->uncompressed_objects_dir_fd, objdir_name,
+                                    &objdir_fd, error))
+        return FALSE;
+      if (objdir_fd == -1)
+        continue;
+
+      if (!glnx_dirfd_iterator_init_take_fd (glnx_steal_fd (&objdir_fd), &dfd_iter, error))
+        return FALSE;
+
+      while (TRUE)
+        {
+          struct dirent *dent;
+          struct stat stbuf;
+          UncompressedCacheEntry *entry;
+
+          if (!glnx_dirfd_iterator_next_dent (&dfd_iter, &dent, cancellable, error))
+            return FALSE;
+          if (dent == NULL)
+            break;
+
+          if (strlen (dent->d_name) != 62 + strlen (".file") ||
+              !g_str_has_suffix (dent->d_name, ".file"))
+            continue;
+
+          if (fstatat (dfd_iter.fd, dent->d_name, &stbuf, AT_SYMLINK_NOFOLLOW) != 0)
+            {
+              if (errno == ENOENT)
+                continue;
+              glnx_set_error_from_errno (error);
+              return FALSE;
+            }
+
+          entry = g_new0 (UncompressedCacheEntry, 1);
+          memcpy (entry->checksum, objdir_name, 2);
+          memcpy (entry->checksum + 2, dent->d_name, 62);
+          entry->size = stbuf.st_size;
+          g_hash_table_replace (entries, entry->checksum, entry);
+        }
+    }
+
+  return TRUE;
+}
+
+static gboolean
+uncompressed_cache_load_index (OstreeRepo    *self,
+                               guint64       *out_hits,
+                               guint64       *out_misses,
+                               GHashTable   **out_entries,
+                               gboolean      *out_found,
+                               GCancellable  *cancellable,
+                               GError       **error)
+{
+  glnx_fd_close int fd = -1;
+  g_autoptr(GVariant) index = NULL;
+  g_autoptr(GVariant) entries_v = NULL;
+  g_autoptr(GHashTable) entries = NULL;
+  guint64 hits = 0;
+  guint64 misses = 0;
+  guint i, n;
+
+  entries = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_free);
+
+  if (!ot_openat_ignore_enoent (self->uncompressed_objects_dir_fd, "index", &fd, error))
+    return FALSE;
+
+  if (fd != -1)
+    {
+      if (!ot_util_variant_map_fd (fd, 0, G_VARIANT_TYPE (_OSTREE_UNCOMPRESSED_CACHE_INDEX_FORMAT),
+                                   FALSE, &index, error))
+        return FALSE;
+
+      g_variant_get (index, "(tt@a(aytt))", &hits, &misses, &entries_v);
+      n = g_variant_n_children (entries_v);
+      for (i = 0; i < n; i++)
+        {
+          g_autoptr(GVariant) csum_v = NULL;
+          const guchar *csum;
+          UncompressedCacheEntry *entry;
+          guint64 size, last_used;
+
+          g_variant_get_child (entries_v, i, "(@aytt)", &csum_v, &size, &last_used);
+          csum = ostree_checksum_bytes_peek (csum_v);
+          if (csum == NULL)
+            continue;
+
+          entry = g_new0 (UncompressedCacheEntry, 1);
+          ostree_checksum_inplace_from_bytes (csum, entry->checksum);
+          entry->size = size;
+          entry->last_used = last_used;
+          g_hash_table_replace (entries, entry->checksum, entry);
+        }
+    }
+
+  *out_hits = hits;
+  *out_misses = misses;
+  *out_entries = g_steal_pointer (&entries);
+  *out_found = fd != -1;
+  return TRUE;
+}
+
+static int
+compare_entries_by_last_use (gconstpointer a,
+                             gconstpointer b)
+{
+  const UncompressedCacheEntry *entry_a = *((UncompressedCacheEntry**)a);
+  const UncompressedCacheEntry *entry_b = *((UncompressedCacheEntry**)b);
+
+  if (entry_a->last_used < entry_b->last_used)
+    return -1;
+  else if (entry_a->last_used > entry_b->last_used)
+    return 1;
+  return 0;
+}
+
+/* Merge the objects used by this process into the cache index, then
+ * evict the least recently used objects until the cache fits in
+ * core/uncompressed-cache-max-size.  The index is only modified while
+ * holding index.lock, so concurrent checkouts from other processes
+ * simply merge their usage one after another.
+ */
+static gboolean
+uncompressed_cache_update_index (OstreeRepo    *self,
+                                 GCancellable  *cancellable,
+                                 GError       **error)
+{
+  gboolean ret = FALSE;
+  g_auto(GLnxLockFile) lock = GLNX_LOCK_FILE_INIT;
+  g_autoptr(GHashTable) used = NULL;
+  g_autoptr(GHashTable) entries = NULL;
+  g_autoptr(GPtrArray) by_last_use = NULL;
+  g_autoptr(GVariant) index = NULL;
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  gpointer key, value;
+  guint64 hits, misses, new_hits, new_misses;
+  guint64 total_size = 0;
+  guint64 now = g_get_real_time () / G_USEC_PER_SEC;
+  gboolean found;
+  guint i;
+
+  g_mutex_lock (&self->cache_lock);
+  used = self->uncompressed_cache_used;
+  self->uncompressed_cache_used = NULL;
+  new_hits = self->uncompressed_cache_hits;
+  new_misses = self->uncompressed_cache_misses;
+  self->uncompressed_cache_hits = self->uncompressed_cache_misses = 0;
+  g_mutex_unlock (&self->cache_lock);
+
+  if (!glnx_make_lock_file (self->uncompressed_objects_dir_fd, "index.lock", LOCK_EX,
+                            &lock, error))
+    goto out;
+
+  if (!uncompressed_cache_load_index (self, &hits, &misses, &entries, &found,
+                                      cancellable, error))
+    goto out;
+
+  if (!found)
+    {
+      if (!uncompressed_cache_scan (self, entries, cancellable, error))
+        goto out;
+    }
+
+  hits += new_hits;
+  misses += new_misses;
+
+  if (used)
+    g_hash_table_iter_init (&iter, used);
+  while (used && g_hash_table_iter_next (&iter, &key, &value))
+    {
+      const char *checksum = key;
+      char loose_path_buf[_OSTREE_LOOSE_PATH_MAX];
+      UncompressedCacheEntry *entry;
+      struct stat stbuf;
+
+      _ostree_loose_path (loose_path_buf, checksum, OSTREE_OBJECT_TYPE_FILE, OSTREE_REPO_MODE_BARE);
+      if (fstatat (self->uncompressed_objects_dir_fd, loose_path_buf, &stbuf, AT_SYMLINK_NOFOLLOW) != 0)
+        {
+          if (errno != ENOENT)
+            {
+              glnx_set_error_from_errno (error);
+              goto out;
+            }
+          g_hash_table_remove (entries, checksum);
+          continue;
+        }
+
+      entry = g_hash_table_lookup (entries, checksum);
+      if (entry == NULL)
+        {
+          entry = g_new0 (UncompressedCacheEntry, 1);
+          memcpy (entry->checksum, checksum, 65);
+          g_hash_table_replace (entries, entry->checksum, entry);
+        }
+      entry->size = stbuf.st_size;
+      entry->last_used = now;
+    }
+
+  by_last_use = g_ptr_array_new ();
+  g_hash_table_iter_init (&iter, entries);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      UncompressedCacheEntry *entry = value;
+      total_size += entry->size;
+      g_ptr_array_add (by_last_use, entry);
+    }
+  g_ptr_array_sort (by_last_use, compare_entries_by_last_use);
+
+  for (i = 0; i < by_last_use->len && total_size > self->uncompressed_cache_max_size; i++)
+    {
+      UncompressedCacheEntry *entry = by_last_use->pdata[i];
+      char loose_path_buf[_OSTREE_LOOSE_PATH_MAX];
+
+      _ostree_loose_path (loose_path_buf, entry->checksum, OSTREE_OBJECT_TYPE_FILE, OSTREE_REPO_MODE_BARE);
+      if (unlinkat (self->uncompressed_objects_dir_fd, loose_path_buf, 0) != 0 && errno != ENOENT)
+        {
+          glnx_set_error_from_errno (error);
+          goto out;
+        }
+
+      total_size -= entry->size;
+      /* This frees the entry */
+      g_hash_table_remove (entries, entry->checksum);
+    }
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(aytt)"));
+  g_hash_table_iter_init (&iter, entries);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      UncompressedCacheEntry *entry = value;
+      g_variant_builder_add (&builder, "(@aytt)",
+                             ostree_checksum_to_bytes_v (entry->checksum),
+                             entry->size, entry->last_used);
+    }
+  index = g_variant_ref_sink (g_variant_new ("(tt@a(aytt))", hits, misses,
+                                             g_variant_builder_end (&builder)));
+
+  if (!glnx_file_replace_contents_at (self->uncompressed_objects_dir_fd, "index",
+                                      g_variant_get_data (index), g_variant_get_size (index),
+                                      GLNX_FILE_REPLACE_NODATASYNC,
+                                      cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/**
+ * ostree_repo_get_uncompressed_cache_stats:
+ * @self: Repo
+ * @out_hits: (out) (allow-none): Number of objects found in the cache
+ * @out_misses: (out) (allow-none): Number of objects which had to be uncompressed
+ * @out_n_objects: (out) (allow-none): Number of objects in the cache
+ * @out_size: (out) (allow-none): Total size of the objects in the cache
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Gather statistics about the uncompressed object cache used when
+ * checking out from archive-z2 repositories in user mode.  If
+ * `core/uncompressed-cache-max-size` is set, the hit and miss counts
+ * are cumulative across all processes, and the cache contents are as
+ * of the last ostree_repo_checkout_gc(); otherwise, they only cover
+ * this #OstreeRepo, and the object count and size are not tracked.
+ */
+gboolean
+ostree_repo_get_uncompressed_cache_stats (OstreeRepo    *self,
+                                          guint64       *out_hits,
+                                          guint64       *out_misses,
+                                          guint64       *out_n_objects,
+                                          guint64       *out_size,
+                                          GCancellable  *cancellable,
+                                          GError       **error)
+{
+  g_autoptr(GHashTable) entries = NULL;
+  guint64 hits = 0;
+  guint64 misses = 0;
+  guint64 n_objects = 0;
+  guint64 size = 0;
+
+  if (self->uncompressed_objects_dir_fd != -1 && self->uncompressed_cache_max_size > 0)
+    {
+      GHashTableIter iter;
+      gpointer key, value;
+      gboolean found;
+
+      if (!uncompressed_cache_load_index (self, &hits, &misses, &entries, &found,
+                                          cancellable, error))
+        return FALSE;
+
+      n_objects = g_hash_table_size (entries);
+      g_hash_table_iter_init (&iter, entries);
+      while (g_hash_table_iter_next (&iter, &key, &value))
+        size += ((UncompressedCacheEntry*)value)->size;
+    }
+
+  g_mutex_lock (&self->cache_lock);
+  hits += self->uncompressed_cache_hits;
+  misses += self->uncompressed_cache_misses;
+  g_mutex_unlock (&self->cache_lock);
+
+  if (out_hits)
+    *out_hits = hits;
+  if (out_misses)
+    *out_misses = misses;
+  if (out_n_objects)
+    *out_n_objects = n_objects;
+  if (out_size)
+    *out_size = size;
+  return TRUE;
+}
+
 /**
  * ostree_repo_checkout_gc:
  * @self: Repo
@@ -937,6 +2334,11 @@ ostree_repo_devino_cache_new (void)
  * Call this after finishing a succession of checkout operations; it
  * will delete any currently-unused uncompressed objects from the
  * cache.
+ *
+ * If `core/uncompressed-cache-max-size` is set to a number of bytes,
+ * the cache is instead managed as a whole: objects are kept whether
+ * or not they are in use, and the least recently used ones are
+ * evicted until the cache fits in that size.
  */
 gboolean
 ostree_repo_checkout_gc (OstreeRepo        *self,
@@ -953,6 +2355,15 @@ ostree_repo_checkout_gc (OstreeRepo        *self,
   self->updated_uncompressed_dirs = g_hash_table_new (NULL, NULL);
   g_mutex_unlock (&self->cache_lock);
 
+  if (self->uncompressed_cache_max_size > 0)
+    {
+      if (self->uncompressed_objects_dir_fd != -1 &&
+          !uncompressed_cache_update_index (self, cancellable, error))
+        goto out;
+      ret = TRUE;
+      goto out;
+    }
+
   if (to_clean_dirs)
     g_hash_table_iter_init (&iter, to_clean_dirs);
   while (to_clean_dirs && g_hash_table_iter_next (&iter, &key, &value))
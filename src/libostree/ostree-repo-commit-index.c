@@ -0,0 +1,670 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2016 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * Author: Colin Walters <walters@verbum.org>
+ */
+
+
+#include "config.h"
+
+#include "ostree-core-private.h"
+#include "ostree-repo-private.h"
+#include "otutil.h"
+
+/*
+ * The commit index is an append-only file of fixed-size records, one
+ * per commit written to the repository, after a short header.  It's
+ * built by scanning all commit objects once, the first time it's
+ * needed in a writable repository, and from then on every commit
+ * written or imported is appended.
+ *
+ * The index is authoritative: a commit it doesn't list doesn't exist,
+ * and one it does list exists unless it was deleted since, which a
+ * single fstatat() tells.  If an append fails, the index is removed so
+ * it gets rebuilt rather than silently missing a commit.  Only a
+ * missing or damaged index, in a repository we can't write to, means
+ * falling back to a scan.  Commits added by older versions of OSTree
+ * aren't indexed; deleting the file makes the next use rebuild it.
+ */
+
+#define COMMIT_INDEX_MAGIC "ostcidx1"
+#define COMMIT_INDEX_HEADER_SIZE 8
+
+typedef struct {
+  guchar checksum[OSTREE_SHA256_DIGEST_LEN];
+  guchar parent[OSTREE_SHA256_DIGEST_LEN];  /* All zero if none */
+  guchar root_tree[OSTREE_SHA256_DIGEST_LEN];
+  guint64 timestamp;                        /* Big endian */
+} OstreeCommitIndexRecord;
+
+struct OstreeCommitIndex {
+  volatile gint refcount;
+  GMappedFile *mfile;
+  const OstreeCommitIndexRecord *records;
+  guint32 *sorted;   /* Indexes into records, by checksum */
+  guint n_sorted;
+  struct stat stbuf;
+};
+
+static OstreeCommitIndex *
+commit_index_ref (OstreeCommitIndex *index)
+{
+  g_atomic_int_inc (&index->refcount);
+  return index;
+}
+
+void
+_ostree_commit_index_unref (OstreeCommitIndex *index)
+{
+  if (!g_atomic_int_dec_and_test (&index->refcount))
+    return;
+
+  g_mapped_file_unref (index->mfile);
+  g_free (index->sorted);
+  g_free (index);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(OstreeCommitIndex, _ostree_commit_index_unref)
+
+static gboolean
+commit_record_init (OstreeCommitIndexRecord  *record,
+                    const char               *checksum,
+                    GVariant                 *commit,
+                    GError                  **error)
+{
+  g_autoptr(GVariant) parent_csum_v = NULL;
+  g_autoptr(GVariant) tree_csum_v = NULL;
+  const guchar *csum;
+  guint64 timestamp;
+
+  memset (record, 0, sizeof (*record));
+  ostree_checksum_inplace_to_bytes (checksum, record->checksum);
+
+  /* See OSTREE_COMMIT_GVARIANT_FORMAT */
+  g_variant_get_child (commit, 1, "@ay", &parent_csum_v);
+  g_variant_get_child (commit, 5, "t", &timestamp);
+  g_variant_get_child (commit, 6, "@ay", &tree_csum_v);
+
+  if (g_variant_n_children (parent_csum_v) > 0)
+    {
+      csum = ostree_checksum_bytes_peek_validate (parent_csum_v, error);
+      if (!csum)
+        return FALSE;
+      memcpy (record->parent, csum, sizeof (record->parent));
+    }
+
+  csum = ostree_checksum_bytes_peek_validate (tree_csum_v, error);
+  if (!csum)
+    return FALSE;
+  memcpy (record->root_tree, csum, sizeof (record->root_tree));
+
+  /* Already big endian in the commit */
+  record->timestamp = timestamp;
+
+  return TRUE;
+}
+
+static gboolean
+ensure_state_dir (OstreeRepo  *self,
+                  GError     **error)
+{
+  if (mkdirat (self->repo_dir_fd, "state", 0777) != 0)
+    {
+      if (G_UNLIKELY (errno != EEXIST))
+        {
+          glnx_set_error_from_errno (error);
+          return FALSE;
+        }
+    }
+  return TRUE;
+}
+
+/* A failed append may have left a partial record */
+static gboolean
+commit_index_size_is_valid (const struct stat *stbuf)
+{
+  return stbuf->st_size >= COMMIT_INDEX_HEADER_SIZE &&
+    (stbuf->st_size - COMMIT_INDEX_HEADER_SIZE) % sizeof (OstreeCommitIndexRecord) == 0;
+}
+
+/* Indexed commits exist unless they were deleted since */
+static gboolean
+indexed_commit_exists (OstreeRepo    *self,
+                       const char    *checksum,
+                       gboolean      *out_exists,
+                       GError       **error)
+{
+  char loose_path[_OSTREE_LOOSE_PATH_MAX];
+  struct stat stbuf;
+
+  _ostree_loose_path (loose_path, checksum, OSTREE_OBJECT_TYPE_COMMIT, self->mode);
+
+  /* Commits written by our own transaction are still staged */
+  if (self->in_transaction && self->commit_stagedir_fd != -1 &&
+      fstatat (self->commit_stagedir_fd, loose_path, &stbuf, AT_SYMLINK_NOFOLLOW) == 0)
+    {
+      *out_exists = TRUE;
+      return TRUE;
+    }
+
+  if (TEMP_FAILURE_RETRY (fstatat (self->objects_dir_fd, loose_path, &stbuf, AT_SYMLINK_NOFOLLOW)) != 0)
+    {
+      if (errno != ENOENT)
+        {
+          glnx_set_error_from_errno (error);
+          return FALSE;
+        }
+      *out_exists = FALSE;
+      return TRUE;
+    }
+
+  *out_exists = TRUE;
+  return TRUE;
+}
+
+static gboolean
+build_commit_index (OstreeRepo    *self,
+                    GCancellable  *cancellable,
+                    GError       **error)
+{
+  gboolean ret = FALSE;
+  g_autoptr(GHashTable) commits = NULL;
+  g_autoptr(GByteArray) buf = g_byte_array_new ();
+  GHashTableIter hashiter;
+  gpointer key, value;
+
+  if (!ostree_repo_list_commit_objects_starting_with (self, "", &commits,
+                                                      cancellable, error))
+    goto out;
+
+  g_byte_array_append (buf, (guint8*) COMMIT_INDEX_MAGIC, COMMIT_INDEX_HEADER_SIZE);
+
+  g_hash_table_iter_init (&hashiter, commits);
+  while (g_hash_table_iter_next (&hashiter, &key, &value))
+    {
+      const char *checksum;
+      OstreeObjectType objtype;
+      g_autoptr(GVariant) commit = NULL;
+      OstreeCommitIndexRecord record;
+
+      ostree_object_name_deserialize (key, &checksum, &objtype);
+
+      if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_COMMIT, checksum,
+                                     &commit, error))
+        goto out;
+
+      if (!commit_record_init (&record, checksum, commit, error))
+        goto out;
+
+      g_byte_array_append (buf, (guint8*) &record, sizeof (record));
+    }
+
+  if (!_ostree_repo_file_replace_contents (self, self->repo_dir_fd, _OSTREE_COMMIT_INDEX_PATH,
+                                           buf->data, buf->len,
+                                           cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  if (!ret)
+    g_prefix_error (error, "Building commit index: ");
+  return ret;
+}
+
+static int
+compare_records (gconstpointer a,
+                 gconstpointer b,
+                 gpointer      user_data)
+{
+  const OstreeCommitIndexRecord *records = user_data;
+  guint32 ia = *(const guint32*) a;
+  guint32 ib = *(const guint32*) b;
+  int r = memcmp (records[ia].checksum, records[ib].checksum, OSTREE_SHA256_DIGEST_LEN);
+
+  if (r != 0)
+    return r;
+  /* Keep duplicates in file order, so the last one wins below */
+  return ia < ib ? -1 : (ia > ib ? 1 : 0);
+}
+
+/*
+ * Returns the current index in @out_index, or %NULL if there is none
+ * or it's damaged.  Like the packed refs, the parsed index is cached
+ * until the file changes.
+ */
+static gboolean
+load_commit_index (OstreeRepo          *self,
+                   OstreeCommitIndex  **out_index,
+                   GCancellable        *cancellable,
+                   GError             **error)
+{
+  gboolean ret = FALSE;
+  glnx_fd_close int fd = -1;
+  struct stat stbuf;
+  g_autoptr(OstreeCommitIndex) ret_index = NULL;
+  guint n_records, i;
+
+  /* Commits in a parent repo aren't indexed */
+  if (self->parent_repo)
+    goto done;
+
+  if (!ot_openat_ignore_enoent (self->repo_dir_fd, _OSTREE_COMMIT_INDEX_PATH, &fd, error))
+    goto out;
+
+  if (fd == -1)
+    goto done;
+
+  if (fstat (fd, &stbuf) != 0)
+    {
+      glnx_set_error_from_errno (error);
+      goto out;
+    }
+
+  g_mutex_lock (&self->cache_lock);
+  if (self->commit_index &&
+      self->commit_index->stbuf.st_dev == stbuf.st_dev &&
+      self->commit_index->stbuf.st_ino == stbuf.st_ino &&
+      self->commit_index->stbuf.st_size == stbuf.st_size)
+    ret_index = commit_index_ref (self->commit_index);
+  g_mutex_unlock (&self->cache_lock);
+
+  if (ret_index)
+    goto done;
+
+  if (!commit_index_size_is_valid (&stbuf))
+    goto done;
+
+  ret_index = g_new0 (OstreeCommitIndex, 1);
+  ret_index->refcount = 1;
+  ret_index->stbuf = stbuf;
+  ret_index->mfile = g_mapped_file_new_from_fd (fd, FALSE, error);
+  if (!ret_index->mfile)
+    goto out;
+
+  if (memcmp (g_mapped_file_get_contents (ret_index->mfile), COMMIT_INDEX_MAGIC,
+              COMMIT_INDEX_HEADER_SIZE) != 0)
+    {
+      g_clear_pointer (&ret_index, _ostree_commit_index_unref);
+      goto done;
+    }
+
+  ret_index->records = (const OstreeCommitIndexRecord *)
+    (g_mapped_file_get_contents (ret_index->mfile) + COMMIT_INDEX_HEADER_SIZE);
+  n_records = (stbuf.st_size - COMMIT_INDEX_HEADER_SIZE) / sizeof (OstreeCommitIndexRecord);
+
+  ret_index->sorted = g_new (guint32, n_records);
+  for (i = 0; i < n_records; i++)
+    ret_index->sorted[i] = i;
+  g_qsort_with_data (ret_index->sorted, n_records, sizeof (guint32),
+                     compare_records, (gpointer) ret_index->records);
+
+  /* Drop duplicates, keeping the last entry for each commit */
+  ret_index->n_sorted = 0;
+  for (i = 0; i < n_records; i++)
+    {
+      if (i + 1 < n_records &&
+          memcmp (ret_index->records[ret_index->sorted[i]].checksum,
+                  ret_index->records[ret_index->sorted[i+1]].checksum,
+                  OSTREE_SHA256_DIGEST_LEN) == 0)
+        continue;
+      ret_index->sorted[ret_index->n_sorted++] = ret_index->sorted[i];
+    }
+
+  g_mutex_lock (&self->cache_lock);
+  g_clear_pointer (&self->commit_index, _ostree_commit_index_unref);
+  self->commit_index = commit_index_ref (ret_index);
+  g_mutex_unlock (&self->cache_lock);
+
+ done:
+  ret = TRUE;
+  *out_index = g_steal_pointer (&ret_index);
+ out:
+  if (!ret)
+    g_prefix_error (error, "Loading commit index: ");
+  return ret;
+}
+
+/* Compare @csum against the hex string @prefix, considering only the
+ * length of @prefix.
+ */
+static int
+compare_checksum_prefix (const guchar *csum,
+                         const char   *prefix)
+{
+  guint i;
+
+  for (i = 0; prefix[i] && i < 64; i++)
+    {
+      int nibble = (i % 2 == 0) ? csum[i/2] >> 4 : csum[i/2] & 0xf;
+      int wanted = g_ascii_xdigit_value (prefix[i]);
+
+      if (nibble != wanted)
+        return nibble - wanted;
+    }
+
+  return 0;
+}
+
+static const OstreeCommitIndexRecord *
+commit_index_lookup (OstreeCommitIndex *index,
+                     const char        *checksum)
+{
+  guint lo = 0, hi = index->n_sorted;
+
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+      const OstreeCommitIndexRecord *record = &index->records[index->sorted[mid]];
+      int r = compare_checksum_prefix (record->checksum, checksum);
+
+      if (r == 0)
+        return record;
+      else if (r < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return NULL;
+}
+
+/*
+ * With the index lock held, open the index for appending, building it
+ * first if it's missing or damaged.
+ */
+static gboolean
+open_commit_index_locked (OstreeRepo    *self,
+                          int           *out_fd,
+                          GCancellable  *cancellable,
+                          GError       **error)
+{
+  glnx_fd_close int fd = -1;
+  struct stat stbuf;
+  char magic[COMMIT_INDEX_HEADER_SIZE];
+
+  fd = openat (self->repo_dir_fd, _OSTREE_COMMIT_INDEX_PATH,
+               O_RDWR | O_APPEND | O_CLOEXEC | O_NOCTTY);
+  if (fd == -1 && errno != ENOENT)
+    {
+      glnx_set_error_from_errno (error);
+      return FALSE;
+    }
+
+  if (fd != -1 && fstat (fd, &stbuf) != 0)
+    {
+      glnx_set_error_from_errno (error);
+      return FALSE;
+    }
+
+  if (fd == -1 ||
+      !commit_index_size_is_valid (&stbuf) ||
+      TEMP_FAILURE_RETRY (pread (fd, magic, sizeof (magic), 0)) != sizeof (magic) ||
+      memcmp (magic, COMMIT_INDEX_MAGIC, COMMIT_INDEX_HEADER_SIZE) != 0)
+    {
+      if (fd != -1)
+        (void) close (glnx_steal_fd (&fd));
+
+      if (!build_commit_index (self, cancellable, error))
+        return FALSE;
+
+      fd = openat (self->repo_dir_fd, _OSTREE_COMMIT_INDEX_PATH,
+                   O_RDWR | O_APPEND | O_CLOEXEC | O_NOCTTY);
+      if (fd == -1)
+        {
+          glnx_set_error_from_errno (error);
+          return FALSE;
+        }
+    }
+
+  *out_fd = glnx_steal_fd (&fd);
+  return TRUE;
+}
+
+/*
+ * Returns the index, building it if possible, or %NULL if the caller
+ * has to scan instead.
+ */
+static gboolean
+ensure_commit_index (OstreeRepo          *self,
+                     OstreeCommitIndex  **out_index,
+                     GCancellable        *cancellable,
+                     GError             **error)
+{
+  g_autoptr(OstreeCommitIndex) index = NULL;
+  g_auto(GLnxLockFile) lock = GLNX_LOCK_FILE_INIT;
+  glnx_fd_close int fd = -1;
+  g_autoptr(GError) local_error = NULL;
+
+  if (!load_commit_index (self, &index, cancellable, error))
+    return FALSE;
+
+  if (index == NULL && self->writable && !self->parent_repo)
+    {
+      /* Carry on with a scan if building fails */
+      if (!ensure_state_dir (self, &local_error) ||
+          !glnx_make_lock_file (self->repo_dir_fd, _OSTREE_COMMIT_INDEX_LOCK_PATH, LOCK_EX,
+                                &lock, &local_error) ||
+          !open_commit_index_locked (self, &fd, cancellable, &local_error))
+        g_debug ("Building commit index: %s", local_error->message);
+      else if (!load_commit_index (self, &index, cancellable, error))
+        return FALSE;
+    }
+
+  *out_index = g_steal_pointer (&index);
+  return TRUE;
+}
+
+/*
+ * _ostree_repo_commit_index_add:
+ * @self: Repo
+ * @checksum: A commit which was just written to @self
+ *
+ * Append @checksum to the commit index, building the index first if
+ * there is none or a failed append left a partial record.  The commit
+ * is read back from the repository, so this works for commits written
+ * from a stream or imported by hardlink as well.  If this fails, the
+ * index is removed, since it would otherwise be missing the commit.
+ *
+ * Appends and rebuilds hold a lock, so that an append can't go to a
+ * file which a rebuild is about to replace.
+ */
+gboolean
+_ostree_repo_commit_index_add (OstreeRepo    *self,
+                               const char    *checksum,
+                               GCancellable  *cancellable,
+                               GError       **error)
+{
+  gboolean ret = FALSE;
+  g_auto(GLnxLockFile) lock = GLNX_LOCK_FILE_INIT;
+  glnx_fd_close int fd = -1;
+  g_autoptr(GVariant) commit = NULL;
+  OstreeCommitIndexRecord record;
+
+  /* Commits in a parent repo aren't indexed */
+  if (self->parent_repo)
+    {
+      ret = TRUE;
+      goto out;
+    }
+
+  if (!ensure_state_dir (self, error))
+    goto out;
+
+  if (!glnx_make_lock_file (self->repo_dir_fd, _OSTREE_COMMIT_INDEX_LOCK_PATH, LOCK_EX,
+                            &lock, error))
+    goto out;
+
+  /* A staged commit may be missing from a rebuild's scan, so it's
+   * still appended below; duplicates are harmless.
+   */
+  if (!open_commit_index_locked (self, &fd, cancellable, error))
+    goto out;
+
+  if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_COMMIT, checksum,
+                                 &commit, error))
+    goto out;
+
+  if (!commit_record_init (&record, checksum, commit, error))
+    goto out;
+
+  /* A single small O_APPEND write, so concurrent writers don't interleave */
+  if (TEMP_FAILURE_RETRY (write (fd, &record, sizeof (record))) != sizeof (record))
+    {
+      glnx_set_error_from_errno (error);
+      goto out;
+    }
+
+  ret = TRUE;
+ out:
+  if (!ret)
+    (void) unlinkat (self->repo_dir_fd, _OSTREE_COMMIT_INDEX_PATH, 0);
+  return ret;
+}
+
+/*
+ * _ostree_repo_commit_index_lookup_prefix:
+ * @self: Repo
+ * @prefix: Lowercase hex checksum prefix
+ * @out_checksums: (out) (transfer full): Commits starting with @prefix, or %NULL if there's no index
+ *
+ * Find the commits starting with @prefix using a binary search of the
+ * commit index.  Only commits which still exist are returned; this is
+ * the complete list, so the caller only has to scan if there's no
+ * index.
+ */
+gboolean
+_ostree_repo_commit_index_lookup_prefix (OstreeRepo    *self,
+                                         const char    *prefix,
+                                         GPtrArray    **out_checksums,
+                                         GCancellable  *cancellable,
+                                         GError       **error)
+{
+  gboolean ret = FALSE;
+  g_autoptr(OstreeCommitIndex) index = NULL;
+  g_autoptr(GPtrArray) ret_checksums = NULL;
+  g_autoptr(GError) local_error = NULL;
+  guint lo, hi;
+
+  if (!ensure_commit_index (self, &index, cancellable, &local_error))
+    {
+      /* Carry on without it; the caller has a fallback */
+      g_debug ("%s", local_error->message);
+      g_clear_error (&local_error);
+    }
+
+  if (index == NULL)
+    {
+      ret = TRUE;
+      *out_checksums = NULL;
+      goto out;
+    }
+
+  ret_checksums = g_ptr_array_new_with_free_func (g_free);
+
+  /* Find the first entry not less than @prefix */
+  lo = 0;
+  hi = index->n_sorted;
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+
+      if (compare_checksum_prefix (index->records[index->sorted[mid]].checksum, prefix) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  for (; lo < index->n_sorted; lo++)
+    {
+      const OstreeCommitIndexRecord *record = &index->records[index->sorted[lo]];
+      char checksum[65];
+      gboolean have_commit;
+
+      if (compare_checksum_prefix (record->checksum, prefix) != 0)
+        break;
+
+      ostree_checksum_inplace_from_bytes (record->checksum, checksum);
+      if (!indexed_commit_exists (self, checksum, &have_commit, error))
+        goto out;
+
+      if (have_commit)
+        g_ptr_array_add (ret_checksums, g_strdup (checksum));
+    }
+
+  ret = TRUE;
+  *out_checksums = g_steal_pointer (&ret_checksums);
+ out:
+  return ret;
+}
+
+/*
+ * _ostree_repo_commit_index_get_parent:
+ * @self: Repo
+ * @checksum: A commit checksum
+ * @out_found: (out): Whether @checksum was found in the index
+ * @out_parent: (out) (transfer full): Parent of @checksum, or %NULL if it has none
+ *
+ * Look up the parent of a commit without loading it.  If @out_found
+ * is %FALSE, the commit isn't indexed or doesn't exist, and the caller
+ * should load it instead.
+ */
+gboolean
+_ostree_repo_commit_index_get_parent (OstreeRepo    *self,
+                                      const char    *checksum,
+                                      gboolean      *out_found,
+                                      char         **out_parent,
+                                      GCancellable  *cancellable,
+                                      GError       **error)
+{
+  gboolean ret = FALSE;
+  g_autoptr(OstreeCommitIndex) index = NULL;
+  g_autoptr(GError) local_error = NULL;
+  const OstreeCommitIndexRecord *record = NULL;
+  static const guchar zero_csum[OSTREE_SHA256_DIGEST_LEN] = { 0, };
+
+  if (!ensure_commit_index (self, &index, cancellable, &local_error))
+    {
+      /* Carry on without it; the caller has a fallback */
+      g_debug ("%s", local_error->message);
+      g_clear_error (&local_error);
+    }
+
+  if (index)
+    record = commit_index_lookup (index, checksum);
+
+  /* Stale entries for deleted commits are left in the index */
+  if (record)
+    {
+      gboolean have_commit;
+
+      if (!indexed_commit_exists (self, checksum, &have_commit, error))
+        goto out;
+      if (!have_commit)
+        record = NULL;
+    }
+
+  ret = TRUE;
+  *out_found = record != NULL;
+  if (record && memcmp (record->parent, zero_csum, sizeof (zero_csum)) != 0)
+    *out_parent = ostree_checksum_from_bytes (record->parent);
+  else
+    *out_parent = NULL;
+ out:
+  return ret;
+}
@@ -25,6 +25,7 @@
 #include <glib-unix.h>
 #include <gio/gfiledescriptorbased.h>
 #include <gio/gunixinputstream.h>
+#include <gio/gunixoutputstream.h>
 #include "otutil.h"
 
 #include "ostree-core-private.h"
@@ -121,6 +122,7 @@ _ostree_repo_commit_loose_final (OstreeRepo        *self,
   gboolean ret = FALSE;
   int dest_dfd;
   char tmpbuf[_OSTREE_LOOSE_PATH_MAX];
+  g_auto(GLnxLockFile) sweep_lock = GLNX_LOCK_FILE_INIT;
 
   _ostree_loose_path (tmpbuf, checksum, objtype, self->mode);
 
@@ -133,6 +135,11 @@ _ostree_repo_commit_loose_final (OstreeRepo        *self,
                                             cancellable, error))
     goto out;
 
+  /* This may replace an old object a prune is about to delete */
+  if (dest_dfd == self->objects_dir_fd &&
+      !_ostree_repo_lock_prune_sweep (self, &sweep_lock, error))
+    goto out;
+
   if (G_UNLIKELY (renameat (temp_dfd, temp_filename,
                             dest_dfd, tmpbuf) == -1))
     {
@@ -151,6 +158,185 @@ _ostree_repo_commit_loose_final (OstreeRepo        *self,
   return ret;
 }
 
+/*
+ * Open a temporary file in the repo tmpdir for a new object.  Where
+ * O_TMPFILE works the file is anonymous and *out_temp_filename is
+ * %NULL; it only gets a name when link_tmpfile_loose_final() links it
+ * into place, and otherwise disappears on close, even after a crash.
+ * Else, fall back to a named temporary file which the caller must
+ * rename or unlink.  Either way, the stream's fd is open read-write.
+ */
+static gboolean
+open_object_tmpfile (OstreeRepo      *self,
+                     char           **out_temp_filename,
+                     GOutputStream  **out_stream,
+                     GCancellable    *cancellable,
+                     GError         **error)
+{
+  g_autofree char *temp_filename = NULL;
+  g_autoptr(GOutputStream) temp_out = NULL;
+  int fd;
+#ifdef O_TMPFILE
+  static gsize proc_checked;
+  static gboolean have_proc_fd;
+
+  /* Linking an anonymous file without CAP_DAC_READ_SEARCH needs /proc */
+  if (g_once_init_enter (&proc_checked))
+    {
+      have_proc_fd = access ("/proc/self/fd", F_OK) == 0;
+      g_once_init_leave (&proc_checked, 1);
+    }
+
+  if (have_proc_fd && !g_atomic_int_get (&self->tmpfile_unsupported))
+    {
+      fd = openat (self->tmp_dir_fd, ".", O_TMPFILE | O_RDWR | O_CLOEXEC, 0644);
+
+      if (fd != -1)
+        {
+          *out_temp_filename = NULL;
+          *out_stream = g_unix_output_stream_new (fd, TRUE);
+          return TRUE;
+        }
+
+      /* Old kernels and some filesystems; anything else is a real error */
+      if (errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL)
+        {
+          glnx_set_error_from_errno (error);
+          return FALSE;
+        }
+
+      g_atomic_int_set (&self->tmpfile_unsupported, TRUE);
+    }
+#endif
+
+  if (!gs_file_open_in_tmpdir_at (self->tmp_dir_fd, 0644,
+                                  &temp_filename, &temp_out,
+                                  cancellable, error))
+    return FALSE;
+
+  /* That's write-only; reopen it so it can be mapped and read back
+   * like an anonymous file.
+   */
+  fd = openat (self->tmp_dir_fd, temp_filename, O_RDWR | O_CLOEXEC);
+  if (fd == -1)
+    {
+      glnx_set_error_from_errno (error);
+      (void) unlinkat (self->tmp_dir_fd, temp_filename, 0);
+      return FALSE;
+    }
+
+  *out_temp_filename = g_steal_pointer (&temp_filename);
+  *out_stream = g_unix_output_stream_new (fd, TRUE);
+  return TRUE;
+}
+
+/*
+ * Link the anonymous file @fd to a temporary name, and rename that
+ * over @loose_path, replacing an existing object which couldn't be
+ * freshened.
+ */
+static gboolean
+replace_loose_object_with_tmpfile (OstreeRepo    *self,
+                                   const char    *loose_path,
+                                   const char    *proc_fd_path,
+                                   GError       **error)
+{
+  g_auto(GLnxLockFile) sweep_lock = GLNX_LOCK_FILE_INIT;
+  char tmpname[] = "tmpobject.XXXXXX";
+  guint i;
+  const int max_attempts = 128;
+
+  if (!_ostree_repo_lock_prune_sweep (self, &sweep_lock, error))
+    return FALSE;
+
+  for (i = 0; i < max_attempts; i++)
+    {
+      glnx_gen_temp_name (tmpname);
+      if (linkat (AT_FDCWD, proc_fd_path, self->tmp_dir_fd, tmpname,
+                  AT_SYMLINK_FOLLOW) == 0)
+        break;
+      if (errno != EEXIST)
+        {
+          glnx_set_error_from_errno (error);
+          return FALSE;
+        }
+    }
+  if (i == max_attempts)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Exhausted attempts to open temporary file");
+      return FALSE;
+    }
+
+  if (renameat (self->tmp_dir_fd, tmpname, self->objects_dir_fd, loose_path) == -1)
+    {
+      glnx_set_error_from_errno (error);
+      (void) unlinkat (self->tmp_dir_fd, tmpname, 0);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/*
+ * Like _ostree_repo_commit_loose_final(), but for an anonymous file
+ * from open_object_tmpfile().  If the object already exists, it's
+ * freshened and the new file is simply dropped when @fd is closed;
+ * if it can't be freshened, the new file replaces it.
+ */
+static gboolean
+link_tmpfile_loose_final (OstreeRepo        *self,
+                          const char        *checksum,
+                          OstreeObjectType   objtype,
+                          int                fd,
+                          GCancellable      *cancellable,
+                          GError           **error)
+{
+  int dest_dfd;
+  char tmpbuf[_OSTREE_LOOSE_PATH_MAX];
+  char proc_fd_path[64];
+  gboolean is_fresh;
+
+  _ostree_loose_path (tmpbuf, checksum, objtype, self->mode);
+
+  if (self->in_transaction)
+    dest_dfd = self->commit_stagedir_fd;
+  else
+    dest_dfd = self->objects_dir_fd;
+
+  if (!_ostree_repo_ensure_loose_objdir_at (dest_dfd, tmpbuf,
+                                            cancellable, error))
+    return FALSE;
+
+  g_snprintf (proc_fd_path, sizeof (proc_fd_path), "/proc/self/fd/%d", fd);
+
+  if (G_UNLIKELY (linkat (AT_FDCWD, proc_fd_path, dest_dfd, tmpbuf,
+                          AT_SYMLINK_FOLLOW) == -1))
+    {
+      if (errno != EEXIST)
+        {
+          glnx_set_error_from_errno (error);
+          g_prefix_error (error, "Storing object %s: ", checksum);
+          return FALSE;
+        }
+
+      /* Staged objects are renamed into place at commit time */
+      if (dest_dfd != self->objects_dir_fd)
+        return TRUE;
+
+      if (!_ostree_repo_freshen_loose_object (self, tmpbuf, &is_fresh, error))
+        return FALSE;
+      if (!is_fresh &&
+          !replace_loose_object_with_tmpfile (self, tmpbuf, proc_fd_path, error))
+        {
+          g_prefix_error (error, "Storing object %s: ", checksum);
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
 static gboolean
 commit_loose_object_trusted (OstreeRepo        *self,
                              const char        *checksum,
@@ -173,10 +359,16 @@ commit_loose_object_trusted (OstreeRepo        *self,
   if (self->mode == OSTREE_REPO_MODE_ARCHIVE_Z2
       && self->target_owner_uid != -1) 
     {
-      if (G_UNLIKELY (fchownat (self->tmp_dir_fd, temp_filename,
-                                self->target_owner_uid,
-                                self->target_owner_gid,
-                                AT_SYMLINK_NOFOLLOW) == -1))
+      int res;
+
+      if (temp_filename == NULL)
+        res = fchown (fd, self->target_owner_uid, self->target_owner_gid);
+      else
+        res = fchownat (self->tmp_dir_fd, temp_filename,
+                        self->target_owner_uid,
+                        self->target_owner_gid,
+                        AT_SYMLINK_NOFOLLOW);
+      if (G_UNLIKELY (res == -1))
         {
           glnx_set_error_from_errno (error);
           goto out;
@@ -295,10 +487,19 @@ commit_loose_object_trusted (OstreeRepo        *self,
         }
     }
 
-  if (!_ostree_repo_commit_loose_final (self, checksum, objtype,
-                                        self->tmp_dir_fd, temp_filename,
-                                        cancellable, error))
-    goto out;
+  if (temp_filename == NULL)
+    {
+      if (!link_tmpfile_loose_final (self, checksum, objtype, fd,
+                                     cancellable, error))
+        goto out;
+    }
+  else
+    {
+      if (!_ostree_repo_commit_loose_final (self, checksum, objtype,
+                                            self->tmp_dir_fd, temp_filename,
+                                            cancellable, error))
+        goto out;
+    }
   
   ret = TRUE;
  out:
@@ -491,9 +692,9 @@ _ostree_repo_commit_untrusted_content_bare (OstreeRepo          *self,
       g_autoptr(GFileInfo) file_info = NULL;
       g_autofree guchar *actual_csum = NULL;
       g_autofree char *actual_checksum = NULL;
-      int fd;
+      glnx_fd_close int fd = -1;
 
-      fd = openat (self->tmp_dir_fd, state->temp_filename, O_RDONLY);
+      fd = dup (state->fd);
       if (fd == -1)
         {
           glnx_set_error_from_errno (error);
@@ -501,8 +702,6 @@ _ostree_repo_commit_untrusted_content_bare (OstreeRepo          *self,
         }
 
       mapped = g_mapped_file_new_from_fd (fd, FALSE, error);
-
-      close (fd);
       if (mapped == NULL)
         goto out;
 
@@ -564,8 +763,8 @@ _ostree_repo_open_trusted_content_bare (OstreeRepo          *self,
 
   if (!have_obj)
     {
-      if (!gs_file_open_in_tmpdir_at (self->tmp_dir_fd, 0644, &temp_filename, &ret_stream,
-                                      cancellable, error))
+      if (!open_object_tmpfile (self, &temp_filename, &ret_stream,
+                                cancellable, error))
         goto out;
       
       if (!fallocate_stream ((GFileDescriptorBased*)ret_stream, content_len,
@@ -721,8 +920,8 @@ write_object (OstreeRepo         *self,
         {
           guint64 size = g_file_info_get_size (file_info);
 
-          if (!gs_file_open_in_tmpdir_at (self->tmp_dir_fd, 0644, &temp_filename, &temp_out,
-                                          cancellable, error))
+          if (!open_object_tmpfile (self, &temp_filename, &temp_out,
+                                    cancellable, error))
             goto out;
 
           if (!fallocate_stream ((GFileDescriptorBased*)temp_out, size,
@@ -750,9 +949,8 @@ write_object (OstreeRepo         *self,
           if (self->generate_sizes)
             indexable = TRUE;
 
-          if (!gs_file_open_in_tmpdir_at (self->tmp_dir_fd, 0644,
-                                          &temp_filename, &temp_out,
-                                          cancellable, error))
+          if (!open_object_tmpfile (self, &temp_filename, &temp_out,
+                                    cancellable, error))
             goto out;
           temp_file_is_regular = TRUE;
 
@@ -780,8 +978,8 @@ write_object (OstreeRepo         *self,
     }
   else
     {
-      if (!gs_file_open_in_tmpdir_at (self->tmp_dir_fd, 0644, &temp_filename, &temp_out,
-                                      cancellable, error))
+      if (!open_object_tmpfile (self, &temp_filename, &temp_out,
+                                cancellable, error))
         goto out;
 
       if (!fallocate_stream ((GFileDescriptorBased*)temp_out, file_object_length,
@@ -822,7 +1020,7 @@ write_object (OstreeRepo         *self,
     {
       struct stat stbuf;
 
-      if (fstatat (self->tmp_dir_fd, temp_filename, &stbuf, AT_SYMLINK_NOFOLLOW) == -1)
+      if (fstat (g_file_descriptor_based_get_fd ((GFileDescriptorBased*)temp_out), &stbuf) == -1)
         {
           glnx_set_error_from_errno (error);
           goto out;
@@ -882,6 +1080,13 @@ write_object (OstreeRepo         *self,
                   goto out;
                 }
             }
+
+          /* A failed add removes the index, so don't fail the write */
+          if (!_ostree_repo_commit_index_add (self, actual_checksum, cancellable, &local_error))
+            {
+              g_debug ("Failed to add %s to commit index: %s", actual_checksum, local_error->message);
+              g_clear_error (&local_error);
+            }
         }
 
       if (OSTREE_OBJECT_TYPE_IS_META (objtype))
@@ -1058,29 +1263,53 @@ scan_loose_devino (OstreeRepo                     *self,
   return ret;
 }
 
-static const char *
+/* Sets *out_checksum to the checksum of the object this file is a
+ * hardlink of, if there is one.  As with any reused object, it's
+ * freshened first; if it has gone meanwhile, it's a miss.
+ */
+static gboolean
 devino_cache_lookup (OstreeRepo           *self,
                      OstreeRepoCommitModifier *modifier,
                      guint32               device,
-                     guint32               inode)
+                     guint32               inode,
+                     const char          **out_checksum,
+                     GCancellable         *cancellable,
+                     GError              **error)
 {
   OstreeDevIno dev_ino_key;
   OstreeDevIno *dev_ino_val;
   GHashTable *cache;
+  gboolean is_stored;
+
+  *out_checksum = NULL;
 
   if (self->loose_object_devino_hash)
     cache = self->loose_object_devino_hash;
   else if (modifier && modifier->devino_cache)
     cache = modifier->devino_cache;
   else
-    return NULL;
+    return TRUE;
 
   dev_ino_key.dev = device;
   dev_ino_key.ino = inode;
   dev_ino_val = g_hash_table_lookup (cache, &dev_ino_key);
   if (!dev_ino_val)
-    return NULL;
-  return dev_ino_val->checksum;
+    return TRUE;
+
+  if (!_ostree_repo_has_loose_object (self, dev_ino_val->checksum, OSTREE_OBJECT_TYPE_FILE,
+                                      &is_stored, cancellable, error))
+    return FALSE;
+  if (!is_stored && self->parent_repo)
+    {
+      if (!ostree_repo_has_object (self->parent_repo, OSTREE_OBJECT_TYPE_FILE,
+                                   dev_ino_val->checksum, &is_stored,
+                                   cancellable, error))
+        return FALSE;
+    }
+
+  if (is_stored)
+    *out_checksum = dev_ino_val->checksum;
+  return TRUE;
 }
 
 /**
@@ -1136,6 +1365,12 @@ ostree_repo_scan_hardlinks (OstreeRepo    *self,
  *
  * Currently, transactions are not atomic, and aborting a transaction
  * will not erase any data you  write during the transaction.
+ *
+ * Any number of processes may have a transaction open on the same
+ * repository at once.  Each one stages objects in its own locked
+ * directory, and they are published with a rename; only the ref
+ * updates in ostree_repo_commit_transaction() are serialized.  A
+ * given #OstreeRepo instance holds at most one transaction.
  */
 gboolean
 ostree_repo_prepare_transaction (OstreeRepo     *self,
@@ -1178,10 +1413,17 @@ rename_pending_loose_objects (OstreeRepo        *self,
 {
   gboolean ret = FALSE;
   gs_dirfd_iterator_cleanup GSDirFdIterator dfd_iter = { 0, };
+  g_auto(GLnxLockFile) sweep_lock = GLNX_LOCK_FILE_INIT;
 
   if (!gs_dirfd_iterator_init_at (self->commit_stagedir_fd, ".", FALSE, &dfd_iter, error))
     goto out;
 
+  /* Objects staged because they couldn't be freshened replace old
+   * ones which a running prune may be about to delete.
+   */
+  if (!_ostree_repo_lock_prune_sweep (self, &sweep_lock, error))
+    goto out;
+
   /* Iterate over the outer checksum dir */
   while (TRUE)
     {
@@ -1431,6 +1673,9 @@ ostree_repo_transaction_set_ref (OstreeRepo *self,
  * This is like ostree_repo_transaction_set_ref(), except it may be
  * invoked outside of a transaction.  This is presently safe for the
  * case where we're creating or overwriting an existing ref.
+ *
+ * Like ostree_repo_commit_transaction(), this brings automatic static
+ * deltas up to date afterwards.
  */
 gboolean
 ostree_repo_set_ref_immediate (OstreeRepo *self,
@@ -1440,8 +1685,11 @@ ostree_repo_set_ref_immediate (OstreeRepo *self,
                                GCancellable  *cancellable,
                                GError       **error)
 {
-  return _ostree_repo_write_ref (self, remote, ref, checksum,
-                                 cancellable, error);
+  if (!_ostree_repo_write_ref (self, remote, ref, checksum,
+                               cancellable, error))
+    return FALSE;
+
+  return ostree_repo_regenerate_static_deltas (self, cancellable, error);
 }
 
 /**
@@ -1455,6 +1703,11 @@ ostree_repo_set_ref_immediate (OstreeRepo *self,
  * Complete the transaction. Any refs set with
  * ostree_repo_transaction_set_ref() or
  * ostree_repo_transaction_set_refspec() will be written out.
+ *
+ * If any refs were written, the static deltas maintained via
+ * `core/auto-static-deltas` are then brought up to date, see
+ * ostree_repo_regenerate_static_deltas().  The transaction's objects
+ * and refs are already committed if that step fails.
  */
 gboolean
 ostree_repo_commit_transaction (OstreeRepo                  *self,
@@ -1463,6 +1716,7 @@ ostree_repo_commit_transaction (OstreeRepo                  *self,
                                 GError                     **error)
 {
   gboolean ret = FALSE;
+  gboolean refs_updated = FALSE;
 
   g_return_val_if_fail (self->in_transaction == TRUE, FALSE);
 
@@ -1489,8 +1743,11 @@ ostree_repo_commit_transaction (OstreeRepo                  *self,
     g_hash_table_remove_all (self->loose_object_devino_hash);
 
   if (self->txn_refs)
-    if (!_ostree_repo_update_refs (self, self->txn_refs, cancellable, error))
-      goto out;
+    {
+      if (!_ostree_repo_update_refs (self, self->txn_refs, cancellable, error))
+        goto out;
+      refs_updated = g_hash_table_size (self->txn_refs) > 0;
+    }
   g_clear_pointer (&self->txn_refs, g_hash_table_destroy);
 
   if (self->commit_stagedir_fd != -1)
@@ -1511,6 +1768,10 @@ ostree_repo_commit_transaction (OstreeRepo                  *self,
   if (out_stats)
     *out_stats = self->txn_stats;
 
+  if (refs_updated &&
+      !ostree_repo_regenerate_static_deltas (self, cancellable, error))
+    goto out;
+
   ret = TRUE;
  out:
   return ret;
@@ -2526,9 +2787,11 @@ write_directory_content_to_mtree_internal (OstreeRepo                  *self,
       g_autofree guchar *child_file_csum = NULL;
       g_autofree char *tmp_checksum = NULL;
 
-      loose_checksum = devino_cache_lookup (self, modifier,
-                                            g_file_info_get_attribute_uint32 (child_info, "unix::device"),
-                                            g_file_info_get_attribute_uint64 (child_info, "unix::inode"));
+      if (!devino_cache_lookup (self, modifier,
+                                g_file_info_get_attribute_uint32 (child_info, "unix::device"),
+                                g_file_info_get_attribute_uint64 (child_info, "unix::inode"),
+                                &loose_checksum, cancellable, error))
+        goto out;
 
       if (loose_checksum)
         {
@@ -2780,7 +3043,9 @@ write_dfd_iter_to_mtree_internal (OstreeRepo                  *self,
           goto out;
         }
 
-      loose_checksum = devino_cache_lookup (self, modifier, stbuf.st_dev, stbuf.st_ino);
+      if (!devino_cache_lookup (self, modifier, stbuf.st_dev, stbuf.st_ino,
+                                &loose_checksum, cancellable, error))
+        goto out;
       if (loose_checksum)
         {
           if (!ostree_mutable_tree_replace_file (mtree, dent->d_name, loose_checksum,
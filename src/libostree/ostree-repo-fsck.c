@@ -0,0 +1,770 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2016 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * Author: Colin Walters <walters@verbum.org>
+ */
+
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "ostree-core-private.h"
+#include "ostree-repo-private.h"
+#include "otutil.h"
+
+/* Objects are handed to the worker threads in batches of this size */
+#define FSCK_BATCH_SIZE 64
+
+/*
+ * The journal records when each object was last verified, along with
+ * its ctime at that point, so that an object which was replaced since
+ * is verified again.  It's an append-only file of fixed-size records
+ * after a short header; each batch of verified objects is appended as
+ * it completes, so an interrupted run loses nothing.  At the end of a
+ * run, it's compacted to one record per object which still exists.
+ */
+
+#define FSCK_JOURNAL_MAGIC "ostfsck1"
+#define FSCK_JOURNAL_HEADER_SIZE 8
+
+typedef struct {
+  guchar csum[OSTREE_SHA256_DIGEST_LEN];
+  guchar objtype;
+  guchar padding[7];
+  guint64 ctime;     /* Big endian */
+  guint64 verified;  /* Big endian */
+} FsckJournalRecord;
+
+typedef struct {
+  guchar csum[OSTREE_SHA256_DIGEST_LEN];
+  guchar objtype;
+  gint64 ctime;
+  gint64 verified;
+} FsckJournalEntry;
+
+typedef struct {
+  guchar csum[OSTREE_SHA256_DIGEST_LEN];
+  guchar objtype;
+  gboolean journaled;  /* A loose object of this repo, not a parent */
+  gint64 ctime;
+  guint64 ino;
+} FsckItem;
+
+typedef struct {
+  OstreeRepo *repo;
+  OstreeRepoFsckFlags flags;
+  GCancellable *cancellable;
+  GThreadPool *pool;
+  int journal_fd;            /* Opened for appending, or -1 */
+
+  GMutex lock;
+  GPtrArray *corrupted;      /* protected by lock */
+  guint n_verified;          /* protected by lock */
+  GError *error;             /* protected by lock */
+} ParallelFsck;
+
+static int
+compare_journal_entries (gconstpointer a,
+                         gconstpointer b)
+{
+  const FsckJournalEntry *ea = a;
+  const FsckJournalEntry *eb = b;
+  int r = memcmp (ea->csum, eb->csum, OSTREE_SHA256_DIGEST_LEN);
+
+  if (r != 0)
+    return r;
+  return (int) ea->objtype - (int) eb->objtype;
+}
+
+/* Sorts entries for the same object oldest first */
+static int
+compare_journal_entries_by_age (gconstpointer a,
+                                gconstpointer b)
+{
+  const FsckJournalEntry *ea = a;
+  const FsckJournalEntry *eb = b;
+  int r = compare_journal_entries (a, b);
+
+  if (r != 0)
+    return r;
+  if (ea->verified < eb->verified)
+    return -1;
+  else if (ea->verified > eb->verified)
+    return 1;
+  return 0;
+}
+
+static int
+compare_items_by_inode (gconstpointer a,
+                        gconstpointer b)
+{
+  const FsckItem *ia = a;
+  const FsckItem *ib = b;
+
+  if (ia->ino < ib->ino)
+    return -1;
+  else if (ia->ino > ib->ino)
+    return 1;
+  return 0;
+}
+
+static void
+fsck_journal_record_init (FsckJournalRecord       *record,
+                          const FsckJournalEntry  *entry)
+{
+  memset (record, 0, sizeof (*record));
+  memcpy (record->csum, entry->csum, sizeof (record->csum));
+  record->objtype = entry->objtype;
+  record->ctime = GUINT64_TO_BE ((guint64) entry->ctime);
+  record->verified = GUINT64_TO_BE ((guint64) entry->verified);
+}
+
+static const FsckJournalEntry *
+fsck_journal_lookup (GArray           *journal,
+                     const guchar     *csum,
+                     OstreeObjectType  objtype)
+{
+  FsckJournalEntry key;
+
+  memcpy (key.csum, csum, sizeof (key.csum));
+  key.objtype = objtype;
+  return bsearch (&key, journal->data, journal->len, sizeof (FsckJournalEntry),
+                  compare_journal_entries);
+}
+
+/*
+ * Load the journal, sorted with one entry per object.  If
+ * @out_needs_compaction is set, the file is damaged or has repeated
+ * entries.
+ */
+static gboolean
+fsck_journal_load (OstreeRepo  *repo,
+                   GArray     **out_journal,
+                   gboolean    *out_needs_compaction,
+                   GError     **error)
+{
+  gboolean ret = FALSE;
+  glnx_fd_close int fd = -1;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GArray) journal = g_array_new (FALSE, FALSE, sizeof (FsckJournalEntry));
+  gboolean needs_compaction = FALSE;
+  const guint8 *data;
+  gsize size, n_records, i, n;
+
+  if (!ot_openat_ignore_enoent (repo->repo_dir_fd, _OSTREE_FSCK_JOURNAL_PATH, &fd, error))
+    goto out;
+
+  if (fd == -1)
+    {
+      needs_compaction = TRUE;
+      goto done;
+    }
+
+  bytes = glnx_fd_readall_bytes (fd, NULL, error);
+  if (!bytes)
+    goto out;
+
+  data = g_bytes_get_data (bytes, &size);
+  /* A damaged journal just means objects get verified again */
+  if (size < FSCK_JOURNAL_HEADER_SIZE ||
+      memcmp (data, FSCK_JOURNAL_MAGIC, FSCK_JOURNAL_HEADER_SIZE) != 0)
+    {
+      needs_compaction = TRUE;
+      goto done;
+    }
+
+  n_records = (size - FSCK_JOURNAL_HEADER_SIZE) / sizeof (FsckJournalRecord);
+  if ((size - FSCK_JOURNAL_HEADER_SIZE) % sizeof (FsckJournalRecord) != 0)
+    needs_compaction = TRUE;
+
+  for (i = 0; i < n_records; i++)
+    {
+      FsckJournalRecord record;
+      FsckJournalEntry entry;
+
+      memcpy (&record, data + FSCK_JOURNAL_HEADER_SIZE + i * sizeof (record), sizeof (record));
+      if (!ostree_validate_structureof_objtype (record.objtype, NULL))
+        {
+          needs_compaction = TRUE;
+          continue;
+        }
+      memcpy (entry.csum, record.csum, sizeof (entry.csum));
+      entry.objtype = record.objtype;
+      entry.ctime = (gint64) GUINT64_FROM_BE (record.ctime);
+      entry.verified = (gint64) GUINT64_FROM_BE (record.verified);
+      g_array_append_val (journal, entry);
+    }
+
+  /* Keep only the latest verification of each object */
+  g_array_sort (journal, compare_journal_entries_by_age);
+  for (i = 0, n = 0; i < journal->len; i++)
+    {
+      if (i + 1 < journal->len &&
+          compare_journal_entries (&g_array_index (journal, FsckJournalEntry, i),
+                                   &g_array_index (journal, FsckJournalEntry, i + 1)) == 0)
+        continue;
+      if (n != i)
+        g_array_index (journal, FsckJournalEntry, n) = g_array_index (journal, FsckJournalEntry, i);
+      n++;
+    }
+  if (n != journal->len)
+    {
+      needs_compaction = TRUE;
+      g_array_set_size (journal, n);
+    }
+
+ done:
+  ret = TRUE;
+  *out_journal = g_steal_pointer (&journal);
+  *out_needs_compaction = needs_compaction;
+ out:
+  if (!ret)
+    g_prefix_error (error, "Loading fsck journal: ");
+  return ret;
+}
+
+/* Rewrite the journal with one record per object which still exists
+ * unchanged.
+ */
+static gboolean
+fsck_journal_compact (OstreeRepo    *repo,
+                      GCancellable  *cancellable,
+                      GError       **error)
+{
+  gboolean ret = FALSE;
+  g_autoptr(GArray) journal = NULL;
+  g_autoptr(GByteArray) buf = g_byte_array_new ();
+  gboolean needs_compaction;
+  guint i;
+
+  if (!fsck_journal_load (repo, &journal, &needs_compaction, error))
+    goto out;
+
+  g_byte_array_append (buf, (guint8*) FSCK_JOURNAL_MAGIC, FSCK_JOURNAL_HEADER_SIZE);
+
+  for (i = 0; i < journal->len; i++)
+    {
+      const FsckJournalEntry *entry = &g_array_index (journal, FsckJournalEntry, i);
+      char checksum[65];
+      char loose_path[_OSTREE_LOOSE_PATH_MAX];
+      struct stat stbuf;
+      FsckJournalRecord record;
+
+      ostree_checksum_inplace_from_bytes (entry->csum, checksum);
+      _ostree_loose_path (loose_path, checksum, entry->objtype, repo->mode);
+      if (TEMP_FAILURE_RETRY (fstatat (repo->objects_dir_fd, loose_path, &stbuf,
+                                       AT_SYMLINK_NOFOLLOW)) != 0)
+        {
+          if (errno == ENOENT)
+            continue;
+          glnx_set_error_from_errno (error);
+          goto out;
+        }
+      if (stbuf.st_ctime != entry->ctime)
+        continue;
+
+      fsck_journal_record_init (&record, entry);
+      g_byte_array_append (buf, (guint8*) &record, sizeof (record));
+    }
+
+  if (mkdirat (repo->repo_dir_fd, "state", 0777) != 0)
+    {
+      if (G_UNLIKELY (errno != EEXIST))
+        {
+          glnx_set_error_from_errno (error);
+          goto out;
+        }
+    }
+
+  if (!_ostree_repo_file_replace_contents (repo, repo->repo_dir_fd, _OSTREE_FSCK_JOURNAL_PATH,
+                                           buf->data, buf->len,
+                                           cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  if (!ret)
+    g_prefix_error (error, "Compacting fsck journal: ");
+  return ret;
+}
+
+/* Read metadata straight from the object file rather than with
+ * ostree_repo_load_variant(), so that a whole-repository fsck doesn't
+ * evict everything from the metadata cache, and a cached copy can't
+ * hide corruption on disk.  Sets *out_metadata to %NULL if the object
+ * is missing.
+ */
+static gboolean
+fsck_load_metadata (OstreeRepo        *repo,
+                    const char        *checksum,
+                    OstreeObjectType   objtype,
+                    GVariant         **out_metadata,
+                    GError           **error)
+{
+  OstreeRepo *r;
+
+  for (r = repo; r != NULL; r = r->parent_repo)
+    {
+      char loose_path[_OSTREE_LOOSE_PATH_MAX];
+      glnx_fd_close int fd = -1;
+
+      _ostree_loose_path (loose_path, checksum, objtype, r->mode);
+      if (!ot_openat_ignore_enoent (r->objects_dir_fd, loose_path, &fd, error))
+        return FALSE;
+
+      if (fd != -1)
+        return ot_util_variant_map_fd (fd, 0, ostree_metadata_variant_type (objtype),
+                                       FALSE, out_metadata, error);
+    }
+
+  *out_metadata = NULL;
+  return TRUE;
+}
+
+/*
+ * Verify a single object.  Returns %FALSE only on unexpected errors;
+ * if the object is missing or corrupt, @out_corruption is set to a
+ * description of the problem.
+ */
+static gboolean
+fsck_one_object (OstreeRepo            *repo,
+                 const char            *checksum,
+                 OstreeObjectType       objtype,
+                 char                 **out_corruption,
+                 GCancellable          *cancellable,
+                 GError               **error)
+{
+  gboolean ret = FALSE;
+  g_autoptr(GVariant) metadata = NULL;
+  g_autoptr(GInputStream) input = NULL;
+  g_autoptr(GFileInfo) file_info = NULL;
+  g_autoptr(GVariant) xattrs = NULL;
+  g_autofree guchar *computed_csum = NULL;
+  g_autofree char *actual_checksum = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  *out_corruption = NULL;
+
+  if (OSTREE_OBJECT_TYPE_IS_META (objtype))
+    {
+      gboolean valid;
+
+      if (!fsck_load_metadata (repo, checksum, objtype, &metadata, &local_error))
+        {
+          g_propagate_prefixed_error (error, g_steal_pointer (&local_error),
+                                      "Loading metadata object %s: ", checksum);
+          goto out;
+        }
+      if (metadata == NULL)
+        {
+          *out_corruption = g_strdup_printf ("Object missing: %s.%s", checksum,
+                                             ostree_object_type_to_string (objtype));
+          ret = TRUE;
+          goto out;
+        }
+
+      if (objtype == OSTREE_OBJECT_TYPE_COMMIT)
+        valid = ostree_validate_structureof_commit (metadata, &local_error);
+      else if (objtype == OSTREE_OBJECT_TYPE_DIR_TREE)
+        valid = ostree_validate_structureof_dirtree (metadata, &local_error);
+      else if (objtype == OSTREE_OBJECT_TYPE_DIR_META)
+        valid = ostree_validate_structureof_dirmeta (metadata, &local_error);
+      else
+        valid = TRUE;
+      if (!valid)
+        {
+          *out_corruption = g_strdup_printf ("Invalid object %s.%s: %s", checksum,
+                                             ostree_object_type_to_string (objtype),
+                                             local_error->message);
+          ret = TRUE;
+          goto out;
+        }
+
+      input = g_memory_input_stream_new_from_data (g_variant_get_data (metadata),
+                                                   g_variant_get_size (metadata),
+                                                   NULL);
+    }
+  else
+    {
+      guint32 mode;
+
+      g_assert (objtype == OSTREE_OBJECT_TYPE_FILE);
+      if (!ostree_repo_load_file (repo, checksum, &input, &file_info,
+                                  &xattrs, cancellable, &local_error))
+        {
+          if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+            {
+              *out_corruption = g_strdup_printf ("Object missing: %s.%s", checksum,
+                                                 ostree_object_type_to_string (objtype));
+              ret = TRUE;
+              goto out;
+            }
+          g_propagate_prefixed_error (error, g_steal_pointer (&local_error),
+                                      "Loading file object %s: ", checksum);
+          goto out;
+        }
+
+      mode = g_file_info_get_attribute_uint32 (file_info, "unix::mode");
+      if (!ostree_validate_structureof_file_mode (mode, &local_error))
+        {
+          *out_corruption = g_strdup_printf ("Invalid object %s.%s: %s", checksum,
+                                             ostree_object_type_to_string (objtype),
+                                             local_error->message);
+          ret = TRUE;
+          goto out;
+        }
+    }
+
+  if (!ostree_checksum_file_from_input (file_info, xattrs, input,
+                                        objtype, &computed_csum,
+                                        cancellable, error))
+    goto out;
+
+  actual_checksum = ostree_checksum_from_bytes (computed_csum);
+  if (strcmp (checksum, actual_checksum) != 0)
+    *out_corruption = g_strdup_printf ("corrupted object %s.%s; actual checksum: %s",
+                                       checksum, ostree_object_type_to_string (objtype),
+                                       actual_checksum);
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static gboolean
+parallel_fsck_failed (ParallelFsck *fsck)
+{
+  gboolean failed;
+
+  g_mutex_lock (&fsck->lock);
+  failed = fsck->error != NULL;
+  g_mutex_unlock (&fsck->lock);
+
+  return failed || g_cancellable_is_cancelled (fsck->cancellable);
+}
+
+static gboolean
+fsck_batch (ParallelFsck  *fsck,
+            GArray        *batch,
+            GError       **error)
+{
+  gboolean ret = FALSE;
+  g_autoptr(GByteArray) records = g_byte_array_new ();
+  guint i;
+
+  for (i = 0; i < batch->len; i++)
+    {
+      const FsckItem *item = &g_array_index (batch, FsckItem, i);
+      char checksum[65];
+      g_autofree char *corruption = NULL;
+
+      if (parallel_fsck_failed (fsck))
+        break;
+
+      ostree_checksum_inplace_from_bytes (item->csum, checksum);
+      if (!fsck_one_object (fsck->repo, checksum, item->objtype, &corruption,
+                            fsck->cancellable, error))
+        goto out;
+
+      if (corruption && (fsck->flags & OSTREE_REPO_FSCK_FLAGS_DELETE) != 0)
+        (void) ostree_repo_delete_object (fsck->repo, item->objtype, checksum,
+                                          fsck->cancellable, NULL);
+
+      if (!corruption && item->journaled)
+        {
+          FsckJournalEntry entry;
+          FsckJournalRecord record;
+
+          memcpy (entry.csum, item->csum, sizeof (entry.csum));
+          entry.objtype = item->objtype;
+          entry.ctime = item->ctime;
+          entry.verified = g_get_real_time () / G_USEC_PER_SEC;
+          fsck_journal_record_init (&record, &entry);
+          g_byte_array_append (records, (guint8*) &record, sizeof (record));
+        }
+
+      g_mutex_lock (&fsck->lock);
+      if (corruption)
+        g_ptr_array_add (fsck->corrupted, g_steal_pointer (&corruption));
+      fsck->n_verified++;
+      g_mutex_unlock (&fsck->lock);
+    }
+
+  /* Save progress, so an interrupted run can resume.  A single
+   * O_APPEND write, so the threads' batches don't interleave.
+   */
+  if (fsck->journal_fd != -1 && records->len > 0 &&
+      TEMP_FAILURE_RETRY (write (fsck->journal_fd, records->data, records->len)) != (gssize) records->len)
+    g_debug ("Failed to append to fsck journal: %s", g_strerror (errno));
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static void
+fsck_batch_task_run (gpointer data,
+                     gpointer user_data)
+{
+  g_autoptr(GArray) batch = data;
+  ParallelFsck *fsck = user_data;
+  GError *local_error = NULL;
+
+  if (!parallel_fsck_failed (fsck) &&
+      !fsck_batch (fsck, batch, &local_error))
+    {
+      g_mutex_lock (&fsck->lock);
+      if (fsck->error == NULL)
+        fsck->error = local_error;
+      else
+        g_error_free (local_error);
+      g_mutex_unlock (&fsck->lock);
+    }
+}
+
+/*
+ * _ostree_repo_fsck_object_set:
+ *
+ * Like ostree_repo_fsck_objects(), but using the compact
+ * #OstreeObjectSet.
+ */
+gboolean
+_ostree_repo_fsck_object_set (OstreeRepo           *self,
+                              OstreeObjectSet      *objects,
+                              OstreeRepoFsckFlags   flags,
+                              guint64               max_age_secs,
+                              GPtrArray           **out_corrupted,
+                              guint                *out_n_verified,
+                              guint                *out_n_skipped,
+                              GCancellable         *cancellable,
+                              GError              **error)
+{
+  gboolean ret = FALSE;
+  ParallelFsck fsck = { 0, };
+  g_autoptr(GArray) journal = NULL;
+  g_autoptr(GArray) items = g_array_new (FALSE, FALSE, sizeof (FsckItem));
+  OstreeObjectSetIter setiter;
+  const guchar *csum;
+  OstreeObjectType objtype;
+  gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+  gboolean needs_compaction;
+  guint n_skipped = 0;
+  guint i;
+
+  fsck.repo = self;
+  fsck.flags = flags;
+  fsck.cancellable = cancellable;
+  fsck.journal_fd = -1;
+  g_mutex_init (&fsck.lock);
+  fsck.corrupted = g_ptr_array_new_with_free_func (g_free);
+
+  if (!fsck_journal_load (self, &journal, &needs_compaction, error))
+    goto out;
+
+  if (self->writable)
+    {
+      /* Start from a well-formed file, so records can be appended */
+      if (needs_compaction &&
+          !fsck_journal_compact (self, cancellable, error))
+        goto out;
+
+      fsck.journal_fd = openat (self->repo_dir_fd, _OSTREE_FSCK_JOURNAL_PATH,
+                                O_WRONLY | O_APPEND | O_CLOEXEC | O_NOCTTY);
+      if (fsck.journal_fd == -1)
+        {
+          glnx_set_error_from_errno (error);
+          goto out;
+        }
+    }
+
+  _ostree_object_set_iter_init (&setiter, objects);
+  while (_ostree_object_set_iter_next (&setiter, &csum, &objtype))
+    {
+      char checksum[65];
+      char loose_path[_OSTREE_LOOSE_PATH_MAX];
+      struct stat stbuf;
+      FsckItem item = { { 0, }, };
+
+      ostree_checksum_inplace_from_bytes (csum, checksum);
+      memcpy (item.csum, csum, sizeof (item.csum));
+      item.objtype = objtype;
+
+      /* Objects from a parent repo, or missing ones, just get
+       * verified (or reported) without using the journal.
+       */
+      _ostree_loose_path (loose_path, checksum, objtype, self->mode);
+      if (TEMP_FAILURE_RETRY (fstatat (self->objects_dir_fd, loose_path, &stbuf,
+                                       AT_SYMLINK_NOFOLLOW)) == 0)
+        {
+          item.journaled = TRUE;
+          item.ctime = stbuf.st_ctime;
+          item.ino = stbuf.st_ino;
+
+          if (max_age_secs > 0)
+            {
+              const FsckJournalEntry *entry =
+                fsck_journal_lookup (journal, item.csum, objtype);
+
+              if (entry && entry->ctime == item.ctime &&
+                  entry->verified <= now &&
+                  (guint64) (now - entry->verified) < max_age_secs)
+                {
+                  n_skipped++;
+                  continue;
+                }
+            }
+        }
+      else if (errno != ENOENT)
+        {
+          glnx_set_error_from_errno (error);
+          goto out;
+        }
+
+      g_array_append_val (items, item);
+    }
+
+  g_array_sort (items, compare_items_by_inode);
+
+  fsck.pool = g_thread_pool_new (fsck_batch_task_run, &fsck,
+                                 MAX (g_get_num_processors (), 1), FALSE, error);
+  if (!fsck.pool)
+    goto out;
+
+  for (i = 0; i < items->len; i += FSCK_BATCH_SIZE)
+    {
+      guint n = MIN (FSCK_BATCH_SIZE, items->len - i);
+      GArray *batch = g_array_sized_new (FALSE, FALSE, sizeof (FsckItem), n);
+
+      g_array_append_vals (batch, &g_array_index (items, FsckItem, i), n);
+      g_thread_pool_push (fsck.pool, batch, NULL);
+    }
+
+  /* Waits for all queued batches */
+  g_thread_pool_free (fsck.pool, FALSE, TRUE);
+  fsck.pool = NULL;
+
+  /* Fold this run's records in, even if we were interrupted */
+  if (fsck.journal_fd != -1)
+    {
+      g_autoptr(GError) local_error = NULL;
+
+      if (!fsck_journal_compact (self, cancellable, fsck.error ? &local_error : error) &&
+          !fsck.error)
+        goto out;
+    }
+
+  if (fsck.error)
+    {
+      g_propagate_error (error, g_steal_pointer (&fsck.error));
+      goto out;
+    }
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    goto out;
+
+  ret = TRUE;
+  if (out_n_verified)
+    *out_n_verified = fsck.n_verified;
+  if (out_n_skipped)
+    *out_n_skipped = n_skipped;
+  if (out_corrupted)
+    *out_corrupted = g_steal_pointer (&fsck.corrupted);
+ out:
+  if (fsck.journal_fd != -1)
+    (void) close (fsck.journal_fd);
+  g_clear_pointer (&fsck.corrupted, (GDestroyNotify) g_ptr_array_unref);
+  g_clear_error (&fsck.error);
+  g_mutex_clear (&fsck.lock);
+  return ret;
+}
+
+/**
+ * ostree_repo_fsck_objects:
+ * @self: Repo
+ * @objects: (element-type GVariant GVariant): Set of object names to verify, as returned by ostree_repo_traverse_commit()
+ * @flags: Options controlling verification
+ * @max_age_secs: Skip objects verified less than this many seconds ago, or 0 to verify all
+ * @out_corrupted: (out) (transfer container) (element-type utf8): Descriptions of missing or corrupted objects
+ * @out_n_verified: (out) (allow-none): Number of objects verified
+ * @out_n_skipped: (out) (allow-none): Number of objects skipped as recently verified
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Verify the checksums of @objects, using a pool of threads.  Objects
+ * are read in inode order, which on most filesystems is close to
+ * their order on disk.
+ *
+ * Successfully verified objects are recorded in a journal in the
+ * repository.  If @max_age_secs is nonzero, objects whose journal
+ * entry is younger than that, and which haven't changed since, are
+ * skipped.  Since the journal is appended to as objects are verified,
+ * this also allows resuming an interrupted run.
+ *
+ * Missing or corrupted objects don't cause an error; they're returned
+ * in @out_corrupted instead.  If %OSTREE_REPO_FSCK_FLAGS_DELETE is
+ * given, corrupted objects are also deleted.
+ */
+gboolean
+ostree_repo_fsck_objects (OstreeRepo           *self,
+                          GHashTable           *objects,
+                          OstreeRepoFsckFlags   flags,
+                          guint64               max_age_secs,
+                          GPtrArray           **out_corrupted,
+                          guint                *out_n_verified,
+                          guint                *out_n_skipped,
+                          GCancellable         *cancellable,
+                          GError              **error)
+{
+  g_autoptr(OstreeObjectSet) set = _ostree_object_set_new ();
+
+  _ostree_object_set_add_names (set, objects);
+
+  return _ostree_repo_fsck_object_set (self, set, flags, max_age_secs,
+                                       out_corrupted, out_n_verified, out_n_skipped,
+                                       cancellable, error);
+}
+
+/*
+ * _ostree_repo_fsck_commits:
+ *
+ * Verify all objects reachable from the %NULL-terminated @commits
+ * (without their parents), traversing them all into one
+ * #OstreeObjectSet; see ostree_repo_fsck_objects().
+ */
+gboolean
+_ostree_repo_fsck_commits (OstreeRepo           *self,
+                           const char * const   *commits,
+                           OstreeRepoFsckFlags   flags,
+                           guint64               max_age_secs,
+                           GPtrArray           **out_corrupted,
+                           guint                *out_n_verified,
+                           guint                *out_n_skipped,
+                           GCancellable         *cancellable,
+                           GError              **error)
+{
+  g_autoptr(OstreeObjectSet) reachable = _ostree_object_set_new ();
+
+  if (!_ostree_repo_traverse_commits_union_set (self, commits, 0, reachable,
+                                                cancellable, error))
+    return FALSE;
+
+  return _ostree_repo_fsck_object_set (self, reachable, flags, max_age_secs,
+                                       out_corrupted, out_n_verified, out_n_skipped,
+                                       cancellable, error);
+}
@@ -21,19 +21,76 @@
 #pragma once
 
 #include "ostree-repo.h"
+#include "ostree-metadata-cache.h"
+#include "ostree-object-set.h"
 #include "libglnx.h"
 
 G_BEGIN_DECLS
 
 #define OSTREE_DELTAPART_VERSION (0)
 
+/* Upper bound on memory used for parsed dirtree/dirmeta objects */
+#define _OSTREE_METADATA_CACHE_SIZE (8 * 1024 * 1024)
+
+/* Loose metadata objects at least this large are mmap()ed */
+#define _OSTREE_METADATA_MMAP_THRESHOLD (16 * 1024)
+
 #define _OSTREE_OBJECT_SIZES_ENTRY_SIGNATURE "ay"
 
 #define _OSTREE_SUMMARY_CACHE_DIR "summaries"
 #define _OSTREE_CACHE_DIR "cache"
 
+/* Under _OSTREE_CACHE_DIR; one file per commit listing the objects
+ * reachable from its root tree.
+ */
+#define _OSTREE_REACHABLE_CACHE_DIR "reachable"
+#define _OSTREE_REACHABLE_CACHE_FORMAT "a(yay)"
+
+/* Exists, and is locked, while a prune is running; its mtime is the
+ * prune epoch.
+ */
+#define _OSTREE_PRUNE_EPOCH_PATH "state/prune-epoch"
+
+/* Held exclusively by a prune while it deletes a batch of objects, and
+ * shared by writers while they freshen or replace an existing object.
+ */
+#define _OSTREE_PRUNE_SWEEP_LOCK_PATH "state/prune-sweep-lock"
+
+/* Records when objects were last verified by ostree_repo_fsck_objects();
+ * see ostree-repo-fsck.c for the format.
+ */
+#define _OSTREE_FSCK_JOURNAL_PATH "state/fsck-journal"
+
+/* Sorted lines of "<checksum> <refspec>"; loose refs take precedence.
+ * The lock file serializes rewrites.
+ */
+#define _OSTREE_PACKED_REFS_PATH "packed-refs"
+#define _OSTREE_PACKED_REFS_LOCK_PATH "packed-refs.lock"
+
+/* Held exclusively while refs are written; taken before the packed
+ * refs lock.  Objects need no lock since they are published by rename.
+ */
+#define _OSTREE_REFS_LOCK_PATH "refs.lock"
+
+/* Append-only index of commits, see ostree-repo-commit-index.c */
+#define _OSTREE_COMMIT_INDEX_PATH "state/commit-index"
+#define _OSTREE_COMMIT_INDEX_LOCK_PATH "state/commit-index.lock"
+
+typedef struct OstreeCommitIndex OstreeCommitIndex;
+typedef struct OstreePackedRefs OstreePackedRefs;
+
+/* One file per successfully verified commit, see
+ * _ostree_repo_verify_commit_cached().  Entries hold the verification
+ * time, the number of valid signatures and each signature's attributes.
+ */
+#define _OSTREE_GPG_VERIFY_CACHE_PATH "state/gpg-verify-cache"
+#define _OSTREE_GPG_VERIFY_CACHE_FORMAT "(tuav)"
+#define _OSTREE_GPG_VERIFY_CACHE_MAX_AGE (24 * 60 * 60)
+
 typedef enum {
-  OSTREE_REPO_TEST_ERROR_PRE_COMMIT = (1 << 0)
+  OSTREE_REPO_TEST_ERROR_PRE_COMMIT = (1 << 0),
+  OSTREE_REPO_TEST_ERROR_BSPATCH_COPY = (1 << 1),
+  OSTREE_REPO_TEST_ERROR_NO_TMPFILE = (1 << 2)
 } OstreeRepoTestErrorFlags;
 
 struct OstreeRepoCommitModifier {
@@ -75,7 +132,6 @@ struct OstreeRepo {
   GFile *sysroot_dir;
   char *remotes_config_dir;
 
-  GFile *transaction_lock_path;
   GHashTable *txn_refs;
   GMutex txn_stats_lock;
   OstreeRepoTransactionStats txn_stats;
@@ -89,9 +145,18 @@ struct OstreeRepo {
   GError *writable_error;
   gboolean in_transaction;
   gboolean disable_fsync;
+  gint tmpfile_unsupported; /* atomic; O_TMPFILE failed in tmp/ */
   GHashTable *loose_object_devino_hash;
   GHashTable *updated_uncompressed_dirs;
+  GHashTable *uncompressed_cache_used; /* checksums; protected by cache_lock */
+  guint64 uncompressed_cache_hits; /* protected by cache_lock */
+  guint64 uncompressed_cache_misses; /* protected by cache_lock */
+  OstreePackedRefs *packed_refs; /* protected by cache_lock */
+  struct stat packed_refs_stbuf; /* protected by cache_lock */
+  OstreeCommitIndex *commit_index; /* protected by cache_lock */
   GHashTable *object_sizes;
+  OstreeMetadataCache *metadata_cache; /* dirtree/dirmeta; internally locked */
+  struct OstreeGpgHomeCache *gpg_home_cache; /* internally locked */
 
   uid_t target_owner_uid;
   gid_t target_owner_gid;
@@ -100,9 +165,15 @@ struct OstreeRepo {
 
   GKeyFile *config;
   GHashTable *remotes;
+  gboolean remotes_loaded; /* protected by remotes_lock */
+  GError *remotes_error; /* protected by remotes_lock */
   GMutex remotes_lock;
   OstreeRepoMode mode;
   gboolean enable_uncompressed_cache;
+  guint64 uncompressed_cache_max_size;
+  gboolean enable_traverse_cache;
+  gboolean enable_packed_refs;
+  gboolean enable_gpg_verify_cache;
   gboolean generate_sizes;
   guint64 tmp_expiry_seconds;
 
@@ -115,6 +186,18 @@ typedef struct {
   char checksum[65];
 } OstreeDevIno;
 
+/*
+ * The index of the uncompressed object cache, stored as "index" in
+ * uncompressed-objects-cache/.  It is a local cache, so integers are
+ * in host byte order:
+ *
+ * t - Cumulative cache hits
+ * t - Cumulative cache misses
+ * a(aytt) - Cached objects: checksum, size, time of last use (seconds
+ *           since the epoch)
+ */
+#define _OSTREE_UNCOMPRESSED_CACHE_INDEX_FORMAT "(tta(aytt))"
+
 #define OSTREE_REPO_TMPDIR_STAGING "staging-"
 #define OSTREE_REPO_TMPDIR_FETCHER "fetcher-"
 
@@ -213,6 +296,129 @@ _ostree_repo_traverse_dirtree_internal (OstreeRepo      *repo,
                                         GCancellable    *cancellable,
                                         GError         **error);
 
+gboolean
+_ostree_repo_traverse_commit_union_set (OstreeRepo       *repo,
+                                        const char       *commit_checksum,
+                                        int               maxdepth,
+                                        OstreeObjectSet  *inout_reachable,
+                                        GCancellable     *cancellable,
+                                        GError          **error);
+
+gboolean
+_ostree_repo_traverse_commits_union_set (OstreeRepo         *repo,
+                                         const char * const *commits,
+                                         int                 maxdepth,
+                                         OstreeObjectSet    *inout_reachable,
+                                         GCancellable       *cancellable,
+                                         GError            **error);
+
+gboolean
+_ostree_repo_remove_reachable_cache (OstreeRepo   *repo,
+                                     const char   *commit_checksum,
+                                     GError      **error);
+
+gboolean
+_ostree_repo_prune_reachable_cache (OstreeRepo    *repo,
+                                    GCancellable  *cancellable,
+                                    GError       **error);
+
+gboolean
+_ostree_repo_lock_prune_sweep (OstreeRepo    *self,
+                               GLnxLockFile  *out_lockfile,
+                               GError       **error);
+
+gboolean
+_ostree_repo_freshen_loose_object (OstreeRepo    *self,
+                                   const char    *loose_path,
+                                   gboolean      *out_is_fresh,
+                                   GError       **error);
+
+gboolean
+_ostree_repo_fsck_object_set (OstreeRepo           *self,
+                              OstreeObjectSet      *objects,
+                              OstreeRepoFsckFlags   flags,
+                              guint64               max_age_secs,
+                              GPtrArray           **out_corrupted,
+                              guint                *out_n_verified,
+                              guint                *out_n_skipped,
+                              GCancellable         *cancellable,
+                              GError              **error);
+
+gboolean
+_ostree_repo_fsck_commits (OstreeRepo           *self,
+                           const char * const   *commits,
+                           OstreeRepoFsckFlags   flags,
+                           guint64               max_age_secs,
+                           GPtrArray           **out_corrupted,
+                           guint                *out_n_verified,
+                           guint                *out_n_skipped,
+                           GCancellable         *cancellable,
+                           GError              **error);
+
+gboolean
+_ostree_repo_parse_loose_object_name (OstreeRepo        *self,
+                                      const char        *prefix,
+                                      const char        *name,
+                                      char              *out_checksum,
+                                      OstreeObjectType  *out_objtype);
+
+gboolean
+_ostree_repo_list_objects_set (OstreeRepo                  *self,
+                               OstreeRepoListObjectsFlags   flags,
+                               OstreeObjectSet             *inout_objects,
+                               GCancellable                *cancellable,
+                               GError                     **error);
+
+typedef struct {
+  guchar csum[OSTREE_SHA256_DIGEST_LEN];
+  OstreeObjectType objtype;
+} OstreeLooseObject;
+
+#define _OSTREE_OBJECT_TYPE_MASK(objtype) (1U << (objtype))
+#define _OSTREE_OBJECT_TYPE_MASK_ALL (G_MAXUINT)
+
+typedef gboolean (*OstreeRepoLooseObjectsFunc) (OstreeRepo               *self,
+                                                const OstreeLooseObject  *objects,
+                                                guint                     n_objects,
+                                                gpointer                  user_data,
+                                                GError                  **error);
+
+gboolean
+_ostree_repo_enumerate_loose_objects (OstreeRepo                  *self,
+                                      guint                        objtype_mask,
+                                      const char                  *checksum_prefix,
+                                      OstreeRepoLooseObjectsFunc   func,
+                                      gpointer                     user_data,
+                                      GCancellable                *cancellable,
+                                      GError                     **error);
+
+void
+_ostree_commit_index_unref (OstreeCommitIndex *index);
+
+void
+_ostree_packed_refs_unref (OstreePackedRefs *packed_refs);
+
+gboolean
+_ostree_repo_commit_index_add (OstreeRepo    *self,
+                               const char    *checksum,
+                               GCancellable  *cancellable,
+                               GError       **error);
+
+gboolean
+_ostree_repo_commit_index_lookup_prefix (OstreeRepo    *self,
+                                         const char    *prefix,
+                                         GPtrArray    **out_checksums,
+                                         GCancellable  *cancellable,
+                                         GError       **error);
+
+gboolean
+_ostree_repo_commit_index_get_parent (OstreeRepo    *self,
+                                      const char    *checksum,
+                                      gboolean      *out_found,
+                                      char         **out_parent,
+                                      GCancellable  *cancellable,
+                                      GError       **error);
+
 OstreeRepoCommitFilterResult
 _ostree_repo_commit_modifier_apply (OstreeRepo               *self,
                                     OstreeRepoCommitModifier *modifier,
@@ -223,6 +429,10 @@ _ostree_repo_commit_modifier_apply (OstreeRepo               *self,
 gboolean
 _ostree_repo_remote_name_is_file (const char *remote_name);
 
+GHashTable *
+_ostree_repo_list_remote_names (OstreeRepo  *self,
+                                GError     **error);
+
 OstreeGpgVerifyResult *
 _ostree_repo_gpg_verify_with_metadata (OstreeRepo          *self,
                                        GBytes              *signed_data,
@@ -242,6 +452,18 @@ _ostree_repo_verify_commit_internal (OstreeRepo    *self,
                                      GCancellable  *cancellable,
                                      GError       **error);
 
+gboolean
+_ostree_repo_verify_commit_cached (OstreeRepo             *self,
+                                   const char             *commit_checksum,
+                                   const char             *remote_name,
+                                   GFile                  *keyringdir,
+                                   GFile                  *extra_keyring,
+                                   GVariant              **out_signatures,
+                                   guint                  *out_n_valid,
+                                   OstreeGpgVerifyResult **out_result,
+                                   GCancellable           *cancellable,
+                                   GError                **error);
+
 gboolean
 _ostree_repo_commit_loose_final (OstreeRepo        *self,
                                  const char        *checksum,
@@ -27,15 +27,62 @@
 #include "otutil.h"
 
 typedef struct {
-  OstreeRepo *repo;
-  GHashTable *reachable;
   guint n_reachable_meta;
   guint n_reachable_content;
   guint n_unreachable_meta;
   guint n_unreachable_content;
   guint64 freed_bytes;
+} OtPruneCounts;
+
+typedef struct {
+  OstreeRepo *repo;
+  OstreeRepoPruneFlags flags;
+  OstreeObjectSet *reachable;
+  struct timespec epoch;
+  GCancellable *cancellable;
+  OtPruneCounts counts; /* batches are never handled concurrently */
 } OtPruneData;
 
+/* Set on the thread which holds the sweep lock, so that writes made
+ * by the prune itself, such as tombstone commits, don't wait for it.
+ */
+static GPrivate sweeping_thread;
+
+/* How long to wait for transactions already open when a prune starts */
+#define PRUNE_TRANSACTION_TIMEOUT_SECS (5 * 60)
+
+/*
+ * _ostree_repo_lock_prune_sweep:
+ * @out_lockfile: Set to a shared lock on the prune sweep, if a prune is running
+ *
+ * A prune keeps any object whose ctime is newer than its epoch, but it
+ * checks the ctime before deleting the object.  Writers which reuse an
+ * existing object must freshen it, or replace it, while holding this
+ * lock; the prune then either sees the new ctime, or has already
+ * deleted the object, in which case freshening fails.
+ */
+gboolean
+_ostree_repo_lock_prune_sweep (OstreeRepo    *self,
+                               GLnxLockFile  *out_lockfile,
+                               GError       **error)
+{
+  struct stat stbuf;
+
+  if (g_private_get (&sweeping_thread))
+    return TRUE;
+
+  if (fstatat (self->repo_dir_fd, _OSTREE_PRUNE_EPOCH_PATH, &stbuf, 0) != 0)
+    {
+      if (errno == ENOENT)
+        return TRUE;
+      glnx_set_error_from_errno (error);
+      return FALSE;
+    }
+
+  return glnx_make_lock_file (self->repo_dir_fd, _OSTREE_PRUNE_SWEEP_LOCK_PATH,
+                              LOCK_SH, out_lockfile, error);
+}
+
 static gboolean
 prune_commitpartial_file (OstreeRepo    *repo,
                           const char    *checksum,
@@ -61,54 +108,198 @@ prune_commitpartial_file (OstreeRepo    *repo,
 
 static gboolean
 maybe_prune_loose_object (OtPruneData        *data,
-                          OstreeRepoPruneFlags    flags,
                           const char         *checksum,
                           OstreeObjectType    objtype,
-                          GCancellable       *cancellable,
                           GError            **error)
 {
   gboolean ret = FALSE;
-  g_autoptr(GVariant) key = NULL;
+  gboolean keep;
 
-  key = ostree_object_name_serialize (checksum, objtype);
-
-  if (!g_hash_table_lookup_extended (data->reachable, key, NULL, NULL))
+  keep = _ostree_object_set_contains_checksum (data->reachable, checksum, objtype);
+  if (!keep)
     {
-      g_debug ("Pruning unneeded object %s.%s", checksum,
-               ostree_object_type_to_string (objtype));
-      if (!(flags & OSTREE_REPO_PRUNE_FLAGS_NO_PRUNE))
-        {
-          guint64 storage_size = 0;
+      char loose_path[_OSTREE_LOOSE_PATH_MAX];
+      struct stat stbuf;
+
+      _ostree_loose_path (loose_path, checksum, objtype, data->repo->mode);
 
-          if (objtype == OSTREE_OBJECT_TYPE_COMMIT)
+      if (TEMP_FAILURE_RETRY (fstatat (data->repo->objects_dir_fd, loose_path,
+                                       &stbuf, AT_SYMLINK_NOFOLLOW)) != 0)
+        {
+          if (errno == ENOENT)
             {
-              if (!prune_commitpartial_file (data->repo, checksum, cancellable, error))
-                goto out;
+              ret = TRUE;
+              goto out;
             }
+          glnx_set_error_from_errno (error);
+          goto out;
+        }
 
-          if (!ostree_repo_query_object_storage_size (data->repo, objtype, checksum,
-                                                      &storage_size, cancellable, error))
-            goto out;
+      /* Written, linked or reused by a transaction since we started;
+       * it may be part of a commit we haven't seen.
+       */
+      if (stbuf.st_ctim.tv_sec > data->epoch.tv_sec ||
+          (stbuf.st_ctim.tv_sec == data->epoch.tv_sec &&
+           stbuf.st_ctim.tv_nsec >= data->epoch.tv_nsec))
+        {
+          g_debug ("Keeping new object %s.%s", checksum,
+                   ostree_object_type_to_string (objtype));
+          keep = TRUE;
+        }
+      else
+        {
+          g_debug ("Pruning unneeded object %s.%s", checksum,
+                   ostree_object_type_to_string (objtype));
+          if (!(data->flags & OSTREE_REPO_PRUNE_FLAGS_NO_PRUNE))
+            {
+              if (objtype == OSTREE_OBJECT_TYPE_COMMIT)
+                {
+                  if (!prune_commitpartial_file (data->repo, checksum, data->cancellable, error))
+                    goto out;
+                }
 
-          if (!ostree_repo_delete_object (data->repo, objtype, checksum,
-                                          cancellable, error))
-            goto out;
+              if (!ostree_repo_delete_object (data->repo, objtype, checksum,
+                                              data->cancellable, error))
+                goto out;
 
-          data->freed_bytes += storage_size;
+              data->counts.freed_bytes += stbuf.st_size;
+            }
+          if (OSTREE_OBJECT_TYPE_IS_META (objtype))
+            data->counts.n_unreachable_meta++;
+          else
+            data->counts.n_unreachable_content++;
         }
-      if (OSTREE_OBJECT_TYPE_IS_META (objtype))
-        data->n_unreachable_meta++;
-      else
-        data->n_unreachable_content++;
     }
   else
+    g_debug ("Keeping needed object %s.%s", checksum,
+             ostree_object_type_to_string (objtype));
+
+  if (keep)
     {
-      g_debug ("Keeping needed object %s.%s", checksum,
-               ostree_object_type_to_string (objtype));
       if (OSTREE_OBJECT_TYPE_IS_META (objtype))
-        data->n_reachable_meta++;
+        data->counts.n_reachable_meta++;
       else
-        data->n_reachable_content++;
+        data->counts.n_reachable_content++;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/* Each batch is checked and deleted under the sweep lock, so that a
+ * writer can't freshen an object between its ctime being read and it
+ * being deleted.
+ */
+static gboolean
+prune_loose_objects_batch (OstreeRepo               *repo,
+                           const OstreeLooseObject  *objects,
+                           guint                     n_objects,
+                           gpointer                  user_data,
+                           GError                  **error)
+{
+  gboolean ret = FALSE;
+  OtPruneData *data = user_data;
+  g_auto(GLnxLockFile) sweep_lock = GLNX_LOCK_FILE_INIT;
+  guint i;
+
+  if (!(data->flags & OSTREE_REPO_PRUNE_FLAGS_NO_PRUNE))
+    {
+      if (!glnx_make_lock_file (repo->repo_dir_fd, _OSTREE_PRUNE_SWEEP_LOCK_PATH,
+                                LOCK_EX, &sweep_lock, error))
+        goto out;
+      g_private_set (&sweeping_thread, GINT_TO_POINTER (TRUE));
+    }
+
+  for (i = 0; i < n_objects; i++)
+    {
+      char checksum[65];
+
+      ostree_checksum_inplace_from_bytes (objects[i].csum, checksum);
+
+      if (!maybe_prune_loose_object (data, checksum, objects[i].objtype, error))
+        goto out;
+    }
+
+  ret = TRUE;
+ out:
+  g_private_set (&sweeping_thread, NULL);
+  return ret;
+}
+
+/* Transactions opened before the epoch may have found an object
+ * already stored without freshening it, and that object may only
+ * become reachable once they commit.  Each open transaction holds the
+ * lock on its staging directory, so wait for those to be released
+ * before we look for commits.
+ *
+ * The wait is bounded, since a transaction may stay open indefinitely;
+ * notably, one opened by this process on another #OstreeRepo for the
+ * same repository can never finish while we wait for it.
+ */
+static gboolean
+wait_for_open_transactions (OstreeRepo    *self,
+                            GCancellable  *cancellable,
+                            GError       **error)
+{
+  gboolean ret = FALSE;
+  g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+  gint64 deadline = g_get_monotonic_time () + PRUNE_TRANSACTION_TIMEOUT_SECS * G_USEC_PER_SEC;
+
+  if (!glnx_dirfd_iterator_init_at (self->tmp_dir_fd, ".", TRUE, &dfd_iter, error))
+    goto out;
+
+  while (TRUE)
+    {
+      struct dirent *dent;
+      struct stat stbuf;
+      g_auto(GLnxLockFile) lockfile = GLNX_LOCK_FILE_INIT;
+      gboolean did_lock = FALSE;
+
+      if (!glnx_dirfd_iterator_next_dent (&dfd_iter, &dent, cancellable, error))
+        goto out;
+
+      if (dent == NULL)
+        break;
+
+      if (!g_str_has_prefix (dent->d_name, OSTREE_REPO_TMPDIR_STAGING))
+        continue;
+
+      /* Our own transaction, if any, can't be waited for */
+      if (g_strcmp0 (dent->d_name, self->commit_stagedir_name) == 0)
+        continue;
+
+      if (TEMP_FAILURE_RETRY (fstatat (dfd_iter.fd, dent->d_name, &stbuf, AT_SYMLINK_NOFOLLOW)) < 0)
+        {
+          if (errno == ENOENT)
+            continue;
+          glnx_set_error_from_errno (error);
+          goto out;
+        }
+      if (!S_ISDIR (stbuf.st_mode))
+        continue;
+
+      /* Poll until the transaction using it, if any, is done */
+      while (TRUE)
+        {
+          if (!_ostree_repo_try_lock_tmpdir (dfd_iter.fd, dent->d_name,
+                                             &lockfile, &did_lock, error))
+            goto out;
+          if (did_lock)
+            break;
+
+          if (g_get_monotonic_time () >= deadline)
+            {
+              g_set_error (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                           "Timed out waiting for the transaction using tmp/%s to finish",
+                           dent->d_name);
+              goto out;
+            }
+          if (g_cancellable_set_error_if_cancelled (cancellable, error))
+            goto out;
+
+          g_usleep (G_USEC_PER_SEC / 10);
+        }
     }
 
   ret = TRUE;
@@ -123,6 +314,7 @@ _ostree_repo_prune_tmp (OstreeRepo *self,
 {
   gboolean ret = FALSE;
   g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+  g_autoptr(GHashTable) remotes = NULL;
   glnx_fd_close int fd = -1;
 
   if (self->cache_dir_fd == -1)
@@ -141,6 +333,10 @@ _ostree_repo_prune_tmp (OstreeRepo *self,
   if (!glnx_dirfd_iterator_init_take_fd (dup (fd), &dfd_iter, error))
     goto out;
 
+  remotes = _ostree_repo_list_remote_names (self, error);
+  if (remotes == NULL)
+    goto out;
+
   while (TRUE)
     {
       size_t len;
@@ -160,7 +356,7 @@ _ostree_repo_prune_tmp (OstreeRepo *self,
           dent->d_name[len - 4] = '\0';
         }
 
-      if (!g_hash_table_contains (self->remotes, dent->d_name))
+      if (!g_hash_table_contains (remotes, dent->d_name))
         {
           /* Restore the previous value to get the file name.  */
           if (has_sig_suffix)
@@ -278,6 +474,17 @@ ostree_repo_prune_static_deltas (OstreeRepo *self, const char *commit,
  * Use the %OSTREE_REPO_PRUNE_FLAGS_NO_PRUNE to just determine
  * statistics on objects that would be deleted, without actually
  * deleting them.
+ *
+ * Pruning may run concurrently with commits and pulls.  Any object
+ * written, or reused by a transaction, after the prune started is
+ * kept, even if it isn't reachable yet.  Transactions already open
+ * when the prune starts are waited for before looking for commits,
+ * so a long-running pull will delay the prune; if one is still open
+ * after five minutes, the prune fails with %G_IO_ERROR_TIMED_OUT.
+ * This is always the case for a transaction open on another
+ * #OstreeRepo for the same repository in the calling process.  Dry
+ * runs with %OSTREE_REPO_PRUNE_FLAGS_NO_PRUNE neither wait nor modify
+ * the repository.
  */
 gboolean
 ostree_repo_prune (OstreeRepo        *self,
@@ -292,13 +499,55 @@ ostree_repo_prune (OstreeRepo        *self,
   gboolean ret = FALSE;
   GHashTableIter hash_iter;
   gpointer key, value;
-  g_autoptr(GHashTable) objects = NULL;
   g_autoptr(GHashTable) all_refs = NULL;
+  g_autoptr(GHashTable) all_commits = NULL;
+  g_auto(GLnxLockFile) epoch_lock = GLNX_LOCK_FILE_INIT;
+  struct stat stbuf;
   OtPruneData data = { 0, };
   gboolean refs_only = flags & OSTREE_REPO_PRUNE_FLAGS_REFS_ONLY;
 
   data.repo = self;
-  data.reachable = ostree_repo_traverse_new_reachable ();
+  data.flags = flags;
+  data.reachable = _ostree_object_set_new ();
+  data.cancellable = cancellable;
+
+  if (flags & OSTREE_REPO_PRUNE_FLAGS_NO_PRUNE)
+    {
+      /* Nothing is deleted, so there's nothing to race with */
+      if (clock_gettime (CLOCK_REALTIME, &data.epoch) != 0)
+        {
+          glnx_set_error_from_errno (error);
+          goto out;
+        }
+    }
+  else
+    {
+      /* Start a new epoch before finding reachable objects.  While the
+       * lock file exists, transactions bump the ctime of objects they
+       * reuse, so we can tell them apart from old unreachable ones.
+       * Concurrent prunes wait for each other here.
+       */
+      if (mkdirat (self->repo_dir_fd, "state", 0777) != 0)
+        {
+          if (G_UNLIKELY (errno != EEXIST))
+            {
+              glnx_set_error_from_errno (error);
+              goto out;
+            }
+        }
+      if (!glnx_make_lock_file (self->repo_dir_fd, _OSTREE_PRUNE_EPOCH_PATH, LOCK_EX,
+                                &epoch_lock, error))
+        goto out;
+      if (futimens (epoch_lock.fd, NULL) != 0 || fstat (epoch_lock.fd, &stbuf) != 0)
+        {
+          glnx_set_error_from_errno (error);
+          goto out;
+        }
+      data.epoch = stbuf.st_mtim;
+
+      if (!wait_for_open_transactions (self, cancellable, error))
+        goto out;
+    }
 
   if (refs_only)
     {
@@ -319,8 +568,8 @@ ostree_repo_prune (OstreeRepo        *self,
             goto out;
 
           g_debug ("Finding objects to keep for commit %s", checksum);
-          if (!ostree_repo_traverse_commit_union (self, checksum, depth, data.reachable,
-                                                  cancellable, &local_error))
+          if (!_ostree_repo_traverse_commit_union_set (self, checksum, depth, data.reachable,
+                                                       cancellable, &local_error))
             {
               /* Don't fail traversing a partial commit */
               if ((commitstate & OSTREE_REPO_COMMIT_STATE_PARTIAL) > 0 &&
@@ -336,34 +585,29 @@ ostree_repo_prune (OstreeRepo        *self,
             }
         }
     }
-
-  if (!ostree_repo_list_objects (self, OSTREE_REPO_LIST_OBJECTS_ALL, &objects,
-                                 cancellable, error))
-    goto out;
-
-  if (!refs_only)
+  else
     {
-      g_hash_table_iter_init (&hash_iter, objects);
+      if (!ostree_repo_list_commit_objects_starting_with (self, "", &all_commits,
+                                                          cancellable, error))
+        goto out;
+
+      g_hash_table_iter_init (&hash_iter, all_commits);
       while (g_hash_table_iter_next (&hash_iter, &key, &value))
         {
-          GVariant *serialized_key = key;
           const char *checksum;
           OstreeObjectType objtype;
           OstreeRepoCommitState commitstate;
           GError *local_error = NULL;
 
-          ostree_object_name_deserialize (serialized_key, &checksum, &objtype);
-
-          if (objtype != OSTREE_OBJECT_TYPE_COMMIT)
-            continue;
+          ostree_object_name_deserialize (key, &checksum, &objtype);
 
           if (!ostree_repo_load_commit (self, checksum, NULL, &commitstate,
                                         error))
             goto out;
 
           g_debug ("Finding objects to keep for commit %s", checksum);
-          if (!ostree_repo_traverse_commit_union (self, checksum, depth, data.reachable,
-                                                  cancellable, &local_error))
+          if (!_ostree_repo_traverse_commit_union_set (self, checksum, depth, data.reachable,
+                                                       cancellable, &local_error))
             {
               /* Don't fail traversing a partial commit */
               if ((commitstate & OSTREE_REPO_COMMIT_STATE_PARTIAL) > 0 &&
@@ -380,39 +624,29 @@ ostree_repo_prune (OstreeRepo        *self,
         }
     }
 
-  g_hash_table_iter_init (&hash_iter, objects);
-  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+  if (!_ostree_repo_enumerate_loose_objects (self, _OSTREE_OBJECT_TYPE_MASK_ALL, NULL,
+                                             prune_loose_objects_batch, &data,
+                                             cancellable, error))
+    goto out;
+
+  if (!(flags & OSTREE_REPO_PRUNE_FLAGS_NO_PRUNE))
     {
-      GVariant *serialized_key = key;
-      GVariant *objdata = value;
-      const char *checksum;
-      OstreeObjectType objtype;
-      gboolean is_loose;
-      
-      ostree_object_name_deserialize (serialized_key, &checksum, &objtype);
-      g_variant_get_child (objdata, 0, "b", &is_loose);
+      if (!_ostree_repo_prune_reachable_cache (self, cancellable, error))
+        goto out;
 
-      if (!is_loose)
-        continue;
+      if (!ostree_repo_prune_static_deltas (self, NULL, cancellable, error))
+        goto out;
 
-      if (!maybe_prune_loose_object (&data, flags, checksum, objtype,
-                                     cancellable, error))
+      if (!_ostree_repo_prune_tmp (self, cancellable, error))
         goto out;
     }
 
-  if (!ostree_repo_prune_static_deltas (self, NULL, cancellable, error))
-    goto out;
-
-  if (!_ostree_repo_prune_tmp (self, cancellable, error))
-    goto out;
-
   ret = TRUE;
-  *out_objects_total = (data.n_reachable_meta + data.n_unreachable_meta +
-                        data.n_reachable_content + data.n_unreachable_content);
-  *out_objects_pruned = (data.n_unreachable_meta + data.n_unreachable_content);
-  *out_pruned_object_size_total = data.freed_bytes;
+  *out_objects_total = (data.counts.n_reachable_meta + data.counts.n_unreachable_meta +
+                        data.counts.n_reachable_content + data.counts.n_unreachable_content);
+  *out_objects_pruned = (data.counts.n_unreachable_meta + data.counts.n_unreachable_content);
+  *out_pruned_object_size_total = data.counts.freed_bytes;
  out:
-  if (data.reachable)
-    g_hash_table_unref (data.reachable);
+  _ostree_object_set_free (data.reachable);
   return ret;
 }
@@ -54,6 +54,7 @@ typedef struct {
 
   gboolean      dry_run;
   gboolean      dry_run_emitted_progress;
+  gboolean      stream_deltaparts;
   gboolean      legacy_transaction_resuming;
   enum {
     OSTREE_PULL_PHASE_FETCHING_REFS,
@@ -72,6 +73,7 @@ typedef struct {
   GPtrArray        *static_delta_superblocks;
   GHashTable       *expected_commit_sizes; /* Maps commit checksum to known size */
   GHashTable       *commit_to_depth; /* Maps commit checksum maximum depth */
+  GHashTable       *verified_commits; /* Commit checksums with valid signatures */
   GHashTable       *scanned_metadata; /* Maps object name to itself */
   GHashTable       *requested_metadata; /* Maps object name to itself */
   GHashTable       *requested_content; /* Maps object name to itself */
@@ -81,6 +83,7 @@ typedef struct {
   guint             n_outstanding_content_write_requests;
   guint             n_outstanding_deltapart_fetches;
   guint             n_outstanding_deltapart_write_requests;
+  guint             n_outstanding_gpg_verifications;
   guint             n_total_deltaparts;
   guint64           total_deltapart_size;
   guint64           total_deltapart_usize;
@@ -135,6 +138,16 @@ typedef struct {
   guint recursion_depth;
 } ScanObjectQueueData;
 
+typedef struct {
+  OtPullData  *pull_data;
+  char        *remote_name;
+  char        *checksum;
+  guint        recursion_depth;
+  guint        n_valid;
+  gboolean     want_result;
+  OstreeGpgVerifyResult *result;
+} VerifyCommitData;
+
 static void queue_scan_one_metadata_object (OtPullData         *pull_data,
                                             const char         *csum,
                                             OstreeObjectType    objtype,
@@ -230,7 +243,8 @@ pull_termination_condition (OtPullData          *pull_data)
   gboolean current_write_idle = (pull_data->n_outstanding_metadata_write_requests == 0 &&
                                  pull_data->n_outstanding_content_write_requests == 0 &&
                                  pull_data->n_outstanding_deltapart_write_requests == 0 );
-  gboolean current_scan_idle = g_queue_is_empty (&pull_data->scan_object_queue);
+  gboolean current_scan_idle = (g_queue_is_empty (&pull_data->scan_object_queue) &&
+                                pull_data->n_outstanding_gpg_verifications == 0);
   gboolean current_idle = current_fetch_idle && current_write_idle && current_scan_idle;
 
   if (pull_data->caught_error)
@@ -820,6 +834,23 @@ on_static_delta_written (GObject           *object,
   fetch_static_delta_data_free (fetch_data);
 }
 
+static void
+execute_fetched_deltapart (FetchStaticDeltaData *fetch_data,
+                           GVariant             *part)
+{
+  OtPullData *pull_data = fetch_data->pull_data;
+
+  _ostree_static_delta_part_execute_async (pull_data->repo,
+                                           fetch_data->objects,
+                                           part,
+                                           /* Trust checksums if summary was gpg signed */
+                                           pull_data->gpg_verify_summary && pull_data->summary_data_sig,
+                                           pull_data->cancellable,
+                                           on_static_delta_written,
+                                           fetch_data);
+  pull_data->n_outstanding_deltapart_write_requests++;
+}
+
 static void
 static_deltapart_fetch_on_complete (GObject           *object,
                                     GAsyncResult      *result,
@@ -863,15 +894,7 @@ static_deltapart_fetch_on_complete (GObject           *object,
                                        &part, pull_data->cancellable, error))
     goto out;
 
-  _ostree_static_delta_part_execute_async (pull_data->repo,
-                                           fetch_data->objects,
-                                           part,
-                                           /* Trust checksums if summary was gpg signed */
-                                           pull_data->gpg_verify_summary && pull_data->summary_data_sig,
-                                           pull_data->cancellable,
-                                           on_static_delta_written,
-                                           fetch_data);
-  pull_data->n_outstanding_deltapart_write_requests++;
+  execute_fetched_deltapart (fetch_data, part);
 
  out:
   g_assert (pull_data->n_outstanding_deltapart_fetches > 0);
@@ -882,6 +905,196 @@ static_deltapart_fetch_on_complete (GObject           *object,
     fetch_static_delta_data_free (fetch_data);
 }
 
+static void
+open_streamed_deltapart_thread (GTask         *task,
+                                gpointer       source_object,
+                                gpointer       task_data,
+                                GCancellable  *cancellable)
+{
+  FetchStaticDeltaData *fetch_data = g_task_get_task_data (task);
+  GInputStream *in = source_object;
+  g_autoptr(GVariant) part = NULL;
+  GError *local_error = NULL;
+
+  if (!_ostree_static_delta_part_open (in, NULL, 0, fetch_data->expected_checksum,
+                                       &part, cancellable, &local_error))
+    g_task_return_error (task, local_error);
+  else
+    g_task_return_pointer (task, g_steal_pointer (&part), (GDestroyNotify) g_variant_unref);
+}
+
+static void
+on_streamed_deltapart_opened (GObject           *object,
+                              GAsyncResult      *result,
+                              gpointer           user_data)
+{
+  FetchStaticDeltaData *fetch_data = user_data;
+  OtPullData *pull_data = fetch_data->pull_data;
+  g_autoptr(GVariant) part = NULL;
+  GError *local_error = NULL;
+
+  g_debug ("stream static delta part %s complete", fetch_data->expected_checksum);
+
+  part = g_task_propagate_pointer (G_TASK (result), &local_error);
+  if (!part)
+    goto out;
+
+  execute_fetched_deltapart (fetch_data, part);
+
+ out:
+  g_assert (pull_data->n_outstanding_deltapart_fetches > 0);
+  pull_data->n_outstanding_deltapart_fetches--;
+  pull_data->n_fetched_deltaparts++;
+  check_outstanding_requests_handle_error (pull_data, local_error);
+  if (local_error)
+    fetch_static_delta_data_free (fetch_data);
+}
+
+/* Streaming mode: rather than downloading the part to the fetcher
+ * tmpdir first, decompress and checksum it as it arrives, in a
+ * worker thread since the reads block.
+ */
+static void
+static_deltapart_stream_on_request (GObject           *object,
+                                    GAsyncResult      *result,
+                                    gpointer           user_data)
+{
+  OstreeFetcher *fetcher = (OstreeFetcher *)object;
+  FetchStaticDeltaData *fetch_data = user_data;
+  OtPullData *pull_data = fetch_data->pull_data;
+  g_autoptr(GInputStream) in = NULL;
+  g_autoptr(GTask) task = NULL;
+  GError *local_error = NULL;
+
+  in = ostree_fetcher_stream_uri_finish (fetcher, result, &local_error);
+  if (!in)
+    {
+      g_assert (pull_data->n_outstanding_deltapart_fetches > 0);
+      pull_data->n_outstanding_deltapart_fetches--;
+      pull_data->n_fetched_deltaparts++;
+      check_outstanding_requests_handle_error (pull_data, local_error);
+      fetch_static_delta_data_free (fetch_data);
+      return;
+    }
+
+  task = g_task_new (in, pull_data->cancellable, on_streamed_deltapart_opened, fetch_data);
+  g_task_set_task_data (task, fetch_data, NULL);
+  g_task_run_in_thread (task, open_streamed_deltapart_thread);
+}
+
+static gboolean scan_commit_object (OtPullData         *pull_data,
+                                    const char         *checksum,
+                                    guint               recursion_depth,
+                                    GCancellable       *cancellable,
+                                    GError            **error);
+
+static void
+verify_commit_data_free (VerifyCommitData *data)
+{
+  g_free (data->remote_name);
+  g_free (data->checksum);
+  g_clear_object (&data->result);
+  g_free (data);
+}
+
+static void
+verify_commit_thread (GTask         *task,
+                      gpointer       source_object,
+                      gpointer       task_data,
+                      GCancellable  *cancellable)
+{
+  OstreeRepo *repo = source_object;
+  VerifyCommitData *data = task_data;
+  g_autoptr(GVariant) signatures = NULL;
+  GError *local_error = NULL;
+
+  if (!_ostree_repo_verify_commit_cached (repo,
+                                          data->checksum,
+                                          data->remote_name,
+                                          NULL,
+                                          NULL,
+                                          &signatures,
+                                          &data->n_valid,
+                                          data->want_result ? &data->result : NULL,
+                                          cancellable,
+                                          &local_error))
+    g_task_return_error (task, local_error);
+  else
+    g_task_return_boolean (task, TRUE);
+}
+
+static void
+on_verify_commit_complete (GObject        *object,
+                           GAsyncResult   *result,
+                           gpointer        user_data)
+{
+  VerifyCommitData *data = g_task_get_task_data (G_TASK (result));
+  OtPullData *pull_data = data->pull_data;
+  GError *local_error = NULL;
+  GError **error = &local_error;
+
+  pull_data->n_outstanding_gpg_verifications--;
+
+  if (!g_task_propagate_boolean (G_TASK (result), error))
+    goto out;
+
+  /* Allow callers to output the results immediately. */
+  if (data->result != NULL)
+    g_signal_emit_by_name (pull_data->repo,
+                           "gpg-verify-result",
+                           data->checksum, data->result);
+
+  if (data->n_valid == 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "GPG signatures found, but none are in trusted keyring");
+      goto out;
+    }
+
+  g_hash_table_add (pull_data->verified_commits, g_strdup (data->checksum));
+
+  if (pull_data->caught_error)
+    goto out;
+
+  if (!scan_commit_object (pull_data, data->checksum, data->recursion_depth,
+                           pull_data->cancellable, error))
+    goto out;
+
+ out:
+  check_outstanding_requests_handle_error (pull_data, local_error);
+}
+
+/* Verifying a commit spawns gpg, so do it off the main loop; this lets
+ * verification of one commit overlap with fetching others.
+ */
+static void
+verify_commit_async (OtPullData         *pull_data,
+                     const char         *checksum,
+                     guint               recursion_depth)
+{
+  g_autoptr(GTask) task = NULL;
+  VerifyCommitData *data = g_new0 (VerifyCommitData, 1);
+
+  data->pull_data = pull_data;
+  data->remote_name = g_strdup (pull_data->remote_name);
+  data->checksum = g_strdup (checksum);
+  data->recursion_depth = recursion_depth;
+  /* The cache can't provide a result to emit, so bypass it for callers
+   * listening to gpg-verify-result.
+   */
+  data->want_result = g_signal_has_handler_pending (pull_data->repo,
+                                                    g_signal_lookup ("gpg-verify-result",
+                                                                     OSTREE_TYPE_REPO),
+                                                    0, TRUE);
+
+  task = g_task_new (pull_data->repo, pull_data->cancellable,
+                     on_verify_commit_complete, NULL);
+  g_task_set_task_data (task, data, (GDestroyNotify) verify_commit_data_free);
+  g_task_run_in_thread (task, verify_commit_thread);
+
+  pull_data->n_outstanding_gpg_verifications++;
+}
+
 static gboolean
 scan_commit_object (OtPullData         *pull_data,
                     const char         *checksum,
@@ -915,32 +1128,15 @@ scan_commit_object (OtPullData         *pull_data,
                            GINT_TO_POINTER (depth));
     }
 
-  if (pull_data->gpg_verify)
+  /* Signature verification runs in a worker thread; we're called
+   * again for this commit once it has succeeded.
+   */
+  if (pull_data->gpg_verify &&
+      !g_hash_table_contains (pull_data->verified_commits, checksum))
     {
-      glnx_unref_object OstreeGpgVerifyResult *result = NULL;
-
-      result = _ostree_repo_verify_commit_internal (pull_data->repo,
-                                                    checksum,
-                                                    pull_data->remote_name,
-                                                    NULL,
-                                                    NULL,
-                                                    cancellable,
-                                                    error);
-
-      if (result == NULL)
-        goto out;
-
-      /* Allow callers to output the results immediately. */
-      g_signal_emit_by_name (pull_data->repo,
-                             "gpg-verify-result",
-                             checksum, result);
-
-      if (ostree_gpg_verify_result_count_valid (result) == 0)
-        {
-          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                       "GPG signatures found, but none are in trusted keyring");
-          goto out;
-        }
+      verify_commit_async (pull_data, checksum, recursion_depth);
+      ret = TRUE;
+      goto out;
     }
 
   if (!ostree_repo_load_variant (pull_data->repo, OSTREE_OBJECT_TYPE_COMMIT, checksum,
@@ -1577,11 +1773,18 @@ process_one_static_delta (OtPullData   *pull_data,
       else
         {
           target_uri = suburi_new (pull_data->base_uri, deltapart_path, NULL);
-          ostree_fetcher_request_uri_with_partial_async (pull_data->fetcher, target_uri, size,
-                                                          OSTREE_FETCHER_DEFAULT_PRIORITY,
-                                                          pull_data->cancellable,
-                                                          static_deltapart_fetch_on_complete,
-                                                          fetch_data);
+          if (pull_data->stream_deltaparts)
+            ostree_fetcher_stream_uri_async (pull_data->fetcher, target_uri, size,
+                                             OSTREE_FETCHER_DEFAULT_PRIORITY,
+                                             pull_data->cancellable,
+                                             static_deltapart_stream_on_request,
+                                             fetch_data);
+          else
+            ostree_fetcher_request_uri_with_partial_async (pull_data->fetcher, target_uri, size,
+                                                            OSTREE_FETCHER_DEFAULT_PRIORITY,
+                                                            pull_data->cancellable,
+                                                            static_deltapart_fetch_on_complete,
+                                                            fetch_data);
           pull_data->n_outstanding_deltapart_fetches++;
           soup_uri_free (target_uri);
         }
@@ -2023,6 +2226,8 @@ repo_remote_fetch_summary (OstreeRepo    *self,
  *   * override-commit-ids (as): Array of specific commit IDs to fetch for refs
  *   * dry-run (b): Only print information on what will be downloaded (requires static deltas)
  *   * override-url (s): Fetch objects from this URL if remote specifies no metalink in options
+ *   * stream-static-deltas (b): Decompress and checksum static delta parts as they are downloaded,
+ *     rather than storing them first; interrupted parts are not resumed
  */
 gboolean
 ostree_repo_pull_with_options (OstreeRepo             *self,
@@ -2075,6 +2280,7 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
       (void) g_variant_lookup (options, "override-commit-ids", "^a&s", &override_commit_ids);
       (void) g_variant_lookup (options, "dry-run", "b", &pull_data->dry_run);
       (void) g_variant_lookup (options, "override-url", "&s", &url_override);
+      (void) g_variant_lookup (options, "stream-static-deltas", "b", &pull_data->stream_deltaparts);
     }
 
   g_return_val_if_fail (pull_data->maxdepth >= -1, FALSE);
@@ -2110,6 +2316,9 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
   pull_data->commit_to_depth = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                       (GDestroyNotify)g_free,
                                                       NULL);
+  pull_data->verified_commits = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                       (GDestroyNotify)g_free,
+                                                       NULL);
   pull_data->summary_deltas_checksums = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                                (GDestroyNotify)g_free,
                                                                (GDestroyNotify)g_free);
@@ -2546,17 +2755,38 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
       g_autofree char *from_revision = NULL;
       const char *ref = key;
       const char *to_revision = value;
+      const char *delta_from_revision;
       GVariant *delta_superblock = NULL;
 
       if (!ostree_repo_resolve_rev (pull_data->repo, ref, TRUE,
                                     &from_revision, error))
         goto out;
 
+      delta_from_revision = from_revision;
+
       if (!disable_static_deltas && (from_revision == NULL || g_strcmp0 (from_revision, to_revision) != 0))
         {
           if (!request_static_delta_superblock_sync (pull_data, from_revision, to_revision,
                                                      &delta_superblock, cancellable, error))
             goto out;
+
+          /* Multi-base deltas are stored as the from-empty delta; use
+           * one if it was generated against our current commit.
+           */
+          if (!delta_superblock && from_revision != NULL)
+            {
+              if (!request_static_delta_superblock_sync (pull_data, NULL, to_revision,
+                                                         &delta_superblock, cancellable, error))
+                goto out;
+
+              if (delta_superblock && _ostree_delta_has_base (delta_superblock, from_revision))
+                {
+                  g_debug ("using multi-base delta for %s", to_revision);
+                  delta_from_revision = NULL;
+                }
+              else
+                g_clear_pointer (&delta_superblock, g_variant_unref);
+            }
         }
           
       if (!delta_superblock)
@@ -2573,9 +2803,9 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
         }
       else
         {
-          g_debug ("processing delta superblock for %s-%s", from_revision ? from_revision : "empty", to_revision);
+          g_debug ("processing delta superblock for %s-%s", delta_from_revision ? delta_from_revision : "empty", to_revision);
           g_ptr_array_add (pull_data->static_delta_superblocks, g_variant_ref (delta_superblock));
-          if (!process_one_static_delta (pull_data, from_revision, to_revision,
+          if (!process_one_static_delta (pull_data, delta_from_revision, to_revision,
                                          delta_superblock,
                                          cancellable, error))
             goto out;
@@ -2707,6 +2937,10 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
 
   ret = TRUE;
  out:
+  /* Verification threads still reference @pull_data */
+  while (pull_data->n_outstanding_gpg_verifications > 0)
+    g_main_context_iteration (pull_data->main_context, TRUE);
+
   /* This is pretty ugly - we have two error locations, because we
    * have a mix of synchronous and async code.  Mixing them gets messy
    * as we need to avoid overwriting errors.
@@ -2731,6 +2965,7 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
   g_clear_pointer (&pull_data->summary, (GDestroyNotify) g_variant_unref);
   g_clear_pointer (&pull_data->static_delta_superblocks, (GDestroyNotify) g_ptr_array_unref);
   g_clear_pointer (&pull_data->commit_to_depth, (GDestroyNotify) g_hash_table_unref);
+  g_clear_pointer (&pull_data->verified_commits, (GDestroyNotify) g_hash_table_unref);
   g_clear_pointer (&pull_data->expected_commit_sizes, (GDestroyNotify) g_hash_table_unref);
   g_clear_pointer (&pull_data->scanned_metadata, (GDestroyNotify) g_hash_table_unref);
   g_clear_pointer (&pull_data->summary_deltas_checksums, (GDestroyNotify) g_hash_table_unref);
@@ -59,33 +59,44 @@ add_ref_to_set (const char       *remote,
 }
 
 static gboolean
-write_checksum_file_at (OstreeRepo   *self,
-                        int dfd,
-                        const char *name,
-                        const char *sha256,
-                        GCancellable *cancellable,
-                        GError **error)
+validate_ref_write (const char  *name,
+                    const char  *sha256,
+                    GError     **error)
 {
-  gboolean ret = FALSE;
-  const char *lastslash;
-
   if (!ostree_validate_checksum_string (sha256, error))
-    goto out;
+    return FALSE;
 
   if (ostree_validate_checksum_string (name, NULL))
     {
       g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
                    "Rev name '%s' looks like a checksum", name);
-      goto out;
+      return FALSE;
     }
 
   if (!*name)
     {
       g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
                    "Invalid empty ref name");
-      goto out;
+      return FALSE;
     }
 
+  return TRUE;
+}
+
+static gboolean
+write_checksum_file_at (OstreeRepo   *self,
+                        int dfd,
+                        const char *name,
+                        const char *sha256,
+                        GCancellable *cancellable,
+                        GError **error)
+{
+  gboolean ret = FALSE;
+  const char *lastslash;
+
+  if (!validate_ref_write (name, sha256, error))
+    goto out;
+
   lastslash = strrchr (name, '/');
 
   if (lastslash)
@@ -115,6 +126,328 @@ write_checksum_file_at (OstreeRepo   *self,
   return ret;
 }
 
+/*
+ * The parsed packed refs file.  Besides the table of refs, the refs of
+ * all remotes are indexed by name alone, for resolving a ref in any
+ * remote, and the refspecs are kept sorted, for listing by prefix.
+ */
+struct OstreePackedRefs {
+  volatile gint refcount;
+  GHashTable *refs;         /* refspec -> checksum */
+  GHashTable *remote_refs;  /* ref -> checksum; borrows from refs */
+  GPtrArray *sorted;        /* refspecs; borrows from refs */
+};
+
+static OstreePackedRefs *
+packed_refs_ref (OstreePackedRefs *packed_refs)
+{
+  g_atomic_int_inc (&packed_refs->refcount);
+  return packed_refs;
+}
+
+void
+_ostree_packed_refs_unref (OstreePackedRefs *packed_refs)
+{
+  if (!g_atomic_int_dec_and_test (&packed_refs->refcount))
+    return;
+
+  g_hash_table_unref (packed_refs->remote_refs);
+  g_ptr_array_unref (packed_refs->sorted);
+  g_hash_table_unref (packed_refs->refs);
+  g_free (packed_refs);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(OstreePackedRefs, _ostree_packed_refs_unref)
+
+static int
+compare_refspecs (gconstpointer a,
+                  gconstpointer b)
+{
+  return strcmp (*(const char * const *) a, *(const char * const *) b);
+}
+
+/* Takes ownership of @refs */
+static OstreePackedRefs *
+packed_refs_new (GHashTable *refs)
+{
+  OstreePackedRefs *packed_refs = g_new0 (OstreePackedRefs, 1);
+  GHashTableIter hashiter;
+  gpointer key;
+  guint i;
+
+  packed_refs->refcount = 1;
+  packed_refs->refs = refs;
+  packed_refs->remote_refs = g_hash_table_new (g_str_hash, g_str_equal);
+  packed_refs->sorted = g_ptr_array_sized_new (g_hash_table_size (refs));
+
+  g_hash_table_iter_init (&hashiter, refs);
+  while (g_hash_table_iter_next (&hashiter, &key, NULL))
+    g_ptr_array_add (packed_refs->sorted, key);
+  g_ptr_array_sort (packed_refs->sorted, compare_refspecs);
+
+  /* Like find_ref_in_remotes(), any remote may win; make it stable */
+  for (i = 0; i < packed_refs->sorted->len; i++)
+    {
+      const char *refspec = packed_refs->sorted->pdata[i];
+      const char *colon = strchr (refspec, ':');
+
+      if (colon && !g_hash_table_contains (packed_refs->remote_refs, colon + 1))
+        g_hash_table_insert (packed_refs->remote_refs, (char*) colon + 1,
+                             g_hash_table_lookup (refs, refspec));
+    }
+
+  return packed_refs;
+}
+
+static gboolean
+parse_packed_refs (const char  *contents,
+                   gsize        len,
+                   GHashTable  *packed_refs,
+                   GError     **error)
+{
+  const char *p = contents;
+  const char *end = contents + len;
+
+  while (p < end)
+    {
+      const char *eol = memchr (p, '\n', end - p);
+      gsize linelen;
+
+      if (eol == NULL)
+        eol = end;
+      linelen = eol - p;
+
+      /* Comments and blank lines */
+      if (linelen > 0 && *p != '#')
+        {
+          g_autofree char *checksum = NULL;
+
+          if (linelen < 66 || p[64] != ' ')
+            {
+              g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "Invalid line in %s: %.*s", _OSTREE_PACKED_REFS_PATH,
+                           (int) linelen, p);
+              return FALSE;
+            }
+
+          checksum = g_strndup (p, 64);
+          if (!ostree_validate_checksum_string (checksum, error))
+            return FALSE;
+
+          g_hash_table_replace (packed_refs, g_strndup (p + 65, linelen - 65),
+                                g_steal_pointer (&checksum));
+        }
+
+      p = eol + 1;
+    }
+
+  return TRUE;
+}
+
+/*
+ * Returns the current contents of the packed refs file.  The parsed
+ * table is cached until the file changes, so this costs a single open
+ * and fstat in the common case.
+ */
+static gboolean
+load_packed_refs (OstreeRepo         *self,
+                  OstreePackedRefs  **out_packed_refs,
+                  GError            **error)
+{
+  gboolean ret = FALSE;
+  glnx_fd_close int fd = -1;
+  struct stat stbuf;
+  g_autoptr(GMappedFile) mfile = NULL;
+  g_autoptr(GHashTable) refs = NULL;
+  g_autoptr(OstreePackedRefs) ret_packed_refs = NULL;
+
+  if (!ot_openat_ignore_enoent (self->repo_dir_fd, _OSTREE_PACKED_REFS_PATH, &fd, error))
+    goto out;
+
+  if (fd == -1)
+    {
+      ret_packed_refs = packed_refs_new (g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                                g_free, g_free));
+      goto done;
+    }
+
+  if (fstat (fd, &stbuf) != 0)
+    {
+      glnx_set_error_from_errno (error);
+      goto out;
+    }
+
+  g_mutex_lock (&self->cache_lock);
+  if (self->packed_refs &&
+      self->packed_refs_stbuf.st_dev == stbuf.st_dev &&
+      self->packed_refs_stbuf.st_ino == stbuf.st_ino &&
+      self->packed_refs_stbuf.st_size == stbuf.st_size &&
+      self->packed_refs_stbuf.st_mtim.tv_sec == stbuf.st_mtim.tv_sec &&
+      self->packed_refs_stbuf.st_mtim.tv_nsec == stbuf.st_mtim.tv_nsec)
+    ret_packed_refs = packed_refs_ref (self->packed_refs);
+  g_mutex_unlock (&self->cache_lock);
+
+  if (ret_packed_refs)
+    goto done;
+
+  refs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  if (stbuf.st_size > 0)
+    {
+      mfile = g_mapped_file_new_from_fd (fd, FALSE, error);
+      if (!mfile)
+        goto out;
+
+      if (!parse_packed_refs (g_mapped_file_get_contents (mfile),
+                              g_mapped_file_get_length (mfile),
+                              refs, error))
+        goto out;
+    }
+
+  ret_packed_refs = packed_refs_new (g_steal_pointer (&refs));
+
+  g_mutex_lock (&self->cache_lock);
+  g_clear_pointer (&self->packed_refs, _ostree_packed_refs_unref);
+  self->packed_refs = packed_refs_ref (ret_packed_refs);
+  self->packed_refs_stbuf = stbuf;
+  g_mutex_unlock (&self->cache_lock);
+
+ done:
+  ret = TRUE;
+  *out_packed_refs = g_steal_pointer (&ret_packed_refs);
+ out:
+  if (!ret)
+    g_prefix_error (error, "Loading %s: ", _OSTREE_PACKED_REFS_PATH);
+  return ret;
+}
+
+static const char *
+lookup_packed_ref (OstreePackedRefs  *packed_refs,
+                   const char        *remote,
+                   const char        *ref)
+{
+  if (remote)
+    {
+      g_autofree char *refspec = g_strconcat (remote, ":", ref, NULL);
+      return g_hash_table_lookup (packed_refs->refs, refspec);
+    }
+  return g_hash_table_lookup (packed_refs->refs, ref);
+}
+
+static gboolean
+write_packed_refs (OstreeRepo    *self,
+                   GHashTable    *packed_refs,
+                   GCancellable  *cancellable,
+                   GError       **error)
+{
+  gboolean ret = FALSE;
+  g_autoptr(GString) buf = g_string_new ("");
+  GList *refspecs = NULL;
+  GList *l;
+
+  if (g_hash_table_size (packed_refs) == 0)
+    {
+      if (unlinkat (self->repo_dir_fd, _OSTREE_PACKED_REFS_PATH, 0) != 0 && errno != ENOENT)
+        {
+          glnx_set_error_from_errno (error);
+          goto out;
+        }
+      ret = TRUE;
+      goto out;
+    }
+
+  refspecs = g_list_sort (g_hash_table_get_keys (packed_refs), (GCompareFunc) strcmp);
+
+  g_string_append (buf, "# ostree packed-refs\n");
+  for (l = refspecs; l; l = l->next)
+    {
+      const char *refspec = l->data;
+
+      g_string_append_printf (buf, "%s %s\n",
+                              (char*) g_hash_table_lookup (packed_refs, refspec),
+                              refspec);
+    }
+
+  if (!_ostree_repo_file_replace_contents (self, self->repo_dir_fd, _OSTREE_PACKED_REFS_PATH,
+                                           (guint8*) buf->str, buf->len,
+                                           cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  /* Don't rely on the stat check to notice our own rewrite */
+  g_mutex_lock (&self->cache_lock);
+  g_clear_pointer (&self->packed_refs, _ostree_packed_refs_unref);
+  g_mutex_unlock (&self->cache_lock);
+  g_list_free (refspecs);
+  return ret;
+}
+
+/*
+ * Apply @refs (refspec -> checksum, or %NULL to delete) to the packed
+ * refs file.  If @pack is %FALSE, only deletions are applied; this is
+ * used when the updated refs are written as loose files, which take
+ * precedence anyway.  The new file replaces the old one atomically.
+ */
+static gboolean
+update_packed_refs (OstreeRepo    *self,
+                    GHashTable    *refs,
+                    gboolean       pack,
+                    GCancellable  *cancellable,
+                    GError       **error)
+{
+  gboolean ret = FALSE;
+  g_auto(GLnxLockFile) lock = GLNX_LOCK_FILE_INIT;
+  g_autoptr(OstreePackedRefs) current = NULL;
+  g_autoptr(GHashTable) updated = NULL;
+  gboolean changed = FALSE;
+  GHashTableIter hashiter;
+  gpointer key, value;
+
+  if (!glnx_make_lock_file (self->repo_dir_fd, _OSTREE_PACKED_REFS_LOCK_PATH, LOCK_EX,
+                            &lock, error))
+    goto out;
+
+  /* Reload under the lock, in case another process just rewrote it */
+  if (!load_packed_refs (self, &current, error))
+    goto out;
+
+  updated = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  g_hash_table_iter_init (&hashiter, current->refs);
+  while (g_hash_table_iter_next (&hashiter, &key, &value))
+    g_hash_table_insert (updated, g_strdup (key), g_strdup (value));
+
+  g_hash_table_iter_init (&hashiter, refs);
+  while (g_hash_table_iter_next (&hashiter, &key, &value))
+    {
+      const char *refspec = key;
+      const char *rev = value;
+
+      if (rev == NULL)
+        changed |= g_hash_table_remove (updated, refspec);
+      else if (pack)
+        {
+          const char *prev = g_hash_table_lookup (updated, refspec);
+
+          if (prev == NULL || strcmp (prev, rev) != 0)
+            {
+              g_hash_table_replace (updated, g_strdup (refspec), g_strdup (rev));
+              changed = TRUE;
+            }
+        }
+    }
+
+  if (changed)
+    {
+      if (!write_packed_refs (self, updated, cancellable, error))
+        goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
 static gboolean
 find_ref_in_remotes (OstreeRepo         *self,
                      const char         *rev,
@@ -157,6 +490,13 @@ find_ref_in_remotes (OstreeRepo         *self,
   return ret;
 }
 
+static const char *
+find_packed_ref_in_remotes (OstreePackedRefs  *packed_refs,
+                            const char        *ref)
+{
+  return g_hash_table_lookup (packed_refs->remote_refs, ref);
+}
+
 static gboolean
 resolve_refspec (OstreeRepo     *self,
                  const char     *remote,
@@ -211,6 +551,8 @@ resolve_refspec (OstreeRepo     *self,
   __attribute__((unused)) GCancellable *cancellable = NULL;
   g_autofree char *ret_rev = NULL;
   glnx_fd_close int target_fd = -1;
+  g_autoptr(OstreePackedRefs) packed_refs = NULL;
+  const char *packed_rev = NULL;
   
   g_return_val_if_fail (ref != NULL, FALSE);
 
@@ -225,6 +567,13 @@ resolve_refspec (OstreeRepo     *self,
 
       if (!ot_openat_ignore_enoent (self->repo_dir_fd, remote_ref, &target_fd, error))
         goto out;
+
+      if (target_fd == -1)
+        {
+          if (!load_packed_refs (self, &packed_refs, error))
+            goto out;
+          packed_rev = lookup_packed_ref (packed_refs, remote, ref);
+        }
     }
   else
     {
@@ -234,18 +583,40 @@ resolve_refspec (OstreeRepo     *self,
         goto out;
 
       if (target_fd == -1)
+        {
+          if (!load_packed_refs (self, &packed_refs, error))
+            goto out;
+          packed_rev = lookup_packed_ref (packed_refs, NULL, ref);
+        }
+
+      if (target_fd == -1 && packed_rev == NULL)
         {
           local_ref = glnx_strjoina ("refs/remotes/", ref);
 
           if (!ot_openat_ignore_enoent (self->repo_dir_fd, local_ref, &target_fd, error))
             goto out;
+        }
 
-          if (target_fd == -1)
+      /* The packed equivalent of refs/remotes/ above */
+      if (target_fd == -1 && packed_rev == NULL)
+        {
+          const char *slash = strchr (ref, '/');
+
+          if (slash)
             {
-              if (!find_ref_in_remotes (self, ref, &target_fd, error))
-                goto out;
+              g_autofree char *ref_remote = g_strndup (ref, slash - ref);
+              packed_rev = lookup_packed_ref (packed_refs, ref_remote, slash + 1);
             }
         }
+
+      if (target_fd == -1 && packed_rev == NULL)
+        {
+          if (!find_ref_in_remotes (self, ref, &target_fd, error))
+            goto out;
+        }
+
+      if (target_fd == -1 && packed_rev == NULL)
+        packed_rev = find_packed_ref_in_remotes (packed_refs, ref);
     }
 
   if (target_fd != -1)
@@ -261,6 +632,10 @@ resolve_refspec (OstreeRepo     *self,
       if (!ostree_validate_checksum_string (ret_rev, error))
         goto out;
     }
+  else if (packed_rev != NULL)
+    {
+      ret_rev = g_strdup (packed_rev);
+    }
   else
     {
       if (!resolve_refspec_fallback (self, remote, ref, allow_noent,
@@ -294,6 +669,7 @@ ostree_repo_resolve_partial_checksum (OstreeRepo   *self,
   static const char hexchars[] = "0123456789abcdef";
   gsize off;
   g_autoptr(GHashTable) ref_list = NULL;
+  g_autoptr(GPtrArray) indexed = NULL;
   g_autofree char *ret_rev = NULL;
   guint length;
   const char *checksum = NULL;
@@ -310,22 +686,35 @@ ostree_repo_resolve_partial_checksum (OstreeRepo   *self,
   if (off > 64 || refspec[off] != '\0')
     return TRUE;
 
-  /* this looks through all objects and adds them to the ref_list if:
-     a) they are a commit object AND
-     b) the obj checksum starts with the partual checksum defined by "refspec" */
-  if (!ostree_repo_list_commit_objects_starting_with (self, refspec, &ref_list, NULL, error))
+  /* The commit index lists every commit, so only scan without one */
+  if (!_ostree_repo_commit_index_lookup_prefix (self, refspec, &indexed, NULL, error))
     goto out;
 
-  length = g_hash_table_size (ref_list);
-
-  g_hash_table_iter_init (&hashiter, ref_list);
-  if (g_hash_table_iter_next (&hashiter, &key, &value))
-    first_commit = (GVariant*) key;
+  if (indexed != NULL)
+    {
+      length = indexed->len;
+      if (length > 0)
+        checksum = indexed->pdata[0];
+    }
   else
-    first_commit = NULL;
+    {
+      /* this looks through all objects and adds them to the ref_list if:
+         a) they are a commit object AND
+         b) the obj checksum starts with the partual checksum defined by "refspec" */
+      if (!ostree_repo_list_commit_objects_starting_with (self, refspec, &ref_list, NULL, error))
+        goto out;
 
-  if (first_commit) 
-    ostree_object_name_deserialize (first_commit, &checksum, &objtype);
+      length = g_hash_table_size (ref_list);
+
+      g_hash_table_iter_init (&hashiter, ref_list);
+      if (g_hash_table_iter_next (&hashiter, &key, &value))
+        first_commit = (GVariant*) key;
+      else
+        first_commit = NULL;
+
+      if (first_commit) 
+        ostree_object_name_deserialize (first_commit, &checksum, &objtype);
+    }
 
   /* length more than one - multiple commits match partial refspec: is not unique */
   if (length > 1)
@@ -392,18 +781,29 @@ ostree_repo_resolve_rev (OstreeRepo     *self,
           g_autofree char *parent_refspec = NULL;
           g_autofree char *parent_rev = NULL;
           g_autoptr(GVariant) commit = NULL;
+          gboolean indexed = FALSE;
 
           parent_refspec = g_strdup (refspec);
           parent_refspec[strlen(parent_refspec) - 1] = '\0';
 
           if (!ostree_repo_resolve_rev (self, parent_refspec, allow_noent, &parent_rev, error))
             goto out;
-          
-          if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_COMMIT, parent_rev,
-                                         &commit, error))
+
+          if (parent_rev &&
+              !_ostree_repo_commit_index_get_parent (self, parent_rev, &indexed, &ret_rev,
+                                                     NULL, error))
             goto out;
-      
-          if (!(ret_rev = ostree_commit_get_parent (commit)))
+
+          if (!indexed)
+            {
+              if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_COMMIT, parent_rev,
+                                             &commit, error))
+                goto out;
+
+              ret_rev = ostree_commit_get_parent (commit);
+            }
+
+          if (!ret_rev)
             {
               g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
                            "Commit %s has no parent", parent_rev);
@@ -484,6 +884,84 @@ enumerate_refs_recurse (OstreeRepo    *repo,
   return ret;
 }
 
+/*
+ * Add the packed refs matching @remote and @ref_prefix (or all of them,
+ * if @ref_prefix is %NULL) to @refs, using the same naming as the
+ * loose refs enumeration.  Refs already in @refs were found as loose
+ * files and take precedence.
+ */
+static void
+add_packed_refs_to_set (OstreePackedRefs  *packed_refs,
+                        const char        *remote,
+                        const char        *ref_prefix,
+                        gboolean           cut_prefix,
+                        GHashTable        *refs)
+{
+  gsize prefix_len = ref_prefix ? strlen (ref_prefix) : 0;
+  g_autofree char *search = NULL;
+  guint lo = 0, hi = packed_refs->sorted->len;
+
+  /* Only the refspecs starting with the prefix can match; find the
+   * first of them.
+   */
+  if (ref_prefix != NULL)
+    {
+      search = remote ? g_strconcat (remote, ":", ref_prefix, NULL) : g_strdup (ref_prefix);
+      while (lo < hi)
+        {
+          guint mid = lo + (hi - lo) / 2;
+
+          if (strcmp (packed_refs->sorted->pdata[mid], search) < 0)
+            lo = mid + 1;
+          else
+            hi = mid;
+        }
+    }
+
+  for (; lo < packed_refs->sorted->len; lo++)
+    {
+      const char *refspec = packed_refs->sorted->pdata[lo];
+      const char *colon = strchr (refspec, ':');
+      const char *ref = colon ? colon + 1 : refspec;
+      g_autofree char *name = NULL;
+
+      if (ref_prefix != NULL)
+        {
+          if (!g_str_has_prefix (refspec, search))
+            break;
+
+          /* Must be in the same remote (or local) namespace */
+          if (remote == NULL && colon != NULL)
+            continue;
+          if (remote != NULL &&
+              (colon == NULL || strlen (remote) != (gsize)(colon - refspec) ||
+               strncmp (refspec, remote, colon - refspec) != 0))
+            continue;
+
+          if (strcmp (ref, ref_prefix) == 0)
+            ;
+          else if (strncmp (ref, ref_prefix, prefix_len) == 0 && ref[prefix_len] == '/')
+            {
+              if (cut_prefix)
+                ref += prefix_len + 1;
+            }
+          else
+            continue;
+
+          if (remote)
+            name = g_strconcat (remote, ":", ref, NULL);
+          else
+            name = g_strdup (ref);
+        }
+      else
+        name = g_strdup (refspec);
+
+      if (!g_hash_table_contains (refs, name))
+        g_hash_table_insert (refs, g_steal_pointer (&name),
+                             g_strdup (g_hash_table_lookup (packed_refs->refs, refspec)));
+    }
+}
+
 static gboolean
 _ostree_repo_list_refs_internal (OstreeRepo       *self,
                                  gboolean         cut_prefix,
@@ -494,6 +972,7 @@ _ostree_repo_list_refs_internal (OstreeRepo       *self,
 {
   gboolean ret = FALSE;
   g_autoptr(GHashTable) ret_all_refs = NULL;
+  g_autoptr(OstreePackedRefs) packed_refs = NULL;
   g_autofree char *remote = NULL;
   g_autofree char *ref_prefix = NULL;
 
@@ -600,6 +1079,10 @@ _ostree_repo_list_refs_internal (OstreeRepo       *self,
         }
     }
 
+  if (!load_packed_refs (self, &packed_refs, error))
+    goto out;
+  add_packed_refs_to_set (packed_refs, remote, ref_prefix, cut_prefix, ret_all_refs);
+
   ret = TRUE;
   ot_transfer_out_value (out_all_refs, &ret_all_refs);
  out:
@@ -734,65 +1217,181 @@ ostree_repo_remote_list_refs (OstreeRepo       *self,
   return ret;
 }
 
-gboolean      
-_ostree_repo_write_ref (OstreeRepo    *self,
-                        const char    *remote,
-                        const char    *ref,
-                        const char    *rev,
-                        GCancellable  *cancellable,
-                        GError       **error)
+static gboolean
+unlink_loose_ref (OstreeRepo   *self,
+                  const char   *remote,
+                  const char   *ref,
+                  GError      **error)
+{
+  const char *path;
+
+  if (remote)
+    path = glnx_strjoina ("refs/remotes/", remote, "/", ref);
+  else
+    path = glnx_strjoina ("refs/heads/", ref);
+
+  if (unlinkat (self->repo_dir_fd, path, 0) != 0)
+    {
+      if (errno != ENOENT && errno != ENOTDIR)
+        {
+          glnx_set_error_from_errno (error);
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+/*
+ * Serializes ref updates between writers; concurrent transactions
+ * otherwise only contend here, for as long as it takes to write the
+ * ref files.
+ */
+static gboolean
+lock_refs (OstreeRepo    *self,
+           GLnxLockFile  *lock,
+           GError       **error)
+{
+  return glnx_make_lock_file (self->repo_dir_fd, _OSTREE_REFS_LOCK_PATH, LOCK_EX,
+                              lock, error);
+}
+
+static gboolean
+write_ref_locked (OstreeRepo    *self,
+                  const char    *remote,
+                  const char    *ref,
+                  const char    *rev,
+                  GCancellable  *cancellable,
+                  GError       **error)
 {
   gboolean ret = FALSE;
   glnx_fd_close int dfd = -1;
 
-  if (remote == NULL)
+  if (rev == NULL)
     {
-      if (!glnx_opendirat (self->repo_dir_fd, "refs/heads", TRUE,
-                           &dfd, error))
+      g_autoptr(OstreePackedRefs) packed_refs = NULL;
+      g_autofree char *refspec = remote ? g_strconcat (remote, ":", ref, NULL) : g_strdup (ref);
+
+      if (!unlink_loose_ref (self, remote, ref, error))
+        goto out;
+
+      /* A packed copy would otherwise become visible again */
+      if (!load_packed_refs (self, &packed_refs, error))
+        goto out;
+
+      if (g_hash_table_contains (packed_refs->refs, refspec))
         {
-          g_prefix_error (error, "Opening %s: ", "refs/heads");
-          goto out;
+          g_autoptr(GHashTable) deleted = g_hash_table_new (g_str_hash, g_str_equal);
+
+          g_hash_table_insert (deleted, refspec, NULL);
+          if (!update_packed_refs (self, deleted, FALSE, cancellable, error))
+            goto out;
         }
     }
   else
     {
-      glnx_fd_close int refs_remotes_dfd = -1;
-
-      if (!glnx_opendirat (self->repo_dir_fd, "refs/remotes", TRUE,
-                           &refs_remotes_dfd, error))
+      if (remote == NULL)
         {
-          g_prefix_error (error, "Opening %s: ", "refs/remotes");
-          goto out;
+          if (!glnx_opendirat (self->repo_dir_fd, "refs/heads", TRUE,
+                               &dfd, error))
+            {
+              g_prefix_error (error, "Opening %s: ", "refs/heads");
+              goto out;
+            }
         }
-
-      if (rev != NULL)
+      else
         {
+          glnx_fd_close int refs_remotes_dfd = -1;
+
+          if (!glnx_opendirat (self->repo_dir_fd, "refs/remotes", TRUE,
+                               &refs_remotes_dfd, error))
+            {
+              g_prefix_error (error, "Opening %s: ", "refs/remotes");
+              goto out;
+            }
+
           /* Ensure we have a dir for the remote */
           if (!glnx_shutil_mkdir_p_at (refs_remotes_dfd, remote, 0777, cancellable, error))
             goto out;
-        }
 
-      if (!glnx_opendirat (refs_remotes_dfd, remote, TRUE, &dfd, error))
-        {
-          g_prefix_error (error, "Opening remotes/ dir %s: ", remote);
-          goto out;
-        }
-    }
-
-  if (rev == NULL)
-    {
-      if (unlinkat (dfd, ref, 0) != 0)
-        {
-          if (errno != ENOENT)
+          if (!glnx_opendirat (refs_remotes_dfd, remote, TRUE, &dfd, error))
             {
-              glnx_set_error_from_errno (error);
+              g_prefix_error (error, "Opening remotes/ dir %s: ", remote);
               goto out;
             }
         }
+
+      if (!write_checksum_file_at (self, dfd, ref, rev, cancellable, error))
+        goto out;
     }
-  else
+
+  if (!_ostree_repo_update_mtime (self, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+gboolean
+_ostree_repo_write_ref (OstreeRepo    *self,
+                        const char    *remote,
+                        const char    *ref,
+                        const char    *rev,
+                        GCancellable  *cancellable,
+                        GError       **error)
+{
+  g_auto(GLnxLockFile) lock = GLNX_LOCK_FILE_INIT;
+
+  if (!lock_refs (self, &lock, error))
+    return FALSE;
+
+  return write_ref_locked (self, remote, ref, rev, cancellable, error);
+}
+
+/*
+ * With core.packed-refs enabled, all of @refs are written to the
+ * packed refs file in a single atomic replacement, and any loose
+ * files for them are then removed, since they would take precedence.
+ */
+static gboolean
+update_refs_packed (OstreeRepo        *self,
+                    GHashTable        *refs,
+                    GCancellable      *cancellable,
+                    GError           **error)
+{
+  gboolean ret = FALSE;
+  GHashTableIter hash_iter;
+  gpointer key, value;
+
+  g_hash_table_iter_init (&hash_iter, refs);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
     {
-      if (!write_checksum_file_at (self, dfd, ref, rev, cancellable, error))
+      const char *refspec = key;
+      const char *rev = value;
+      g_autofree char *remote = NULL;
+      g_autofree char *ref = NULL;
+
+      if (!ostree_parse_refspec (refspec, &remote, &ref, error))
+        goto out;
+
+      if (rev != NULL && !validate_ref_write (ref, rev, error))
+        goto out;
+    }
+
+  if (!update_packed_refs (self, refs, TRUE, cancellable, error))
+    goto out;
+
+  g_hash_table_iter_init (&hash_iter, refs);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+    {
+      g_autofree char *remote = NULL;
+      g_autofree char *ref = NULL;
+
+      if (!ostree_parse_refspec (key, &remote, &ref, error))
+        goto out;
+
+      if (!unlink_loose_ref (self, remote, ref, error))
         goto out;
     }
 
@@ -811,9 +1410,17 @@ _ostree_repo_update_refs (OstreeRepo        *self,
                           GError           **error)
 {
   gboolean ret = FALSE;
+  g_auto(GLnxLockFile) lock = GLNX_LOCK_FILE_INIT;
+  g_autoptr(GHashTable) deleted = NULL;
   GHashTableIter hash_iter;
   gpointer key, value;
 
+  if (!lock_refs (self, &lock, error))
+    goto out;
+
+  if (self->enable_packed_refs)
+    return update_refs_packed (self, refs, cancellable, error);
+
   g_hash_table_iter_init (&hash_iter, refs);
   while (g_hash_table_iter_next (&hash_iter, &key, &value))
     {
@@ -825,11 +1432,67 @@ _ostree_repo_update_refs (OstreeRepo        *self,
       if (!ostree_parse_refspec (refspec, &remote, &ref, error))
         goto out;
 
-      if (!_ostree_repo_write_ref (self, remote, ref, rev,
-                                   cancellable, error))
+      if (rev == NULL)
+        {
+          if (!unlink_loose_ref (self, remote, ref, error))
+            goto out;
+
+          if (!deleted)
+            deleted = g_hash_table_new (g_str_hash, g_str_equal);
+          g_hash_table_insert (deleted, (char*) refspec, NULL);
+        }
+      else if (!write_ref_locked (self, remote, ref, rev,
+                                  cancellable, error))
         goto out;
     }
 
+  /* Drop any packed copies of the deleted refs in a single rewrite */
+  if (deleted)
+    {
+      if (!update_packed_refs (self, deleted, FALSE, cancellable, error))
+        goto out;
+
+      if (!_ostree_repo_update_mtime (self, error))
+        goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/**
+ * ostree_repo_pack_refs:
+ * @self: Repo
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Move all loose refs into the packed refs file in a single atomic
+ * replacement, then remove the loose files.  Refs resolve to the
+ * same commits before and after.  This converts an existing
+ * repository for `core.packed-refs`; note that older versions of
+ * OSTree only read loose refs.
+ */
+gboolean
+ostree_repo_pack_refs (OstreeRepo    *self,
+                       GCancellable  *cancellable,
+                       GError       **error)
+{
+  gboolean ret = FALSE;
+  g_auto(GLnxLockFile) lock = GLNX_LOCK_FILE_INIT;
+  g_autoptr(GHashTable) all_refs = NULL;
+
+  if (!lock_refs (self, &lock, error))
+    goto out;
+
+  /* Loose refs take precedence here, as when resolving */
+  if (!_ostree_repo_list_refs_internal (self, FALSE, NULL, &all_refs,
+                                        cancellable, error))
+    goto out;
+
+  if (!update_refs_packed (self, all_refs, cancellable, error))
+    goto out;
+
   ret = TRUE;
  out:
   return ret;
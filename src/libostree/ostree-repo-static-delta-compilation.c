@@ -54,12 +54,15 @@ typedef struct {
   guint64 loose_compressed_size;
   guint64 min_fallback_size_bytes;
   guint64 max_bsdiff_size_bytes;
+  guint64 bsdiff_window_size_bytes;
   guint64 max_chunk_size_bytes;
   guint64 rollsum_size;
   guint n_rollsum;
   guint n_bsdiff;
+  guint n_bsdiff_windowed;
   guint n_fallback;
   gboolean swap_endian;
+  GHashTable *to_reachable_objects; /* Borrowed; shared across generations */
 } OstreeStaticDeltaBuilder;
 
 typedef enum {
@@ -411,10 +414,18 @@ process_one_object (OstreeRepo                       *repo,
   return ret;
 }
 
+typedef struct {
+  guint64 from_start;
+  guint64 from_len;
+  guint64 to_start;
+  guint64 to_len;
+} BsdiffWindow;
+
 typedef struct {
   char *from_checksum;
   GBytes *tmp_from;
   GBytes *tmp_to;
+  GArray *windows; /* BsdiffWindow; NULL when diffing the whole object */
 } ContentBsdiff;
 
 typedef struct {
@@ -440,6 +451,8 @@ content_bsdiffs_free (ContentBsdiff  *bsdiff)
   g_free (bsdiff->from_checksum);
   g_bytes_unref (bsdiff->tmp_from);
   g_bytes_unref (bsdiff->tmp_to);
+  if (bsdiff->windows)
+    g_array_unref (bsdiff->windows);
   g_free (bsdiff);
 }
 
@@ -494,12 +507,154 @@ get_unpacked_unlinked_content (OstreeRepo       *repo,
   return ret;
 }
 
+static int
+compare_guint64 (gconstpointer a,
+                 gconstpointer b)
+{
+  guint64 av = *(const guint64*)a;
+  guint64 bv = *(const guint64*)b;
+
+  if (av < bv)
+    return -1;
+  else if (av > bv)
+    return 1;
+  return 0;
+}
+
+static int
+compare_gint64 (gconstpointer a,
+                gconstpointer b)
+{
+  gint64 av = *(const gint64*)a;
+  gint64 bv = *(const gint64*)b;
+
+  if (av < bv)
+    return -1;
+  else if (av > bv)
+    return 1;
+  return 0;
+}
+
+/* Split the target into segments of at most @window_size bytes, each
+ * ending on a rollsum chunk boundary where possible, and pick for each
+ * one a window of the source of the same size.  The source window is
+ * positioned using the rollsum matches found inside the segment (the
+ * median displacement), falling back to the proportional position in
+ * the file.  bsdiff then only ever sees @window_size bytes of input,
+ * which bounds the suffix sort memory.
+ */
+static GArray *
+compute_bsdiff_windows (GBytes   *tmp_from,
+                        GBytes   *tmp_to,
+                        guint64   window_size)
+{
+  GArray *ret_windows = g_array_new (FALSE, FALSE, sizeof (BsdiffWindow));
+  g_autoptr(GArray) boundaries = g_array_new (FALSE, FALSE, sizeof (guint64));
+  gsize from_len = g_bytes_get_size (tmp_from);
+  gsize to_len = g_bytes_get_size (tmp_to);
+  OstreeRollsumMatches *matches = NULL;
+  GHashTableIter hiter;
+  gpointer hkey, hvalue;
+  guint64 seg_start = 0;
+  guint boundary_idx = 0;
+  guint match_idx = 0;
+
+  g_assert (window_size > 0);
+
+  matches = _ostree_compute_rollsum_matches (tmp_from, tmp_to);
+
+  g_hash_table_iter_init (&hiter, matches->to_rollsums);
+  while (g_hash_table_iter_next (&hiter, &hkey, &hvalue))
+    {
+      GPtrArray *chunks = hvalue;
+      guint i;
+
+      for (i = 0; i < chunks->len; i++)
+        {
+          guint64 start, offset, end;
+          g_variant_get (chunks->pdata[i], "(utt)", NULL, &start, &offset);
+          end = start + offset;
+          g_array_append_val (boundaries, end);
+        }
+    }
+  g_array_sort (boundaries, compare_guint64);
+
+  while (seg_start < to_len)
+    {
+      BsdiffWindow window;
+      guint64 seg_end = MIN (seg_start + window_size, to_len);
+      g_autoptr(GArray) displacements = g_array_new (FALSE, FALSE, sizeof (gint64));
+      gint64 displacement;
+      gint64 from_start;
+
+      /* Prefer the last chunk boundary which fits in the window */
+      if (seg_end < to_len)
+        {
+          guint64 best = 0;
+
+          while (boundary_idx < boundaries->len &&
+                 g_array_index (boundaries, guint64, boundary_idx) <= seg_end)
+            {
+              best = g_array_index (boundaries, guint64, boundary_idx);
+              boundary_idx++;
+            }
+          if (best > seg_start)
+            seg_end = best;
+        }
+
+      /* Matches are sorted by target offset */
+      while (match_idx < matches->matches->len)
+        {
+          guint64 to_start, from_start_m;
+
+          g_variant_get (matches->matches->pdata[match_idx], "(uttt)",
+                         NULL, NULL, &to_start, &from_start_m);
+          if (to_start >= seg_end)
+            break;
+          if (to_start >= seg_start)
+            {
+              gint64 d = (gint64)from_start_m - (gint64)to_start;
+              g_array_append_val (displacements, d);
+            }
+          match_idx++;
+        }
+
+      if (displacements->len > 0)
+        {
+          g_array_sort (displacements, compare_gint64);
+          displacement = g_array_index (displacements, gint64, displacements->len / 2);
+          from_start = (gint64)seg_start + displacement;
+        }
+      else
+        {
+          from_start = (gint64)(((double)seg_start / to_len) * from_len);
+        }
+
+      /* Center the segment in the source window */
+      window.from_len = MIN (window_size, from_len);
+      from_start -= (gint64)(window.from_len - (seg_end - seg_start)) / 2;
+      from_start = CLAMP (from_start, 0, (gint64)(from_len - window.from_len));
+
+      window.from_start = from_start;
+      window.to_start = seg_start;
+      window.to_len = seg_end - seg_start;
+      g_array_append_val (ret_windows, window);
+
+      seg_start = seg_end;
+    }
+
+  _ostree_rollsum_matches_free (matches);
+
+  return ret_windows;
+}
+
 static gboolean
 try_content_bsdiff (OstreeRepo                       *repo,
                     const char                       *from,
                     const char                       *to,
                     ContentBsdiff                    **out_bsdiff,
                     guint64                          max_bsdiff_size_bytes,
+                    guint64                          bsdiff_window_size_bytes,
                     GCancellable                     *cancellable,
                     GError                           **error)
 {
@@ -510,6 +665,7 @@ try_content_bsdiff (OstreeRepo                       *repo,
   g_autoptr(GBytes) tmp_to = NULL;
   g_autoptr(GFileInfo) from_finfo = NULL;
   g_autoptr(GFileInfo) to_finfo = NULL;
+  g_autoptr(GArray) windows = NULL;
   ContentBsdiff *ret_bsdiff = NULL;
 
   *out_bsdiff = NULL;
@@ -523,14 +679,24 @@ try_content_bsdiff (OstreeRepo                       *repo,
 
   if (g_bytes_get_size (tmp_to) + g_bytes_get_size (tmp_from) > max_bsdiff_size_bytes)
     {
-      ret = TRUE;
-      goto out;
+      /* Too large to diff in one go; if enabled, diff it in
+       * bounded-size segments instead.
+       */
+      if (bsdiff_window_size_bytes == 0 ||
+          g_bytes_get_size (tmp_from) == 0)
+        {
+          ret = TRUE;
+          goto out;
+        }
+
+      windows = compute_bsdiff_windows (tmp_from, tmp_to, bsdiff_window_size_bytes);
     }
 
   ret_bsdiff = g_new0 (ContentBsdiff, 1);
   ret_bsdiff->from_checksum = g_strdup (from);
   ret_bsdiff->tmp_from = tmp_from; tmp_from = NULL;
   ret_bsdiff->tmp_to = tmp_to; tmp_to = NULL;
+  ret_bsdiff->windows = g_steal_pointer (&windows);
 
   ret = TRUE;
   if (out_bsdiff)
@@ -761,6 +927,46 @@ process_one_rollsum (OstreeRepo                       *repo,
   return ret;
 }
 
+static gboolean
+append_bsdiff_payload (OstreeStaticDeltaPartBuilder    *current_part,
+                       const guint8                    *old_buf,
+                       gsize                            old_len,
+                       const guint8                    *new_buf,
+                       gsize                            new_len,
+                       guint64                         *out_payload_offset,
+                       guint64                         *out_payload_size,
+                       GCancellable                    *cancellable,
+                       GError                         **error)
+{
+  struct bsdiff_stream stream;
+  struct bzdiff_opaque_s op;
+  const gchar *payload;
+  gssize payload_size;
+  g_autoptr(GOutputStream) out = g_memory_output_stream_new_resizable ();
+
+  stream.malloc = malloc;
+  stream.free = free;
+  stream.write = bzdiff_write;
+  op.out = out;
+  op.cancellable = cancellable;
+  op.error = error;
+  stream.opaque = &op;
+  if (bsdiff (old_buf, old_len, new_buf, new_len, &stream) < 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "bsdiff generation failed");
+      return FALSE;
+    }
+
+  payload = g_memory_output_stream_get_data (G_MEMORY_OUTPUT_STREAM (out));
+  payload_size = g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (out));
+
+  *out_payload_offset = current_part->payload->len;
+  *out_payload_size = payload_size;
+  g_string_append_len (current_part->payload, payload, payload_size);
+
+  return TRUE;
+}
+
 static gboolean
 process_one_bsdiff (OstreeRepo                       *repo,
                     OstreeStaticDeltaBuilder         *builder,
@@ -820,33 +1026,47 @@ process_one_bsdiff (OstreeRepo                       *repo,
     _ostree_write_varuint64 (current_part->operations, xattr_offset);
     _ostree_write_varuint64 (current_part->operations, content_size);
 
-    {
-      struct bsdiff_stream stream;
-      struct bzdiff_opaque_s op;
-      const gchar *payload;
-      gssize payload_size;
-      g_autoptr(GOutputStream) out = g_memory_output_stream_new_resizable ();
-      stream.malloc = malloc;
-      stream.free = free;
-      stream.write = bzdiff_write;
-      op.out = out;
-      op.cancellable = cancellable;
-      op.error = error;
-      stream.opaque = &op;
-      if (bsdiff (tmp_from_buf, tmp_from_len, tmp_to_buf, tmp_to_len, &stream) < 0) {
-        g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "bsdiff generation failed");
-        goto out;
+    if (bsdiff_content->windows == NULL)
+      {
+        guint64 payload_offset, payload_size;
+
+        if (!append_bsdiff_payload (current_part, tmp_from_buf, tmp_from_len,
+                                    tmp_to_buf, tmp_to_len,
+                                    &payload_offset, &payload_size,
+                                    cancellable, error))
+          goto out;
+
+        g_string_append_c (current_part->operations, (gchar)OSTREE_STATIC_DELTA_OP_BSPATCH);
+        _ostree_write_varuint64 (current_part->operations, payload_offset);
+        _ostree_write_varuint64 (current_part->operations, payload_size);
       }
+    else
+      {
+        guint i;
 
-      payload = g_memory_output_stream_get_data (G_MEMORY_OUTPUT_STREAM (out));
-      payload_size = g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (out));
+        for (i = 0; i < bsdiff_content->windows->len; i++)
+          {
+            BsdiffWindow *window = &g_array_index (bsdiff_content->windows, BsdiffWindow, i);
+            guint64 payload_offset, payload_size;
 
-      g_string_append_c (current_part->operations, (gchar)OSTREE_STATIC_DELTA_OP_BSPATCH);
-      _ostree_write_varuint64 (current_part->operations, current_part->payload->len);
-      _ostree_write_varuint64 (current_part->operations, payload_size);
+            g_assert_cmpint (window->from_start + window->from_len, <=, tmp_from_len);
+            g_assert_cmpint (window->to_start + window->to_len, <=, tmp_to_len);
 
-      g_string_append_len (current_part->payload, payload, payload_size);
-    }
+            if (!append_bsdiff_payload (current_part,
+                                        tmp_from_buf + window->from_start, window->from_len,
+                                        tmp_to_buf + window->to_start, window->to_len,
+                                        &payload_offset, &payload_size,
+                                        cancellable, error))
+              goto out;
+
+            g_string_append_c (current_part->operations, (gchar)OSTREE_STATIC_DELTA_OP_BSPATCH_WINDOW);
+            _ostree_write_varuint64 (current_part->operations, payload_offset);
+            _ostree_write_varuint64 (current_part->operations, payload_size);
+            _ostree_write_varuint64 (current_part->operations, window->from_start);
+            _ostree_write_varuint64 (current_part->operations, window->from_len);
+            _ostree_write_varuint64 (current_part->operations, window->to_len);
+          }
+      }
     g_string_append_c (current_part->operations, (gchar)OSTREE_STATIC_DELTA_OP_CLOSE);
   }
 
@@ -907,8 +1127,10 @@ generate_delta_lowlatency (OstreeRepo                       *repo,
                                  &to_commit, error))
     goto out;
 
-  if (!ostree_repo_traverse_commit (repo, to, 0, &to_reachable_objects,
-                                    cancellable, error))
+  if (builder->to_reachable_objects)
+    to_reachable_objects = g_hash_table_ref (builder->to_reachable_objects);
+  else if (!ostree_repo_traverse_commit (repo, to, 0, &to_reachable_objects,
+                                         cancellable, error))
     goto out;
 
   new_reachable_metadata = ostree_repo_traverse_new_reachable ();
@@ -1005,6 +1227,7 @@ generate_delta_lowlatency (OstreeRepo                       *repo,
         {
           if (!try_content_bsdiff (repo, from_checksum, to_checksum,
                                    &bsdiff, builder->max_bsdiff_size_bytes,
+                                   builder->bsdiff_window_size_bytes,
                                    cancellable, error))
             goto out;
 
@@ -1068,6 +1291,8 @@ generate_delta_lowlatency (OstreeRepo                       *repo,
         goto out;
 
       builder->n_bsdiff++;
+      if (bsdiff->windows)
+        builder->n_bsdiff_windowed++;
     }
 
   /* Scan for large objects, so we can fall back to plain HTTP-based
@@ -1141,6 +1366,190 @@ generate_delta_lowlatency (OstreeRepo                       *repo,
   return ret;
 }
 
+static gint
+compare_signatures (gconstpointer a,
+                    gconstpointer b)
+{
+  guint a_bits = __builtin_popcountll (*(const guint64*)a);
+  guint b_bits = __builtin_popcountll (*(const guint64*)b);
+
+  /* Order by number of bases which have the objects, so that the
+   * parts almost every client needs come first.
+   */
+  if (a_bits != b_bits)
+    return a_bits < b_bits ? -1 : 1;
+  return compare_guint64 (a, b);
+}
+
+/* Generate a from-empty delta for @to whose parts are partitioned by
+ * which of @bases already contain the objects.  Every part holds only
+ * objects with the same presence signature, so a client on any of
+ * the bases has either all or none of the objects of a given part,
+ * and the per-part "have all objects" check skips exactly the parts
+ * it does not need.  Clients on no base can use it as a plain
+ * from-empty delta.
+ */
+static gboolean
+generate_delta_multibase (OstreeRepo                       *repo,
+                          const char *const                *bases,
+                          const char                       *to,
+                          DeltaOpts                         opts,
+                          OstreeStaticDeltaBuilder         *builder,
+                          GCancellable                     *cancellable,
+                          GError                          **error)
+{
+  gboolean ret = FALSE;
+  GHashTableIter hashiter;
+  gpointer key, value;
+  guint i, n_bases;
+  g_autoptr(GHashTable) to_reachable_objects = NULL;
+  g_autoptr(GPtrArray) base_reachable_objects = NULL;
+  g_autoptr(GHashTable) groups = NULL;
+  g_autoptr(GArray) signatures = NULL;
+  g_autoptr(GVariant) to_commit_key = NULL;
+
+  n_bases = g_strv_length ((char**)bases);
+  if (n_bases == 0 || n_bases > 64)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                   "Invalid number of delta bases %u (must be 1 to 64)", n_bases);
+      goto out;
+    }
+
+  base_reachable_objects = g_ptr_array_new_with_free_func ((GDestroyNotify)g_hash_table_unref);
+  for (i = 0; i < n_bases; i++)
+    {
+      GHashTable *reachable = NULL;
+
+      if (!ostree_repo_traverse_commit (repo, bases[i], 0, &reachable,
+                                        cancellable, error))
+        goto out;
+      g_ptr_array_add (base_reachable_objects, reachable);
+    }
+
+  if (!ostree_repo_traverse_commit (repo, to, 0, &to_reachable_objects,
+                                    cancellable, error))
+    goto out;
+
+  /* We already ship the to commit in the superblock, don't ship it twice */
+  to_commit_key = g_variant_ref_sink (ostree_object_name_serialize (to, OSTREE_OBJECT_TYPE_COMMIT));
+
+  groups = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free,
+                                  (GDestroyNotify)g_ptr_array_unref);
+
+  g_hash_table_iter_init (&hashiter, to_reachable_objects);
+  while (g_hash_table_iter_next (&hashiter, &key, &value))
+    {
+      GVariant *serialized_key = key;
+      guint64 signature = 0;
+      GPtrArray *group;
+
+      if (g_variant_equal (serialized_key, to_commit_key))
+        continue;
+
+      for (i = 0; i < n_bases; i++)
+        {
+          if (g_hash_table_contains (base_reachable_objects->pdata[i], serialized_key))
+            signature |= (((guint64)1) << i);
+        }
+
+      group = g_hash_table_lookup (groups, &signature);
+      if (!group)
+        {
+          gint64 *signature_key = g_new (gint64, 1);
+          *signature_key = (gint64)signature;
+          group = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
+          g_hash_table_insert (groups, signature_key, group);
+        }
+      g_ptr_array_add (group, g_variant_ref (serialized_key));
+    }
+
+  signatures = g_array_new (FALSE, FALSE, sizeof (guint64));
+  g_hash_table_iter_init (&hashiter, groups);
+  while (g_hash_table_iter_next (&hashiter, &key, &value))
+    {
+      guint64 signature = (guint64) *(gint64*)key;
+      g_array_append_val (signatures, signature);
+    }
+  g_array_sort (signatures, compare_signatures);
+
+  if (opts & DELTAOPT_FLAG_VERBOSE)
+    g_printerr ("multi-base: bases=%u groups=%u\n", n_bases, signatures->len);
+
+  for (i = 0; i < signatures->len; i++)
+    {
+      guint64 signature = g_array_index (signatures, guint64, i);
+      GPtrArray *group = g_hash_table_lookup (groups, &signature);
+      g_autoptr(GPtrArray) metadata_objects = g_ptr_array_new ();
+      g_autoptr(GPtrArray) content_objects = g_ptr_array_new ();
+      OstreeStaticDeltaPartBuilder *current_part = NULL;
+      guint j;
+
+      for (j = 0; j < group->len; j++)
+        {
+          GVariant *serialized_key = group->pdata[j];
+          const char *checksum;
+          OstreeObjectType objtype;
+
+          ostree_object_name_deserialize (serialized_key, &checksum, &objtype);
+
+          if (OSTREE_OBJECT_TYPE_IS_META (objtype))
+            {
+              g_ptr_array_add (metadata_objects, serialized_key);
+              continue;
+            }
+
+          /* Scan for large objects, so we can fall back to plain
+           * HTTP-based fetch.
+           */
+          if (builder->min_fallback_size_bytes > 0)
+            {
+              guint64 uncompressed_size;
+
+              if (!ostree_repo_load_object_stream (repo, OSTREE_OBJECT_TYPE_FILE, checksum,
+                                                   NULL, &uncompressed_size,
+                                                   cancellable, error))
+                goto out;
+
+              if (uncompressed_size > builder->min_fallback_size_bytes)
+                {
+                  g_ptr_array_add (builder->fallback_objects, g_variant_ref (serialized_key));
+                  builder->n_fallback++;
+                  continue;
+                }
+            }
+
+          g_ptr_array_add (content_objects, serialized_key);
+        }
+
+      /* Metadata first, then content; never emit an empty part */
+      for (j = 0; j < content_objects->len; j++)
+        g_ptr_array_add (metadata_objects, content_objects->pdata[j]);
+
+      if (metadata_objects->len == 0)
+        continue;
+
+      current_part = allocate_part (builder);
+
+      for (j = 0; j < metadata_objects->len; j++)
+        {
+          const char *checksum;
+          OstreeObjectType objtype;
+
+          ostree_object_name_deserialize (metadata_objects->pdata[j], &checksum, &objtype);
+
+          if (!process_one_object (repo, builder, &current_part,
+                                   checksum, objtype,
+                                   cancellable, error))
+            goto out;
+        }
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
 static gboolean
 get_fallback_headers (OstreeRepo               *self,
                       OstreeStaticDeltaBuilder *builder,
@@ -1208,50 +1617,23 @@ get_fallback_headers (OstreeRepo               *self,
   return ret;
 }
 
-/**
- * ostree_repo_static_delta_generate:
- * @self: Repo
- * @opt: High level optimization choice
- * @from: ASCII SHA256 checksum of origin, or %NULL
- * @to: ASCII SHA256 checksum of target
- * @metadata: (allow-none): Optional metadata
- * @params: (allow-none): Parameters, see below
- * @cancellable: Cancellable
- * @error: Error
- *
- * Generate a lookaside "static delta" from @from (%NULL means
- * from-empty) which can generate the objects in @to.  This delta is
- * an optimization over fetching individual objects, and can be
- * conveniently stored and applied offline.
- *
- * The @params argument should be an a{sv}.  The following attributes
- * are known:
- *   - min-fallback-size: u: Minimum uncompressed size in megabytes to use fallback, 0 to disable fallbacks
- *   - max-chunk-size: u: Maximum size in megabytes of a delta part
- *   - max-bsdiff-size: u: Maximum size in megabytes to consider bsdiff compression
- *   for input files
- *   - compression: y: Compression type: 0=none, x=lzma, g=gzip
- *   - bsdiff-enabled: b: Enable bsdiff compression.  Default TRUE.
- *   - inline-parts: b: Put part data in header, to get a single file delta.  Default FALSE.
- *   - verbose: b: Print diagnostic messages.  Default FALSE.
- *   - endianness: b: Deltas use host byte order by default; this option allows choosing (G_BIG_ENDIAN or G_LITTLE_ENDIAN)
- *   - filename: ay: Save delta superblock to this filename, and parts in the same directory.  Default saves to repository.
- */
-gboolean
-ostree_repo_static_delta_generate (OstreeRepo                   *self,
-                                   OstreeStaticDeltaGenerateOpt  opt,
-                                   const char                   *from,
-                                   const char                   *to,
-                                   GVariant                     *metadata,
-                                   GVariant                     *params,
-                                   GCancellable                 *cancellable,
-                                   GError                      **error)
+static gboolean
+static_delta_generate_full (OstreeRepo                   *self,
+                            OstreeStaticDeltaGenerateOpt  opt,
+                            const char                   *from,
+                            const char                   *to,
+                            GVariant                     *metadata,
+                            GVariant                     *params,
+                            GHashTable                   *to_reachable_objects,
+                            GCancellable                 *cancellable,
+                            GError                      **error)
 {
   gboolean ret = FALSE;
   OstreeStaticDeltaBuilder builder = { 0, };
   guint i;
   guint min_fallback_size;
   guint max_bsdiff_size;
+  guint bsdiff_window_size;
   guint max_chunk_size;
   g_auto(GVariantBuilder) metadata_builder = {{0,}};
   DeltaOpts delta_opts = DELTAOPT_FLAG_NONE;
@@ -1271,8 +1653,10 @@ ostree_repo_static_delta_generate (OstreeRepo                   *self,
   gboolean inline_parts;
   guint endianness = G_BYTE_ORDER; 
   g_autoptr(GFile) tmp_dir = NULL;
+  g_autofree const char **from_bases = NULL;
   builder.parts = g_ptr_array_new_with_free_func ((GDestroyNotify)ostree_static_delta_part_builder_unref);
   builder.fallback_objects = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
+  builder.to_reachable_objects = to_reachable_objects;
 
   if (!g_variant_lookup (params, "min-fallback-size", "u", &min_fallback_size))
     min_fallback_size = 4;
@@ -1281,6 +1665,9 @@ ostree_repo_static_delta_generate (OstreeRepo                   *self,
   if (!g_variant_lookup (params, "max-bsdiff-size", "u", &max_bsdiff_size))
     max_bsdiff_size = 128;
   builder.max_bsdiff_size_bytes = ((guint64)max_bsdiff_size) * 1000 * 1000;
+  if (!g_variant_lookup (params, "bsdiff-window-size", "u", &bsdiff_window_size))
+    bsdiff_window_size = 0;
+  builder.bsdiff_window_size_bytes = ((guint64)bsdiff_window_size) * 1000 * 1000;
   if (!g_variant_lookup (params, "max-chunk-size", "u", &max_chunk_size))
     max_chunk_size = 32;
   builder.max_chunk_size_bytes = ((guint64)max_chunk_size) * 1000 * 1000;
@@ -1310,13 +1697,29 @@ ostree_repo_static_delta_generate (OstreeRepo                   *self,
   if (!g_variant_lookup (params, "filename", "^&ay", &opt_filename))
     opt_filename = NULL;
 
+  if (!g_variant_lookup (params, "from-bases", "^a&s", &from_bases))
+    from_bases = NULL;
+
+  if (from_bases != NULL && from != NULL)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                           "Cannot specify both a from revision and delta bases");
+      goto out;
+    }
+
   if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_COMMIT, to,
                                  &to_commit, error))
     goto out;
 
   /* Ignore optimization flags */
-  if (!generate_delta_lowlatency (self, from, to, delta_opts, &builder,
-                                  cancellable, error))
+  if (from_bases != NULL)
+    {
+      if (!generate_delta_multibase (self, from_bases, to, delta_opts, &builder,
+                                     cancellable, error))
+        goto out;
+    }
+  else if (!generate_delta_lowlatency (self, from, to, delta_opts, &builder,
+                                       cancellable, error))
     goto out;
 
   /* NOTE: Add user-supplied metadata first.  This is used by at least
@@ -1353,6 +1756,10 @@ ostree_repo_static_delta_generate (OstreeRepo                   *self,
     g_variant_builder_add (&metadata_builder, "{sv}", "ostree.endianness", g_variant_new_byte (endianness_char));
   }
 
+  if (from_bases != NULL)
+    g_variant_builder_add (&metadata_builder, "{sv}", OSTREE_STATIC_DELTA_META_BASES,
+                           g_variant_new_strv (from_bases, -1));
+
   if (opt_filename)
     {
       g_autoptr(GFile) f = g_file_new_for_path (opt_filename);
@@ -1541,7 +1948,8 @@ ostree_repo_static_delta_generate (OstreeRepo                   *self,
       g_printerr ("rollsum=%u objects, %" G_GUINT64_FORMAT " bytes\n",
                   builder.n_rollsum,
                   builder.rollsum_size);
-      g_printerr ("bsdiff=%u objects\n", builder.n_bsdiff);
+      g_printerr ("bsdiff=%u objects (windowed=%u)\n", builder.n_bsdiff,
+                  builder.n_bsdiff_windowed);
     }
 
   if (!ot_util_variant_save (descriptor_path, delta_descriptor, cancellable, error))
@@ -1553,3 +1961,256 @@ ostree_repo_static_delta_generate (OstreeRepo                   *self,
   g_clear_pointer (&builder.fallback_objects, g_ptr_array_unref);
   return ret;
 }
+
+/**
+ * ostree_repo_static_delta_generate:
+ * @self: Repo
+ * @opt: High level optimization choice
+ * @from: ASCII SHA256 checksum of origin, or %NULL
+ * @to: ASCII SHA256 checksum of target
+ * @metadata: (allow-none): Optional metadata
+ * @params: (allow-none): Parameters, see below
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Generate a lookaside "static delta" from @from (%NULL means
+ * from-empty) which can generate the objects in @to.  This delta is
+ * an optimization over fetching individual objects, and can be
+ * conveniently stored and applied offline.
+ *
+ * The @params argument should be an a{sv}.  The following attributes
+ * are known:
+ *   - min-fallback-size: u: Minimum uncompressed size in megabytes to use fallback, 0 to disable fallbacks
+ *   - max-chunk-size: u: Maximum size in megabytes of a delta part
+ *   - max-bsdiff-size: u: Maximum size in megabytes to consider bsdiff compression
+ *   for input files
+ *   - bsdiff-window-size: u: If nonzero, objects larger than max-bsdiff-size are
+ *   diffed in segments of at most this many megabytes, bounding compiler memory.
+ *   Deltas using this can only be applied by clients which support windowed
+ *   bspatch.  Default 0 (disabled).
+ *   - compression: y: Compression type: 0=none, x=lzma, g=gzip
+ *   - bsdiff-enabled: b: Enable bsdiff compression.  Default TRUE.
+ *   - inline-parts: b: Put part data in header, to get a single file delta.  Default FALSE.
+ *   - verbose: b: Print diagnostic messages.  Default FALSE.
+ *   - endianness: b: Deltas use host byte order by default; this option allows choosing (G_BIG_ENDIAN or G_LITTLE_ENDIAN)
+ *   - filename: ay: Save delta superblock to this filename, and parts in the same directory.  Default saves to repository.
+ *   - from-bases: as: Generate a from-empty delta for @to whose parts are split by which of
+ *   these base commits already contain their objects, so that clients on any of the bases only fetch
+ *   the parts they need.  @from must be %NULL.
+ */
+gboolean
+ostree_repo_static_delta_generate (OstreeRepo                   *self,
+                                   OstreeStaticDeltaGenerateOpt  opt,
+                                   const char                   *from,
+                                   const char                   *to,
+                                   GVariant                     *metadata,
+                                   GVariant                     *params,
+                                   GCancellable                 *cancellable,
+                                   GError                      **error)
+{
+  return static_delta_generate_full (self, opt, from, to, metadata, params, NULL,
+                                     cancellable, error);
+}
+
+static gboolean
+delta_is_auto_generated (OstreeRepo    *self,
+                         const char    *from,
+                         const char    *to,
+                         gboolean      *out_auto_generated,
+                         GError       **error)
+{
+  gboolean ret = FALSE;
+  g_autofree char *superblock_path = NULL;
+  g_autoptr(GVariant) superblock = NULL;
+  g_autoptr(GVariant) delta_meta = NULL;
+  gboolean auto_generated = FALSE;
+
+  superblock_path = _ostree_get_relative_static_delta_superblock_path (from, to);
+  if (!ot_util_variant_map_at (self->repo_dir_fd, superblock_path,
+                               (GVariantType*)OSTREE_STATIC_DELTA_SUPERBLOCK_FORMAT,
+                               TRUE, &superblock, error))
+    goto out;
+
+  delta_meta = g_variant_get_child_value (superblock, 0);
+  (void) g_variant_lookup (delta_meta, OSTREE_STATIC_DELTA_META_AUTO_GENERATED, "b", &auto_generated);
+
+  ret = TRUE;
+  *out_auto_generated = auto_generated;
+ out:
+  return ret;
+}
+
+/**
+ * ostree_repo_regenerate_static_deltas:
+ * @self: Repo
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Bring the repository's automatically generated static deltas up
+ * to date with its refs.  If `core/auto-static-deltas` is set to a
+ * number N greater than zero, then for each ref, a delta is generated
+ * from each of the last N parent commits present in the repository,
+ * and (unless `core/auto-static-deltas-from-scratch` is false) from
+ * empty.  Deltas which already exist are left alone, and deltas
+ * previously generated by this function which are no longer wanted
+ * are deleted; deltas generated manually are never touched.  If
+ * `core/auto-static-deltas` is unset or zero, this does nothing.
+ *
+ * This is called by ostree_repo_commit_transaction() and
+ * ostree_repo_set_ref_immediate() after they update refs, and by
+ * ostree_repo_regenerate_summary().
+ */
+gboolean
+ostree_repo_regenerate_static_deltas (OstreeRepo     *self,
+                                      GCancellable   *cancellable,
+                                      GError        **error)
+{
+  gboolean ret = FALSE;
+  g_autofree char *history_str = NULL;
+  guint64 history;
+  gboolean from_scratch;
+  g_autoptr(GHashTable) refs = NULL;
+  g_autoptr(GHashTable) targets = NULL;
+  g_autoptr(GHashTable) existing = NULL;
+  g_autoptr(GHashTable) wanted = NULL;
+  g_autoptr(GPtrArray) delta_names = NULL;
+  g_autoptr(GVariant) metadata = NULL;
+  g_autoptr(GVariant) params = NULL;
+  GHashTableIter hashiter;
+  gpointer key, value;
+  guint i;
+
+  if (!ot_keyfile_get_value_with_default (self->config, "core", "auto-static-deltas", "0",
+                                          &history_str, error))
+    goto out;
+  history = g_ascii_strtoull (history_str, NULL, 10);
+
+  if (history == 0)
+    {
+      ret = TRUE;
+      goto out;
+    }
+
+  if (!ot_keyfile_get_boolean_with_default (self->config, "core",
+                                            "auto-static-deltas-from-scratch", TRUE,
+                                            &from_scratch, error))
+    goto out;
+
+  if (!ostree_repo_list_static_delta_names (self, &delta_names, cancellable, error))
+    goto out;
+
+  existing = g_hash_table_new (g_str_hash, g_str_equal);
+  for (i = 0; i < delta_names->len; i++)
+    g_hash_table_add (existing, delta_names->pdata[i]);
+
+  wanted = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  { GVariantBuilder metadata_builder;
+
+    g_variant_builder_init (&metadata_builder, G_VARIANT_TYPE ("a{sv}"));
+    g_variant_builder_add (&metadata_builder, "{sv}", OSTREE_STATIC_DELTA_META_AUTO_GENERATED,
+                           g_variant_new_boolean (TRUE));
+    metadata = g_variant_ref_sink (g_variant_builder_end (&metadata_builder));
+    params = g_variant_ref_sink (g_variant_new_array (G_VARIANT_TYPE ("{sv}"), NULL, 0));
+  }
+
+  if (!ostree_repo_list_refs (self, NULL, &refs, cancellable, error))
+    goto out;
+
+  /* Several refs commonly point to the same commit */
+  targets = g_hash_table_new (g_str_hash, g_str_equal);
+  g_hash_table_iter_init (&hashiter, refs);
+  while (g_hash_table_iter_next (&hashiter, &key, &value))
+    g_hash_table_add (targets, value);
+
+  g_hash_table_iter_init (&hashiter, targets);
+  while (g_hash_table_iter_next (&hashiter, &key, NULL))
+    {
+      const char *to = key;
+      g_autoptr(GPtrArray) froms = g_ptr_array_new_with_free_func (g_free);
+      g_autoptr(GHashTable) to_reachable_objects = NULL;
+      g_autofree char *cur = g_strdup (to);
+      guint64 depth;
+
+      for (depth = 0; depth < history; depth++)
+        {
+          g_autoptr(GVariant) commit = NULL;
+          g_autofree char *parent = NULL;
+          gboolean have_parent;
+
+          if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_COMMIT, cur,
+                                         &commit, error))
+            goto out;
+
+          parent = ostree_commit_get_parent (commit);
+          if (parent == NULL)
+            break;
+
+          /* Stop at history which has been pruned */
+          if (!ostree_repo_has_object (self, OSTREE_OBJECT_TYPE_COMMIT, parent,
+                                       &have_parent, cancellable, error))
+            goto out;
+          if (!have_parent)
+            break;
+
+          g_ptr_array_add (froms, g_strdup (parent));
+          g_free (cur);
+          cur = g_steal_pointer (&parent);
+        }
+
+      if (from_scratch)
+        g_ptr_array_add (froms, NULL);
+
+      for (i = 0; i < froms->len; i++)
+        {
+          const char *from = froms->pdata[i];
+          g_autofree char *name = from ? g_strconcat (from, "-", to, NULL) : g_strdup (to);
+
+          if (!g_hash_table_contains (existing, name))
+            {
+              /* Traverse @to once for all of its deltas */
+              if (to_reachable_objects == NULL &&
+                  !ostree_repo_traverse_commit (self, to, 0, &to_reachable_objects,
+                                                cancellable, error))
+                goto out;
+
+              if (!static_delta_generate_full (self, OSTREE_STATIC_DELTA_GENERATE_OPT_MAJOR,
+                                               from, to, metadata, params,
+                                               to_reachable_objects,
+                                               cancellable, error))
+                {
+                  g_prefix_error (error, "Generating delta %s: ", name);
+                  goto out;
+                }
+            }
+
+          g_hash_table_add (wanted, g_steal_pointer (&name));
+        }
+    }
+
+  for (i = 0; i < delta_names->len; i++)
+    {
+      const char *name = delta_names->pdata[i];
+      g_autofree char *from = NULL;
+      g_autofree char *to = NULL;
+      gboolean auto_generated;
+
+      if (g_hash_table_contains (wanted, name))
+        continue;
+
+      _ostree_parse_delta_name (name, &from, &to);
+      if (!delta_is_auto_generated (self, (from && from[0]) ? from : NULL, to,
+                                    &auto_generated, error))
+        goto out;
+      if (!auto_generated)
+        continue;
+
+      g_debug ("Deleting automatic static delta %s", name);
+      if (!_ostree_repo_static_delta_delete (self, name, cancellable, error))
+        goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
@@ -449,6 +449,86 @@ ostree_repo_static_delta_execute_offline (OstreeRepo                    *self,
   return ret;
 }
 
+/* Copy @in into an unlinked temporary file and return its fd; used
+ * for compressed parts we have on disk, which may be too large to
+ * unpack into memory.
+ */
+static gboolean
+spool_to_tmpfile (GInputStream  *in,
+                  int           *out_fd,
+                  GCancellable  *cancellable,
+                  GError       **error)
+{
+  gboolean ret = FALSE;
+  g_autofree char *tmppath = g_strdup ("/var/tmp/ostree-delta-XXXXXX");
+  g_autoptr(GOutputStream) unpacked_out = NULL;
+  glnx_fd_close int unpacked_fd = -1;
+  gssize n_bytes_written;
+
+  unpacked_fd = g_mkstemp_full (tmppath, O_RDWR | O_CLOEXEC, 0640);
+  if (unpacked_fd < 0)
+    {
+      glnx_set_error_from_errno (error);
+      goto out;
+    }
+
+  /* Now make it autocleanup on process exit - in the future, we
+   * should consider caching unpacked deltas as well.
+   */
+  if (unlink (tmppath) < 0)
+    {
+      glnx_set_error_from_errno (error);
+      goto out;
+    }
+
+  unpacked_out = g_unix_output_stream_new (unpacked_fd, FALSE);
+
+  n_bytes_written = g_output_stream_splice (unpacked_out, in,
+                                            G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+                                            G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                                            cancellable, error);
+  if (n_bytes_written < 0)
+    goto out;
+
+  ret = TRUE;
+  *out_fd = glnx_steal_fd (&unpacked_fd);
+ out:
+  return ret;
+}
+
+/* Read the unpacked payload of a part that isn't backed by a file
+ * (one being streamed from the network, or an inline part) straight
+ * into memory; it is handed to the opcode interpreter from there,
+ * without touching the disk.
+ */
+static gboolean
+read_part_payload (GInputStream  *in,
+                   gboolean       trusted,
+                   GVariant     **out_part,
+                   GCancellable  *cancellable,
+                   GError       **error)
+{
+  g_autoptr(GOutputStream) membuf = g_memory_output_stream_new_resizable ();
+  g_autoptr(GBytes) payload = NULL;
+
+  if (g_output_stream_splice (membuf, in,
+                              G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+                              G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                              cancellable, error) < 0)
+    return FALSE;
+
+  payload = g_memory_output_stream_steal_as_bytes ((GMemoryOutputStream*)membuf);
+  *out_part = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (OSTREE_STATIC_DELTA_PART_PAYLOAD_FORMAT_V0),
+                                                            payload, trusted));
+  return TRUE;
+}
+
+/* @part_in may be any stream, including one being read from the
+ * network; in that case the part is decompressed as it arrives and
+ * the unpacked payload is kept in memory.  The checksum covers the
+ * raw stream and is verified before the part is returned, so a
+ * corrupt part is never executed.
+ */
 gboolean
 _ostree_static_delta_part_open (GInputStream   *part_in,
                                 GBytes         *inline_part_bytes,
@@ -468,8 +548,7 @@ _ostree_static_delta_part_open (GInputStream   *part_in,
   g_autoptr(GVariant) ret_part = NULL;
   GInputStream *source_in;
 
-  /* We either take a fd or a GBytes reference */
-  g_return_val_if_fail (G_IS_FILE_DESCRIPTOR_BASED (part_in) || inline_part_bytes != NULL, FALSE);
+  g_return_val_if_fail (part_in != NULL, FALSE);
   g_return_val_if_fail (skip_checksum || expected_checksum != NULL, FALSE);
 
   if (!skip_checksum)
@@ -497,7 +576,7 @@ _ostree_static_delta_part_open (GInputStream   *part_in,
   switch (comptype)
     {
     case 0:
-      if (!inline_part_bytes)
+      if (inline_part_bytes == NULL && G_IS_FILE_DESCRIPTOR_BASED (part_in))
         {
           int part_fd = g_file_descriptor_based_get_fd ((GFileDescriptorBased*)part_in);
 
@@ -505,6 +584,16 @@ _ostree_static_delta_part_open (GInputStream   *part_in,
           if (!ot_util_variant_map_fd (part_fd, 1, G_VARIANT_TYPE (OSTREE_STATIC_DELTA_PART_PAYLOAD_FORMAT_V0),
                                        trusted, &ret_part, error))
             goto out;
+
+          if (!skip_checksum)
+            g_checksum_update (checksum, g_variant_get_data (ret_part),
+                               g_variant_get_size (ret_part));
+        }
+      else if (inline_part_bytes == NULL)
+        {
+          /* The checksum is computed by source_in as we read */
+          if (!read_part_payload (source_in, trusted, &ret_part, cancellable, error))
+            goto out;
         }
       else
         {
@@ -513,45 +602,26 @@ _ostree_static_delta_part_open (GInputStream   *part_in,
           ret_part = g_variant_new_from_bytes (G_VARIANT_TYPE (OSTREE_STATIC_DELTA_PART_PAYLOAD_FORMAT_V0),
                                                content_bytes, trusted);
           g_variant_ref_sink (ret_part);
-        }
 
-      if (!skip_checksum)
-        g_checksum_update (checksum, g_variant_get_data (ret_part),
-                           g_variant_get_size (ret_part));
-      
+          if (!skip_checksum)
+            g_checksum_update (checksum, g_variant_get_data (ret_part),
+                               g_variant_get_size (ret_part));
+        }
       break;
     case 'x':
       {
-        g_autofree char *tmppath = g_strdup ("/var/tmp/ostree-delta-XXXXXX");
         g_autoptr(GConverter) decomp = (GConverter*) _ostree_lzma_decompressor_new ();
         g_autoptr(GInputStream) convin = g_converter_input_stream_new (source_in, decomp);
-        g_autoptr(GOutputStream) unpacked_out = NULL;
         glnx_fd_close int unpacked_fd = -1;
-        gssize n_bytes_written;
 
-        unpacked_fd = g_mkstemp_full (tmppath, O_RDWR | O_CLOEXEC, 0640);
-        if (unpacked_fd < 0)
+        if (!G_IS_FILE_DESCRIPTOR_BASED (part_in))
           {
-            glnx_set_error_from_errno (error);
-            goto out;
-          }
-        
-        /* Now make it autocleanup on process exit - in the future, we
-         * should consider caching unpacked deltas as well.
-         */
-        if (unlink (tmppath) < 0)
-          {
-            glnx_set_error_from_errno (error);
-            goto out;
+            if (!read_part_payload (convin, trusted, &ret_part, cancellable, error))
+              goto out;
+            break;
           }
-        
-        unpacked_out = g_unix_output_stream_new (unpacked_fd, FALSE);
 
-        n_bytes_written = g_output_stream_splice (unpacked_out, convin,
-                                                  G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
-                                                  G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
-                                                  cancellable, error);
-        if (n_bytes_written < 0)
+        if (!spool_to_tmpfile (convin, &unpacked_fd, cancellable, error))
           goto out;
 
         if (!ot_util_variant_map_fd (unpacked_fd, 0, G_VARIANT_TYPE (OSTREE_STATIC_DELTA_PART_PAYLOAD_FORMAT_V0),
@@ -660,8 +730,9 @@ show_one_part (OstreeRepo                    *self,
 
     { const guint *n_ops = stats.n_ops_executed;
       g_print ("PartPayloadOps%u: openspliceclose=%u open=%u write=%u setread=%u "
-               "unsetread=%u close=%u bspatch=%u\n",
-               i, n_ops[0], n_ops[1], n_ops[2], n_ops[3], n_ops[4], n_ops[5], n_ops[6]);
+               "unsetread=%u close=%u bspatch=%u bspatchwindow=%u\n",
+               i, n_ops[0], n_ops[1], n_ops[2], n_ops[3], n_ops[4], n_ops[5], n_ops[6],
+               n_ops[7]);
     }
   }
     
@@ -783,6 +854,29 @@ _ostree_delta_needs_byteswap (GVariant *superblock)
     }
 }
 
+/* Returns %TRUE if @superblock is a multi-base delta, and @checksum is
+ * one of the commits its parts were partitioned against.
+ */
+gboolean
+_ostree_delta_has_base (GVariant   *superblock,
+                        const char *checksum)
+{
+  g_autoptr(GVariant) delta_meta = NULL;
+  g_autofree const char **bases = NULL;
+  guint i;
+
+  delta_meta = g_variant_get_child_value (superblock, 0);
+  if (!g_variant_lookup (delta_meta, OSTREE_STATIC_DELTA_META_BASES, "^a&s", &bases))
+    return FALSE;
+
+  for (i = 0; bases[i] != NULL; i++)
+    {
+      if (strcmp (bases[i], checksum) == 0)
+        return TRUE;
+    }
+  return FALSE;
+}
+
 gboolean
 _ostree_repo_static_delta_delete (OstreeRepo                    *self,
                                   const char                    *delta_id,
@@ -883,6 +977,16 @@ _ostree_repo_static_delta_dump (OstreeRepo                    *self,
     g_variant_get_child (delta_superblock, 1, "t", &ts);
     g_print ("Timestamp: %" G_GUINT64_FORMAT "\n", GUINT64_FROM_BE (ts));
   }
+  { g_autoptr(GVariant) delta_meta = g_variant_get_child_value (delta_superblock, 0);
+    g_autofree const char **bases = NULL;
+
+    if (g_variant_lookup (delta_meta, OSTREE_STATIC_DELTA_META_BASES, "^a&s", &bases))
+      {
+        g_print ("Number of bases: %u\n", g_strv_length ((char**)bases));
+        for (i = 0; bases[i] != NULL; i++)
+          g_print ("  Base: %s\n", bases[i]);
+      }
+  }
   { g_autoptr(GVariant) recurse = NULL;
     g_variant_get_child (delta_superblock, 5, "@ay", &recurse);
     g_print ("Number of parents: %u\n", (guint)(g_variant_get_size (recurse) / (OSTREE_SHA256_DIGEST_LEN * 2)));
@@ -31,6 +31,18 @@ G_BEGIN_DECLS
 
 #define OSTREE_SUMMARY_STATIC_DELTAS "ostree.static-deltas"
 
+/* Superblock metadata key (as) listing the base commits a multi-base
+ * delta was partitioned against; such deltas are stored as from-empty
+ * deltas.
+ */
+#define OSTREE_STATIC_DELTA_META_BASES "ostree.delta-bases"
+
+/* Superblock metadata key (b) marking deltas created by
+ * ostree_repo_regenerate_static_deltas(), which may delete them again
+ * once they fall out of the configured history.
+ */
+#define OSTREE_STATIC_DELTA_META_AUTO_GENERATED "ostree.auto-generated"
+
 /**
  * OSTREE_STATIC_DELTA_PART_PAYLOAD_FORMAT_V0:
  *
@@ -116,9 +128,10 @@ typedef enum {
   OSTREE_STATIC_DELTA_OP_SET_READ_SOURCE = 'r',
   OSTREE_STATIC_DELTA_OP_UNSET_READ_SOURCE = 'R',
   OSTREE_STATIC_DELTA_OP_CLOSE = 'c',
-  OSTREE_STATIC_DELTA_OP_BSPATCH = 'B'
+  OSTREE_STATIC_DELTA_OP_BSPATCH = 'B',
+  OSTREE_STATIC_DELTA_OP_BSPATCH_WINDOW = 'b'
 } OstreeStaticDeltaOpCode;
-#define OSTREE_STATIC_DELTA_N_OPS 7
+#define OSTREE_STATIC_DELTA_N_OPS 8
 
 gboolean
 _ostree_static_delta_part_open (GInputStream   *part_in,
@@ -235,4 +248,7 @@ OstreeDeltaEndianness _ostree_delta_get_endianness (GVariant *superblock, gboole
 
 gboolean _ostree_delta_needs_byteswap (GVariant *superblock);
 
+gboolean _ostree_delta_has_base (GVariant   *superblock,
+                                 const char *checksum);
+
 G_END_DECLS
@@ -21,6 +21,7 @@
 #include "config.h"
 
 #include <string.h>
+#include <sys/mman.h>
 
 #include <glib-unix.h>
 #include <gio/gunixinputstream.h>
@@ -59,6 +60,7 @@ typedef struct {
   OstreeObjectType output_objtype;
   OstreeRepoContentBareCommit barecommitstate;
   guint64          content_size;
+  guint64          content_pos;
   GOutputStream   *content_out;
   char             checksum[65];
   char             *read_source_object;
@@ -104,6 +106,7 @@ OPPROTO(set_read_source)
 OPPROTO(unset_read_source)
 OPPROTO(close)
 OPPROTO(bspatch)
+OPPROTO(bspatch_window)
 #undef OPPROTO
 
 static void
@@ -175,6 +178,8 @@ delta_opcode_index (OstreeStaticDeltaOpCode op)
       return 5;
     case OSTREE_STATIC_DELTA_OP_BSPATCH:
       return 6;
+    case OSTREE_STATIC_DELTA_OP_BSPATCH_WINDOW:
+      return 7;
     default:
       g_assert_not_reached ();
     }
@@ -269,6 +274,10 @@ _ostree_static_delta_part_execute (OstreeRepo      *repo,
           if (!dispatch_bspatch (repo, state, cancellable, error))
             goto out;
           break;
+        case OSTREE_STATIC_DELTA_OP_BSPATCH_WINDOW:
+          if (!dispatch_bspatch_window (repo, state, cancellable, error))
+            goto out;
+          break;
         default:
           g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
                        "Unknown opcode %u at offset %u", opcode, n_executed);
@@ -404,6 +413,7 @@ do_content_open_generic (OstreeRepo                 *repo,
     goto out;
 
   state->barecommitstate.fd = -1;
+  state->content_pos = 0;
 
   modev = g_variant_get_child_value (state->mode_dict, mode_offset);
   g_variant_get (modev, "(uuu)", &uid, &gid, &mode);
@@ -438,6 +448,165 @@ bspatch_read (const struct bspatch_stream* stream, void* buffer, int length)
   return 0;
 }
 
+/* For bare repositories, all object content is written through
+ * barecommitstate.fd at content_pos, which tracks how much of the
+ * (already fallocate()d) object has been produced so far; content_out
+ * just owns the fd.  Every write is positioned, so none of them
+ * depends on the file offset.
+ */
+static gboolean
+content_check_range (StaticDeltaExecutionState  *state,
+                     guint64                     len,
+                     GError                    **error)
+{
+  if (G_UNLIKELY (state->content_pos > state->content_size ||
+                  len > state->content_size - state->content_pos))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                   "Writing %" G_GUINT64_FORMAT " bytes at offset %" G_GUINT64_FORMAT
+                   " exceeds object size %" G_GUINT64_FORMAT,
+                   len, state->content_pos, state->content_size);
+      return FALSE;
+    }
+  return TRUE;
+}
+
+static gboolean
+content_write (StaticDeltaExecutionState  *state,
+               const guint8               *buf,
+               guint64                     len,
+               GError                    **error)
+{
+  if (!content_check_range (state, len, error))
+    return FALSE;
+
+  while (len > 0)
+    {
+      gssize n;
+
+      do
+        n = pwrite (state->barecommitstate.fd, buf, MIN (len, G_MAXSSIZE), state->content_pos);
+      while (G_UNLIKELY (n == -1 && errno == EINTR));
+      if (n == -1)
+        {
+          glnx_set_error_from_errno (error);
+          return FALSE;
+        }
+      buf += n;
+      len -= n;
+      state->content_pos += n;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+content_copy_from_read_source (StaticDeltaExecutionState  *state,
+                               guint64                     source_offset,
+                               guint64                     len,
+                               GCancellable               *cancellable,
+                               GError                    **error)
+{
+  if (!content_check_range (state, len, error))
+    return FALSE;
+
+  /* Let the kernel move the data (possibly sharing extents) rather
+   * than bouncing it through userspace.
+   */
+  if (!ot_copy_fd_range_at (state->read_source_fd, source_offset,
+                            state->barecommitstate.fd, state->content_pos,
+                            len, cancellable, error))
+    return FALSE;
+
+  state->content_pos += len;
+  return TRUE;
+}
+
+/* Where bspatch writes its output.  We map the next @len bytes of the
+ * object and let bspatch write straight into the page cache; if
+ * mapping fails we fall back to a heap buffer which is written out
+ * afterwards.
+ */
+typedef struct {
+  guint8 *data;
+  gsize   len;
+  void   *map;
+  gsize   map_len;
+} BspatchOutput;
+
+static gboolean
+bspatch_output_init (StaticDeltaExecutionState  *state,
+                     guint64                     len,
+                     BspatchOutput              *out,
+                     GError                    **error)
+{
+  int fd = state->barecommitstate.fd;
+
+  memset (out, 0, sizeof (*out));
+  out->len = len;
+
+  if (!content_check_range (state, len, error))
+    return FALSE;
+
+  if (len > 0)
+    {
+      long pagesize = sysconf (_SC_PAGESIZE);
+      off_t pos = state->content_pos;
+      off_t aligned = pos - (pos % pagesize);
+
+      out->map_len = (pos - aligned) + len;
+      out->map = mmap (NULL, out->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, aligned);
+      if (out->map != MAP_FAILED)
+        {
+          out->data = (guint8*)out->map + (pos - aligned);
+          return TRUE;
+        }
+      out->map = NULL;
+
+      if ((state->repo->test_error_flags & OSTREE_REPO_TEST_ERROR_BSPATCH_COPY) > 0)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "OSTREE_REPO_TEST_ERROR_BSPATCH_COPY specified: mmap: %s",
+                       g_strerror (errno));
+          return FALSE;
+        }
+    }
+
+  out->data = g_malloc0 (len);
+  return TRUE;
+}
+
+static gboolean
+bspatch_output_finish (StaticDeltaExecutionState  *state,
+                       BspatchOutput              *out,
+                       GError                    **error)
+{
+  if (out->map)
+    {
+      (void) munmap (out->map, out->map_len);
+      out->map = NULL;
+      state->content_pos += out->len;
+    }
+  else
+    {
+      if (!content_write (state, out->data, out->len, error))
+        return FALSE;
+      g_clear_pointer (&out->data, g_free);
+    }
+
+  return TRUE;
+}
+
+static void
+bspatch_output_clear (BspatchOutput *out)
+{
+  if (out->map)
+    (void) munmap (out->map, out->map_len);
+  else
+    g_free (out->data);
+  memset (out, 0, sizeof (*out));
+}
+
 static gboolean
 dispatch_bspatch (OstreeRepo                 *repo,
                   StaticDeltaExecutionState  *state,
@@ -448,10 +617,9 @@ dispatch_bspatch (OstreeRepo                 *repo,
   guint64 offset, length;
   g_autoptr(GInputStream) in_stream = NULL;
   g_autoptr(GMappedFile) input_mfile = NULL;
-  g_autofree guchar *buf = NULL;
+  BspatchOutput output = { 0, };
   struct bspatch_stream stream;
   struct bzpatch_opaque_s opaque;
-  gsize bytes_written;
 
   if (!read_varuint64 (state, &offset, error))
     goto out;
@@ -470,7 +638,8 @@ dispatch_bspatch (OstreeRepo                 *repo,
       if (!input_mfile)
         goto out;
 
-      buf = g_malloc0 (state->content_size);
+      if (!bspatch_output_init (state, state->content_size, &output, error))
+        goto out;
 
       opaque.state = state;
       opaque.offset = offset;
@@ -479,23 +648,128 @@ dispatch_bspatch (OstreeRepo                 *repo,
       stream.opaque = &opaque;
       if (bspatch ((const guint8*)g_mapped_file_get_contents (input_mfile),
                    g_mapped_file_get_length (input_mfile),
-                   buf,
+                   output.data,
                    state->content_size,
                    &stream) < 0)
         goto out;
 
-      if (!g_output_stream_write_all (state->content_out,
-                                      buf,
-                                      state->content_size,
-                                      &bytes_written,
-                                      cancellable, error))
+      if (!bspatch_output_finish (state, &output, error))
         goto out;
+    }
 
-      g_assert (bytes_written == state->content_size);
+  ret = TRUE;
+ out:
+  bspatch_output_clear (&output);
+  return ret;
+}
+
+/* Like bspatch, but the patch only covers a window of the source
+ * object and produces the next @target_length bytes of the output;
+ * the compiler emits one of these per segment for objects too large
+ * to bsdiff whole.
+ */
+static gboolean
+dispatch_bspatch_window (OstreeRepo                 *repo,
+                         StaticDeltaExecutionState  *state,
+                         GCancellable               *cancellable,
+                         GError                    **error)
+{
+  gboolean ret = FALSE;
+  guint64 offset, length;
+  guint64 source_offset, source_length;
+  guint64 target_length;
+  g_autoptr(GMappedFile) input_mfile = NULL;
+  BspatchOutput output = { 0, };
+  struct bspatch_stream stream;
+  struct bzpatch_opaque_s opaque;
+
+  if (!read_varuint64 (state, &offset, error))
+    goto out;
+  if (!read_varuint64 (state, &length, error))
+    goto out;
+  if (!read_varuint64 (state, &source_offset, error))
+    goto out;
+  if (!read_varuint64 (state, &source_length, error))
+    goto out;
+  if (!read_varuint64 (state, &target_length, error))
+    goto out;
+  if (!validate_ofs (state, offset, length, error))
+    goto out;
+
+  if (state->stats_only)
+    {
+      ret = TRUE;
+      goto out;
+    }
+
+  if (!state->have_obj)
+    {
+      const guint8 *source_data;
+      gsize source_size;
+
+      if (state->read_source_fd == -1)
+        {
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                               "No read source set");
+          goto out;
+        }
+
+      /* Windows are applied back to back; each must fit in what is
+       * left of the object, not merely in the object.
+       */
+      if (G_UNLIKELY (target_length == 0 ||
+                      state->content_pos > state->content_size ||
+                      target_length > state->content_size - state->content_pos))
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                       "Invalid bspatch target window %" G_GUINT64_FORMAT
+                       " at offset %" G_GUINT64_FORMAT " for object size %" G_GUINT64_FORMAT,
+                       target_length, state->content_pos, state->content_size);
+          goto out;
+        }
+
+      input_mfile = g_mapped_file_new_from_fd (state->read_source_fd, FALSE, error);
+      if (!input_mfile)
+        goto out;
+
+      source_data = (const guint8*)g_mapped_file_get_contents (input_mfile);
+      source_size = g_mapped_file_get_length (input_mfile);
+
+      if (G_UNLIKELY (source_offset + source_length < source_offset ||
+                      source_offset + source_length > source_size))
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                       "Invalid source window %" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT,
+                       source_offset, source_length);
+          goto out;
+        }
+
+      if (!bspatch_output_init (state, target_length, &output, error))
+        goto out;
+
+      opaque.state = state;
+      opaque.offset = offset;
+      opaque.length = length;
+      stream.read = bspatch_read;
+      stream.opaque = &opaque;
+      if (bspatch (source_data + source_offset, source_length,
+                   output.data, target_length,
+                   &stream) < 0)
+        {
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                               "bspatch failed");
+          goto out;
+        }
+
+      if (!bspatch_output_finish (state, &output, error))
+        goto out;
     }
 
   ret = TRUE;
  out:
+  bspatch_output_clear (&output);
+  if (!ret)
+    g_prefix_error (error, "opcode bspatch-window: ");
   return ret;
 }
 
@@ -557,7 +831,6 @@ dispatch_open_splice_and_close (OstreeRepo                 *repo,
     {
       guint64 content_offset;
       guint64 objlen;
-      gsize bytes_written;
       g_autoptr(GInputStream) object_input = NULL;
       g_autoptr(GInputStream) memin = NULL;
       
@@ -605,11 +878,8 @@ dispatch_open_splice_and_close (OstreeRepo                 *repo,
 
           if (!state->have_obj)
             {
-              if (!g_output_stream_write_all (state->content_out,
-                                              state->payload_data + content_offset,
-                                              state->content_size,
-                                              &bytes_written,
-                                              cancellable, error))
+              if (!content_write (state, state->payload_data + content_offset,
+                                  state->content_size, error))
                 goto out;
             }
         }
@@ -743,7 +1013,6 @@ dispatch_write (OstreeRepo                 *repo,
   gboolean ret = FALSE;
   guint64 content_size;
   guint64 content_offset;
-  gsize bytes_written;
       
   if (!read_varuint64 (state, &content_size, error))
     goto out;
@@ -760,51 +1029,20 @@ dispatch_write (OstreeRepo                 *repo,
     {
       if (state->read_source_fd != -1)
         {
-          if (lseek (state->read_source_fd, content_offset, SEEK_SET) == -1)
+          if (!content_copy_from_read_source (state, content_offset, content_size,
+                                              cancellable, error))
             {
-              glnx_set_error_from_errno (error);
+              g_prefix_error (error, "Reading object %s: ", state->read_source_object);
               goto out;
             }
-          while (content_size > 0)
-            {
-              char buf[4096];
-              gssize bytes_read;
-
-              do
-                bytes_read = read (state->read_source_fd, buf, MIN(sizeof(buf), content_size));
-              while (G_UNLIKELY (bytes_read == -1 && errno == EINTR));
-              if (bytes_read == -1)
-                {
-                  glnx_set_error_from_errno (error);
-                  goto out;
-                }
-              if (G_UNLIKELY (bytes_read == 0))
-                {
-                  g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                               "Unexpected EOF reading object %s", state->read_source_object);
-                  goto out;
-                }
-              
-              if (!g_output_stream_write_all (state->content_out,
-                                              buf,
-                                              bytes_read,
-                                              &bytes_written,
-                                              cancellable, error))
-                goto out;
-              
-              content_size -= bytes_read;
-            }
         }
       else
         {
           if (!validate_ofs (state, content_offset, content_size, error))
             goto out;
 
-          if (!g_output_stream_write_all (state->content_out,
-                                          state->payload_data + content_offset,
-                                          content_size,
-                                          &bytes_written,
-                                          cancellable, error))
+          if (!content_write (state, state->payload_data + content_offset,
+                              content_size, error))
             goto out;
         }
     }
@@ -895,8 +1133,14 @@ dispatch_close (OstreeRepo                 *repo,
   
   if (state->content_out)
     {
-      if (!g_output_stream_flush (state->content_out, cancellable, error))
-        goto out;
+      if (G_UNLIKELY (state->content_pos != state->content_size))
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                       "Object %s is incomplete: wrote %" G_GUINT64_FORMAT
+                       " of %" G_GUINT64_FORMAT " bytes",
+                       state->checksum, state->content_pos, state->content_size);
+          goto out;
+        }
 
       if (state->trusted)
         {
@@ -24,6 +24,7 @@
 
 #include "libglnx.h"
 #include "ostree.h"
+#include "ostree-repo-private.h"
 #include "otutil.h"
 
 struct _OstreeRepoRealCommitTraverseIter {
@@ -297,168 +298,615 @@ ostree_repo_traverse_new_reachable (void)
                                 NULL, (GDestroyNotify)g_variant_unref);
 }
 
+/*
+ * Reachability of a tree is computed by a pool of threads, each of
+ * which takes one dirtree at a time, and queues any subdirectories
+ * which haven't been seen yet.  Objects are collected in a scratch
+ * set per commit; a dirtree there has only been queued, not walked,
+ * so the set is only merged into the caller's once the whole tree is
+ * done.
+ */
+typedef struct {
+  OstreeRepo *repo;
+  GThreadPool *pool;
+  GCancellable *cancellable;
+
+  GMutex lock;
+  GCond cond;
+  OstreeObjectSet *known;     /* complete already; read-only while walking */
+  GHashTable *known_names;    /* likewise, from the public API; may be NULL */
+  OstreeObjectSet *reachable; /* protected by lock */
+  guint pending;              /* protected by lock */
+  GError *error;              /* protected by lock */
+} ParallelTraverse;
+
+typedef struct {
+  guchar csum[OSTREE_SHA256_DIGEST_LEN];
+  OstreeObjectType objtype;
+} FoundObject;
+
+/* Whether @csum/@objtype was already found, either in @known or in
+ * the caller's set of object names.  With @known %NULL, the whole
+ * tree is wanted and nothing counts as found.
+ */
 static gboolean
-traverse_dirtree (OstreeRepo           *repo,
-                  const char           *checksum,
-                  GHashTable           *inout_reachable,
-                  GCancellable         *cancellable,
-                  GError              **error);
+traverse_is_known (ParallelTraverse  *traverse,
+                   OstreeObjectSet   *known,
+                   const guchar      *csum,
+                   OstreeObjectType   objtype)
+{
+  char checksum[65];
+  g_autoptr(GVariant) key = NULL;
+
+  if (known == NULL)
+    return FALSE;
+  if (_ostree_object_set_contains (known, csum, objtype))
+    return TRUE;
+  if (traverse->known_names == NULL)
+    return FALSE;
+
+  ostree_checksum_inplace_from_bytes (csum, checksum);
+  key = g_variant_ref_sink (ostree_object_name_serialize (checksum, objtype));
+  return g_hash_table_contains (traverse->known_names, key);
+}
+
+static gboolean
+parallel_traverse_failed (ParallelTraverse *traverse)
+{
+  gboolean failed;
+
+  g_mutex_lock (&traverse->lock);
+  failed = traverse->error != NULL;
+  g_mutex_unlock (&traverse->lock);
+
+  return failed || g_cancellable_is_cancelled (traverse->cancellable);
+}
 
 static gboolean
-traverse_iter (OstreeRepo                          *repo,
-               OstreeRepoCommitTraverseIter        *iter,
-               GHashTable                          *inout_reachable,
-               GCancellable                        *cancellable,
-               GError                             **error)
+traverse_dirtree (ParallelTraverse  *traverse,
+                  const guchar      *dirtree_csum,
+                  GError           **error)
 {
   gboolean ret = FALSE;
+  char checksum[65];
+  g_autoptr(GVariant) dirtree = NULL;
+  g_autoptr(GVariant) files_variant = NULL;
+  g_autoptr(GVariant) dirs_variant = NULL;
+  g_autoptr(GArray) found = NULL;
+  guint i, n;
 
-  while (TRUE)
+  ostree_checksum_inplace_from_bytes (dirtree_csum, checksum);
+  if (!ostree_repo_load_variant (traverse->repo, OSTREE_OBJECT_TYPE_DIR_TREE, checksum,
+                                 &dirtree, error))
+    goto out;
+
+  g_debug ("Traversing dirtree %s", checksum);
+
+  /* Collect the names without holding the lock */
+  found = g_array_new (FALSE, FALSE, sizeof (FoundObject));
+
+  /* PARSE OSTREE_OBJECT_TYPE_DIR_TREE */
+  files_variant = g_variant_get_child_value (dirtree, 0);
+  n = g_variant_n_children (files_variant);
+  for (i = 0; i < n; i++)
     {
-      g_autoptr(GVariant) key = NULL;
-      OstreeRepoCommitIterResult iterres =
-        ostree_repo_commit_traverse_iter_next (iter, cancellable, error);
-          
-      if (iterres == OSTREE_REPO_COMMIT_ITER_RESULT_ERROR)
-        goto out;
-      else if (iterres == OSTREE_REPO_COMMIT_ITER_RESULT_END)
-        break;
-      else if (iterres == OSTREE_REPO_COMMIT_ITER_RESULT_FILE)
-        {
-          char *name;
-          char *checksum;
+      const char *name;
+      g_autoptr(GVariant) csum_v = NULL;
+      FoundObject obj = { { 0, }, OSTREE_OBJECT_TYPE_FILE };
+      const guchar *csum;
 
-          ostree_repo_commit_traverse_iter_get_file (iter, &name, &checksum);
+      g_variant_get_child (files_variant, i, "(&s@ay)", &name, &csum_v);
+      csum = ostree_checksum_bytes_peek_validate (csum_v, error);
+      if (!csum)
+        goto out;
+      memcpy (obj.csum, csum, sizeof (obj.csum));
+      g_array_append_val (found, obj);
+    }
 
-          g_debug ("Found file object %s", checksum);
-          key = ostree_object_name_serialize (checksum, OSTREE_OBJECT_TYPE_FILE);
-          g_hash_table_replace (inout_reachable, key, key);
-          key = NULL;
-        }
-      else if (iterres == OSTREE_REPO_COMMIT_ITER_RESULT_DIR)
-        {
-          char *name;
-          char *content_checksum;
-          char *meta_checksum;
+  dirs_variant = g_variant_get_child_value (dirtree, 1);
+  n = g_variant_n_children (dirs_variant);
+  for (i = 0; i < n; i++)
+    {
+      const char *name;
+      g_autoptr(GVariant) contents_csum_v = NULL;
+      g_autoptr(GVariant) meta_csum_v = NULL;
+      FoundObject meta = { { 0, }, OSTREE_OBJECT_TYPE_DIR_META };
+      FoundObject tree = { { 0, }, OSTREE_OBJECT_TYPE_DIR_TREE };
+      const guchar *csum;
 
-          ostree_repo_commit_traverse_iter_get_dir (iter, &name, &content_checksum,
-                                                    &meta_checksum);
+      g_variant_get_child (dirs_variant, i, "(&s@ay@ay)",
+                           &name, &contents_csum_v, &meta_csum_v);
+      csum = ostree_checksum_bytes_peek_validate (meta_csum_v, error);
+      if (!csum)
+        goto out;
+      memcpy (meta.csum, csum, sizeof (meta.csum));
+      g_array_append_val (found, meta);
+      csum = ostree_checksum_bytes_peek_validate (contents_csum_v, error);
+      if (!csum)
+        goto out;
+      memcpy (tree.csum, csum, sizeof (tree.csum));
+      g_array_append_val (found, tree);
+    }
 
-          g_debug ("Found dirtree object %s", content_checksum);
-          g_debug ("Found dirmeta object %s", meta_checksum);
-          key = ostree_object_name_serialize (meta_checksum, OSTREE_OBJECT_TYPE_DIR_META);
-          g_hash_table_replace (inout_reachable, key, key);
-          key = NULL;
+  g_mutex_lock (&traverse->lock);
+  for (i = 0; i < found->len; i++)
+    {
+      FoundObject *obj = &g_array_index (found, FoundObject, i);
 
-          key = ostree_object_name_serialize (content_checksum, OSTREE_OBJECT_TYPE_DIR_TREE);
-          if (!g_hash_table_lookup (inout_reachable, key))
-            {
-              g_hash_table_replace (inout_reachable, key, key);
-              key = NULL;
+      if (traverse_is_known (traverse, traverse->known, obj->csum, obj->objtype))
+        continue;
 
-              if (!traverse_dirtree (repo, content_checksum, inout_reachable,
-                                     cancellable, error))
-                goto out;
-            }
+      if (_ostree_object_set_add (traverse->reachable, obj->csum, obj->objtype) &&
+          obj->objtype == OSTREE_OBJECT_TYPE_DIR_TREE)
+        {
+          traverse->pending++;
+          g_thread_pool_push (traverse->pool, g_memdup (obj->csum, sizeof (obj->csum)), NULL);
         }
-      else
-        g_assert_not_reached ();
     }
+  g_mutex_unlock (&traverse->lock);
 
   ret = TRUE;
  out:
   return ret;
 }
 
+static void
+traverse_dirtree_task_run (gpointer data,
+                           gpointer user_data)
+{
+  g_autofree guchar *csum = data;
+  ParallelTraverse *traverse = user_data;
+  GError *local_error = NULL;
+
+  if (!parallel_traverse_failed (traverse) &&
+      !traverse_dirtree (traverse, csum, &local_error))
+    {
+      g_mutex_lock (&traverse->lock);
+      if (traverse->error == NULL)
+        traverse->error = local_error;
+      else
+        g_error_free (local_error);
+      g_mutex_unlock (&traverse->lock);
+    }
+
+  g_mutex_lock (&traverse->lock);
+  if (--traverse->pending == 0)
+    g_cond_signal (&traverse->cond);
+  g_mutex_unlock (&traverse->lock);
+}
+
+static gboolean
+parallel_traverse_init (ParallelTraverse  *traverse,
+                        OstreeRepo        *repo,
+                        GCancellable      *cancellable,
+                        GError           **error)
+{
+  memset (traverse, 0, sizeof (*traverse));
+  traverse->repo = repo;
+  traverse->cancellable = cancellable;
+  g_mutex_init (&traverse->lock);
+  g_cond_init (&traverse->cond);
+
+  traverse->pool = g_thread_pool_new (traverse_dirtree_task_run, traverse,
+                                      MAX (g_get_num_processors (), 1), FALSE, error);
+  return traverse->pool != NULL;
+}
+
+static void
+parallel_traverse_clear (ParallelTraverse *traverse)
+{
+  if (traverse->pool)
+    g_thread_pool_free (traverse->pool, FALSE, TRUE);
+  g_clear_error (&traverse->error);
+  g_mutex_clear (&traverse->lock);
+  g_cond_clear (&traverse->cond);
+}
+
+/*
+ * Add the root dirtree and dirmeta of @commit, and everything
+ * reachable from them, to @inout_reachable.  Subtrees in @known
+ * (which may be %NULL) are taken to be complete and not walked again.
+ *
+ * If the walk fails, e.g. on a partial commit, only the files and
+ * dirmeta objects found are added; a dirtree whose children were not
+ * all recorded must not make a later traversal skip it.
+ */
 static gboolean
-traverse_dirtree (OstreeRepo           *repo,
-                  const char           *checksum,
-                  GHashTable           *inout_reachable,
-                  GCancellable         *cancellable,
-                  GError              **error)
+parallel_traverse_commit_tree (ParallelTraverse  *traverse,
+                               GVariant          *commit,
+                               OstreeObjectSet   *known,
+                               OstreeObjectSet   *inout_reachable,
+                               GError           **error)
 {
   gboolean ret = FALSE;
-  g_autoptr(GVariant) dirtree = NULL;
-  ostree_cleanup_repo_commit_traverse_iter
-    OstreeRepoCommitTraverseIter iter = { 0, };
+  g_autoptr(GVariant) content_csum_v = NULL;
+  g_autoptr(GVariant) meta_csum_v = NULL;
+  g_autoptr(OstreeObjectSet) commit_reachable = NULL;
+  const guchar *content_csum;
+  const guchar *meta_csum;
+  OstreeObjectSetIter setiter;
+  const guchar *csum;
+  OstreeObjectType objtype;
 
-  if (!ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_DIR_TREE, checksum,
-                                 &dirtree, error))
+  /* See OSTREE_COMMIT_GVARIANT_STRING */
+  g_variant_get_child (commit, 6, "@ay", &content_csum_v);
+  content_csum = ostree_checksum_bytes_peek_validate (content_csum_v, error);
+  if (!content_csum)
+    goto out;
+  g_variant_get_child (commit, 7, "@ay", &meta_csum_v);
+  meta_csum = ostree_checksum_bytes_peek_validate (meta_csum_v, error);
+  if (!meta_csum)
     goto out;
 
-  g_debug ("Traversing dirtree %s", checksum);
-  if (!ostree_repo_commit_traverse_iter_init_dirtree (&iter, repo, dirtree,
-                                                      OSTREE_REPO_COMMIT_TRAVERSE_FLAG_NONE,
-                                                      error))
+  _ostree_object_set_add (inout_reachable, meta_csum, OSTREE_OBJECT_TYPE_DIR_META);
+  if (traverse_is_known (traverse, known, content_csum, OSTREE_OBJECT_TYPE_DIR_TREE))
+    {
+      _ostree_object_set_add (inout_reachable, content_csum, OSTREE_OBJECT_TYPE_DIR_TREE);
+      ret = TRUE;
+      goto out;
+    }
+
+  /* No workers are running yet, so no need to lock */
+  commit_reachable = _ostree_object_set_new ();
+  traverse->known = known;
+  traverse->reachable = commit_reachable;
+  _ostree_object_set_add (commit_reachable, content_csum, OSTREE_OBJECT_TYPE_DIR_TREE);
+
+  traverse->pending = 1;
+  g_thread_pool_push (traverse->pool, g_memdup (content_csum, OSTREE_SHA256_DIGEST_LEN), NULL);
+
+  g_mutex_lock (&traverse->lock);
+  while (traverse->pending > 0)
+    g_cond_wait (&traverse->cond, &traverse->lock);
+  g_mutex_unlock (&traverse->lock);
+
+  traverse->known = NULL;
+  traverse->reachable = NULL;
+
+  if (traverse->error)
+    g_propagate_error (error, g_steal_pointer (&traverse->error));
+  else if (!g_cancellable_set_error_if_cancelled (traverse->cancellable, error))
+    ret = TRUE;
+
+  _ostree_object_set_iter_init (&setiter, commit_reachable);
+  while (_ostree_object_set_iter_next (&setiter, &csum, &objtype))
+    {
+      if (ret || objtype != OSTREE_OBJECT_TYPE_DIR_TREE)
+        _ostree_object_set_add (inout_reachable, csum, objtype);
+    }
+
+ out:
+  return ret;
+}
+
+/*
+ * The objects reachable from a commit's tree never change, so they
+ * can be cached.  The cache is a list of (objtype, checksum) pairs,
+ * stored under the repo cache directory and named after the commit.
+ */
+static gboolean
+load_reachable_cache (OstreeRepo       *repo,
+                      const char       *commit_checksum,
+                      GVariant         *commit,
+                      OstreeObjectSet  *inout_reachable,
+                      gboolean         *out_found,
+                      GError          **error)
+{
+  gboolean ret = FALSE;
+  const char *path = glnx_strjoina (_OSTREE_REACHABLE_CACHE_DIR, "/", commit_checksum);
+  glnx_fd_close int fd = -1;
+  g_autoptr(GVariant) cached = NULL;
+  g_autoptr(OstreeObjectSet) cached_set = NULL;
+  g_autoptr(GVariant) content_csum_v = NULL;
+  g_autoptr(GVariant) meta_csum_v = NULL;
+  const guchar *root_csum;
+  OstreeObjectSetIter setiter;
+  const guchar *set_csum;
+  OstreeObjectType set_objtype;
+  guint i, n;
+
+  *out_found = FALSE;
+
+  if (!ot_openat_ignore_enoent (repo->cache_dir_fd, path, &fd, error))
     goto out;
+  if (fd == -1)
+    {
+      ret = TRUE;
+      goto out;
+    }
 
-  if (!traverse_iter (repo, &iter, inout_reachable, cancellable, error))
+  if (!ot_util_variant_map_fd (fd, 0, G_VARIANT_TYPE (_OSTREE_REACHABLE_CACHE_FORMAT),
+                               FALSE, &cached, error))
     goto out;
 
+  cached_set = _ostree_object_set_new ();
+  n = g_variant_n_children (cached);
+  for (i = 0; i < n; i++)
+    {
+      guchar objtype;
+      g_autoptr(GVariant) csum_v = NULL;
+      const guchar *csum;
+
+      g_variant_get_child (cached, i, "(y@ay)", &objtype, &csum_v);
+      if (!ostree_validate_structureof_objtype (objtype, error))
+        goto out;
+      csum = ostree_checksum_bytes_peek_validate (csum_v, error);
+      if (!csum)
+        goto out;
+
+      _ostree_object_set_add (cached_set, csum, objtype);
+    }
+
+  /* A damaged file must not make us drop the tree; every complete
+   * tree includes at least its root dirtree and dirmeta.
+   */
+  g_variant_get_child (commit, 6, "@ay", &content_csum_v);
+  root_csum = ostree_checksum_bytes_peek_validate (content_csum_v, error);
+  if (!root_csum)
+    goto out;
+  if (!_ostree_object_set_contains (cached_set, root_csum, OSTREE_OBJECT_TYPE_DIR_TREE))
+    {
+      g_debug ("Ignoring incomplete reachability cache for %s", commit_checksum);
+      ret = TRUE;
+      goto out;
+    }
+  g_variant_get_child (commit, 7, "@ay", &meta_csum_v);
+  root_csum = ostree_checksum_bytes_peek_validate (meta_csum_v, error);
+  if (!root_csum)
+    goto out;
+  if (!_ostree_object_set_contains (cached_set, root_csum, OSTREE_OBJECT_TYPE_DIR_META))
+    {
+      g_debug ("Ignoring incomplete reachability cache for %s", commit_checksum);
+      ret = TRUE;
+      goto out;
+    }
+
+  _ostree_object_set_iter_init (&setiter, cached_set);
+  while (_ostree_object_set_iter_next (&setiter, &set_csum, &set_objtype))
+    _ostree_object_set_add (inout_reachable, set_csum, set_objtype);
+
+  *out_found = TRUE;
   ret = TRUE;
  out:
+  if (!ret)
+    g_prefix_error (error, "Loading reachability cache for %s: ", commit_checksum);
   return ret;
 }
 
-/**
- * ostree_repo_traverse_commit_union: (skip)
- * @repo: Repo
- * @commit_checksum: ASCII SHA256 checksum
- * @maxdepth: Traverse this many parent commits, -1 for unlimited
- * @inout_reachable: Set of reachable objects
- * @cancellable: Cancellable
- * @error: Error
+static gboolean
+write_reachable_cache (OstreeRepo       *repo,
+                       const char       *commit_checksum,
+                       OstreeObjectSet  *reachable,
+                       GCancellable     *cancellable,
+                       GError          **error)
+{
+  gboolean ret = FALSE;
+  const char *path = glnx_strjoina (_OSTREE_REACHABLE_CACHE_DIR, "/", commit_checksum);
+  g_auto(GVariantBuilder) builder = {{0,}};
+  g_autoptr(GVariant) cached = NULL;
+  OstreeObjectSetIter setiter;
+  const guchar *csum;
+  OstreeObjectType objtype;
+
+  if (!glnx_shutil_mkdir_p_at (repo->cache_dir_fd, _OSTREE_REACHABLE_CACHE_DIR, 0775,
+                               cancellable, error))
+    goto out;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE (_OSTREE_REACHABLE_CACHE_FORMAT));
+  _ostree_object_set_iter_init (&setiter, reachable);
+  while (_ostree_object_set_iter_next (&setiter, &csum, &objtype))
+    g_variant_builder_add (&builder, "(y@ay)", (guchar) objtype,
+                           ot_gvariant_new_bytearray (csum, OSTREE_SHA256_DIGEST_LEN));
+  cached = g_variant_ref_sink (g_variant_builder_end (&builder));
+
+  if (!glnx_file_replace_contents_at (repo->cache_dir_fd, path,
+                                      g_variant_get_data (cached),
+                                      g_variant_get_size (cached),
+                                      GLNX_FILE_REPLACE_DATASYNC_NEW,
+                                      cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/*
+ * _ostree_repo_remove_reachable_cache:
  *
- * Update the set @inout_reachable containing all objects reachable
- * from @commit_checksum, traversing @maxdepth parent commits.
+ * Remove the reachability cache of @commit_checksum, if any; called
+ * when the commit is deleted.
  */
 gboolean
-ostree_repo_traverse_commit_union (OstreeRepo      *repo,
-                                   const char      *commit_checksum,
-                                   int              maxdepth,
-                                   GHashTable      *inout_reachable,
-                                   GCancellable    *cancellable,
-                                   GError         **error)
+_ostree_repo_remove_reachable_cache (OstreeRepo   *repo,
+                                     const char   *commit_checksum,
+                                     GError      **error)
+{
+  const char *path = glnx_strjoina (_OSTREE_REACHABLE_CACHE_DIR, "/", commit_checksum);
+
+  if (repo->cache_dir_fd == -1)
+    return TRUE;
+
+  if (unlinkat (repo->cache_dir_fd, path, 0) != 0 && errno != ENOENT)
+    {
+      glnx_set_error_from_errno (error);
+      g_prefix_error (error, "Removing reachability cache for %s: ", commit_checksum);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/*
+ * _ostree_repo_prune_reachable_cache:
+ *
+ * Remove reachability caches whose commit no longer exists, e.g.
+ * because it was deleted by an older version or by hand.
+ */
+gboolean
+_ostree_repo_prune_reachable_cache (OstreeRepo    *repo,
+                                    GCancellable  *cancellable,
+                                    GError       **error)
+{
+  gboolean ret = FALSE;
+  glnx_fd_close int dfd = -1;
+  g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+
+  if (repo->cache_dir_fd == -1)
+    return TRUE;
+
+  dfd = openat (repo->cache_dir_fd, _OSTREE_REACHABLE_CACHE_DIR,
+                O_RDONLY | O_NONBLOCK | O_DIRECTORY | O_CLOEXEC);
+  if (dfd == -1)
+    {
+      if (errno == ENOENT)
+        return TRUE;
+      glnx_set_error_from_errno (error);
+      goto out;
+    }
+
+  if (!glnx_dirfd_iterator_init_take_fd (glnx_steal_fd (&dfd), &dfd_iter, error))
+    goto out;
+
+  while (TRUE)
+    {
+      struct dirent *dent;
+      gboolean have_commit;
+
+      if (!glnx_dirfd_iterator_next_dent (&dfd_iter, &dent, cancellable, error))
+        goto out;
+      if (dent == NULL)
+        break;
+
+      /* Leave anything that isn't a cache file alone, including
+       * temporary files being written right now.
+       */
+      if (!ostree_validate_checksum_string (dent->d_name, NULL))
+        continue;
+
+      if (!ostree_repo_has_object (repo, OSTREE_OBJECT_TYPE_COMMIT, dent->d_name,
+                                   &have_commit, cancellable, error))
+        goto out;
+      if (have_commit)
+        continue;
+
+      if (unlinkat (dfd_iter.fd, dent->d_name, 0) != 0 && errno != ENOENT)
+        {
+          glnx_set_error_from_errno (error);
+          goto out;
+        }
+    }
+
+  ret = TRUE;
+ out:
+  if (!ret)
+    g_prefix_error (error, "Pruning reachability caches: ");
+  return ret;
+}
+
+static gboolean
+traverse_commit_tree (ParallelTraverse  *traverse,
+                      const char        *commit_checksum,
+                      GVariant          *commit,
+                      OstreeObjectSet   *inout_reachable,
+                      GError           **error)
+{
+  gboolean ret = FALSE;
+  OstreeRepo *repo = traverse->repo;
+  OstreeRepoCommitState commitstate;
+  gboolean found;
+  g_autoptr(OstreeObjectSet) commit_reachable = NULL;
+  OstreeObjectSetIter setiter;
+  const guchar *csum;
+  OstreeObjectType objtype;
+  GError *local_error = NULL;
+
+  if (!repo->enable_traverse_cache || repo->cache_dir_fd == -1)
+    return parallel_traverse_commit_tree (traverse, commit, inout_reachable,
+                                          inout_reachable, error);
+
+  if (!load_reachable_cache (repo, commit_checksum, commit, inout_reachable, &found, error))
+    goto out;
+  if (found)
+    {
+      ret = TRUE;
+      goto out;
+    }
+
+  /* Don't record a partial commit's tree as complete */
+  if (!ostree_repo_load_commit (repo, commit_checksum, NULL, &commitstate, error))
+    goto out;
+  if ((commitstate & OSTREE_REPO_COMMIT_STATE_PARTIAL) != 0)
+    return parallel_traverse_commit_tree (traverse, commit, inout_reachable,
+                                          inout_reachable, error);
+
+  /* The cache has to hold the commit's whole tree, so we can't skip
+   * subtrees already found via other commits here.
+   */
+  commit_reachable = _ostree_object_set_new ();
+  if (!parallel_traverse_commit_tree (traverse, commit, NULL, commit_reachable, error))
+    goto out;
+
+  /* Failing to write the cache just means we'll traverse again later */
+  if (!write_reachable_cache (repo, commit_checksum, commit_reachable,
+                              traverse->cancellable, &local_error))
+    {
+      g_debug ("Failed to write reachability cache for %s: %s",
+               commit_checksum, local_error->message);
+      g_clear_error (&local_error);
+    }
+
+  _ostree_object_set_iter_init (&setiter, commit_reachable);
+  while (_ostree_object_set_iter_next (&setiter, &csum, &objtype))
+    _ostree_object_set_add (inout_reachable, csum, objtype);
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static gboolean
+traverse_commit_union (ParallelTraverse  *traverse,
+                       const char        *commit_checksum,
+                       int                maxdepth,
+                       OstreeObjectSet   *inout_reachable,
+                       GError           **error)
 {
   gboolean ret = FALSE;
+  OstreeRepo *repo = traverse->repo;
   g_autofree char *tmp_checksum = NULL;
 
   while (TRUE)
     {
       gboolean recurse = FALSE;
-      g_autoptr(GVariant) key = NULL;
       g_autoptr(GVariant) commit = NULL;
-      ostree_cleanup_repo_commit_traverse_iter
-        OstreeRepoCommitTraverseIter iter = { 0, };
 
-      key = ostree_object_name_serialize (commit_checksum, OSTREE_OBJECT_TYPE_COMMIT);
+      { guchar csum[OSTREE_SHA256_DIGEST_LEN];
 
-      if (g_hash_table_contains (inout_reachable, key))
-        break;
+        ostree_checksum_inplace_to_bytes (commit_checksum, csum);
+        if (traverse_is_known (traverse, inout_reachable, csum, OSTREE_OBJECT_TYPE_COMMIT))
+          break;
+      }
 
       if (!ostree_repo_load_variant_if_exists (repo, OSTREE_OBJECT_TYPE_COMMIT,
                                                commit_checksum, &commit,
                                                error))
         goto out;
-        
+
       /* Just return if the parent isn't found; we do expect most
        * people to have partial repositories.
        */
       if (!commit)
         break;
 
-      g_hash_table_add (inout_reachable, key);
-      key = NULL;
+      _ostree_object_set_add_checksum (inout_reachable, commit_checksum,
+                                       OSTREE_OBJECT_TYPE_COMMIT);
 
       g_debug ("Traversing commit %s", commit_checksum);
-      if (!ostree_repo_commit_traverse_iter_init_commit (&iter, repo, commit,
-                                                         OSTREE_REPO_COMMIT_TRAVERSE_FLAG_NONE,
-                                                         error))
+      if (!traverse_commit_tree (traverse, commit_checksum, commit,
+                                 inout_reachable, error))
         goto out;
 
-      if (!traverse_iter (repo, &iter, inout_reachable, cancellable, error))
-        goto out;
-      
       if (maxdepth == -1 || maxdepth > 0)
         {
           g_free (tmp_checksum);
@@ -480,6 +928,130 @@ ostree_repo_traverse_commit_union (OstreeRepo      *repo,
   return ret;
 }
 
+/*
+ * Traverse each of the %NULL-terminated @commits into
+ * @inout_reachable, sharing one pool of worker threads.  Objects in
+ * @known_names (which may be %NULL) are taken to be reachable already
+ * and are not added again.
+ */
+static gboolean
+traverse_commits_union (OstreeRepo         *repo,
+                        const char * const *commits,
+                        int                 maxdepth,
+                        GHashTable         *known_names,
+                        OstreeObjectSet    *inout_reachable,
+                        GCancellable       *cancellable,
+                        GError            **error)
+{
+  gboolean ret = FALSE;
+  ParallelTraverse traverse;
+  guint i;
+
+  if (!parallel_traverse_init (&traverse, repo, cancellable, error))
+    goto out;
+  traverse.known_names = known_names;
+
+  for (i = 0; commits[i] != NULL; i++)
+    {
+      if (!traverse_commit_union (&traverse, commits[i], maxdepth,
+                                  inout_reachable, error))
+        goto out;
+    }
+
+  ret = TRUE;
+ out:
+  parallel_traverse_clear (&traverse);
+  return ret;
+}
+
+/*
+ * _ostree_repo_traverse_commit_union_set:
+ *
+ * Like ostree_repo_traverse_commit_union(), but using the compact
+ * #OstreeObjectSet.
+ */
+gboolean
+_ostree_repo_traverse_commit_union_set (OstreeRepo       *repo,
+                                        const char       *commit_checksum,
+                                        int               maxdepth,
+                                        OstreeObjectSet  *inout_reachable,
+                                        GCancellable     *cancellable,
+                                        GError          **error)
+{
+  const char *commits[] = { commit_checksum, NULL };
+
+  return traverse_commits_union (repo, commits, maxdepth, NULL,
+                                 inout_reachable, cancellable, error);
+}
+
+/*
+ * _ostree_repo_traverse_commits_union_set:
+ *
+ * Like _ostree_repo_traverse_commit_union_set() for each of the
+ * %NULL-terminated @commits, sharing one pool of worker threads.
+ */
+gboolean
+_ostree_repo_traverse_commits_union_set (OstreeRepo         *repo,
+                                         const char * const *commits,
+                                         int                 maxdepth,
+                                         OstreeObjectSet    *inout_reachable,
+                                         GCancellable       *cancellable,
+                                         GError            **error)
+{
+  return traverse_commits_union (repo, commits, maxdepth, NULL,
+                                 inout_reachable, cancellable, error);
+}
+
+/**
+ * ostree_repo_traverse_commit_union: (skip)
+ * @repo: Repo
+ * @commit_checksum: ASCII SHA256 checksum
+ * @maxdepth: Traverse this many parent commits, -1 for unlimited
+ * @inout_reachable: Set of reachable objects
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Update the set @inout_reachable containing all objects reachable
+ * from @commit_checksum, traversing @maxdepth parent commits.
+ */
+gboolean
+ostree_repo_traverse_commit_union (OstreeRepo      *repo,
+                                   const char      *commit_checksum,
+                                   int              maxdepth,
+                                   GHashTable      *inout_reachable,
+                                   GCancellable    *cancellable,
+                                   GError         **error)
+{
+  gboolean ret = FALSE;
+  const char *commits[] = { commit_checksum, NULL };
+  g_autoptr(OstreeObjectSet) found = _ostree_object_set_new ();
+  OstreeObjectSetIter setiter;
+  const guchar *csum;
+  OstreeObjectType objtype;
+
+  /* @inout_reachable is consulted in place, and only what wasn't in
+   * it yet is collected in @found, so that calling this in a loop
+   * costs no more than the new objects each time.
+   */
+  if (!traverse_commits_union (repo, commits, maxdepth, inout_reachable,
+                               found, cancellable, error))
+    goto out;
+
+  _ostree_object_set_iter_init (&setiter, found);
+  while (_ostree_object_set_iter_next (&setiter, &csum, &objtype))
+    {
+      char checksum[65];
+
+      ostree_checksum_inplace_from_bytes (csum, checksum);
+      g_hash_table_add (inout_reachable,
+                        g_variant_ref_sink (ostree_object_name_serialize (checksum, objtype)));
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
 /**
  * ostree_repo_traverse_commit:
  * @repo: Repo
@@ -193,6 +193,44 @@ ost_remote_unref (OstreeRemote *remote)
 GS_DEFINE_CLEANUP_FUNCTION0(OstreeRemote*, local_remote_unref, ost_remote_unref)
 #define local_cleanup_remote __attribute__ ((cleanup(local_remote_unref)))
 
+static gboolean add_remotes_from_keyfile (OstreeRepo *self,
+                                          GKeyFile   *keyfile,
+                                          GFile      *file,
+                                          GError    **error);
+static gboolean append_remotes_d (OstreeRepo          *self,
+                                  GCancellable        *cancellable,
+                                  GError             **error);
+
+/* Most operations never look at remotes, so they are only parsed from
+ * the config and remotes.d on first use.  A failure is remembered and
+ * returned by every later lookup.  Must be called with remotes_lock held.
+ */
+static gboolean
+ensure_remotes_loaded_unlocked (OstreeRepo  *self,
+                                GError     **error)
+{
+  if (!self->remotes_loaded && self->inited)
+    {
+      gint64 start = g_get_monotonic_time ();
+
+      self->remotes_loaded = TRUE;
+      if (!add_remotes_from_keyfile (self, self->config, NULL, &self->remotes_error) ||
+          !append_remotes_d (self, NULL, &self->remotes_error))
+        g_prefix_error (&self->remotes_error, "Loading remotes: ");
+
+      g_debug ("Loaded %u remotes in %" G_GINT64_FORMAT " us",
+               g_hash_table_size (self->remotes), g_get_monotonic_time () - start);
+    }
+
+  if (self->remotes_error != NULL)
+    {
+      g_propagate_error (error, g_error_copy (self->remotes_error));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
 static OstreeRemote *
 ost_repo_get_remote (OstreeRepo  *self,
                      const char  *name,
@@ -204,6 +242,9 @@ ost_repo_get_remote (OstreeRepo  *self,
 
   g_mutex_lock (&self->remotes_lock);
 
+  if (!ensure_remotes_loaded_unlocked (self, error))
+    goto out;
+
   remote = g_hash_table_lookup (self->remotes, name);
 
   if (remote != NULL)
@@ -212,6 +253,7 @@ ost_repo_get_remote (OstreeRepo  *self,
     g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
                  "Remote \"%s\" not found", name);
 
+ out:
   g_mutex_unlock (&self->remotes_lock);
 
   return remote;
@@ -248,6 +290,8 @@ ost_repo_add_remote (OstreeRepo   *self,
 
   g_mutex_lock (&self->remotes_lock);
 
+  /* Callers looked the remote up first, so this can't fail */
+  (void) ensure_remotes_loaded_unlocked (self, NULL);
   g_hash_table_replace (self->remotes, remote->name, ost_remote_ref (remote));
 
   g_mutex_unlock (&self->remotes_lock);
@@ -265,6 +309,7 @@ ost_repo_remove_remote (OstreeRepo   *self,
 
   g_mutex_lock (&self->remotes_lock);
 
+  (void) ensure_remotes_loaded_unlocked (self, NULL);
   removed = g_hash_table_remove (self->remotes, remote->name);
 
   g_mutex_unlock (&self->remotes_lock);
@@ -531,12 +576,13 @@ ostree_repo_finalize (GObject *object)
   g_clear_object (&self->config_file);
   g_free (self->remotes_config_dir);
 
-  g_clear_object (&self->transaction_lock_path);
-
   if (self->loose_object_devino_hash)
     g_hash_table_destroy (self->loose_object_devino_hash);
   if (self->updated_uncompressed_dirs)
     g_hash_table_destroy (self->updated_uncompressed_dirs);
+  g_clear_pointer (&self->uncompressed_cache_used, g_hash_table_destroy);
+  g_clear_pointer (&self->packed_refs, _ostree_packed_refs_unref);
+  g_clear_pointer (&self->commit_index, _ostree_commit_index_unref);
   if (self->config)
     g_key_file_free (self->config);
   g_clear_pointer (&self->txn_refs, g_hash_table_destroy);
@@ -544,10 +590,21 @@ ostree_repo_finalize (GObject *object)
   g_clear_pointer (&self->cached_content_indexes, (GDestroyNotify) g_ptr_array_unref);
   g_clear_error (&self->writable_error);
   g_clear_pointer (&self->object_sizes, (GDestroyNotify) g_hash_table_unref);
+  if (self->metadata_cache)
+    {
+      guint64 hits, misses;
+
+      _ostree_metadata_cache_get_stats (self->metadata_cache, &hits, &misses);
+      g_debug ("metadata cache: %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " misses",
+               hits, misses);
+      _ostree_metadata_cache_free (self->metadata_cache);
+    }
+  g_clear_pointer (&self->gpg_home_cache, _ostree_gpg_home_cache_free);
   g_mutex_clear (&self->cache_lock);
   g_mutex_clear (&self->txn_stats_lock);
 
   g_clear_pointer (&self->remotes, g_hash_table_destroy);
+  g_clear_error (&self->remotes_error);
   g_mutex_clear (&self->remotes_lock);
 
   G_OBJECT_CLASS (ostree_repo_parent_class)->finalize (object);
@@ -679,6 +736,8 @@ ostree_repo_init (OstreeRepo *self)
   GLnxLockFile empty_lockfile = GLNX_LOCK_FILE_INIT;
   const GDebugKey test_error_keys[] = {
     { "pre-commit", OSTREE_REPO_TEST_ERROR_PRE_COMMIT },
+    { "bspatch-copy", OSTREE_REPO_TEST_ERROR_BSPATCH_COPY },
+    { "no-tmpfile", OSTREE_REPO_TEST_ERROR_NO_TMPFILE },
   };
 
   if (g_once_init_enter (&gpgme_initialized))
@@ -690,10 +749,16 @@ ostree_repo_init (OstreeRepo *self)
 
   self->test_error_flags = g_parse_debug_string (g_getenv ("OSTREE_REPO_TEST_ERROR"),
                                                  test_error_keys, G_N_ELEMENTS (test_error_keys));
+  /* Exercise the named temporary file fallback */
+  if ((self->test_error_flags & OSTREE_REPO_TEST_ERROR_NO_TMPFILE) > 0)
+    self->tmpfile_unsupported = TRUE;
 
   g_mutex_init (&self->cache_lock);
   g_mutex_init (&self->txn_stats_lock);
 
+  self->metadata_cache = _ostree_metadata_cache_new (_OSTREE_METADATA_CACHE_SIZE);
+  self->gpg_home_cache = _ostree_gpg_home_cache_new ();
+
   self->remotes = g_hash_table_new_full (g_str_hash, g_str_equal,
                                          (GDestroyNotify) NULL,
                                          (GDestroyNotify) ost_remote_unref);
@@ -1230,6 +1295,36 @@ ostree_repo_remote_change (OstreeRepo     *self,
   g_assert_not_reached ();
 }
 
+/* Returns the set of names of the remotes configured in @self itself,
+ * failing if the remote configuration can't be loaded.
+ */
+GHashTable *
+_ostree_repo_list_remote_names (OstreeRepo  *self,
+                                GError     **error)
+{
+  g_autoptr(GHashTable) names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  GHashTableIter iter;
+  gpointer key;
+  gboolean loaded;
+
+  g_mutex_lock (&self->remotes_lock);
+
+  loaded = ensure_remotes_loaded_unlocked (self, error);
+  if (loaded)
+    {
+      g_hash_table_iter_init (&iter, self->remotes);
+      while (g_hash_table_iter_next (&iter, &key, NULL))
+        g_hash_table_add (names, g_strdup (key));
+    }
+
+  g_mutex_unlock (&self->remotes_lock);
+
+  if (!loaded)
+    return NULL;
+
+  return g_steal_pointer (&names);
+}
+
 static void
 _ostree_repo_remote_list (OstreeRepo *self,
                           GHashTable *out)
@@ -1239,6 +1334,10 @@ _ostree_repo_remote_list (OstreeRepo *self,
 
   g_mutex_lock (&self->remotes_lock);
 
+  /* Like before remotes were loaded lazily, a broken remote
+   * configuration only shows up when looking up a remote.
+   */
+  (void) ensure_remotes_loaded_unlocked (self, NULL);
   g_hash_table_iter_init (&iter, self->remotes);
   while (g_hash_table_iter_next (&iter, &key, &value))
     g_hash_table_insert (out, g_strdup (key), NULL);
@@ -1934,6 +2033,7 @@ enumerate_directory_allow_noent (GFile               *dirpath,
   return ret;
 }
 
+/* Called with remotes_lock held */
 static gboolean
 add_remotes_from_keyfile (OstreeRepo *self,
                           GKeyFile   *keyfile,
@@ -1945,8 +2045,6 @@ add_remotes_from_keyfile (OstreeRepo *self,
   gsize length, ii;
   gboolean ret = FALSE;
 
-  g_mutex_lock (&self->remotes_lock);
-
   groups = g_key_file_get_groups (keyfile, &length);
 
   for (ii = 0; ii < length; ii++)
@@ -1986,8 +2084,6 @@ add_remotes_from_keyfile (OstreeRepo *self,
   while (!g_queue_is_empty (&queue))
     ost_remote_unref (g_queue_pop_head (&queue));
 
-  g_mutex_unlock (&self->remotes_lock);
-
   return ret;
 }
 
@@ -2081,6 +2177,7 @@ ostree_repo_open (OstreeRepo    *self,
   g_autofree char *version = NULL;
   g_autofree char *mode = NULL;
   g_autofree char *parent_repo_path = NULL;
+  gint64 open_start = g_get_monotonic_time ();
 
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
@@ -2152,9 +2249,6 @@ ostree_repo_open (OstreeRepo    *self,
       g_prefix_error (error, "Couldn't parse config file: ");
       goto out;
     }
-  if (!add_remotes_from_keyfile (self, self->config, NULL, error))
-    goto out;
-
   version = g_key_file_get_value (self->config, "core", "repo_version", error);
   if (!version)
     goto out;
@@ -2209,6 +2303,28 @@ ostree_repo_open (OstreeRepo    *self,
   else
     self->enable_uncompressed_cache = FALSE;
 
+  { g_autofree char *max_size = NULL;
+
+    /* 0 means unlimited, and objects are only freed by ostree_repo_checkout_gc() */
+    if (!ot_keyfile_get_value_with_default (self->config, "core", "uncompressed-cache-max-size", "0",
+                                            &max_size, error))
+      goto out;
+
+    self->uncompressed_cache_max_size = g_ascii_strtoull (max_size, NULL, 10);
+  }
+
+  if (!ot_keyfile_get_boolean_with_default (self->config, "core", "traverse-cache",
+                                            FALSE, &self->enable_traverse_cache, error))
+    goto out;
+
+  if (!ot_keyfile_get_boolean_with_default (self->config, "core", "packed-refs",
+                                            FALSE, &self->enable_packed_refs, error))
+    goto out;
+
+  if (!ot_keyfile_get_boolean_with_default (self->config, "core", "gpg-verify-cache",
+                                            FALSE, &self->enable_gpg_verify_cache, error))
+    goto out;
+
   {
     gboolean do_fsync;
     
@@ -2230,9 +2346,6 @@ ostree_repo_open (OstreeRepo    *self,
     self->tmp_expiry_seconds = g_ascii_strtoull (tmp_expiry_seconds, NULL, 10);
   }
 
-  if (!append_remotes_d (self, cancellable, error))
-    goto out;
-
   if (!glnx_opendirat (self->repo_dir_fd, "tmp", TRUE, &self->tmp_dir_fd, error))
     goto out;
 
@@ -2258,6 +2371,9 @@ ostree_repo_open (OstreeRepo    *self,
 
   self->inited = TRUE;
 
+  g_debug ("Opened repo %s in %" G_GINT64_FORMAT " us",
+           gs_file_get_path_cached (self->repodir), g_get_monotonic_time () - open_start);
+
   ret = TRUE;
  out:
   return ret;
@@ -2396,131 +2512,302 @@ ostree_repo_get_parent (OstreeRepo  *self)
   return self->parent_repo;
 }
 
+/*
+ * _ostree_repo_parse_loose_object_name:
+ * @prefix: Name of the two-character object subdirectory
+ * @name: Name of a file in that subdirectory
+ * @out_checksum: (out caller-allocates): Buffer of 65 bytes for the checksum
+ *
+ * Returns: %TRUE if @name is a loose object for the mode of @self
+ */
+gboolean
+_ostree_repo_parse_loose_object_name (OstreeRepo        *self,
+                                      const char        *prefix,
+                                      const char        *name,
+                                      char              *out_checksum,
+                                      OstreeObjectType  *out_objtype)
+{
+  const char *dot;
+  OstreeObjectType objtype;
+
+  dot = strrchr (name, '.');
+  if (!dot)
+    return FALSE;
+
+  if ((self->mode == OSTREE_REPO_MODE_ARCHIVE_Z2
+       && strcmp (dot, ".filez") == 0) ||
+      ((self->mode == OSTREE_REPO_MODE_BARE || self->mode == OSTREE_REPO_MODE_BARE_USER)
+       && strcmp (dot, ".file") == 0))
+    objtype = OSTREE_OBJECT_TYPE_FILE;
+  else if (strcmp (dot, ".dirtree") == 0)
+    objtype = OSTREE_OBJECT_TYPE_DIR_TREE;
+  else if (strcmp (dot, ".dirmeta") == 0)
+    objtype = OSTREE_OBJECT_TYPE_DIR_META;
+  else if (strcmp (dot, ".commit") == 0)
+    objtype = OSTREE_OBJECT_TYPE_COMMIT;
+  else
+    return FALSE;
+
+  if ((dot - name) != 62)
+    return FALSE;
+
+  memcpy (out_checksum, prefix, 2);
+  memcpy (out_checksum + 2, name, 62);
+  out_checksum[64] = '\0';
+  *out_objtype = objtype;
+  return TRUE;
+}
+
+/* Objects are handed to the enumeration callback in batches of this size */
+#define ENUMERATE_BATCH_SIZE 4096
+
+typedef struct {
+  OstreeRepo *repo;
+  guint objtype_mask;
+  const char *checksum_prefix;
+  OstreeRepoLooseObjectsFunc func;
+  gpointer user_data;
+  GCancellable *cancellable;
+
+  GMutex lock;       /* Serializes calls to func */
+  GError *error;     /* protected by lock */
+} ParallelEnumerate;
+
+typedef struct {
+  ParallelEnumerate *penum;
+  char prefix[3];
+  GArray *objects;   /* OstreeLooseObject */
+} EnumerateObjdir;
+
 static gboolean
-list_loose_objects_at (OstreeRepo             *self,
-                       GHashTable             *inout_objects,
-                       const char             *prefix,
-                       int                     dfd,
-                       const char             *commit_starting_with,
-                       GCancellable           *cancellable,
-                       GError                **error)
+enumerate_flush (EnumerateObjdir  *objdir,
+                 GError          **error)
 {
-  gboolean ret = FALSE;
-  DIR *d = NULL;
-  struct dirent *dent;
-  GVariant *key, *value;
+  ParallelEnumerate *penum = objdir->penum;
+  gboolean ret;
 
-  d = fdopendir (dfd);
-  if (!d)
+  if (objdir->objects->len == 0)
+    return TRUE;
+
+  g_mutex_lock (&penum->lock);
+  ret = penum->func (penum->repo, (const OstreeLooseObject *) objdir->objects->data,
+                     objdir->objects->len, penum->user_data, error);
+  g_mutex_unlock (&penum->lock);
+
+  g_array_set_size (objdir->objects, 0);
+  return ret;
+}
+
+static gboolean
+enumerate_dent (const char     *name,
+                unsigned char   d_type,
+                gpointer        user_data,
+                GError        **error)
+{
+  EnumerateObjdir *objdir = user_data;
+  ParallelEnumerate *penum = objdir->penum;
+  OstreeLooseObject object;
+  OstreeObjectType objtype;
+  char checksum[65];
+
+  /* Objects are regular files, or symlinks in bare repos */
+  if (d_type != DT_REG && d_type != DT_LNK && d_type != DT_UNKNOWN)
+    return TRUE;
+
+  if (!_ostree_repo_parse_loose_object_name (penum->repo, objdir->prefix, name,
+                                             checksum, &objtype))
+    return TRUE;
+
+  if ((penum->objtype_mask & _OSTREE_OBJECT_TYPE_MASK (objtype)) == 0)
+    return TRUE;
+
+  if (penum->checksum_prefix && !g_str_has_prefix (checksum, penum->checksum_prefix))
+    return TRUE;
+
+  ostree_checksum_inplace_to_bytes (checksum, object.csum);
+  object.objtype = objtype;
+  g_array_append_val (objdir->objects, object);
+
+  if (objdir->objects->len >= ENUMERATE_BATCH_SIZE)
+    return enumerate_flush (objdir, error);
+
+  return TRUE;
+}
+
+static gboolean
+enumerate_objdir (ParallelEnumerate  *penum,
+                  guint               c,
+                  GError            **error)
+{
+  static const gchar hexchars[] = "0123456789abcdef";
+  g_autoptr(GArray) objects = g_array_new (FALSE, FALSE, sizeof (OstreeLooseObject));
+  EnumerateObjdir objdir = { penum, };
+  glnx_fd_close int dfd = -1;
+
+  objdir.prefix[0] = hexchars[c >> 4];
+  objdir.prefix[1] = hexchars[c & 0xF];
+  objdir.prefix[2] = '\0';
+  objdir.objects = objects;
+
+  dfd = ot_opendirat (penum->repo->objects_dir_fd, objdir.prefix, FALSE);
+  if (dfd == -1)
     {
+      if (errno == ENOENT)
+        return TRUE;
       glnx_set_error_from_errno (error);
-      goto out;
+      return FALSE;
     }
 
-  while ((dent = readdir (d)) != NULL)
-    {
-      const char *name = dent->d_name;
-      const char *dot;
-      OstreeObjectType objtype;
-      char buf[65];
+  if (!ot_dirfd_foreach_dent (dfd, enumerate_dent, &objdir, penum->cancellable, error))
+    return FALSE;
 
-      if (strcmp (name, ".") == 0 ||
-          strcmp (name, "..") == 0)
-        continue;
+  return enumerate_flush (&objdir, error);
+}
 
-      dot = strrchr (name, '.');
-      if (!dot)
-        continue;
+static void
+enumerate_objdir_task_run (gpointer task_data,
+                           gpointer user_data)
+{
+  ParallelEnumerate *penum = user_data;
+  guint c = GPOINTER_TO_UINT (task_data) - 1;
+  GError *local_error = NULL;
+  gboolean failed;
+
+  g_mutex_lock (&penum->lock);
+  failed = penum->error != NULL;
+  g_mutex_unlock (&penum->lock);
 
-      if ((self->mode == OSTREE_REPO_MODE_ARCHIVE_Z2
-           && strcmp (dot, ".filez") == 0) ||
-          ((self->mode == OSTREE_REPO_MODE_BARE || self->mode == OSTREE_REPO_MODE_BARE_USER)
-           && strcmp (dot, ".file") == 0))
-        objtype = OSTREE_OBJECT_TYPE_FILE;
-      else if (strcmp (dot, ".dirtree") == 0)
-        objtype = OSTREE_OBJECT_TYPE_DIR_TREE;
-      else if (strcmp (dot, ".dirmeta") == 0)
-        objtype = OSTREE_OBJECT_TYPE_DIR_META;
-      else if (strcmp (dot, ".commit") == 0)
-        objtype = OSTREE_OBJECT_TYPE_COMMIT;
+  if (!failed && !enumerate_objdir (penum, c, &local_error))
+    {
+      g_mutex_lock (&penum->lock);
+      if (penum->error == NULL)
+        penum->error = local_error;
       else
-        continue;
+        g_error_free (local_error);
+      g_mutex_unlock (&penum->lock);
+    }
+}
 
-      if ((dot - name) != 62)
-        continue;
+/*
+ * _ostree_repo_enumerate_loose_objects:
+ * @self: Repo
+ * @objtype_mask: Only return objects whose type is in this mask of _OSTREE_OBJECT_TYPE_MASK() values
+ * @checksum_prefix: (allow-none): Only return objects whose checksum starts with this
+ * @func: Called with batches of objects
+ * @user_data: Data for @func
+ *
+ * Enumerate the loose objects of @self (not including any parent
+ * repo).  The object directories are read concurrently by a pool of
+ * threads; @func is called from those threads, but never more than
+ * one at a time.  Only the directories which can match
+ * @checksum_prefix are read.
+ */
+gboolean
+_ostree_repo_enumerate_loose_objects (OstreeRepo                  *self,
+                                      guint                        objtype_mask,
+                                      const char                  *checksum_prefix,
+                                      OstreeRepoLooseObjectsFunc   func,
+                                      gpointer                     user_data,
+                                      GCancellable                *cancellable,
+                                      GError                     **error)
+{
+  gboolean ret = FALSE;
+  ParallelEnumerate penum = { 0, };
+  GThreadPool *pool = NULL;
+  guint first = 0, last = 255;
+  guint c;
 
-      memcpy (buf, prefix, 2);
-      memcpy (buf + 2, name, 62);
-      buf[sizeof(buf)-1] = '\0';
+  penum.repo = self;
+  penum.objtype_mask = objtype_mask;
+  penum.checksum_prefix = checksum_prefix && *checksum_prefix ? checksum_prefix : NULL;
+  penum.func = func;
+  penum.user_data = user_data;
+  penum.cancellable = cancellable;
+  g_mutex_init (&penum.lock);
 
-      /* if we passed in a "starting with" argument, then
-         we only want to return .commit objects with a checksum
-         that matches the commit_starting_with argument */
-      if (commit_starting_with)
-        {
-          /* object is not a commit, do not add to array */
-          if (objtype != OSTREE_OBJECT_TYPE_COMMIT)
-              continue;
+  /* The first two characters of the checksum name the directory */
+  if (penum.checksum_prefix)
+    {
+      int hi = g_ascii_xdigit_value (checksum_prefix[0]);
+      int lo = checksum_prefix[1] ? g_ascii_xdigit_value (checksum_prefix[1]) : -1;
 
-          /* commit checksum does not match "starting with", do not add to array */     
-          if (!g_str_has_prefix (buf, commit_starting_with))
-            continue;
+      if (hi < 0)
+        {
+          ret = TRUE;
+          goto out;
         }
+      first = hi << 4;
+      last = first | 0xF;
+      if (lo >= 0)
+        first = last = first | lo;
+    }
 
-        key = ostree_object_name_serialize (buf, objtype);
-        value = g_variant_new ("(b@as)",
-                               TRUE, g_variant_new_strv (NULL, 0));
-        /* transfer ownership */
-        g_hash_table_replace (inout_objects, key,
-                              g_variant_ref_sink (value));
+  if (first == last)
+    {
+      if (!enumerate_objdir (&penum, first, error))
+        goto out;
+      ret = TRUE;
+      goto out;
+    }
+
+  pool = g_thread_pool_new (enumerate_objdir_task_run, &penum,
+                            MAX (g_get_num_processors (), 1), FALSE, error);
+  if (!pool)
+    goto out;
+
+  /* Offset by one, since NULL can't be pushed */
+  for (c = first; c <= last; c++)
+    g_thread_pool_push (pool, GUINT_TO_POINTER (c + 1), NULL);
+
+  /* Waits for all queued directories */
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  if (penum.error)
+    {
+      g_propagate_error (error, g_steal_pointer (&penum.error));
+      goto out;
     }
 
   ret = TRUE;
  out:
-  if (d)
-    (void) closedir (d);
+  g_clear_error (&penum.error);
+  g_mutex_clear (&penum.lock);
   return ret;
 }
 
+static gboolean
+add_loose_objects_to_set (OstreeRepo               *self,
+                          const OstreeLooseObject  *objects,
+                          guint                     n_objects,
+                          gpointer                  user_data,
+                          GError                  **error)
+{
+  OstreeObjectSet *set = user_data;
+  guint i;
+
+  for (i = 0; i < n_objects; i++)
+    _ostree_object_set_add (set, objects[i].csum, objects[i].objtype);
+
+  return TRUE;
+}
+
 static gboolean
 list_loose_objects (OstreeRepo                     *self,
-                    GHashTable                     *inout_objects,
+                    OstreeObjectSet                *inout_objects,
                     const char                     *commit_starting_with,
                     GCancellable                   *cancellable,
                     GError                        **error)
 {
-  gboolean ret = FALSE;
-  guint c;
-  int dfd = -1;
-  static const gchar hexchars[] = "0123456789abcdef";
-
-  for (c = 0; c < 256; c++)
-    {
-      char buf[3];
-      buf[0] = hexchars[c >> 4];
-      buf[1] = hexchars[c & 0xF];
-      buf[2] = '\0';
-      dfd = ot_opendirat (self->objects_dir_fd, buf, FALSE);
-      if (dfd == -1)
-        {
-          if (errno == ENOENT)
-            continue;
-          else
-            {
-              glnx_set_error_from_errno (error);
-              goto out;
-            }
-        }
-      /* Takes ownership of dfd */
-      if (!list_loose_objects_at (self, inout_objects, buf, dfd,
-                                       commit_starting_with,
-                                       cancellable, error))
-        goto out;
-    }
-
-  ret = TRUE;
- out:
-  return ret;
+  /* If we passed in a "starting with" argument, then we only want
+   * .commit objects with a checksum that matches it.
+   */
+  return _ostree_repo_enumerate_loose_objects (self,
+                                               commit_starting_with ?
+                                               _OSTREE_OBJECT_TYPE_MASK (OSTREE_OBJECT_TYPE_COMMIT) :
+                                               _OSTREE_OBJECT_TYPE_MASK_ALL,
+                                               commit_starting_with,
+                                               add_loose_objects_to_set, inout_objects,
+                                               cancellable, error);
 }
 
 static gboolean
@@ -2539,9 +2826,28 @@ load_metadata_internal (OstreeRepo       *self,
   int fd = -1;
   g_autoptr(GInputStream) ret_stream = NULL;
   g_autoptr(GVariant) ret_variant = NULL;
+  gboolean cacheable;
 
   g_return_val_if_fail (OSTREE_OBJECT_TYPE_IS_META (objtype), FALSE);
 
+  /* Trees are read over and over again by checkout, diff, prune and
+   * so on; since they're immutable, keep the parsed variants around.
+   */
+  cacheable = out_variant != NULL &&
+    (objtype == OSTREE_OBJECT_TYPE_DIR_TREE || objtype == OSTREE_OBJECT_TYPE_DIR_META);
+  if (cacheable)
+    {
+      ret_variant = _ostree_metadata_cache_lookup (self->metadata_cache, objtype, sha256);
+      if (ret_variant)
+        {
+          if (out_size)
+            *out_size = g_variant_get_size (ret_variant);
+          ret = TRUE;
+          ot_transfer_out_value (out_variant, &ret_variant);
+          goto out;
+        }
+    }
+
   _ostree_loose_path (loose_path_buf, sha256, objtype, self->mode);
 
  if (!ot_openat_ignore_enoent (self->objects_dir_fd, loose_path_buf, &fd,
@@ -2559,23 +2865,49 @@ load_metadata_internal (OstreeRepo       *self,
     {
       if (out_variant)
         {
-          GMappedFile *mfile;
+          g_autoptr(GBytes) bytes = NULL;
+          struct stat stbuf;
 
-          mfile = g_mapped_file_new_from_fd (fd, FALSE, error);
-          if (!mfile)
-            goto out;
-          (void) close (fd); /* Ignore errors, we have it mapped */
+          if (fstat (fd, &stbuf) != 0)
+            {
+              glnx_set_error_from_errno (error);
+              goto out;
+            }
+
+          /* Large objects (e.g. huge dirtrees) are mapped so they can be
+           * paged in lazily and shared; small ones are read directly,
+           * since a mapping per tiny dirmeta costs more than the copy.
+           */
+          if (stbuf.st_size >= _OSTREE_METADATA_MMAP_THRESHOLD)
+            {
+              g_autoptr(GMappedFile) mfile = NULL;
+
+              mfile = g_mapped_file_new_from_fd (fd, FALSE, error);
+              if (!mfile)
+                goto out;
+              bytes = g_mapped_file_get_bytes (mfile);
+            }
+          else
+            {
+              bytes = glnx_fd_readall_bytes (fd, cancellable, error);
+              if (!bytes)
+                goto out;
+            }
+          (void) close (fd); /* Ignore errors, we have the contents */
           fd = -1;
-          ret_variant = g_variant_new_from_data (ostree_metadata_variant_type (objtype),
-                                                 g_mapped_file_get_contents (mfile),
-                                                 g_mapped_file_get_length (mfile),
-                                                 TRUE,
-                                                 (GDestroyNotify) g_mapped_file_unref,
-                                                 mfile);
+
+          /* Objects in our own store were normalized when written, so
+           * skip GVariant's validation on access.
+           */
+          ret_variant = g_variant_new_from_bytes (ostree_metadata_variant_type (objtype),
+                                                  bytes, TRUE);
           g_variant_ref_sink (ret_variant);
 
           if (out_size)
             *out_size = g_variant_get_size (ret_variant);
+
+          if (cacheable)
+            _ostree_metadata_cache_insert (self->metadata_cache, objtype, sha256, ret_variant);
         }
       else if (out_stream)
         {
@@ -2964,6 +3296,37 @@ ostree_repo_load_object_stream (OstreeRepo         *self,
   return ret;
 }
 
+/*
+ * _ostree_repo_freshen_loose_object:
+ * @loose_path: Path of an object relative to the objects directory
+ * @out_is_fresh: (out): Whether the object can be reused
+ *
+ * While a prune is running, it keeps any object whose ctime is newer
+ * than the prune epoch; see ostree_repo_prune().  A no-op chown is
+ * enough to bump the ctime without changing anything visible.  If that
+ * fails, the prune may have deleted the object already, or may still
+ * delete it, so @out_is_fresh is %FALSE and the object must be written
+ * again.
+ */
+gboolean
+_ostree_repo_freshen_loose_object (OstreeRepo    *self,
+                                   const char    *loose_path,
+                                   gboolean      *out_is_fresh,
+                                   GError       **error)
+{
+  g_auto(GLnxLockFile) sweep_lock = GLNX_LOCK_FILE_INIT;
+
+  if (!_ostree_repo_lock_prune_sweep (self, &sweep_lock, error))
+    return FALSE;
+
+  if (sweep_lock.fd == -1)
+    *out_is_fresh = TRUE;
+  else
+    *out_is_fresh = fchownat (self->objects_dir_fd, loose_path, -1, -1, AT_SYMLINK_NOFOLLOW) == 0;
+
+  return TRUE;
+}
+
 /*
  * _ostree_repo_has_loose_object:
  * @loose_path_buf: Buffer of size _OSTREE_LOOSE_PATH_MAX
@@ -3008,6 +3371,17 @@ _ostree_repo_has_loose_object (OstreeRepo           *self,
           glnx_set_error_from_errno (error);
           goto out;
         }
+
+      /* We're about to reuse this object instead of writing it */
+      if (res == 0 && self->in_transaction)
+        {
+          gboolean is_fresh;
+
+          if (!_ostree_repo_freshen_loose_object (self, loose_path_buf, &is_fresh, error))
+            goto out;
+          if (!is_fresh)
+            res = -1;
+        }
     }
 
   ret = TRUE;
@@ -3115,6 +3489,12 @@ ostree_repo_delete_object (OstreeRepo           *self,
       goto out;
     }
 
+  if (objtype == OSTREE_OBJECT_TYPE_DIR_TREE || objtype == OSTREE_OBJECT_TYPE_DIR_META)
+    _ostree_metadata_cache_remove (self->metadata_cache, objtype, sha256);
+  else if (objtype == OSTREE_OBJECT_TYPE_COMMIT &&
+           !_ostree_repo_remove_reachable_cache (self, sha256, error))
+    goto out;
+
   /* If the repository is configured to use tombstone commits, create one when deleting a commit.  */
   if (objtype == OSTREE_OBJECT_TYPE_COMMIT)
     {
@@ -3289,8 +3669,13 @@ import_one_object_link (OstreeRepo    *self,
 
   if (objtype == OSTREE_OBJECT_TYPE_COMMIT)
     {
+      g_autoptr(GError) local_error = NULL;
+
       if (!copy_detached_metadata (self, source, checksum, cancellable, error))
         goto out;
+
+      if (!_ostree_repo_commit_index_add (self, checksum, cancellable, &local_error))
+        g_debug ("Failed to add %s to commit index: %s", checksum, local_error->message);
     }
 
   ret = TRUE;
@@ -3526,6 +3911,77 @@ ostree_repo_load_commit (OstreeRepo            *self,
   return ret;
 }
 
+/* Convert to the historical ostree_repo_list_objects() format */
+static GHashTable *
+object_set_to_list_objects_table (OstreeObjectSet *objects)
+{
+  GHashTable *ret_objects;
+  g_autoptr(GVariant) loose_value = NULL;
+  OstreeObjectSetIter setiter;
+  const guchar *csum;
+  OstreeObjectType objtype;
+
+  ret_objects = g_hash_table_new_full (ostree_hash_object_name, g_variant_equal,
+                                       (GDestroyNotify) g_variant_unref,
+                                       (GDestroyNotify) g_variant_unref);
+
+  /* All loose objects share the same value */
+  loose_value = g_variant_ref_sink (g_variant_new ("(b@as)",
+                                                   TRUE, g_variant_new_strv (NULL, 0)));
+
+  _ostree_object_set_iter_init (&setiter, objects);
+  while (_ostree_object_set_iter_next (&setiter, &csum, &objtype))
+    {
+      char checksum[65];
+
+      ostree_checksum_inplace_from_bytes (csum, checksum);
+      g_hash_table_replace (ret_objects,
+                            g_variant_ref_sink (ostree_object_name_serialize (checksum, objtype)),
+                            g_variant_ref (loose_value));
+    }
+
+  return ret_objects;
+}
+
+/*
+ * _ostree_repo_list_objects_set:
+ *
+ * Like ostree_repo_list_objects(), but adds the names to the compact
+ * @inout_objects set.
+ */
+gboolean
+_ostree_repo_list_objects_set (OstreeRepo                  *self,
+                               OstreeRepoListObjectsFlags   flags,
+                               OstreeObjectSet             *inout_objects,
+                               GCancellable                *cancellable,
+                               GError                     **error)
+{
+  gboolean ret = FALSE;
+
+  if (flags & OSTREE_REPO_LIST_OBJECTS_ALL)
+    flags |= (OSTREE_REPO_LIST_OBJECTS_LOOSE | OSTREE_REPO_LIST_OBJECTS_PACKED);
+
+  if (flags & OSTREE_REPO_LIST_OBJECTS_LOOSE)
+    {
+      if (!list_loose_objects (self, inout_objects, NULL, cancellable, error))
+        goto out;
+      if (self->parent_repo)
+        {
+          if (!list_loose_objects (self->parent_repo, inout_objects, NULL, cancellable, error))
+            goto out;
+        }
+    }
+
+  if (flags & OSTREE_REPO_LIST_OBJECTS_PACKED)
+    {
+      /* Nothing for now... */
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
 /**
  * ostree_repo_list_objects:
  * @self: Repo
@@ -3549,33 +4005,16 @@ ostree_repo_list_objects (OstreeRepo                  *self,
                           GError                     **error)
 {
   gboolean ret = FALSE;
+  g_autoptr(OstreeObjectSet) objects = _ostree_object_set_new ();
   g_autoptr(GHashTable) ret_objects = NULL;
 
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
   g_return_val_if_fail (self->inited, FALSE);
 
-  ret_objects = g_hash_table_new_full (ostree_hash_object_name, g_variant_equal,
-                                       (GDestroyNotify) g_variant_unref,
-                                       (GDestroyNotify) g_variant_unref);
-
-  if (flags & OSTREE_REPO_LIST_OBJECTS_ALL)
-    flags |= (OSTREE_REPO_LIST_OBJECTS_LOOSE | OSTREE_REPO_LIST_OBJECTS_PACKED);
+  if (!_ostree_repo_list_objects_set (self, flags, objects, cancellable, error))
+    goto out;
 
-  if (flags & OSTREE_REPO_LIST_OBJECTS_LOOSE)
-    {
-      if (!list_loose_objects (self, ret_objects, NULL, cancellable, error))
-        goto out;
-      if (self->parent_repo)
-        {
-          if (!list_loose_objects (self->parent_repo, ret_objects, NULL, cancellable, error))
-            goto out;
-        }
-    }
-
-  if (flags & OSTREE_REPO_LIST_OBJECTS_PACKED)
-    {
-      /* Nothing for now... */
-    }
+  ret_objects = object_set_to_list_objects_table (objects);
 
   ret = TRUE;
   ot_transfer_out_value (out_objects, &ret_objects);
@@ -3604,26 +4043,25 @@ ostree_repo_list_commit_objects_starting_with (OstreeRepo                  *self
                                                GError                     **error)
 {
   gboolean ret = FALSE;
+  g_autoptr(OstreeObjectSet) commits = _ostree_object_set_new ();
   g_autoptr(GHashTable) ret_commits = NULL;
 
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
   g_return_val_if_fail (self->inited, FALSE);
 
-  ret_commits = g_hash_table_new_full (ostree_hash_object_name, g_variant_equal,
-                                       (GDestroyNotify) g_variant_unref,
-                                       (GDestroyNotify) g_variant_unref);
-
-  if (!list_loose_objects (self, ret_commits, start, cancellable, error))
+  if (!list_loose_objects (self, commits, start, cancellable, error))
         goto out;
 
 
   if (self->parent_repo)
     {
-      if (!list_loose_objects (self->parent_repo, ret_commits, start,
+      if (!list_loose_objects (self->parent_repo, commits, start,
                                cancellable, error))
         goto out;
     }
 
+  ret_commits = object_set_to_list_objects_table (commits);
+
   ret = TRUE;
   ot_transfer_out_value (out_commits, &ret_commits);
  out:
@@ -4279,20 +4717,20 @@ find_keyring (OstreeRepo          *self,
   return NULL;
 }
 
-static OstreeGpgVerifyResult *
-_ostree_repo_gpg_verify_data_internal (OstreeRepo    *self,
-                                       const gchar   *remote_name,
-                                       GBytes        *data,
-                                       GBytes        *signatures,
-                                       GFile         *keyringdir,
-                                       GFile         *extra_keyring,
-                                       GCancellable  *cancellable,
-                                       GError       **error)
+/* Create a verifier with the keyrings trusted for @remote_name */
+static OstreeGpgVerifier *
+new_gpg_verifier (OstreeRepo    *self,
+                  const gchar   *remote_name,
+                  GFile         *keyringdir,
+                  GFile         *extra_keyring,
+                  GCancellable  *cancellable,
+                  GError       **error)
 {
   glnx_unref_object OstreeGpgVerifier *verifier = NULL;
   gboolean add_global_keyring_dir = TRUE;
 
   verifier = _ostree_gpg_verifier_new ();
+  _ostree_gpg_verifier_set_home_cache (verifier, self->gpg_home_cache);
 
   if (remote_name == OSTREE_ALL_REMOTES)
     {
@@ -4342,6 +4780,26 @@ _ostree_repo_gpg_verify_data_internal (OstreeRepo    *self,
       _ostree_gpg_verifier_add_keyring (verifier, extra_keyring);
     }
 
+  return g_steal_pointer (&verifier);
+}
+
+static OstreeGpgVerifyResult *
+_ostree_repo_gpg_verify_data_internal (OstreeRepo    *self,
+                                       const gchar   *remote_name,
+                                       GBytes        *data,
+                                       GBytes        *signatures,
+                                       GFile         *keyringdir,
+                                       GFile         *extra_keyring,
+                                       GCancellable  *cancellable,
+                                       GError       **error)
+{
+  glnx_unref_object OstreeGpgVerifier *verifier = NULL;
+
+  verifier = new_gpg_verifier (self, remote_name, keyringdir, extra_keyring,
+                               cancellable, error);
+  if (verifier == NULL)
+    return NULL;
+
   return _ostree_gpg_verifier_check_signature (verifier,
                                                data,
                                                signatures,
@@ -4349,21 +4807,15 @@ _ostree_repo_gpg_verify_data_internal (OstreeRepo    *self,
                                                error);
 }
 
-OstreeGpgVerifyResult *
-_ostree_repo_gpg_verify_with_metadata (OstreeRepo          *self,
-                                       GBytes              *signed_data,
-                                       GVariant            *metadata,
-                                       const char          *remote_name,
-                                       GFile               *keyringdir,
-                                       GFile               *extra_keyring,
-                                       GCancellable        *cancellable,
-                                       GError             **error)
+/* Concatenate the signatures stored in commit detached metadata */
+static GBytes *
+signatures_from_metadata (GVariant  *metadata,
+                          GError   **error)
 {
   g_autoptr(GVariant) signaturedata = NULL;
   GByteArray *buffer;
   GVariantIter iter;
   GVariant *child;
-  g_autoptr (GBytes) signatures = NULL;
 
   if (metadata)
     signaturedata = g_variant_lookup_value (metadata,
@@ -4393,7 +4845,24 @@ _ostree_repo_gpg_verify_with_metadata (OstreeRepo          *self,
                            g_variant_get_size (child));
       g_variant_unref (child);
     }
-  signatures = g_byte_array_free_to_bytes (buffer);
+  return g_byte_array_free_to_bytes (buffer);
+}
+
+OstreeGpgVerifyResult *
+_ostree_repo_gpg_verify_with_metadata (OstreeRepo          *self,
+                                       GBytes              *signed_data,
+                                       GVariant            *metadata,
+                                       const char          *remote_name,
+                                       GFile               *keyringdir,
+                                       GFile               *extra_keyring,
+                                       GCancellable        *cancellable,
+                                       GError             **error)
+{
+  g_autoptr (GBytes) signatures = NULL;
+
+  signatures = signatures_from_metadata (metadata, error);
+  if (signatures == NULL)
+    return NULL;
 
   return _ostree_repo_gpg_verify_data_internal (self,
                                                 remote_name,
@@ -4461,6 +4930,251 @@ out:
   return result;
 }
 
+/* Cache entries are keyed by a SHA256 over the commit checksum, its
+ * detached metadata and the state of the keyrings used.
+ */
+static char *
+gpg_verify_cache_key (const char         *commit_checksum,
+                      GVariant           *metadata,
+                      OstreeGpgVerifier  *verifier)
+{
+  g_autofree char *fingerprint = _ostree_gpg_verifier_get_fingerprint (verifier);
+  g_autoptr(GChecksum) checksum = NULL;
+
+  if (fingerprint == NULL)
+    return NULL;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  g_checksum_update (checksum, (guint8*)commit_checksum, strlen (commit_checksum) + 1);
+  g_checksum_update (checksum, g_variant_get_data (metadata), g_variant_get_size (metadata));
+  g_checksum_update (checksum, (guint8*)fingerprint, strlen (fingerprint));
+  return g_strdup (g_checksum_get_string (checksum));
+}
+
+static gboolean
+gpg_verify_cache_lookup (OstreeRepo    *self,
+                         const char    *key,
+                         GVariant     **out_signatures,
+                         guint         *out_n_valid,
+                         GError       **error)
+{
+  gboolean ret = FALSE;
+  g_autofree char *path = g_build_filename (_OSTREE_GPG_VERIFY_CACHE_PATH, key, NULL);
+  glnx_fd_close int fd = -1;
+  g_autoptr(GVariant) entry = NULL;
+  g_autoptr(GVariant) signatures = NULL;
+  guint64 verified;
+  guint n_valid;
+  gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+  GVariantIter iter;
+  GVariant *child;
+
+  if (!ot_openat_ignore_enoent (self->repo_dir_fd, path, &fd, error))
+    goto out;
+  if (fd == -1)
+    {
+      ret = TRUE;
+      goto out;
+    }
+
+  if (!ot_util_variant_map_fd (fd, 0, G_VARIANT_TYPE (_OSTREE_GPG_VERIFY_CACHE_FORMAT),
+                               FALSE, &entry, error))
+    goto out;
+
+  g_variant_get (entry, "(tu@av)", &verified, &n_valid, &signatures);
+  verified = GUINT64_FROM_BE (verified);
+  n_valid = GUINT32_FROM_BE (n_valid);
+
+  /* Key expiry isn't recorded in the results, so bound the age */
+  if ((gint64) verified > now || now - (gint64) verified > _OSTREE_GPG_VERIFY_CACHE_MAX_AGE)
+    {
+      ret = TRUE;
+      goto out;
+    }
+
+  g_variant_iter_init (&iter, signatures);
+  while ((child = g_variant_iter_next_value (&iter)) != NULL)
+    {
+      g_autoptr(GVariant) sig = g_variant_get_variant (child);
+      gboolean valid;
+      gint64 exp_timestamp;
+
+      g_variant_unref (child);
+
+      if (!g_variant_is_of_type (sig, G_VARIANT_TYPE ("(bbbbbsxxssss)")))
+        {
+          ret = TRUE;
+          goto out;
+        }
+
+      g_variant_get_child (sig, OSTREE_GPG_SIGNATURE_ATTR_VALID, "b", &valid);
+      g_variant_get_child (sig, OSTREE_GPG_SIGNATURE_ATTR_EXP_TIMESTAMP, "x", &exp_timestamp);
+      if (valid && exp_timestamp != 0 && exp_timestamp <= now)
+        {
+          ret = TRUE;
+          goto out;
+        }
+    }
+
+  *out_signatures = g_steal_pointer (&signatures);
+  *out_n_valid = n_valid;
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static gboolean
+gpg_verify_cache_store (OstreeRepo             *self,
+                        const char             *key,
+                        GVariant               *signatures,
+                        guint                   n_valid,
+                        GCancellable           *cancellable,
+                        GError                **error)
+{
+  gboolean ret = FALSE;
+  g_autofree char *path = g_build_filename (_OSTREE_GPG_VERIFY_CACHE_PATH, key, NULL);
+  g_autoptr(GVariant) entry = NULL;
+  guint64 now = g_get_real_time () / G_USEC_PER_SEC;
+
+  if (!glnx_shutil_mkdir_p_at (self->repo_dir_fd, _OSTREE_GPG_VERIFY_CACHE_PATH, 0777,
+                               cancellable, error))
+    goto out;
+
+  entry = g_variant_ref_sink (g_variant_new ("(tu@av)", GUINT64_TO_BE (now),
+                                             GUINT32_TO_BE (n_valid), signatures));
+
+  if (!_ostree_repo_file_replace_contents (self, self->repo_dir_fd, path,
+                                           g_variant_get_data (entry),
+                                           g_variant_get_size (entry),
+                                           cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/*
+ * _ostree_repo_verify_commit_cached:
+ * @out_signatures: (out): Array of ostree_gpg_verify_result_get_all() variants
+ * @out_n_valid: (out): Number of valid signatures
+ * @out_result: (out) (allow-none): The verification result
+ *
+ * Like _ostree_repo_verify_commit_internal(), but with core.gpg-verify-cache
+ * enabled, a commit that verified successfully before is not passed to
+ * GPG again while its detached metadata and the keyrings are unchanged.
+ * A live result can't be rebuilt from the cache, so if @out_result is
+ * given GPG is always run; the result is still stored in the cache.
+ */
+gboolean
+_ostree_repo_verify_commit_cached (OstreeRepo             *self,
+                                   const char             *commit_checksum,
+                                   const char             *remote_name,
+                                   GFile                  *keyringdir,
+                                   GFile                  *extra_keyring,
+                                   GVariant              **out_signatures,
+                                   guint                  *out_n_valid,
+                                   OstreeGpgVerifyResult **out_result,
+                                   GCancellable           *cancellable,
+                                   GError                **error)
+{
+  gboolean ret = FALSE;
+  glnx_unref_object OstreeGpgVerifier *verifier = NULL;
+  glnx_unref_object OstreeGpgVerifyResult *result = NULL;
+  g_autoptr(GVariant) commit_variant = NULL;
+  g_autoptr(GVariant) metadata = NULL;
+  g_autoptr(GVariant) signatures = NULL;
+  g_autoptr(GBytes) signed_data = NULL;
+  g_autoptr(GBytes) signature_bytes = NULL;
+  g_autofree char *cache_key = NULL;
+  guint n_valid = 0;
+
+  if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_COMMIT,
+                                 commit_checksum, &commit_variant,
+                                 error))
+    {
+      g_prefix_error (error, "Failed to read commit: ");
+      goto out;
+    }
+
+  if (!ostree_repo_read_commit_detached_metadata (self,
+                                                  commit_checksum,
+                                                  &metadata,
+                                                  cancellable,
+                                                  error))
+    {
+      g_prefix_error (error, "Failed to read detached metadata: ");
+      goto out;
+    }
+
+  signature_bytes = signatures_from_metadata (metadata, error);
+  if (signature_bytes == NULL)
+    goto out;
+
+  if (remote_name == NULL)
+    remote_name = OSTREE_ALL_REMOTES;
+
+  verifier = new_gpg_verifier (self, remote_name, keyringdir, extra_keyring,
+                               cancellable, error);
+  if (verifier == NULL)
+    goto out;
+
+  if (self->enable_gpg_verify_cache)
+    {
+      GError *local_error = NULL;
+
+      cache_key = gpg_verify_cache_key (commit_checksum, metadata, verifier);
+      if (cache_key != NULL && out_result == NULL &&
+          !gpg_verify_cache_lookup (self, cache_key, &signatures, &n_valid, &local_error))
+        {
+          g_debug ("Reading GPG verification cache: %s", local_error->message);
+          g_clear_error (&local_error);
+        }
+    }
+
+  if (signatures == NULL)
+    {
+      GVariantBuilder builder;
+      guint i, n_all;
+
+      signed_data = g_variant_get_data_as_bytes (commit_variant);
+      result = _ostree_gpg_verifier_check_signature (verifier, signed_data, signature_bytes,
+                                                     cancellable, error);
+      if (result == NULL)
+        goto out;
+
+      g_variant_builder_init (&builder, G_VARIANT_TYPE ("av"));
+      n_all = ostree_gpg_verify_result_count_all (result);
+      for (i = 0; i < n_all; i++)
+        g_variant_builder_add (&builder, "v", ostree_gpg_verify_result_get_all (result, i));
+      signatures = g_variant_ref_sink (g_variant_builder_end (&builder));
+      n_valid = ostree_gpg_verify_result_count_valid (result);
+
+      /* Only successes are remembered; anything else may be fixed by
+       * importing keys, which changes the keyring fingerprint anyway.
+       */
+      if (cache_key != NULL && n_valid > 0 && self->writable)
+        {
+          GError *local_error = NULL;
+
+          if (!gpg_verify_cache_store (self, cache_key, signatures, n_valid,
+                                       cancellable, &local_error))
+            {
+              g_debug ("Writing GPG verification cache: %s", local_error->message);
+              g_clear_error (&local_error);
+            }
+        }
+    }
+
+  ret = TRUE;
+  *out_signatures = g_steal_pointer (&signatures);
+  *out_n_valid = n_valid;
+  if (out_result)
+    *out_result = g_steal_pointer (&result);
+ out:
+  return ret;
+}
+
 /**
  * ostree_repo_verify_commit:
  * @self: Repository
@@ -4483,13 +5197,23 @@ ostree_repo_verify_commit (OstreeRepo   *self,
                            GCancellable *cancellable,
                            GError      **error)
 {
-  glnx_unref_object OstreeGpgVerifyResult *result = NULL;
+  g_autoptr(GVariant) signatures = NULL;
+  guint n_valid;
 
-  result = ostree_repo_verify_commit_ext (self, commit_checksum,
+  if (!_ostree_repo_verify_commit_cached (self, commit_checksum, NULL,
                                           keyringdir, extra_keyring,
-                                          cancellable, error);
+                                          &signatures, &n_valid, NULL,
+                                          cancellable, error))
+    return FALSE;
 
-  return ostree_gpg_verify_result_require_valid_signature (result, error);
+  if (n_valid == 0)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "GPG signatures found, but none are in trusted keyring");
+      return FALSE;
+    }
+
+  return TRUE;
 }
 
 /**
@@ -4619,6 +5343,9 @@ ostree_repo_verify_summary (OstreeRepo    *self,
  *
  * It is regenerated automatically after a commit if
  * `core/commit-update-summary` is set.
+ *
+ * Any static deltas configured via `core/auto-static-deltas` are
+ * brought up to date first, see ostree_repo_regenerate_static_deltas().
  */
 gboolean
 ostree_repo_regenerate_summary (OstreeRepo     *self,
@@ -4634,6 +5361,9 @@ ostree_repo_regenerate_summary (OstreeRepo     *self,
   GList *iter = NULL;
   g_auto(GVariantDict) additional_metadata_builder = {{0,}};
 
+  if (!ostree_repo_regenerate_static_deltas (self, cancellable, error))
+    goto out;
+
   if (!ostree_repo_list_refs (self, NULL, &refs, cancellable, error))
     goto out;
 
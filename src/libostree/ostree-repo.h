@@ -405,6 +405,11 @@ gboolean      ostree_repo_list_refs_ext (OstreeRepo                 *self,
                                          GCancellable               *cancellable,
                                          GError                     **error);
 
+_OSTREE_PUBLIC
+gboolean      ostree_repo_pack_refs (OstreeRepo     *self,
+                                     GCancellable   *cancellable,
+                                     GError        **error);
+
 _OSTREE_PUBLIC
 gboolean ostree_repo_remote_list_refs (OstreeRepo       *self,
                                        const char       *remote_name,
@@ -726,6 +731,14 @@ ostree_repo_checkout_tree (OstreeRepo               *self,
  * options.  This is used by ostree_repo_checkout_tree_at() which
  * supercedes previous separate enumeration usage in
  * ostree_repo_checkout_tree().
+ *
+ * Set @parallelism to the number of threads to use for checking out
+ * directories concurrently; 0 or 1 means a serial checkout.
+ *
+ * Set @force_copy to never hardlink objects into the checkout, so
+ * that it may safely be modified.  Copies are made as copy-on-write
+ * clones ("reflinks") where the filesystem supports it, falling back
+ * to copying the data otherwise.
  */
 typedef struct {
   OstreeRepoCheckoutMode mode;
@@ -734,13 +747,16 @@ typedef struct {
   guint enable_uncompressed_cache : 1;
   guint disable_fsync : 1;
   guint process_whiteouts : 1;
-  guint reserved : 29;
+  guint force_copy : 1;
+  guint reserved : 28;
 
   const char *subpath;
 
   OstreeRepoDevInoCache *devino_to_csum_cache;
 
-  guint unused_uints[6];
+  guint parallelism;
+
+  guint unused_uints[5];
   gpointer unused_ptrs[7];
 } OstreeRepoCheckoutOptions;
 
@@ -762,11 +778,30 @@ gboolean ostree_repo_checkout_tree_at (OstreeRepo                         *self,
                                        GCancellable                       *cancellable,
                                        GError                            **error);
 
+_OSTREE_PUBLIC
+gboolean ostree_repo_checkout_tree_update_at (OstreeRepo                         *self,
+                                              OstreeRepoCheckoutOptions          *options,
+                                              int                                 destination_dfd,
+                                              const char                         *destination_path,
+                                              const char                         *from_commit,
+                                              const char                         *commit,
+                                              GCancellable                       *cancellable,
+                                              GError                            **error);
+
 _OSTREE_PUBLIC
 gboolean       ostree_repo_checkout_gc (OstreeRepo        *self,
                                         GCancellable      *cancellable,
                                         GError           **error);
 
+_OSTREE_PUBLIC
+gboolean       ostree_repo_get_uncompressed_cache_stats (OstreeRepo    *self,
+                                                         guint64       *out_hits,
+                                                         guint64       *out_misses,
+                                                         guint64       *out_n_objects,
+                                                         guint64       *out_size,
+                                                         GCancellable  *cancellable,
+                                                         GError       **error);
+
 _OSTREE_PUBLIC
 gboolean       ostree_repo_read_commit (OstreeRepo    *self,
                                         const char    *ref,
@@ -837,6 +872,11 @@ gboolean ostree_repo_static_delta_generate (OstreeRepo                   *self,
                                             GCancellable                 *cancellable,
                                             GError                      **error);
 
+_OSTREE_PUBLIC
+gboolean ostree_repo_regenerate_static_deltas (OstreeRepo     *self,
+                                               GCancellable   *cancellable,
+                                               GError        **error);
+
 _OSTREE_PUBLIC
 gboolean ostree_repo_static_delta_execute_offline (OstreeRepo                    *self,
                                                    GFile                         *dir_or_file,
@@ -950,6 +990,27 @@ gboolean ostree_repo_prune (OstreeRepo        *self,
                             GCancellable      *cancellable,
                             GError           **error);
 
+/**
+ * OstreeRepoFsckFlags:
+ * @OSTREE_REPO_FSCK_FLAGS_NONE: No special options for fsck
+ * @OSTREE_REPO_FSCK_FLAGS_DELETE: Delete corrupted objects
+ */
+typedef enum {
+  OSTREE_REPO_FSCK_FLAGS_NONE,
+  OSTREE_REPO_FSCK_FLAGS_DELETE = (1 << 0)
+} OstreeRepoFsckFlags;
+
+_OSTREE_PUBLIC
+gboolean ostree_repo_fsck_objects (OstreeRepo           *self,
+                                   GHashTable           *objects,
+                                   OstreeRepoFsckFlags   flags,
+                                   guint64               max_age_secs,
+                                   GPtrArray           **out_corrupted,
+                                   guint                *out_n_verified,
+                                   guint                *out_n_skipped,
+                                   GCancellable         *cancellable,
+                                   GError              **error);
+
 /**
  * OstreeRepoPullFlags:
  * @OSTREE_REPO_PULL_FLAGS_NONE: No special options for pull
@@ -164,6 +164,91 @@ dirfd_copy_attributes_and_xattrs (int            src_parent_dfd,
   return ret;
 }
 
+/* Like glnx_file_copy_at(), but for regular files try to make a
+ * copy-on-write clone first; this makes copying /etc nearly free on
+ * filesystems with reflink support.
+ */
+static gboolean
+reflink_or_copy_at (int                   src_dfd,
+                    const char           *src_subpath,
+                    struct stat          *src_stbuf,
+                    int                   dest_dfd,
+                    const char           *dest_subpath,
+                    GLnxFileCopyFlags     copyflags,
+                    GCancellable         *cancellable,
+                    GError              **error)
+{
+  gboolean ret = FALSE;
+  glnx_fd_close int src_fd = -1;
+  glnx_fd_close int dest_fd = -1;
+  gboolean did_clone = FALSE;
+  g_autoptr(GVariant) xattrs = NULL;
+  struct timespec ts[2];
+
+  if (!S_ISREG (src_stbuf->st_mode))
+    return glnx_file_copy_at (src_dfd, src_subpath, src_stbuf, dest_dfd, dest_subpath,
+                              copyflags, cancellable, error);
+
+  src_fd = openat (src_dfd, src_subpath, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+  if (src_fd == -1)
+    {
+      glnx_set_error_from_errno (error);
+      goto out;
+    }
+
+  if ((copyflags & GLNX_FILE_COPY_OVERWRITE) &&
+      unlinkat (dest_dfd, dest_subpath, 0) != 0 && errno != ENOENT)
+    {
+      glnx_set_error_from_errno (error);
+      goto out;
+    }
+
+  dest_fd = openat (dest_dfd, dest_subpath, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if (dest_fd == -1)
+    {
+      glnx_set_error_from_errno (error);
+      goto out;
+    }
+
+  if (!ot_clone_fd (src_fd, dest_fd, &did_clone, error))
+    goto out;
+
+  if (!did_clone)
+    {
+      (void) close (glnx_steal_fd (&dest_fd));
+      (void) unlinkat (dest_dfd, dest_subpath, 0);
+      return glnx_file_copy_at (src_dfd, src_subpath, src_stbuf, dest_dfd, dest_subpath,
+                                copyflags, cancellable, error);
+    }
+
+  if (!(copyflags & GLNX_FILE_COPY_NOXATTRS))
+    {
+      if (!glnx_fd_get_all_xattrs (src_fd, &xattrs, cancellable, error))
+        goto out;
+      if (!glnx_fd_set_all_xattrs (dest_fd, xattrs, cancellable, error))
+        goto out;
+    }
+
+  if (fchown (dest_fd, src_stbuf->st_uid, src_stbuf->st_gid) != 0 ||
+      fchmod (dest_fd, src_stbuf->st_mode & 07777) != 0)
+    {
+      glnx_set_error_from_errno (error);
+      goto out;
+    }
+
+  ts[0] = src_stbuf->st_atim;
+  ts[1] = src_stbuf->st_mtim;
+  if (futimens (dest_fd, ts) != 0)
+    {
+      glnx_set_error_from_errno (error);
+      goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
 static gboolean
 copy_dir_recurse (int              src_parent_dfd,
                   int              dest_parent_dfd,
@@ -225,9 +310,9 @@ copy_dir_recurse (int              src_parent_dfd,
         }
       else
         {
-          if (!glnx_file_copy_at (src_dfd, name, &child_stbuf, dest_dfd, name,
-                                  GLNX_FILE_COPY_OVERWRITE,
-                                  cancellable, error))
+          if (!reflink_or_copy_at (src_dfd, name, &child_stbuf, dest_dfd, name,
+                                   GLNX_FILE_COPY_OVERWRITE,
+                                   cancellable, error))
             goto out;
         }
     }
@@ -415,10 +500,10 @@ copy_modified_config_file (int                 orig_etc_fd,
     }
   else if (S_ISLNK (modified_stbuf.st_mode) || S_ISREG (modified_stbuf.st_mode))
     {
-      if (!glnx_file_copy_at (modified_etc_fd, path, &modified_stbuf, 
-                              new_etc_fd, path,
-                              GLNX_FILE_COPY_OVERWRITE,
-                              cancellable, error))
+      if (!reflink_or_copy_at (modified_etc_fd, path, &modified_stbuf,
+                               new_etc_fd, path,
+                               GLNX_FILE_COPY_OVERWRITE,
+                               cancellable, error))
         goto out;
     }
   else
@@ -574,6 +659,10 @@ checkout_deployment_tree (OstreeSysroot     *sysroot,
    * OstreeRepo level fsync.
    */
   checkout_opts.disable_fsync = TRUE;
+  /* Deployment checkouts are dominated by syscall latency (mostly
+   * hardlinks), so spread directories across the CPUs.
+   */
+  checkout_opts.parallelism = g_get_num_processors ();
 
   osdeploy_path = g_strconcat ("ostree/deploy/", ostree_deployment_get_osname (deployment), "/deploy", NULL);
   checkout_target_name = g_strdup_printf ("%s.%d", csum, ostree_deployment_get_deployserial (deployment));
@@ -886,10 +975,14 @@ merge_configuration (OstreeSysroot         *sysroot,
   
   if (usretc_exists)
     {
+      glnx_fd_close int deployment_usr_dfd = -1;
+
       /* TODO - set out labels as we copy files */
       g_assert (!etc_exists);
-      if (!gs_shutil_cp_a (deployment_usretc_path, deployment_etc_path,
-                           cancellable, error))
+      if (!glnx_opendirat (deployment_dfd, "usr", TRUE, &deployment_usr_dfd, error))
+        goto out;
+      if (!copy_dir_recurse (deployment_usr_dfd, deployment_dfd, "etc",
+                             cancellable, error))
         goto out;
 
       /* Here, we initialize SELinux policy from the /usr/etc inside
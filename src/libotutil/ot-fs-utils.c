@@ -24,8 +24,15 @@
 #include "libgsystem.h"
 #include "libglnx.h"
 #include <sys/xattr.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
 #include <gio/gunixinputstream.h>
 
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
 int
 ot_opendirat (int dfd, const char *path, gboolean follow)
 {
@@ -230,3 +237,363 @@ ot_openat_ignore_enoent (int dfd,
  out:
   return ret;
 }
+
+static gboolean
+write_all_fd (int            fd,
+              const guint8  *buf,
+              gsize          len,
+              GError       **error)
+{
+  while (len > 0)
+    {
+      gssize n;
+
+      do
+        n = write (fd, buf, len);
+      while (G_UNLIKELY (n == -1 && errno == EINTR));
+      if (n == -1)
+        {
+          glnx_set_error_from_errno (error);
+          return FALSE;
+        }
+      buf += n;
+      len -= n;
+    }
+  return TRUE;
+}
+
+/**
+ * ot_copy_fd_range:
+ * @src_fd: Source file descriptor
+ * @src_offset: Offset in @src_fd to start copying from
+ * @dest_fd: Destination file descriptor, written at its current position
+ * @len: Number of bytes to copy
+ *
+ * Copy @len bytes from @src_fd to @dest_fd without bouncing the data
+ * through a userspace buffer where the kernel allows it; we try
+ * copy_file_range(), then sendfile(), and only then fall back to
+ * pread()/write().  The file offset of @src_fd is not changed.
+ */
+gboolean
+ot_copy_fd_range (int            src_fd,
+                  guint64        src_offset,
+                  int            dest_fd,
+                  guint64        len,
+                  GCancellable  *cancellable,
+                  GError       **error)
+{
+  guint64 pos = src_offset;
+#ifdef __NR_copy_file_range
+  gboolean try_copy_file_range = TRUE;
+#endif
+  gboolean try_sendfile = TRUE;
+
+  while (len > 0)
+    {
+      gsize chunk = MIN (len, 1 << 30);
+      gssize n;
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        return FALSE;
+
+#ifdef __NR_copy_file_range
+      if (try_copy_file_range)
+        {
+          loff_t off = pos;
+
+          do
+            n = syscall (__NR_copy_file_range, src_fd, &off, dest_fd, NULL, chunk, 0);
+          while (G_UNLIKELY (n == -1 && errno == EINTR));
+          if (n == -1 && (errno == ENOSYS || errno == EXDEV ||
+                          errno == EINVAL || errno == EOPNOTSUPP))
+            {
+              try_copy_file_range = FALSE;
+              continue;
+            }
+        }
+      else
+#endif
+      if (try_sendfile)
+        {
+          off_t off = pos;
+
+          do
+            n = sendfile (dest_fd, src_fd, &off, chunk);
+          while (G_UNLIKELY (n == -1 && errno == EINTR));
+          if (n == -1 && (errno == ENOSYS || errno == EINVAL))
+            {
+              try_sendfile = FALSE;
+              continue;
+            }
+        }
+      else
+        {
+          guint8 buf[16384];
+
+          do
+            n = pread (src_fd, buf, MIN (sizeof (buf), chunk), pos);
+          while (G_UNLIKELY (n == -1 && errno == EINTR));
+          if (n > 0 && !write_all_fd (dest_fd, buf, n, error))
+            return FALSE;
+        }
+
+      if (n == -1)
+        {
+          glnx_set_error_from_errno (error);
+          return FALSE;
+        }
+      if (G_UNLIKELY (n == 0))
+        {
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                               "Unexpected EOF copying file data");
+          return FALSE;
+        }
+
+      pos += n;
+      len -= n;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+pwrite_all_fd (int            fd,
+               const guint8  *buf,
+               gsize          len,
+               guint64        offset,
+               GError       **error)
+{
+  while (len > 0)
+    {
+      gssize n;
+
+      do
+        n = pwrite (fd, buf, len, offset);
+      while (G_UNLIKELY (n == -1 && errno == EINTR));
+      if (n == -1)
+        {
+          glnx_set_error_from_errno (error);
+          return FALSE;
+        }
+      buf += n;
+      len -= n;
+      offset += n;
+    }
+  return TRUE;
+}
+
+/**
+ * ot_copy_fd_range_at:
+ * @src_fd: Source file descriptor
+ * @src_offset: Offset in @src_fd to start copying from
+ * @dest_fd: Destination file descriptor
+ * @dest_offset: Offset in @dest_fd to start writing at
+ * @len: Number of bytes to copy
+ *
+ * Like ot_copy_fd_range(), but writes at @dest_offset, and leaves the
+ * file offsets of both descriptors unchanged.  As sendfile() always
+ * writes at the current position, only copy_file_range() is tried
+ * before falling back to pread()/pwrite().
+ */
+gboolean
+ot_copy_fd_range_at (int            src_fd,
+                     guint64        src_offset,
+                     int            dest_fd,
+                     guint64        dest_offset,
+                     guint64        len,
+                     GCancellable  *cancellable,
+                     GError       **error)
+{
+#ifdef __NR_copy_file_range
+  gboolean try_copy_file_range = TRUE;
+#endif
+
+  while (len > 0)
+    {
+      gsize chunk = MIN (len, 1 << 30);
+      gssize n;
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        return FALSE;
+
+#ifdef __NR_copy_file_range
+      if (try_copy_file_range)
+        {
+          loff_t src_off = src_offset;
+          loff_t dest_off = dest_offset;
+
+          do
+            n = syscall (__NR_copy_file_range, src_fd, &src_off, dest_fd, &dest_off, chunk, 0);
+          while (G_UNLIKELY (n == -1 && errno == EINTR));
+          if (n == -1 && (errno == ENOSYS || errno == EXDEV ||
+                          errno == EINVAL || errno == EOPNOTSUPP))
+            {
+              try_copy_file_range = FALSE;
+              continue;
+            }
+        }
+      else
+#endif
+        {
+          guint8 buf[16384];
+
+          do
+            n = pread (src_fd, buf, MIN (sizeof (buf), chunk), src_offset);
+          while (G_UNLIKELY (n == -1 && errno == EINTR));
+          if (n > 0 && !pwrite_all_fd (dest_fd, buf, n, dest_offset, error))
+            return FALSE;
+        }
+
+      if (n == -1)
+        {
+          glnx_set_error_from_errno (error);
+          return FALSE;
+        }
+      if (G_UNLIKELY (n == 0))
+        {
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                               "Unexpected EOF copying file data");
+          return FALSE;
+        }
+
+      src_offset += n;
+      dest_offset += n;
+      len -= n;
+    }
+
+  return TRUE;
+}
+
+/**
+ * ot_clone_fd:
+ * @src_fd: Source file descriptor
+ * @dest_fd: Destination file descriptor, opened for writing
+ * @out_cloned: (out): Whether or not the clone was made
+ *
+ * Make the contents of @dest_fd a copy-on-write clone of @src_fd,
+ * using the FICLONE ioctl (i.e. a "reflink" on btrfs or XFS).  If the
+ * filesystem does not support it, or the files are on different
+ * filesystems, @out_cloned is set to %FALSE and the caller should fall
+ * back to copying the data.
+ */
+gboolean
+ot_clone_fd (int        src_fd,
+             int        dest_fd,
+             gboolean  *out_cloned,
+             GError   **error)
+{
+  int r;
+
+  do
+    r = ioctl (dest_fd, FICLONE, src_fd);
+  while (G_UNLIKELY (r == -1 && errno == EINTR));
+  if (r == 0)
+    *out_cloned = TRUE;
+  else if (errno == EOPNOTSUPP || errno == ENOTTY || errno == EXDEV ||
+           errno == EINVAL || errno == ENOSYS)
+    *out_cloned = FALSE;
+  else
+    {
+      glnx_set_error_from_errno (error);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+#ifdef __NR_getdents64
+/* Not exported by older glibc */
+struct ot_linux_dirent64 {
+  guint64        d_ino;
+  gint64         d_off;
+  unsigned short d_reclen;
+  unsigned char  d_type;
+  char           d_name[];
+};
+
+/* Much larger than the buffer readdir() uses, to cut down on syscalls
+ * for big directories.
+ */
+#define OT_GETDENTS_BUFSIZE (256 * 1024)
+#endif
+
+/**
+ * ot_dirfd_foreach_dent:
+ * @dfd: Directory file descriptor; its offset is consumed
+ * @func: Called for each entry other than "." and ".."
+ * @user_data: Data for @func
+ *
+ * Call @func with the name and type of each entry in @dfd.  The type
+ * may be %DT_UNKNOWN on filesystems which don't provide it.  On Linux
+ * this uses getdents64() with a large buffer directly, rather than
+ * readdir().  If @func returns %FALSE, iteration stops and its error
+ * is propagated.
+ */
+gboolean
+ot_dirfd_foreach_dent (int              dfd,
+                       OtDirentFunc     func,
+                       gpointer         user_data,
+                       GCancellable    *cancellable,
+                       GError         **error)
+{
+#ifdef __NR_getdents64
+  g_autofree char *buf = g_malloc (OT_GETDENTS_BUFSIZE);
+
+  while (TRUE)
+    {
+      long n;
+      long pos;
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        return FALSE;
+
+      do
+        n = syscall (__NR_getdents64, dfd, buf, OT_GETDENTS_BUFSIZE);
+      while (G_UNLIKELY (n == -1 && errno == EINTR));
+      if (n == -1)
+        {
+          glnx_set_error_from_errno (error);
+          return FALSE;
+        }
+      if (n == 0)
+        break;
+
+      for (pos = 0; pos < n; )
+        {
+          const struct ot_linux_dirent64 *dent = (const struct ot_linux_dirent64 *) (buf + pos);
+
+          pos += dent->d_reclen;
+
+          if (dent->d_name[0] == '.' &&
+              (dent->d_name[1] == '\0' ||
+               (dent->d_name[1] == '.' && dent->d_name[2] == '\0')))
+            continue;
+
+          if (!func (dent->d_name, dent->d_type, user_data, error))
+            return FALSE;
+        }
+    }
+
+  return TRUE;
+#else
+  g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+
+  if (!glnx_dirfd_iterator_init_at (dfd, ".", FALSE, &dfd_iter, error))
+    return FALSE;
+
+  while (TRUE)
+    {
+      struct dirent *dent;
+
+      if (!glnx_dirfd_iterator_next_dent (&dfd_iter, &dent, cancellable, error))
+        return FALSE;
+      if (dent == NULL)
+        break;
+
+      if (!func (dent->d_name, dent->d_type, user_data, error))
+        return FALSE;
+    }
+
+  return TRUE;
+#endif
+}
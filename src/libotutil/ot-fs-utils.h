@@ -66,4 +66,35 @@ gboolean ot_openat_ignore_enoent (int dfd,
                                   int *out_fd,
                                   GError **error);
 
+gboolean ot_copy_fd_range (int            src_fd,
+                           guint64        src_offset,
+                           int            dest_fd,
+                           guint64        len,
+                           GCancellable  *cancellable,
+                           GError       **error);
+
+gboolean ot_copy_fd_range_at (int            src_fd,
+                              guint64        src_offset,
+                              int            dest_fd,
+                              guint64        dest_offset,
+                              guint64        len,
+                              GCancellable  *cancellable,
+                              GError       **error);
+
+gboolean ot_clone_fd (int        src_fd,
+                      int        dest_fd,
+                      gboolean  *out_cloned,
+                      GError   **error);
+
+typedef gboolean (*OtDirentFunc) (const char     *name,
+                                  unsigned char   d_type,
+                                  gpointer        user_data,
+                                  GError        **error);
+
+gboolean ot_dirfd_foreach_dent (int              dfd,
+                                OtDirentFunc     func,
+                                gpointer         user_data,
+                                GCancellable    *cancellable,
+                                GError         **error);
+
 G_END_DECLS
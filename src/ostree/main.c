@@ -32,8 +32,11 @@
 #include "ot-main.h"
 #include "ot-builtins.h"
 
+static gboolean ostree_builtin_batch (int argc, char **argv, GCancellable *cancellable, GError **error);
+
 static OstreeCommand commands[] = {
   { "admin", ostree_builtin_admin },
+  { "batch", ostree_builtin_batch },
   { "cat", ostree_builtin_cat },
   { "checkout", ostree_builtin_checkout },
   { "checksum", ostree_builtin_checksum },
@@ -64,6 +67,13 @@ static OstreeCommand commands[] = {
   { NULL }
 };
 
+/* Lives here rather than in its own file since it needs the command table */
+static gboolean
+ostree_builtin_batch (int argc, char **argv, GCancellable *cancellable, GError **error)
+{
+  return ostree_run_batch (argc, argv, commands, cancellable, error);
+}
+
 int
 main (int    argc,
       char **argv)
@@ -26,6 +26,7 @@
 #include "ot-admin-builtins.h"
 #include "ot-admin-functions.h"
 #include "ostree.h"
+#include "ostree-cmdprivate.h"
 
 #include <glib/gi18n.h>
 
@@ -123,9 +124,9 @@ ot_admin_builtin_status (int argc, char **argv, GCancellable *cancellable, GErro
           const char *ref = ostree_deployment_get_csum (deployment);
           OstreeDeploymentUnlockedState unlocked = ostree_deployment_get_unlocked (deployment);
           g_autofree char *version = version_of_commit (repo, ref);
-          glnx_unref_object OstreeGpgVerifyResult *result = NULL;
+          g_autoptr(GVariant) signatures = NULL;
           GString *output_buffer;
-          guint jj, n_signatures;
+          guint jj, n_signatures, n_valid;
           GError *local_error = NULL;
 
           origin = ostree_deployment_get_origin (deployment);
@@ -161,8 +162,9 @@ ot_admin_builtin_status (int argc, char **argv, GCancellable *cancellable, GErro
             {
               /* Print any digital signatures on this commit. */
 
-              result = ostree_repo_verify_commit_ext (repo, ref, NULL, NULL,
-                                                      cancellable, &local_error);
+              (void) ostree_cmd__private__ ()->ostree_repo_verify_commit_cached (repo, ref, NULL,
+                                                                                 &signatures, &n_valid,
+                                                                                 cancellable, &local_error);
 
               /* G_IO_ERROR_NOT_FOUND just means the commit is not signed. */
               if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
@@ -177,12 +179,15 @@ ot_admin_builtin_status (int argc, char **argv, GCancellable *cancellable, GErro
                 }
 
               output_buffer = g_string_sized_new (256);
-              n_signatures = ostree_gpg_verify_result_count_all (result);
+              n_signatures = g_variant_n_children (signatures);
 
               for (jj = 0; jj < n_signatures; jj++)
                 {
-                  ostree_gpg_verify_result_describe (result, jj, output_buffer, "    GPG: ",
-                                                     OSTREE_GPG_SIGNATURE_FORMAT_DEFAULT);
+                  g_autoptr(GVariant) child = g_variant_get_child_value (signatures, jj);
+                  g_autoptr(GVariant) sig = g_variant_get_variant (child);
+
+                  ostree_gpg_verify_result_describe_variant (sig, output_buffer, "    GPG: ",
+                                                             OSTREE_GPG_SIGNATURE_FORMAT_DEFAULT);
                 }
 
               g_print ("%s", output_buffer->str);
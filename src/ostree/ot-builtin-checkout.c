@@ -40,6 +40,9 @@ static gboolean opt_whiteouts;
 static gboolean opt_from_stdin;
 static char *opt_from_file;
 static gboolean opt_disable_fsync;
+static int opt_jobs;
+static gboolean opt_force_copy;
+static char *opt_update_from;
 
 static gboolean
 parse_fsync_cb (const char  *option_name,
@@ -67,11 +70,15 @@ static GOptionEntry options[] = {
   { "from-stdin", 0, 0, G_OPTION_ARG_NONE, &opt_from_stdin, "Process many checkouts from standard input", NULL },
   { "from-file", 0, 0, G_OPTION_ARG_STRING, &opt_from_file, "Process many checkouts from input file", "FILE" },
   { "fsync", 0, 0, G_OPTION_ARG_CALLBACK, parse_fsync_cb, "Specify how to invoke fsync()", "POLICY" },
+  { "jobs", 'j', 0, G_OPTION_ARG_INT, &opt_jobs, "Check out directories using N threads", "N" },
+  { "update-from", 0, 0, G_OPTION_ARG_STRING, &opt_update_from, "Update an existing checkout of COMMIT in place", "COMMIT" },
+  { "force-copy", 0, 0, G_OPTION_ARG_NONE, &opt_force_copy, "Never hardlink; copy files (as reflinks where supported) so the checkout may be modified", NULL },
   { NULL }
 };
 
 static gboolean
 process_one_checkout (OstreeRepo           *repo,
+                      const char           *resolved_from_commit,
                       const char           *resolved_commit,
                       const char           *subpath,
                       const char           *destination,
@@ -85,7 +92,8 @@ process_one_checkout (OstreeRepo           *repo,
    * `ostree_repo_checkout_tree_at` until such time as we have a more
    * convenient infrastructure for testing C APIs with data.
    */
-  if (opt_disable_cache || opt_whiteouts)
+  if (opt_disable_cache || opt_whiteouts || opt_jobs > 1 || opt_force_copy ||
+      resolved_from_commit)
     {
       OstreeRepoCheckoutOptions options = { 0, };
       
@@ -97,11 +105,26 @@ process_one_checkout (OstreeRepo           *repo,
         options.process_whiteouts = TRUE;
       if (subpath)
         options.subpath = subpath;
-
-      if (!ostree_repo_checkout_tree_at (repo, &options,
-                                         AT_FDCWD, destination,
-                                         resolved_commit,
-                                         cancellable, error))
+      if (opt_jobs > 1)
+        options.parallelism = opt_jobs;
+      if (opt_force_copy)
+        options.force_copy = TRUE;
+      if (opt_jobs > 1 || opt_force_copy || resolved_from_commit)
+        options.enable_uncompressed_cache = !opt_disable_cache;
+
+      if (resolved_from_commit)
+        {
+          if (!ostree_repo_checkout_tree_update_at (repo, &options,
+                                                    AT_FDCWD, destination,
+                                                    resolved_from_commit,
+                                                    resolved_commit,
+                                                    cancellable, error))
+            goto out;
+        }
+      else if (!ostree_repo_checkout_tree_at (repo, &options,
+                                              AT_FDCWD, destination,
+                                              resolved_commit,
+                                              cancellable, error))
         goto out;
     }
   else
@@ -204,7 +227,7 @@ process_many_checkouts (OstreeRepo         *repo,
       if (!ostree_repo_resolve_rev (repo, revision, FALSE, &resolved_commit, error))
         goto out;
 
-      if (!process_one_checkout (repo, resolved_commit, subpath, target,
+      if (!process_one_checkout (repo, NULL, resolved_commit, subpath, target,
                                  cancellable, error))
         {
           g_prefix_error (error, "Processing tree %s: ", resolved_commit);
@@ -233,9 +256,13 @@ ostree_builtin_checkout (int argc, char **argv, GCancellable *cancellable, GErro
   const char *commit;
   const char *destination;
   g_autofree char *resolved_commit = NULL;
+  g_autofree char *resolved_from_commit = NULL;
 
   context = g_option_context_new ("COMMIT [DESTINATION] - Check out a commit into a filesystem tree");
 
+  /* Only set by a callback, which batch mode can't reset for us */
+  opt_disable_fsync = FALSE;
+
   if (!ostree_option_context_parse (context, options, &argc, &argv, OSTREE_BUILTIN_FLAG_NONE, &repo, cancellable, error))
     goto out;
 
@@ -252,6 +279,13 @@ ostree_builtin_checkout (int argc, char **argv, GCancellable *cancellable, GErro
       goto out;
     }
 
+  if (opt_update_from && (opt_from_stdin || opt_from_file))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "--update-from cannot be used with --from-stdin or --from-file");
+      goto out;
+    }
+
   if (opt_from_stdin || opt_from_file)
     {
       destination = argv[1];
@@ -270,12 +304,31 @@ ostree_builtin_checkout (int argc, char **argv, GCancellable *cancellable, GErro
       if (!ostree_repo_resolve_rev (repo, commit, FALSE, &resolved_commit, error))
         goto out;
 
-      if (!process_one_checkout (repo, resolved_commit, opt_subpath,
+      if (opt_update_from &&
+          !ostree_repo_resolve_rev (repo, opt_update_from, FALSE, &resolved_from_commit, error))
+        goto out;
+
+      if (!process_one_checkout (repo, resolved_from_commit, resolved_commit, opt_subpath,
                                  destination,
                                  cancellable, error))
         goto out;
     }
 
+  /* A size-bounded cache is trimmed after checking out; an unbounded
+   * one is left alone, as it always has been.
+   */
+  { g_autofree char *cache_max_size = NULL;
+
+    if (!ot_keyfile_get_value_with_default (ostree_repo_get_config (repo), "core",
+                                            "uncompressed-cache-max-size", "0",
+                                            &cache_max_size, error))
+      goto out;
+
+    if (g_ascii_strtoull (cache_max_size, NULL, 10) > 0 &&
+        !ostree_repo_checkout_gc (repo, cancellable, error))
+      goto out;
+  }
+
   ret = TRUE;
  out:
   if (context)
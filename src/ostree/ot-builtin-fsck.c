@@ -31,152 +31,16 @@
 static gboolean opt_quiet;
 static gboolean opt_delete;
 static gboolean opt_add_tombstones;
+static gint opt_incremental;
 
 static GOptionEntry options[] = {
   { "add-tombstones", 0, 0, G_OPTION_ARG_NONE, &opt_add_tombstones, "Add tombstones for missing commits", NULL },
   { "quiet", 'q', 0, G_OPTION_ARG_NONE, &opt_quiet, "Only print error messages", NULL },
   { "delete", 0, 0, G_OPTION_ARG_NONE, &opt_delete, "Remove corrupted objects", NULL },
+  { "incremental", 0, 0, G_OPTION_ARG_INT, &opt_incremental, "Skip objects verified within the last SECONDS", "SECONDS" },
   { NULL }
 };
 
-static gboolean
-load_and_fsck_one_object (OstreeRepo            *repo,
-                          const char            *checksum,
-                          OstreeObjectType       objtype,
-                          gboolean              *out_found_corruption,
-                          GCancellable          *cancellable,
-                          GError               **error)
-{
-  gboolean ret = FALSE;
-  gboolean missing = FALSE;
-  g_autoptr(GVariant) metadata = NULL;
-  g_autoptr(GInputStream) input = NULL;
-  g_autoptr(GFileInfo) file_info = NULL;
-  g_autoptr(GVariant) xattrs = NULL;
-  GError *temp_error = NULL;
-
-  if (OSTREE_OBJECT_TYPE_IS_META (objtype))
-    {
-      if (!ostree_repo_load_variant (repo, objtype,
-                                     checksum, &metadata, &temp_error))
-        {
-          if (g_error_matches (temp_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-            {
-              g_clear_error (&temp_error);
-              g_printerr ("Object missing: %s.%s\n", checksum,
-                          ostree_object_type_to_string (objtype));
-              missing = TRUE;
-            }
-          else
-            {
-              g_prefix_error (error, "Loading metadata object %s: ", checksum);
-              goto out;
-            }
-        }
-      else
-        {
-          if (objtype == OSTREE_OBJECT_TYPE_COMMIT)
-            {
-              if (!ostree_validate_structureof_commit (metadata, error))
-                {
-                  g_prefix_error (error, "While validating commit metadata '%s': ", checksum);
-                  goto out;
-                }
-            }
-          else if (objtype == OSTREE_OBJECT_TYPE_DIR_TREE)
-            {
-              if (!ostree_validate_structureof_dirtree (metadata, error))
-                {
-                  g_prefix_error (error, "While validating directory tree '%s': ", checksum);
-                  goto out;
-                }
-            }
-          else if (objtype == OSTREE_OBJECT_TYPE_DIR_META)
-            {
-              if (!ostree_validate_structureof_dirmeta (metadata, error))
-                {
-                  g_prefix_error (error, "While validating directory metadata '%s': ", checksum);
-                  goto out;
-                }
-            }
-      
-          input = g_memory_input_stream_new_from_data (g_variant_get_data (metadata),
-                                                       g_variant_get_size (metadata),
-                                                       NULL);
-
-        }
-    }
-  else
-    {
-      guint32 mode;
-      g_assert (objtype == OSTREE_OBJECT_TYPE_FILE);
-      if (!ostree_repo_load_file (repo, checksum, &input, &file_info,
-                                  &xattrs, cancellable, &temp_error))
-        {
-          if (g_error_matches (temp_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-            {
-              g_clear_error (&temp_error);
-              g_printerr ("Object missing: %s.%s\n", checksum,
-                          ostree_object_type_to_string (objtype));
-              missing = TRUE;
-            }
-          else
-            {
-              *error = temp_error;
-              g_prefix_error (error, "Loading file object %s: ", checksum);
-              goto out;
-            }
-        }
-      else
-        {
-          mode = g_file_info_get_attribute_uint32 (file_info, "unix::mode");
-          if (!ostree_validate_structureof_file_mode (mode, error))
-            {
-              g_prefix_error (error, "While validating file '%s': ", checksum);
-              goto out;
-            }
-        }
-    }
-
-  if (missing)
-    {
-      *out_found_corruption = TRUE;
-    }
-  else
-    {
-      g_autofree guchar *computed_csum = NULL;
-      g_autofree char *tmp_checksum = NULL;
-
-      if (!ostree_checksum_file_from_input (file_info, xattrs, input,
-                                            objtype, &computed_csum,
-                                            cancellable, error))
-        goto out;
-      
-      tmp_checksum = ostree_checksum_from_bytes (computed_csum);
-      if (strcmp (checksum, tmp_checksum) != 0)
-        {
-          g_autofree char *msg = g_strdup_printf ("corrupted object %s.%s; actual checksum: %s",
-                                               checksum, ostree_object_type_to_string (objtype),
-                                               tmp_checksum);
-          if (opt_delete)
-            {
-              g_printerr ("%s\n", msg);
-              (void) ostree_repo_delete_object (repo, objtype, checksum, cancellable, NULL);
-              *out_found_corruption = TRUE;
-            }
-          else
-            {
-              g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, msg);
-              goto out;
-            }
-        }
-    }
-
-  ret = TRUE;
- out:
-  return ret;
-}
-
 static gboolean
 fsck_reachable_objects_from_commits (OstreeRepo            *repo,
                                      GHashTable            *commits,
@@ -187,12 +51,14 @@ fsck_reachable_objects_from_commits (OstreeRepo            *repo,
   gboolean ret = FALSE;
   GHashTableIter hash_iter;
   gpointer key, value;
-  g_autoptr(GHashTable) reachable_objects = NULL;
+  g_autoptr(GPtrArray) checksums = NULL;
+  g_autoptr(GPtrArray) corrupted = NULL;
+  OstreeRepoFsckFlags flags = OSTREE_REPO_FSCK_FLAGS_NONE;
+  guint n_verified = 0;
+  guint n_skipped = 0;
   guint i;
-  guint mod;
-  guint count;
 
-  reachable_objects = ostree_repo_traverse_new_reachable ();
+  checksums = g_ptr_array_new ();
 
   g_hash_table_iter_init (&hash_iter, commits);
   while (g_hash_table_iter_next (&hash_iter, &key, &value))
@@ -205,31 +71,29 @@ fsck_reachable_objects_from_commits (OstreeRepo            *repo,
 
       g_assert (objtype == OSTREE_OBJECT_TYPE_COMMIT);
 
-      if (!ostree_repo_traverse_commit_union (repo, checksum, 0, reachable_objects,
-                                              cancellable, error))
-        goto out;
+      g_ptr_array_add (checksums, (char*)checksum);
     }
+  g_ptr_array_add (checksums, NULL);
 
-  count = g_hash_table_size (reachable_objects);
-  mod = count / 10;
-  i = 0;
-  g_hash_table_iter_init (&hash_iter, reachable_objects);
-  while (g_hash_table_iter_next (&hash_iter, &key, &value))
-    {
-      GVariant *serialized_key = key;
-      const char *checksum;
-      OstreeObjectType objtype;
+  if (opt_delete)
+    flags |= OSTREE_REPO_FSCK_FLAGS_DELETE;
 
-      ostree_object_name_deserialize (serialized_key, &checksum, &objtype);
+  /* Traverses all commits into one compact object set in the library */
+  if (!ostree_cmd__private__ ()->ostree_repo_fsck_commits (repo, (const char * const *)checksums->pdata,
+                                                            flags,
+                                                            opt_incremental > 0 ? opt_incremental : 0,
+                                                            &corrupted, &n_verified, &n_skipped,
+                                                            cancellable, error))
+    goto out;
 
-      if (!load_and_fsck_one_object (repo, checksum, objtype, out_found_corruption,
-                                     cancellable, error))
-        goto out;
+  for (i = 0; i < corrupted->len; i++)
+    g_printerr ("%s\n", (char*)corrupted->pdata[i]);
+  if (corrupted->len > 0)
+    *out_found_corruption = TRUE;
 
-      if (mod == 0 || (i % mod == 0))
-        g_print ("%u/%u objects\n", i + 1, count);
-      i++;
-    }
+  if (!opt_quiet)
+    g_print ("Verified %u objects, skipped %u recently verified\n",
+             n_verified, n_skipped);
 
   ret = TRUE;
  out:
@@ -257,8 +121,9 @@ ostree_builtin_fsck (int argc, char **argv, GCancellable *cancellable, GError **
   if (!opt_quiet)
     g_print ("Enumerating objects...\n");
 
-  if (!ostree_repo_list_objects (repo, OSTREE_REPO_LIST_OBJECTS_ALL,
-                                 &objects, cancellable, error))
+  /* Only commits are needed here, so don't build a table of every object */
+  if (!ostree_repo_list_commit_objects_starting_with (repo, "", &objects,
+                                                      cancellable, error))
     goto out;
 
   commits = g_hash_table_new_full (ostree_hash_object_name, g_variant_equal,
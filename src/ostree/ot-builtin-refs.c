@@ -28,10 +28,12 @@
 
 static gboolean opt_delete;
 static gboolean opt_list;
+static gboolean opt_pack;
 
 static GOptionEntry options[] = {
   { "delete", 0, 0, G_OPTION_ARG_NONE, &opt_delete, "Delete refs which match PREFIX, rather than listing them", NULL },
   { "list", 0, 0, G_OPTION_ARG_NONE, &opt_list, "Do not remove the prefix from the refs", NULL },
+  { "pack", 0, 0, G_OPTION_ARG_NONE, &opt_pack, "Move all refs into the packed refs file", NULL },
   { NULL }
 };
 
@@ -62,20 +64,20 @@ static gboolean do_ref (OstreeRepo *repo, const char *refspec_prefix, GCancellab
     }
   else
     {
+      /* One transaction, so that the refs are removed in a single batch */
+      if (!ostree_repo_prepare_transaction (repo, NULL, cancellable, error))
+        goto out;
+
       g_hash_table_iter_init (&hashiter, refs);
       while (g_hash_table_iter_next (&hashiter, &hashkey, &hashvalue))
         {
           const char *refspec = hashkey;
-          g_autofree char *remote = NULL;
-          g_autofree char *ref = NULL;
-
-          if (!ostree_parse_refspec (refspec, &remote, &ref, error))
-            goto out;
-          
-          if (!ostree_repo_set_ref_immediate (repo, remote, ref, NULL,
-                                              cancellable, error))
-            goto out;
+
+          ostree_repo_transaction_set_refspec (repo, refspec, NULL);
         }
+
+      if (!ostree_repo_commit_transaction (repo, NULL, cancellable, error))
+        goto out;
     }
   ret = TRUE;
  out:
@@ -95,6 +97,18 @@ ostree_builtin_refs (int argc, char **argv, GCancellable *cancellable, GError **
   if (!ostree_option_context_parse (context, options, &argc, &argv, OSTREE_BUILTIN_FLAG_NONE, &repo, cancellable, error))
     goto out;
 
+  if (opt_pack)
+    {
+      if (opt_delete || opt_list || argc >= 2)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "--pack takes no other options or arguments");
+          goto out;
+        }
+      ret = ostree_repo_pack_refs (repo, cancellable, error);
+      goto out;
+    }
+
   if (argc >= 2)
     {
       for (i = 1; i < argc; i++)
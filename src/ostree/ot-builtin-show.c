@@ -26,6 +26,7 @@
 #include "ot-builtins.h"
 #include "ot-dump.h"
 #include "ostree.h"
+#include "ostree-cmdprivate.h"
 #include "otutil.h"
 
 static gboolean opt_print_related;
@@ -166,13 +167,14 @@ print_object (OstreeRepo          *repo,
 
   if (objtype == OSTREE_OBJECT_TYPE_COMMIT)
     {
-      glnx_unref_object OstreeGpgVerifyResult *result = NULL;
+      g_autoptr(GVariant) signatures = NULL;
+      guint n_valid;
       GError *local_error = NULL;
       g_autoptr(GFile) gpg_homedir = opt_gpg_homedir ? g_file_new_for_path (opt_gpg_homedir) : NULL;
 
-      result = ostree_repo_verify_commit_ext (repo, checksum,
-                                              gpg_homedir, NULL, NULL,
-                                              &local_error);
+      (void) ostree_cmd__private__ ()->ostree_repo_verify_commit_cached (repo, checksum, gpg_homedir,
+                                                                         &signatures, &n_valid,
+                                                                         NULL, &local_error);
 
       if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
         {
@@ -188,16 +190,19 @@ print_object (OstreeRepo          *repo,
           GString *buffer;
           guint n_sigs, ii;
 
-          n_sigs = ostree_gpg_verify_result_count_all (result);
+          n_sigs = g_variant_n_children (signatures);
           g_print ("Found %u signature%s:\n", n_sigs, n_sigs == 1 ? "" : "s");
 
           buffer = g_string_sized_new (256);
 
           for (ii = 0; ii < n_sigs; ii++)
             {
+              g_autoptr(GVariant) child = g_variant_get_child_value (signatures, ii);
+              g_autoptr(GVariant) sig = g_variant_get_variant (child);
+
               g_string_append_c (buffer, '\n');
-              ostree_gpg_verify_result_describe (result, ii, buffer, "  ",
-                                                 OSTREE_GPG_SIGNATURE_FORMAT_DEFAULT);
+              ostree_gpg_verify_result_describe_variant (sig, buffer, "  ",
+                                                         OSTREE_GPG_SIGNATURE_FORMAT_DEFAULT);
             }
 
           g_print ("%s", buffer->str);
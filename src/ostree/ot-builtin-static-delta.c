@@ -29,8 +29,10 @@
 
 static char *opt_from_rev;
 static char *opt_to_rev;
+static char **opt_bases;
 static char *opt_min_fallback_size;
 static char *opt_max_bsdiff_size;
+static char *opt_bsdiff_window_size;
 static char *opt_max_chunk_size;
 static char *opt_endianness;
 static gboolean opt_empty;
@@ -63,11 +65,13 @@ static GOptionEntry generate_options[] = {
   { "empty", 0, 0, G_OPTION_ARG_NONE, &opt_empty, "Create delta from scratch", NULL },
   { "inline", 0, 0, G_OPTION_ARG_NONE, &opt_inline, "Inline delta parts into main delta", NULL },
   { "to", 0, 0, G_OPTION_ARG_STRING, &opt_to_rev, "Create delta to revision REV", "REV" },
+  { "base", 0, 0, G_OPTION_ARG_STRING_ARRAY, &opt_bases, "Create delta usable from any of the base revisions REV (may be specified multiple times)", "REV" },
   { "disable-bsdiff", 0, 0, G_OPTION_ARG_NONE, &opt_disable_bsdiff, "Disable use of bsdiff", NULL },
   { "set-endianness", 0, 0, G_OPTION_ARG_STRING, &opt_endianness, "Choose metadata endianness ('l' or 'B')", "ENDIAN" },
   { "swap-endianness", 0, 0, G_OPTION_ARG_NONE, &opt_swap_endianness, "Swap metadata endianness from host order", NULL },
   { "min-fallback-size", 0, 0, G_OPTION_ARG_STRING, &opt_min_fallback_size, "Minimum uncompressed size in megabytes for individual HTTP request", NULL},
   { "max-bsdiff-size", 0, 0, G_OPTION_ARG_STRING, &opt_max_bsdiff_size, "Maximum size in megabytes to consider bsdiff compression for input files", NULL},
+  { "bsdiff-window-size", 0, 0, G_OPTION_ARG_STRING, &opt_bsdiff_window_size, "Diff files larger than max-bsdiff-size in segments of this many megabytes", NULL},
   { "max-chunk-size", 0, 0, G_OPTION_ARG_STRING, &opt_max_chunk_size, "Maximum size of delta chunks in megabytes", NULL},
   { NULL }
 };
@@ -233,11 +237,35 @@ ot_static_delta_builtin_generate (int argc, char **argv, GCancellable *cancellab
       g_autofree char *to_resolved = NULL;
       g_autofree char *from_parent_str = NULL;
       g_autoptr(GVariantBuilder) parambuilder = NULL;
+      g_autoptr(GPtrArray) bases_resolved = NULL;
       int endianness;
 
       g_assert (opt_to_rev);
 
-      if (opt_empty)
+      if (opt_bases)
+        {
+          char **iter;
+
+          if (opt_empty || opt_from_rev)
+            {
+              g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                                   "Cannot specify --base with --empty or --from=REV");
+              goto out;
+            }
+          from_source = NULL;
+
+          bases_resolved = g_ptr_array_new_with_free_func (g_free);
+          for (iter = opt_bases; *iter; iter++)
+            {
+              char *base_resolved = NULL;
+
+              if (!ostree_repo_resolve_rev (repo, *iter, FALSE, &base_resolved, error))
+                goto out;
+              g_ptr_array_add (bases_resolved, base_resolved);
+            }
+          g_ptr_array_add (bases_resolved, NULL);
+        }
+      else if (opt_empty)
         {
           if (opt_from_rev)
             {
@@ -303,6 +331,9 @@ ot_static_delta_builtin_generate (int argc, char **argv, GCancellable *cancellab
       if (opt_max_bsdiff_size)
         g_variant_builder_add (parambuilder, "{sv}",
                                "max-bsdiff-size", g_variant_new_uint32 (g_ascii_strtoull (opt_max_bsdiff_size, NULL, 10)));
+      if (opt_bsdiff_window_size)
+        g_variant_builder_add (parambuilder, "{sv}",
+                               "bsdiff-window-size", g_variant_new_uint32 (g_ascii_strtoull (opt_bsdiff_window_size, NULL, 10)));
       if (opt_max_chunk_size)
         g_variant_builder_add (parambuilder, "{sv}",
                                "max-chunk-size", g_variant_new_uint32 (g_ascii_strtoull (opt_max_chunk_size, NULL, 10)));
@@ -312,13 +343,23 @@ ot_static_delta_builtin_generate (int argc, char **argv, GCancellable *cancellab
       if (opt_inline)
         g_variant_builder_add (parambuilder, "{sv}",
                                "inline-parts", g_variant_new_boolean (TRUE));
+      if (bases_resolved)
+        g_variant_builder_add (parambuilder, "{sv}",
+                               "from-bases", g_variant_new_strv ((const char *const *)bases_resolved->pdata, -1));
 
       g_variant_builder_add (parambuilder, "{sv}", "verbose", g_variant_new_boolean (TRUE));
       if (opt_endianness || opt_swap_endianness)
         g_variant_builder_add (parambuilder, "{sv}", "endianness", g_variant_new_uint32 (endianness));
 
       g_print ("Generating static delta:\n");
-      g_print ("  From: %s\n", from_resolved ? from_resolved : "empty");
+      if (bases_resolved)
+        {
+          guint i;
+          for (i = 0; i < bases_resolved->len - 1; i++)
+            g_print ("  Base: %s\n", (char*)bases_resolved->pdata[i]);
+        }
+      else
+        g_print ("  From: %s\n", from_resolved ? from_resolved : "empty");
       g_print ("  To:   %s\n", to_resolved);
       if (!ostree_repo_static_delta_generate (repo, OSTREE_STATIC_DELTA_GENERATE_OPT_MAJOR,
                                               from_resolved, to_resolved, NULL,
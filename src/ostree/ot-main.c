@@ -23,13 +23,20 @@
 #include "config.h"
 
 #include <gio/gio.h>
+#include <gio/gunixinputstream.h>
+#include <gio/gunixoutputstream.h>
+#include <gio/gunixsocketaddress.h>
 
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "ot-main.h"
 #include "ostree.h"
 #include "ot-admin-functions.h"
+#include "ostree-cmdprivate.h"
 #include "otutil.h"
 
 static char *opt_repo;
@@ -38,6 +45,13 @@ static gboolean opt_verbose;
 static gboolean opt_version;
 static gboolean opt_print_current_dir;
 
+static char *opt_batch_socket;
+
+/* Set while running `ostree batch`; see reset_option_entries() */
+static gboolean in_batch;
+static OstreeRepo *batch_repo;
+static GHashTable *option_defaults; /* arg_data -> initial value */
+
 static GOptionEntry global_entries[] = {
   { "verbose", 'v', 0, G_OPTION_ARG_NONE, &opt_verbose, "Print debug information during command processing", NULL },
   { "version", 0, 0, G_OPTION_ARG_NONE, &opt_version, "Print version information and exit", NULL },
@@ -56,6 +70,64 @@ static GOptionEntry global_admin_entries[] = {
   { NULL }
 };
 
+static GOptionEntry batch_entries[] = {
+  { "socket", 0, 0, G_OPTION_ARG_FILENAME, &opt_batch_socket, "Accept commands on the Unix socket PATH instead of standard input", "PATH" },
+  { NULL }
+};
+
+static gsize
+option_arg_size (GOptionArg arg)
+{
+  switch (arg)
+    {
+    case G_OPTION_ARG_NONE:
+      return sizeof (gboolean);
+    case G_OPTION_ARG_INT:
+      return sizeof (gint);
+    case G_OPTION_ARG_INT64:
+      return sizeof (gint64);
+    case G_OPTION_ARG_DOUBLE:
+      return sizeof (gdouble);
+    case G_OPTION_ARG_CALLBACK:
+      return 0;
+    default:
+      /* Strings, filenames and arrays of them */
+      return sizeof (gpointer);
+    }
+}
+
+/* Builtins keep their options in static variables, which in batch mode
+ * would leak from one command into the next.  The first time we see an
+ * option we remember its initial value, and restore it before every
+ * later parse.  Previous string values are deliberately leaked, since
+ * some builtins assign string literals as defaults.
+ */
+static void
+reset_option_entries (const GOptionEntry *entries)
+{
+  if (!in_batch || entries == NULL)
+    return;
+
+  if (option_defaults == NULL)
+    option_defaults = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+
+  for (; entries->long_name != NULL; entries++)
+    {
+      gsize size = option_arg_size (entries->arg);
+      gpointer initial;
+
+      if (entries->arg_data == NULL || size == 0)
+        continue;
+
+      initial = g_hash_table_lookup (option_defaults, entries->arg_data);
+      if (initial != NULL)
+        memcpy (entries->arg_data, initial, size);
+      else
+        g_hash_table_insert (option_defaults, entries->arg_data,
+                             g_memdup (entries->arg_data, size));
+    }
+}
+
 static GOptionContext *
 ostree_option_context_new_with_commands (OstreeCommand *commands)
 {
@@ -234,6 +306,14 @@ ostree_option_context_parse (GOptionContext *context,
   glnx_unref_object OstreeRepo *repo = NULL;
   gboolean success = FALSE;
 
+  reset_option_entries (repo_entry);
+  reset_option_entries (main_entries);
+  reset_option_entries (global_entries);
+
+  /* --help would exit the whole batch */
+  if (in_batch)
+    g_option_context_set_help_enabled (context, FALSE);
+
   /* Entries are listed in --help output in the order added.  We add the
    * main entries ourselves so that we can add the --repo entry first. */
 
@@ -248,7 +328,14 @@ ostree_option_context_parse (GOptionContext *context,
   if (!g_option_context_parse (context, argc, argv, error))
     return FALSE;
 
-  if (opt_version)
+  if (opt_version && in_batch)
+    {
+      /* Like --help, this would exit the whole batch */
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "--version is not supported in batch mode");
+      return FALSE;
+    }
+  else if (opt_version)
     {
       g_print ("%s\n  %s\n", PACKAGE_STRING, OSTREE_FEATURES);
       exit (EXIT_SUCCESS);
@@ -257,7 +344,11 @@ ostree_option_context_parse (GOptionContext *context,
   if (opt_verbose)
     g_log_set_handler (G_LOG_DOMAIN, G_LOG_LEVEL_DEBUG, message_handler, NULL);
 
-  if (opt_repo == NULL && !(flags & OSTREE_BUILTIN_FLAG_NO_REPO))
+  if (opt_repo == NULL && batch_repo != NULL && !(flags & OSTREE_BUILTIN_FLAG_NO_REPO))
+    {
+      repo = g_object_ref (batch_repo);
+    }
+  else if (opt_repo == NULL && !(flags & OSTREE_BUILTIN_FLAG_NO_REPO))
     {
       GError *local_error = NULL;
 
@@ -317,6 +408,8 @@ ostree_admin_option_context_parse (GOptionContext *context,
   glnx_unref_object OstreeSysroot *sysroot = NULL;
   gboolean success = FALSE;
 
+  reset_option_entries (global_admin_entries);
+
   /* Entries are listed in --help output in the order added.  We add the
    * main entries ourselves so that we can add the --sysroot entry first. */
 
@@ -385,6 +478,250 @@ out:
   return success;
 }
 
+static gboolean
+write_record (GOutputStream  *out,
+              const char     *status,
+              gsize           len,
+              GCancellable   *cancellable,
+              GError        **error)
+{
+  g_autofree char *header = g_strdup_printf ("%s %" G_GSIZE_FORMAT "\n", status, len);
+
+  return g_output_stream_write_all (out, header, strlen (header), NULL,
+                                    cancellable, error);
+}
+
+/* Run one command line with standard output redirected to @capture_fd */
+static gboolean
+batch_run_one (OstreeCommand  *commands,
+               const char     *line,
+               int             capture_fd,
+               int             stdout_fd,
+               GError        **error)
+{
+  gboolean ret = FALSE;
+  g_auto(GStrv) args = NULL;
+  g_autofree char **run_argv = NULL;
+  g_autofree char *prgname = g_strdup (g_get_prgname ());
+  gboolean disable_fsync = FALSE;
+  int cache_dir_fd = -1;
+  int n_args;
+
+  if (!g_shell_parse_argv (line, &n_args, &args, error))
+    goto out;
+
+  if (g_str_equal (args[0], "batch"))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "Nested batch is not supported");
+      goto out;
+    }
+
+  /* ostree_run() and the builtins rearrange argv, so give them a copy
+   * of the array.
+   */
+  run_argv = g_new0 (char *, n_args + 2);
+  run_argv[0] = "ostree";
+  memcpy (run_argv + 1, args, n_args * sizeof (char *));
+
+  if (ftruncate (capture_fd, 0) != 0 || lseek (capture_fd, 0, SEEK_SET) != 0)
+    {
+      glnx_set_error_from_errno (error);
+      goto out;
+    }
+
+  fflush (stdout);
+  if (dup2 (capture_fd, STDOUT_FILENO) < 0)
+    {
+      glnx_set_error_from_errno (error);
+      goto out;
+    }
+
+  /* Builtins may reconfigure the shared repo, e.g. --fsync=false or
+   * --cache-dir; undo that afterwards so it can't affect later commands.
+   */
+  if (batch_repo)
+    {
+      disable_fsync = ostree_repo_get_disable_fsync (batch_repo);
+      cache_dir_fd = ostree_cmd__private__ ()->ostree_repo_dup_cache_dir_fd (batch_repo);
+    }
+
+  (void) ostree_run (n_args + 1, run_argv, commands, error);
+
+  if (batch_repo)
+    {
+      ostree_repo_set_disable_fsync (batch_repo, disable_fsync);
+      ostree_cmd__private__ ()->ostree_repo_replace_cache_dir_fd (batch_repo, cache_dir_fd);
+    }
+
+  fflush (stdout);
+  if (dup2 (stdout_fd, STDOUT_FILENO) < 0)
+    g_error ("Restoring stdout: %s", g_strerror (errno));
+
+  g_set_prgname (prgname);
+
+  ret = (error == NULL || *error == NULL);
+ out:
+  return ret;
+}
+
+/* Read command lines from @in_fd until EOF, writing one record per
+ * command to @out_fd: "ok LENGTH\n" followed by the command's standard
+ * output, or "error LENGTH\n" followed by the error message.
+ */
+static gboolean
+batch_serve (OstreeCommand  *commands,
+             int             in_fd,
+             int             out_fd,
+             int             capture_fd,
+             int             stdout_fd,
+             GCancellable   *cancellable,
+             GError        **error)
+{
+  g_autoptr(GInputStream) in = g_unix_input_stream_new (in_fd, FALSE);
+  g_autoptr(GDataInputStream) datain = g_data_input_stream_new (in);
+  g_autoptr(GOutputStream) out = g_unix_output_stream_new (out_fd, FALSE);
+
+  while (TRUE)
+    {
+      g_autofree char *line = NULL;
+      GError *local_error = NULL;
+      gsize len;
+
+      line = g_data_input_stream_read_line (datain, &len, cancellable, error);
+      if (line == NULL)
+        return error == NULL || *error == NULL;
+
+      g_strstrip (line);
+      if (*line == '\0' || *line == '#')
+        continue;
+
+      if (batch_run_one (commands, line, capture_fd, stdout_fd, &local_error))
+        {
+          struct stat stbuf;
+
+          if (fstat (capture_fd, &stbuf) != 0)
+            {
+              glnx_set_error_from_errno (error);
+              return FALSE;
+            }
+
+          if (!write_record (out, "ok", stbuf.st_size, cancellable, error))
+            return FALSE;
+          if (!ot_copy_fd_range (capture_fd, 0, out_fd, stbuf.st_size,
+                                 cancellable, error))
+            return FALSE;
+        }
+      else
+        {
+          gsize msglen = strlen (local_error->message);
+          gboolean ok;
+
+          ok = write_record (out, "error", msglen, cancellable, error) &&
+            g_output_stream_write_all (out, local_error->message, msglen, NULL,
+                                       cancellable, error);
+          g_error_free (local_error);
+          if (!ok)
+            return FALSE;
+        }
+    }
+}
+
+/*
+ * ostree_run_batch:
+ *
+ * Implements `ostree batch`: run many commands against one opened
+ * repository, avoiding the process startup and ostree_repo_open() cost
+ * of each, and keeping the repository's in-memory caches warm.
+ */
+gboolean
+ostree_run_batch (int             argc,
+                  char          **argv,
+                  OstreeCommand  *commands,
+                  GCancellable   *cancellable,
+                  GError        **error)
+{
+  gboolean ret = FALSE;
+  GOptionContext *context;
+  glnx_unref_object OstreeRepo *repo = NULL;
+  g_autofree char *capture_path = NULL;
+  glnx_fd_close int capture_fd = -1;
+  glnx_fd_close int stdout_fd = -1;
+
+  context = g_option_context_new ("- Run commands read from standard input");
+
+  in_batch = TRUE;
+  if (!ostree_option_context_parse (context, batch_entries, &argc, &argv,
+                                    OSTREE_BUILTIN_FLAG_NONE, &repo, cancellable, error))
+    goto out;
+
+  batch_repo = repo;
+
+  capture_fd = g_file_open_tmp ("ostree-batch-XXXXXX", &capture_path, error);
+  if (capture_fd < 0)
+    goto out;
+  (void) unlink (capture_path);
+
+  stdout_fd = dup (STDOUT_FILENO);
+  if (stdout_fd < 0)
+    {
+      glnx_set_error_from_errno (error);
+      goto out;
+    }
+
+  if (opt_batch_socket == NULL)
+    {
+      if (!batch_serve (commands, STDIN_FILENO, stdout_fd, capture_fd, stdout_fd,
+                        cancellable, error))
+        goto out;
+    }
+  else
+    {
+      g_autoptr(GSocketListener) listener = g_socket_listener_new ();
+      g_autoptr(GSocketAddress) address = g_unix_socket_address_new (opt_batch_socket);
+      struct stat stbuf;
+
+      /* Replace a socket left behind by a previous instance */
+      if (lstat (opt_batch_socket, &stbuf) == 0 && S_ISSOCK (stbuf.st_mode))
+        (void) unlink (opt_batch_socket);
+
+      if (!g_socket_listener_add_address (listener, address, G_SOCKET_TYPE_STREAM,
+                                          G_SOCKET_PROTOCOL_DEFAULT, NULL, NULL, error))
+        goto out;
+
+      /* A client going away must not kill us */
+      signal (SIGPIPE, SIG_IGN);
+
+      /* Clients are served one at a time, until we're killed */
+      while (TRUE)
+        {
+          g_autoptr(GSocketConnection) conn = NULL;
+          GError *local_error = NULL;
+          int fd;
+
+          conn = g_socket_listener_accept (listener, NULL, cancellable, error);
+          if (conn == NULL)
+            goto out;
+
+          fd = g_socket_get_fd (g_socket_connection_get_socket (conn));
+          if (!batch_serve (commands, fd, fd, capture_fd, stdout_fd,
+                            cancellable, &local_error))
+            {
+              g_printerr ("%s: %s\n", g_get_prgname (), local_error->message);
+              g_error_free (local_error);
+            }
+        }
+    }
+
+  ret = TRUE;
+ out:
+  batch_repo = NULL;
+  in_batch = FALSE;
+  if (context)
+    g_option_context_free (context);
+  return ret;
+}
+
 gboolean
 ostree_ensure_repo_writable (OstreeRepo *repo,
                              GError **error)
@@ -19,7 +19,7 @@
 
 set -euo pipefail
 
-echo "1..57"
+echo "1..65"
 
 $OSTREE checkout test2 checkout-test2
 echo "ok checkout"
@@ -169,6 +169,32 @@ echo "ok local clone checkout"
 $OSTREE checkout -U test2 checkout-user-test2
 echo "ok user checkout"
 
+cd ${test_tmpdir}
+$OSTREE checkout -U test2 checkout-user-test2-serial
+$OSTREE checkout -U --jobs=4 test2 checkout-user-test2-parallel
+assert_checkouts_equal checkout-user-test2-serial checkout-user-test2-parallel
+rm checkout-user-test2-serial checkout-user-test2-parallel -rf
+echo "ok parallel checkout"
+
+cd ${test_tmpdir}
+$OSTREE checkout -U test2 checkout-user-test2-linked
+$OSTREE checkout -U --force-copy test2 checkout-user-test2-copy
+diff -r checkout-user-test2-linked checkout-user-test2-copy
+find checkout-user-test2-copy -type f -links +1 > links.txt
+assert_file_empty links.txt
+echo mutated > checkout-user-test2-copy/baz/cow
+$OSTREE fsck
+rm checkout-user-test2-linked checkout-user-test2-copy links.txt -rf
+echo "ok checkout --force-copy"
+
+cd ${test_tmpdir}
+$OSTREE checkout -U test2^ checkout-update
+$OSTREE checkout -U --update-from=test2^ test2 checkout-update
+$OSTREE checkout -U test2 checkout-update-fresh
+assert_checkouts_equal checkout-update checkout-update-fresh
+rm checkout-update checkout-update-fresh -rf
+echo "ok checkout --update-from"
+
 $OSTREE commit -b test2 -s "Another commit" --tree=ref=test2
 echo "ok commit from ref"
 
@@ -421,6 +447,18 @@ assert_file_has_content test2-checkout/baz/cow moo
 assert_has_dir repo2/uncompressed-objects-cache
 echo "ok disable cache checkout"
 
+cd ${test_tmpdir}
+${CMD_PREFIX} ostree --repo=repo2 config set core.uncompressed-cache-max-size 1
+rm test2-checkout -rf
+${CMD_PREFIX} ostree --repo=repo2 checkout -U test2 test2-checkout
+assert_file_has_content test2-checkout/baz/cow moo
+assert_has_file repo2/uncompressed-objects-cache/index
+find repo2/uncompressed-objects-cache -name '*.file' > cached.txt
+assert_file_empty cached.txt
+${CMD_PREFIX} ostree --repo=repo2 config set core.uncompressed-cache-max-size 0
+rm test2-checkout cached.txt -rf
+echo "ok bounded uncompressed cache"
+
 cd ${test_tmpdir}
 rm checkout-test2 -rf
 $OSTREE checkout test2 checkout-test2
@@ -520,3 +558,73 @@ cd ${test_tmpdir}
 $OSTREE init --mode=bare --repo=repo-extensions
 assert_has_dir repo-extensions/extensions
 echo "ok extensions dir"
+
+cd ${test_tmpdir}
+$OSTREE fsck
+assert_has_file repo/state/fsck-journal
+journal_size=$(stat -c %s repo/state/fsck-journal)
+$OSTREE fsck --incremental=3600 > fsck-incremental.txt
+assert_file_has_content fsck-incremental.txt "Verified 0 objects"
+# Each run compacts it, so verifying again doesn't grow it
+$OSTREE fsck
+assert_streq "$(stat -c %s repo/state/fsck-journal)" "${journal_size}"
+echo "ok fsck --incremental"
+
+cd ${test_tmpdir}
+rm -f repo/state/commit-index
+$OSTREE rev-parse ${partial}
+# The first lookup builds the index
+assert_has_file repo/state/commit-index
+prev=$($OSTREE rev-parse test2)
+mkdir -p commit-index-tree
+echo index > commit-index-tree/file
+$OSTREE commit -b test2 -s "Commit index" --tree=dir=commit-index-tree
+rev=$($OSTREE rev-parse test2)
+$OSTREE rev-parse ${rev:0:10} > partial-results
+assert_file_has_content partial-results "^${rev}$"
+$OSTREE rev-parse 'test2^' > parent-results
+assert_file_has_content parent-results "^${prev}$"
+# A partial record left by a failed append makes it rebuild
+printf partial >> repo/state/commit-index
+$OSTREE rev-parse ${rev:0:10} > partial-results
+assert_file_has_content partial-results "^${rev}$"
+# The index is authoritative; commits missing from it aren't scanned for
+printf ostcidx1 > repo/state/commit-index
+if $OSTREE rev-parse ${rev:0:10} 2>/dev/null; then
+    assert_not_reached "rev-parse found a commit missing from the index"
+fi
+rm repo/state/commit-index
+$OSTREE rev-parse ${rev:0:10} > partial-results
+assert_file_has_content partial-results "^${rev}$"
+echo "ok commit index"
+
+cd ${test_tmpdir}
+rev=$($OSTREE rev-parse test2)
+printf 'rev-parse test2\nrev-parse --verbose nosuchref\nls test2 /baz/cow\n' | $OSTREE batch > batch.out
+assert_file_has_content batch.out "^ok 65$"
+assert_file_has_content batch.out "^${rev}$"
+assert_file_has_content batch.out "^error "
+assert_file_has_content batch.out "/baz/cow$"
+# Options of one command don't leak into the next, and --version
+# fails the command instead of exiting the batch
+printf 'ls -C test2 /baz/cow\nls test2 /baz/cow\nrev-parse --version\nrev-parse test2\n' | $OSTREE batch > batch-opts.out
+grep -c '[0-9a-f]\{64\}' batch-opts.out > batch-opts.count
+assert_file_has_content batch-opts.count "^2$"
+assert_file_has_content batch-opts.out "^error "
+assert_file_has_content batch-opts.out "^${rev}$"
+echo "ok batch"
+
+cd ${test_tmpdir}
+mkdir -p tmp-orphans-tree
+# With O_TMPFILE and with the named fallback, nothing is left in tmp/
+# besides the cache and the staging directories and their locks
+for testerror in "" no-tmpfile; do
+    # Identical files, and committing twice, hit the existing object paths
+    echo "orphans ${testerror}" > tmp-orphans-tree/file
+    echo "orphans ${testerror}" > tmp-orphans-tree/dup
+    OSTREE_REPO_TEST_ERROR=${testerror} $OSTREE commit -b test-tmp-orphans -s "No orphans" --tree=dir=tmp-orphans-tree
+    OSTREE_REPO_TEST_ERROR=${testerror} $OSTREE commit -b test-tmp-orphans -s "No orphans again" --tree=dir=tmp-orphans-tree
+    find repo/tmp -path repo/tmp/cache -prune -o -type f ! -name '*-lock' -print > tmp-orphans.txt
+    assert_file_empty tmp-orphans.txt
+done
+echo "ok commit leaves no files in tmp"
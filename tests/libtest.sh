@@ -163,6 +163,17 @@ assert_files_hardlinked() {
     fi
 }
 
+# Compare two checkouts: same entries with the same types and modes,
+# and the same file contents.
+assert_checkouts_equal() {
+    if ! diff -u <(cd $1 && find . -printf '%y %m %p\n' | sort) \
+                 <(cd $2 && find . -printf '%y %m %p\n' | sort) >&2; then
+        echo 1>&2 "Checkouts '$1' and '$2' have different entries"
+        exit 1
+    fi
+    diff -r $1 $2
+}
+
 setup_test_repository () {
     mode=$1
     shift
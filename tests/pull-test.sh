@@ -35,7 +35,7 @@ function verify_initial_contents() {
     assert_file_has_content baz/cow '^moo$'
 }
 
-echo "1..11"
+echo "1..13"
 
 # Try both syntaxes
 repo_init
@@ -221,3 +221,29 @@ assert_file_has_content baz/cow "further modified file for static deltas"
 assert_not_has_file baz/saucer
 
 echo "ok static delta 2"
+
+cd ${test_tmpdir}
+${CMD_PREFIX} ostree --repo=ostree-srv/gnomerepo static-delta generate --base=main^ --base=main^^ main
+${CMD_PREFIX} ostree --repo=ostree-srv/gnomerepo summary -u
+
+repo_init
+${CMD_PREFIX} ostree --repo=repo pull origin main@${prev_rev}
+${CMD_PREFIX} ostree --repo=repo pull --require-static-deltas origin main
+rev=$(${CMD_PREFIX} ostree --repo=repo rev-parse origin:main)
+assert_streq "$(${CMD_PREFIX} ostree --repo=ostree-srv/gnomerepo rev-parse main)" "${rev}"
+${CMD_PREFIX} ostree --repo=repo fsck
+
+echo "ok pull multi-base static delta"
+
+cd ${test_tmpdir}
+${CMD_PREFIX} ostree --repo=ostree-srv/gnomerepo static-delta generate main
+${CMD_PREFIX} ostree --repo=ostree-srv/gnomerepo summary -u
+
+repo_init
+${CMD_PREFIX} ostree --repo=repo pull origin main@${prev_rev}
+${CMD_PREFIX} ostree --repo=repo pull --require-static-deltas --stream-static-deltas origin main
+rev=$(${CMD_PREFIX} ostree --repo=repo rev-parse origin:main)
+assert_streq "$(${CMD_PREFIX} ostree --repo=ostree-srv/gnomerepo rev-parse main)" "${rev}"
+${CMD_PREFIX} ostree --repo=repo fsck
+
+echo "ok pull streamed static delta"
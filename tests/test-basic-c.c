@@ -171,6 +171,128 @@ test_raw_file_to_archive_z2_stream (gconstpointer data)
   g_assert_cmpint (checks, >, 0);
 }
 
+static void
+test_metadata_cache_invalidation (gconstpointer data)
+{
+  OstreeRepo *repo = OSTREE_REPO (data);
+  g_autofree gchar *commit_checksum = NULL;
+  g_autofree gchar *dirtree_checksum = NULL;
+  g_autofree guchar *written_csum = NULL;
+  g_autoptr(GVariant) commit = NULL;
+  g_autoptr(GVariant) dirtree = NULL;
+  g_autoptr(GVariant) dirtree_again = NULL;
+  g_autoptr(GVariant) dirtree_csum_v = NULL;
+  g_autoptr(GError) error = NULL;
+
+  ostree_repo_resolve_rev (repo, "test2", FALSE, &commit_checksum, &error);
+  g_assert_no_error (error);
+  ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_COMMIT, commit_checksum, &commit, &error);
+  g_assert_no_error (error);
+  dirtree_csum_v = g_variant_get_child_value (commit, 6);
+  dirtree_checksum = ostree_checksum_from_bytes_v (dirtree_csum_v);
+
+  /* Loading it twice leaves it cached */
+  ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_DIR_TREE, dirtree_checksum, &dirtree, &error);
+  g_assert_no_error (error);
+  ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_DIR_TREE, dirtree_checksum, &dirtree_again, &error);
+  g_assert_no_error (error);
+  g_assert_true (g_variant_equal (dirtree, dirtree_again));
+  g_clear_pointer (&dirtree_again, g_variant_unref);
+
+  /* A deleted object must not be served from the cache */
+  ostree_repo_delete_object (repo, OSTREE_OBJECT_TYPE_DIR_TREE, dirtree_checksum, NULL, &error);
+  g_assert_no_error (error);
+  ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_DIR_TREE, dirtree_checksum, &dirtree_again, &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+  g_clear_error (&error);
+
+  /* Once written again, it is loaded from the new file */
+  ostree_repo_prepare_transaction (repo, NULL, NULL, &error);
+  g_assert_no_error (error);
+  ostree_repo_write_metadata (repo, OSTREE_OBJECT_TYPE_DIR_TREE, dirtree_checksum, dirtree,
+                              &written_csum, NULL, &error);
+  g_assert_no_error (error);
+  ostree_repo_commit_transaction (repo, NULL, NULL, &error);
+  g_assert_no_error (error);
+
+  ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_DIR_TREE, dirtree_checksum, &dirtree_again, &error);
+  g_assert_no_error (error);
+  g_assert_true (g_variant_equal (dirtree, dirtree_again));
+}
+
+static GVariant *
+new_dirtree_with_files (guint n_files)
+{
+  GVariantBuilder files_builder;
+  const guchar csum[OSTREE_SHA256_DIGEST_LEN] = { 0, };
+  guint i;
+
+  g_variant_builder_init (&files_builder, G_VARIANT_TYPE ("a(say)"));
+  for (i = 0; i < n_files; i++)
+    {
+      g_autofree char *name = g_strdup_printf ("file-%05u", i);
+      g_variant_builder_add (&files_builder, "(s@ay)", name,
+                             g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE, csum, sizeof (csum), 1));
+    }
+
+  return g_variant_ref_sink (g_variant_new ("(@a(say)@a(sayay))",
+                                            g_variant_builder_end (&files_builder),
+                                            g_variant_new_array (G_VARIANT_TYPE ("(sayay)"), NULL, 0)));
+}
+
+static gboolean
+dirtree_is_mapped (const char *checksum)
+{
+  g_autofree char *maps = NULL;
+  g_autofree char *suffix = g_strdup_printf ("/objects/%c%c/%s.dirtree",
+                                             checksum[0], checksum[1], checksum + 2);
+  g_autoptr(GError) error = NULL;
+
+  g_file_get_contents ("/proc/self/maps", &maps, NULL, &error);
+  g_assert_no_error (error);
+  return strstr (maps, suffix) != NULL;
+}
+
+static void
+test_metadata_mmap_threshold (gconstpointer data)
+{
+  OstreeRepo *repo = OSTREE_REPO (data);
+  /* Roughly 4 KiB and 40 KiB serialized, either side of the threshold */
+  const guint n_files[] = { 100, 1000 };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (n_files); i++)
+    {
+      g_autoptr(GVariant) dirtree = new_dirtree_with_files (n_files[i]);
+      g_autoptr(GVariant) loaded = NULL;
+      g_autofree guchar *csum = NULL;
+      g_autofree char *checksum = NULL;
+      const gboolean large = g_variant_get_size (dirtree) >= 16 * 1024;
+      g_autoptr(GError) error = NULL;
+
+      g_assert_cmpint (large, ==, i == 1);
+
+      ostree_repo_prepare_transaction (repo, NULL, NULL, &error);
+      g_assert_no_error (error);
+      ostree_repo_write_metadata (repo, OSTREE_OBJECT_TYPE_DIR_TREE, NULL, dirtree,
+                                  &csum, NULL, &error);
+      g_assert_no_error (error);
+      ostree_repo_commit_transaction (repo, NULL, NULL, &error);
+      g_assert_no_error (error);
+      checksum = ostree_checksum_from_bytes (csum);
+
+      ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_DIR_TREE, checksum, &loaded, &error);
+      g_assert_no_error (error);
+      g_assert_true (g_variant_equal (dirtree, loaded));
+
+      /* Only objects at or above the threshold are mapped */
+      g_assert_cmpint (dirtree_is_mapped (checksum), ==, large);
+
+      ostree_repo_delete_object (repo, OSTREE_OBJECT_TYPE_DIR_TREE, checksum, NULL, &error);
+      g_assert_no_error (error);
+    }
+}
+
 int main (int argc, char **argv)
 {
   g_autoptr(GError) error = NULL;
@@ -184,6 +306,8 @@ int main (int argc, char **argv)
   
   g_test_add_data_func ("/repo-not-system", repo, test_repo_is_not_system);
   g_test_add_data_func ("/raw-file-to-archive-z2-stream", repo, test_raw_file_to_archive_z2_stream);
+  g_test_add_data_func ("/metadata-cache-invalidation", repo, test_metadata_cache_invalidation);
+  g_test_add_data_func ("/metadata-mmap-threshold", repo, test_metadata_mmap_threshold);
 
   return g_test_run();
  out:
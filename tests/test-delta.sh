@@ -26,7 +26,7 @@ skip_without_user_xattrs
 bindatafiles="bash true ostree"
 morebindatafiles="false ls"
 
-echo '1..8'
+echo '1..12'
 
 mkdir repo
 ${CMD_PREFIX} ostree --repo=repo init --mode=archive-z2
@@ -187,6 +187,53 @@ ${CMD_PREFIX} ostree --repo=repo2 ls ${newrev} >/dev/null
 
 echo 'ok apply offline inline'
 
+${CMD_PREFIX} ostree --repo=repo static-delta generate --max-bsdiff-size=0 --bsdiff-window-size=1 --from=${origrev} --to=${newrev} 2>&1 | grep "windowed=[1-9]"
+${CMD_PREFIX} ostree --repo=repo static-delta show ${origrev}-${newrev} > show-windowed.txt
+assert_file_has_content show-windowed.txt 'bspatchwindow=[1-9]'
+
+rm repo2 -rf
+mkdir repo2 && ${CMD_PREFIX} ostree --repo=repo2 init --mode=bare-user
+${CMD_PREFIX} ostree --repo=repo2 pull-local repo ${origrev}
+${CMD_PREFIX} ostree --repo=repo2 static-delta apply-offline repo/deltas/${deltaprefix}/${deltadir}
+${CMD_PREFIX} ostree --repo=repo2 fsck
+${CMD_PREFIX} ostree --repo=repo2 ls ${newrev} >/dev/null
+
+echo 'ok apply offline windowed bsdiff'
+
+# bspatch must write straight into the staged object, whether it's an
+# anonymous or a named temporary file
+for genopts in --max-bsdiff-size=10000 "--max-bsdiff-size=0 --bsdiff-window-size=1"; do
+    ${CMD_PREFIX} ostree --repo=repo static-delta generate ${genopts} --from=${origrev} --to=${newrev}
+    for testerror in bspatch-copy bspatch-copy,no-tmpfile; do
+        rm repo2 -rf
+        mkdir repo2 && ${CMD_PREFIX} ostree --repo=repo2 init --mode=bare-user
+        ${CMD_PREFIX} ostree --repo=repo2 pull-local repo ${origrev}
+        OSTREE_REPO_TEST_ERROR=${testerror} ${CMD_PREFIX} ostree --repo=repo2 static-delta apply-offline repo/deltas/${deltaprefix}/${deltadir}
+        ${CMD_PREFIX} ostree --repo=repo2 fsck
+        ${CMD_PREFIX} ostree --repo=repo2 ls ${newrev} >/dev/null
+    done
+done
+
+echo 'ok apply offline bsdiff in place'
+
+find repo/deltas -mindepth 2 -maxdepth 2 | sort > deltas-before.txt
+${CMD_PREFIX} ostree --repo=repo static-delta generate --base=${origrev} --to=${newrev}
+multibasedelta=$(find repo/deltas -mindepth 2 -maxdepth 2 | sort | comm -13 deltas-before.txt -)
+${CMD_PREFIX} ostree --repo=repo static-delta list | grep ^${newrev}$ || exit 1
+${CMD_PREFIX} ostree --repo=repo static-delta show ${newrev} > show-multibase.txt
+assert_file_has_content show-multibase.txt 'Number of bases: 1'
+assert_file_has_content show-multibase.txt "Base: ${origrev}"
+
+rm repo2 -rf
+mkdir repo2 && ${CMD_PREFIX} ostree --repo=repo2 init --mode=bare-user
+${CMD_PREFIX} ostree --repo=repo2 pull-local repo ${origrev}
+${CMD_PREFIX} ostree --repo=repo2 static-delta apply-offline ${multibasedelta}
+${CMD_PREFIX} ostree --repo=repo2 fsck
+${CMD_PREFIX} ostree --repo=repo2 ls ${newrev} >/dev/null
+${CMD_PREFIX} ostree --repo=repo static-delta delete ${newrev}
+
+echo 'ok multi-base delta'
+
 ${CMD_PREFIX} ostree --repo=repo static-delta list | grep ^${origrev}-${newrev}$ || exit 1
 ${CMD_PREFIX} ostree --repo=repo static-delta list | grep ^${origrev}$ || exit 1
 
@@ -201,3 +248,29 @@ ${CMD_PREFIX} ostree --repo=repo static-delta list | grep ^${origrev}-${newrev}$
 ${CMD_PREFIX} ostree --repo=repo static-delta list | grep ^${origrev}$ && exit 1
 
 echo 'ok delete'
+
+${CMD_PREFIX} ostree --repo=repo config set core.auto-static-deltas 1
+${CMD_PREFIX} ostree --repo=repo summary -u
+${CMD_PREFIX} ostree --repo=repo static-delta list | grep ^${origrev}-${newrev}$ || exit 1
+${CMD_PREFIX} ostree --repo=repo static-delta list | grep ^${newrev}$ || exit 1
+${CMD_PREFIX} ostree --repo=repo static-delta delete ${origrev}-${newrev}
+${CMD_PREFIX} ostree --repo=repo static-delta generate --from=${origrev} --to=${newrev}
+
+permuteDirectory 1 files
+${CMD_PREFIX} ostree --repo=repo commit -b test -s test --tree=dir=files
+thirdrev=$(${CMD_PREFIX} ostree --repo=repo rev-parse test)
+${CMD_PREFIX} ostree --repo=repo static-delta list | grep ^${newrev}-${thirdrev}$ || exit 1
+${CMD_PREFIX} ostree --repo=repo static-delta list | grep ^${thirdrev}$ || exit 1
+# Automatic deltas which fell out of the history are removed, manual ones are kept
+${CMD_PREFIX} ostree --repo=repo static-delta list | grep ^${newrev}$ && exit 1
+${CMD_PREFIX} ostree --repo=repo static-delta list | grep ^${origrev}-${newrev}$ || exit 1
+# Ref updates outside of "ostree commit" maintain them as well
+${CMD_PREFIX} ostree --repo=repo reset test ${newrev}
+${CMD_PREFIX} ostree --repo=repo static-delta list | grep ^${newrev}$ || exit 1
+${CMD_PREFIX} ostree --repo=repo static-delta list | grep ^${thirdrev}$ && exit 1
+${CMD_PREFIX} ostree --repo=repo refs --delete test
+${CMD_PREFIX} ostree --repo=repo static-delta list | grep ^${newrev}$ && exit 1
+${CMD_PREFIX} ostree --repo=repo static-delta list | grep ^${origrev}-${newrev}$ || exit 1
+${CMD_PREFIX} ostree --repo=repo config set core.auto-static-deltas 0
+
+echo 'ok automatic deltas'
@@ -27,7 +27,7 @@ fi
 
 . $(dirname $0)/libtest.sh
 
-echo "1..1"
+echo "1..3"
 
 setup_test_repository "archive-z2"
 
@@ -78,6 +78,33 @@ if ${OSTREE} show test2 | grep -o 'Found [[:digit:]] signature'; then
   assert_not_reached
 fi
 
+echo "ok"
+
+# Successful verifications are cached when enabled
+${OSTREE} config set core.gpg-verify-cache true
+${OSTREE} commit -b test3 -s "A GPG signed commit" -m "Signed commit body" --gpg-sign=${TEST_GPG_KEYID_1} --gpg-homedir=${TEST_GPG_KEYHOME} --tree=dir=files
+${OSTREE} show --gpg-homedir=${TEST_GPG_KEYHOME} test3 > test3-show-1
+assert_file_has_content test3-show-1 'Good signature'
+ls repo/state/gpg-verify-cache > cache-entries
+assert_streq "$(wc -l < cache-entries)" "1"
+${OSTREE} show --gpg-homedir=${TEST_GPG_KEYHOME} test3 > test3-show-2
+cmp test3-show-1 test3-show-2
+# Without the key the lookup differs, and the result isn't cached
+${OSTREE} show test3 > test3-show-3
+assert_not_file_has_content test3-show-3 'Good signature'
+ls repo/state/gpg-verify-cache > cache-entries
+assert_streq "$(wc -l < cache-entries)" "1"
+
+echo "ok gpg verify cache"
+
+# Merged keyring homes don't outlive the process
+rm -rf gpg-tmp
+mkdir gpg-tmp
+TMPDIR=${test_tmpdir}/gpg-tmp ${OSTREE} show test3 > test3-show-4
+TMPDIR=${test_tmpdir}/gpg-tmp ${OSTREE} show --gpg-homedir=${TEST_GPG_KEYHOME} test2 > test2-show
+ls gpg-tmp > gpg-tmp-contents
+assert_streq "$(wc -l < gpg-tmp-contents)" "0"
+
 libtest_cleanup_gpg
 
-echo "ok"
+echo "ok gpg homes removed"
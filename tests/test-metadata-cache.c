@@ -0,0 +1,164 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2016 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include "libglnx.h"
+
+#include "ostree-metadata-cache.h"
+
+/* Every entry in these tests is this large, and the cache holds
+ * exactly CACHE_ENTRIES of them; anything bigger than a sixteenth of
+ * the cache isn't cached at all.
+ */
+#define ENTRY_SIZE 64
+#define CACHE_ENTRIES 16
+
+static GVariant *
+new_object (gsize size)
+{
+  g_autoptr(GBytes) bytes = g_bytes_new_take (g_malloc0 (size), size);
+
+  return g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE ("ay"), bytes, TRUE));
+}
+
+static char *
+object_checksum (guint i)
+{
+  g_autofree char *name = g_strdup_printf ("object-%u", i);
+
+  return g_compute_checksum_for_string (G_CHECKSUM_SHA256, name, -1);
+}
+
+static void
+test_lookup (void)
+{
+  OstreeMetadataCache *cache = _ostree_metadata_cache_new (ENTRY_SIZE * CACHE_ENTRIES);
+  g_autoptr(GVariant) obj = new_object (ENTRY_SIZE);
+  g_autoptr(GVariant) found = NULL;
+  g_autofree char *csum = object_checksum (0);
+  guint64 hits, misses;
+
+  g_assert (_ostree_metadata_cache_lookup (cache, OSTREE_OBJECT_TYPE_DIR_TREE, csum) == NULL);
+  _ostree_metadata_cache_insert (cache, OSTREE_OBJECT_TYPE_DIR_TREE, csum, obj);
+
+  found = _ostree_metadata_cache_lookup (cache, OSTREE_OBJECT_TYPE_DIR_TREE, csum);
+  g_assert (found == obj);
+
+  /* The object type is part of the key */
+  g_assert (_ostree_metadata_cache_lookup (cache, OSTREE_OBJECT_TYPE_DIR_META, csum) == NULL);
+
+  _ostree_metadata_cache_get_stats (cache, &hits, &misses);
+  g_assert_cmpint (hits, ==, 1);
+  g_assert_cmpint (misses, ==, 2);
+
+  _ostree_metadata_cache_free (cache);
+}
+
+static void
+test_evict_lru (void)
+{
+  OstreeMetadataCache *cache = _ostree_metadata_cache_new (ENTRY_SIZE * CACHE_ENTRIES);
+  g_autoptr(GVariant) obj = new_object (ENTRY_SIZE);
+  guint i;
+
+  for (i = 0; i < CACHE_ENTRIES; i++)
+    {
+      g_autofree char *csum = object_checksum (i);
+      _ostree_metadata_cache_insert (cache, OSTREE_OBJECT_TYPE_DIR_TREE, csum, obj);
+    }
+
+  /* Use the oldest entry, so the second oldest is evicted instead */
+  { g_autofree char *csum = object_checksum (0);
+    g_autoptr(GVariant) found = _ostree_metadata_cache_lookup (cache, OSTREE_OBJECT_TYPE_DIR_TREE, csum);
+    g_assert (found != NULL);
+  }
+
+  { g_autofree char *csum = object_checksum (CACHE_ENTRIES);
+    _ostree_metadata_cache_insert (cache, OSTREE_OBJECT_TYPE_DIR_TREE, csum, obj);
+  }
+
+  for (i = 0; i <= CACHE_ENTRIES; i++)
+    {
+      g_autofree char *csum = object_checksum (i);
+      g_autoptr(GVariant) found = _ostree_metadata_cache_lookup (cache, OSTREE_OBJECT_TYPE_DIR_TREE, csum);
+
+      if (i == 1)
+        g_assert (found == NULL);
+      else
+        g_assert (found != NULL);
+    }
+
+  _ostree_metadata_cache_free (cache);
+}
+
+static void
+test_oversized (void)
+{
+  OstreeMetadataCache *cache = _ostree_metadata_cache_new (ENTRY_SIZE * CACHE_ENTRIES);
+  g_autoptr(GVariant) obj = new_object (ENTRY_SIZE + 1);
+  g_autofree char *csum = object_checksum (0);
+
+  _ostree_metadata_cache_insert (cache, OSTREE_OBJECT_TYPE_DIR_TREE, csum, obj);
+  g_assert (_ostree_metadata_cache_lookup (cache, OSTREE_OBJECT_TYPE_DIR_TREE, csum) == NULL);
+
+  _ostree_metadata_cache_free (cache);
+}
+
+static void
+test_remove (void)
+{
+  OstreeMetadataCache *cache = _ostree_metadata_cache_new (ENTRY_SIZE * CACHE_ENTRIES);
+  g_autoptr(GVariant) obj = new_object (ENTRY_SIZE);
+  g_autofree char *csum = object_checksum (0);
+  guint i;
+
+  _ostree_metadata_cache_insert (cache, OSTREE_OBJECT_TYPE_DIR_TREE, csum, obj);
+  _ostree_metadata_cache_remove (cache, OSTREE_OBJECT_TYPE_DIR_TREE, csum);
+  g_assert (_ostree_metadata_cache_lookup (cache, OSTREE_OBJECT_TYPE_DIR_TREE, csum) == NULL);
+
+  /* The space it used is given back: a full cache evicts nothing */
+  for (i = 1; i <= CACHE_ENTRIES; i++)
+    {
+      g_autofree char *other = object_checksum (i);
+      _ostree_metadata_cache_insert (cache, OSTREE_OBJECT_TYPE_DIR_TREE, other, obj);
+    }
+  for (i = 1; i <= CACHE_ENTRIES; i++)
+    {
+      g_autofree char *other = object_checksum (i);
+      g_autoptr(GVariant) found = _ostree_metadata_cache_lookup (cache, OSTREE_OBJECT_TYPE_DIR_TREE, other);
+      g_assert (found != NULL);
+    }
+
+  _ostree_metadata_cache_free (cache);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/ostree/metadata-cache/lookup", test_lookup);
+  g_test_add_func ("/ostree/metadata-cache/evict-lru", test_evict_lru);
+  g_test_add_func ("/ostree/metadata-cache/oversized", test_oversized);
+  g_test_add_func ("/ostree/metadata-cache/remove", test_remove);
+
+  return g_test_run ();
+}
@@ -25,7 +25,7 @@ skip_without_user_xattrs
 
 setup_fake_remote_repo1 "archive-z2"
 
-echo '1..2'
+echo '1..4'
 
 cd ${test_tmpdir}
 mkdir repo
@@ -136,3 +136,44 @@ ${CMD_PREFIX} ostree --repo=repo pull --depth=-1 --commit-metadata-only origin t
 ${CMD_PREFIX} ostree --repo=repo prune
 
 echo "ok prune with partial repo"
+
+rm repo -rf
+${CMD_PREFIX} ostree --repo=repo init
+${CMD_PREFIX} ostree --repo=repo config set core.traverse-cache true
+${CMD_PREFIX} ostree --repo=repo commit --branch=test -m test -s test tree
+${CMD_PREFIX} ostree --repo=repo commit --branch=test -m test -s test tree --timestamp="October 25 1985"
+${CMD_PREFIX} ostree --repo=repo prune --refs-only
+COMMIT=$(${CMD_PREFIX} ostree --repo=repo rev-parse test)
+assert_has_file repo/tmp/cache/reachable/${COMMIT}
+${CMD_PREFIX} ostree --repo=repo prune --refs-only > prune-output
+assert_file_has_content prune-output "No unreachable objects"
+PARENT=$(${CMD_PREFIX} ostree --repo=repo rev-parse test^)
+assert_has_file repo/tmp/cache/reachable/${PARENT}
+# Caches of deleted commits are removed, including stray ones
+orphan=$(printf '%064d' 0)
+echo stale > repo/tmp/cache/reachable/${orphan}
+${CMD_PREFIX} ostree --repo=repo prune --refs-only --depth=0
+assert_not_has_file repo/tmp/cache/reachable/${PARENT}
+assert_not_has_file repo/tmp/cache/reachable/${orphan}
+assert_has_file repo/tmp/cache/reachable/${COMMIT}
+# The epoch marker only exists while pruning
+assert_not_has_file repo/state/prune-epoch
+${CMD_PREFIX} ostree --repo=repo fsck
+
+echo "ok prune with reachability cache"
+
+rm repo -rf
+${CMD_PREFIX} ostree --repo=repo init
+${CMD_PREFIX} ostree --repo=repo commit --branch=test -m test -s test tree
+${CMD_PREFIX} ostree --repo=repo commit --branch=test -m test -s test tree --timestamp="October 25 1985"
+find repo/objects -type f | sort > objects-before
+# A dry run neither waits for open transactions nor changes anything
+mkdir repo/tmp/staging-held
+flock repo/tmp/staging-held-lock timeout 60 ${CMD_PREFIX} ostree --repo=repo prune --refs-only --depth=0 --no-prune > prune-output
+assert_file_has_content prune-output "Would delete"
+find repo/objects -type f | sort > objects-after
+cmp objects-before objects-after
+assert_not_has_file repo/state/prune-epoch
+assert_not_has_file repo/state/prune-sweep-lock
+
+echo "ok prune dry run"
@@ -23,7 +23,7 @@ set -euo pipefail
 
 setup_fake_remote_repo1 "archive-z2"
 
-echo '1..1'
+echo '1..4'
 
 cd ${test_tmpdir}
 mkdir repo
@@ -66,3 +66,92 @@ assert_file_has_content refscount.delete3 "^3$"
 assert_not_file_has_content reflist '^test-1$'
 
 echo "ok refs"
+
+cd ${test_tmpdir}
+rm repo -rf
+mkdir repo
+${CMD_PREFIX} ostree --repo=repo init
+echo -e '[core]\npacked-refs=true\n' >> repo/config
+
+seq 3 | while read i; do
+    echo a >> tree/root/a
+    ${CMD_PREFIX} ostree --repo=repo commit --branch=test-$i -m test -s test tree
+    ${CMD_PREFIX} ostree --repo=repo commit --branch=foo/test-$i -m test -s test tree
+done
+assert_has_file repo/packed-refs
+assert_not_has_file repo/refs/heads/test-1
+assert_not_has_file repo/refs/heads/foo/test-1
+
+${CMD_PREFIX} ostree --repo=repo refs | wc -l > refscount
+assert_file_has_content refscount "^6$"
+${CMD_PREFIX} ostree --repo=repo refs foo | wc -l > refscount.foo
+assert_file_has_content refscount.foo "^3$"
+${CMD_PREFIX} ostree --repo=repo refs --list foo > refs
+assert_file_has_content refs "^foo/test-2$"
+${CMD_PREFIX} ostree --repo=repo rev-parse foo/test-2
+
+# Loose refs take precedence over packed ones
+rev=$(${CMD_PREFIX} ostree --repo=repo rev-parse test-1)
+echo ${rev} > repo/refs/heads/test-2
+${CMD_PREFIX} ostree --repo=repo rev-parse test-2 > test2-rev
+assert_file_has_content test2-rev "^${rev}$"
+
+${CMD_PREFIX} ostree --repo=repo refs --delete test-1 foo
+${CMD_PREFIX} ostree --repo=repo refs > refs
+assert_not_file_has_content refs '^test-1$'
+assert_not_file_has_content refs '^foo/'
+assert_file_has_content refs '^test-3$'
+
+echo "ok packed refs"
+
+# Concurrent writers each stage their own objects; only the ref
+# updates are serialized, so none of them may be lost.
+pids=
+for i in $(seq 8); do
+    mkdir -p tree-par-$i
+    echo $i > tree-par-$i/file
+    ${CMD_PREFIX} ostree --repo=repo commit --branch=par/$i -m par -s par tree-par-$i &
+    pids="$pids $!"
+done
+for pid in $pids; do
+    wait $pid
+done
+${CMD_PREFIX} ostree --repo=repo refs par | wc -l > refscount.par
+assert_file_has_content refscount.par "^8$"
+${CMD_PREFIX} ostree --repo=repo fsck
+
+echo "ok concurrent transactions"
+
+cd ${test_tmpdir}
+rm repo -rf
+mkdir repo
+${CMD_PREFIX} ostree --repo=repo init
+seq 3 | while read i; do
+    echo a >> tree/root/a
+    ${CMD_PREFIX} ostree --repo=repo commit --branch=test-$i -m test -s test tree
+    ${CMD_PREFIX} ostree --repo=repo commit --branch=foo/test-$i -m test -s test tree
+done
+rev=$(${CMD_PREFIX} ostree --repo=repo rev-parse foo/test-2)
+mkdir -p repo/refs/remotes/origin
+echo ${rev} > repo/refs/remotes/origin/remote-test
+${CMD_PREFIX} ostree --repo=repo refs | sort > refs-loose
+# Existing loose refs can be migrated
+${CMD_PREFIX} ostree --repo=repo refs --pack
+assert_has_file repo/packed-refs
+assert_not_has_file repo/refs/heads/test-1
+assert_not_has_file repo/refs/heads/foo/test-2
+assert_not_has_file repo/refs/remotes/origin/remote-test
+${CMD_PREFIX} ostree --repo=repo refs | sort > refs-packed
+cmp refs-loose refs-packed
+${CMD_PREFIX} ostree --repo=repo rev-parse foo/test-2 > rev-packed
+assert_file_has_content rev-packed "^${rev}$"
+# Refs of any remote resolve by name alone
+${CMD_PREFIX} ostree --repo=repo rev-parse remote-test > rev-packed
+assert_file_has_content rev-packed "^${rev}$"
+${CMD_PREFIX} ostree --repo=repo refs --delete foo test-1
+${CMD_PREFIX} ostree --repo=repo refs > refs
+assert_not_file_has_content refs '^foo/'
+assert_not_file_has_content refs '^test-1$'
+assert_file_has_content refs '^test-2$'
+
+echo "ok pack refs"
@@ -21,7 +21,7 @@ set -euo pipefail
 
 . $(dirname $0)/libtest.sh
 
-echo '1..13'
+echo '1..14'
 
 setup_test_repository "bare"
 $OSTREE remote add origin http://example.com/ostree/gnome
@@ -92,3 +92,11 @@ assert_not_file_has_content list.txt "origin"
 # Can't grep for 'another' because of 'another-noexist'
 assert_file_has_content list.txt "another-noexist"
 echo "ok remote list remaining"
+
+# Remotes are only parsed when something needs them
+$OSTREE --verbose refs > refs-verbose.txt 2>&1
+assert_not_file_has_content refs-verbose.txt "Loaded .* remotes"
+assert_file_has_content refs-verbose.txt "Opened repo"
+$OSTREE --verbose remote list > list-verbose.txt 2>&1
+assert_file_has_content list-verbose.txt "Loaded .* remotes"
+echo "ok remotes loaded lazily"
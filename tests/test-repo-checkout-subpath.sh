@@ -24,7 +24,7 @@ set -euo pipefail
 
 setup_test_repository "bare"
 
-echo '1..1'
+echo '1..2'
 
 repopath=${test_tmpdir}/ostree-srv/gnomerepo
 
@@ -33,3 +33,11 @@ ${CMD_PREFIX} ostree --repo=repo checkout -U --subpath=/ test2 checkedout
 ${CMD_PREFIX} ostree --repo=repo checkout -U --subpath=/firstfile test2 checkedout2
 
 echo "ok"
+
+# The directory holding a single checked out file keeps its own mode,
+# rather than taking the file's
+assert_has_file checkedout2/firstfile
+stat -c '%a' checkedout2 > dirmode
+assert_file_has_content dirmode '^700$'
+
+echo "ok checkout single file subpath directory mode"